@@ -1,13 +1,23 @@
 #!/usr/bin/env bash
 #
 # build.sh — compile the icinga-lighthouse firmware for the LilyGo T-Relay (ESP32)
-#            using PlatformIO. Produces .build/.pio/build/<board>/firmware.bin
+#            using PlatformIO. Produces .build/.pio/build/<profile>/firmware.bin
+#            and prints its size per subsystem against size-budgets.conf.
 #
 # Usage:
-#   ./build.sh                 # compile
+#   ./build.sh                 # compile (profile "full")
 #   ./build.sh -t erase        # pass extra targets straight to "pio run"
 #   BOARD=esp32dev UPLOAD_SPEED=115200 ./build.sh
 #
+# Build profiles strip whole subsystems at compile time (the LH_* switches at
+# the top of the sketch):
+#   PROFILE=full ./build.sh           # WiFi + Ethernet + TLS + Polish + MQTT (default)
+#   PROFILE=minimal-wifi ./build.sh   # WiFi only, http://, English, no MQTT
+#   PROFILE=eth-only ./build.sh       # W5500 only (+ config AP), http://, English, MQTT
+#   PROFILE=minimal-wifi LH_TLS=1 ./build.sh   # any LH_* overrides the profile
+#
+# SIZE_BUDGET=warn reports budget overruns without failing the build.
+#
 set -euo pipefail
 
 HERE="$(cd "$(dirname "$0")" && pwd)"
@@ -15,6 +25,20 @@ SKETCH="$HERE/trelaylaatern.ino"
 BUILD="$HERE/.build"
 BOARD="${BOARD:-esp32dev}"
 UPLOAD_SPEED="${UPLOAD_SPEED:-115200}"   # 921600 is unreliable on some USB-serial bridges
+PROFILE="${PROFILE:-full}"
+
+#                  WIFI ETH TLS LANG_PL MQTT
+case "$PROFILE" in
+  full)         p=(1 1 1 1 1) ;;
+  minimal-wifi) p=(1 0 0 0 0) ;;
+  eth-only)     p=(0 1 0 0 1) ;;
+  *) echo "ERROR: unknown PROFILE '$PROFILE' (full, minimal-wifi, eth-only)" >&2; exit 1 ;;
+esac
+LH_WIFI="${LH_WIFI:-${p[0]}}"
+LH_ETH="${LH_ETH:-${p[1]}}"
+LH_TLS="${LH_TLS:-${p[2]}}"
+LH_LANG_PL="${LH_LANG_PL:-${p[3]}}"
+LH_MQTT="${LH_MQTT:-${p[4]}}"
 
 command -v pio >/dev/null 2>&1 || {
   echo "ERROR: PlatformIO (pio) not found." >&2
@@ -26,20 +50,49 @@ command -v pio >/dev/null 2>&1 || {
 
 mkdir -p "$BUILD/src"
 cp -f "$SKETCH" "$BUILD/src/main.ino"
+cp -f "$HERE"/*.h "$BUILD/src/"            # lighthouse_core.h (included by the sketch)
 
+ETH_DEP=""
+[ "$LH_ETH" = 1 ] && ETH_DEP="arduino-libraries/Ethernet@^2.0.2"
+MQTT_DEP=""
+[ "$LH_MQTT" = 1 ] && MQTT_DEP="knolleary/PubSubClient@^2.8"
+
+# chain+ evaluates the #if LH_* around the includes, so libraries a profile
+# strips (Ethernet, WiFiClientSecure) aren't even compiled. The map file feeds
+# the size report.
 cat > "$BUILD/platformio.ini" <<INI
 ; Auto-generated by build.sh — edit build.sh, not this file.
-[env:esp32dev]
+[env:$PROFILE]
 platform = espressif32
 board = $BOARD
 framework = arduino
 monitor_speed = 115200
 upload_speed = $UPLOAD_SPEED
+lib_ldf_mode = chain+
+build_flags =
+  -D LH_WIFI=$LH_WIFI
+  -D LH_ETH=$LH_ETH
+  -D LH_TLS=$LH_TLS
+  -D LH_LANG_PL=$LH_LANG_PL
+  -D LH_MQTT=$LH_MQTT
+  -Wl,-Map,\$BUILD_DIR/firmware.map
 lib_deps =
   bblanchon/ArduinoJson@^6.21.3
-  arduino-libraries/Ethernet@^2.0.2
+  $ETH_DEP
+  $MQTT_DEP
 INI
 
-echo ">> Building firmware for board '$BOARD'..."
+echo ">> Building firmware for board '$BOARD', profile '$PROFILE'" \
+     "(wifi=$LH_WIFI eth=$LH_ETH tls=$LH_TLS pl=$LH_LANG_PL mqtt=$LH_MQTT)..."
 pio run -d "$BUILD" "$@"
-echo ">> OK -> $BUILD/.pio/build/$BOARD/firmware.bin"
+
+# Size report (plain builds only; with extra targets the map may be stale).
+MAP="$BUILD/.pio/build/$PROFILE/firmware.map"
+if [ $# -eq 0 ] && [ -f "$MAP" ]; then
+  if command -v python3 >/dev/null 2>&1; then
+    python3 "$HERE/size-report.py" --profile "$PROFILE" --budgets "${BUDGETS:-$HERE/size-budgets.conf}" "$MAP"
+  else
+    echo ">> (python3 not found; skipping the size report)"
+  fi
+fi
+echo ">> OK -> $BUILD/.pio/build/$PROFILE/firmware.bin"
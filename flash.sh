@@ -9,6 +9,7 @@
 #   ./flash.sh --erase               # wipe flash (incl. saved config/NVS) before upload
 #   ./flash.sh --monitor             # open the serial monitor after flashing
 #   PORT=/dev/ttyUSB0 ./flash.sh     # port via env var
+#   PROFILE=minimal-wifi ./flash.sh  # build profile, see build.sh
 #
 set -euo pipefail
 
@@ -0,0 +1,1397 @@
+// lighthouse_core.h — the hardware-independent alarm core of icinga-lighthouse.
+//
+// Everything that decides *whether and when the siren sounds* lives here:
+// confirmation of problems, the relay state machine, the business-hours
+// schedule, the HTTP "Date" parser, the icingadb-web JSON detection and the
+// compiled JSON selectors that read any other alert source. The decoder for
+// delta firmware images (OTA) is here too, being the same kind of pure byte
+// logic, and so is the lock-free status snapshot readers take. None of it
+// touches Arduino globals, pins, millis() or the network; inputs (time in ms,
+// poll results, wall clock, settings) are passed in and outputs (relay
+// commands) are returned. The firmware (trelaylaatern.ino) feeds it from its
+// globals and drives the pins; test-env/esp32-sim/corebench.cpp compiles the
+// same header natively with a synthetic clock.
+//
+// Header-only and C++11 (the ESP32 Arduino core 2.x toolchain). Only
+// parseProblemJson allocates (ArduinoJson's document); everything else,
+// the selectors included, is plain values.
+#pragma once
+
+#include <ArduinoJson.h>
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace lh {
+
+// --- Settings ---------------------------------------------------------------
+
+// Business-hours blocks: a day mask (bit0=Mon .. bit6=Sun; 0 disables the
+// block) plus an [start, end) hour window; end < start spans midnight.
+const int BH_BLOCKS = 4;
+
+struct Schedule {
+  bool enabled;            // restrict the siren to the blocks
+  int  tz_offset;          // hours added to UTC for local time
+  int  days[BH_BLOCKS];
+  int  start[BH_BLOCKS];
+  int  end[BH_BLOCKS];
+};
+
+struct Config {
+  unsigned long poll_ms;              // normal poll cadence
+  unsigned long recheck_ms;           // cadence while a problem is confirming
+  int confirm_threshold;              // consecutive problem polls to arm
+  unsigned long init_alarm_ms;        // first siren pulse
+  unsigned long reminder_interval_ms; // silence between reminders
+  unsigned long reminder_ms;          // reminder pulse
+  Schedule schedule;
+};
+
+// --- Wall clock (from the HTTP "Date" header, UTC) --------------------------
+
+struct WallClock {
+  bool valid;
+  int wday;                // 0=Sun .. 6=Sat
+  int hour;
+  int min;
+  unsigned long epoch;     // seconds since 1970, 0 = the date wasn't understood
+  WallClock() : valid(false), wday(0), hour(0), min(0), epoch(0) {}
+};
+
+static const char* const WDAY_NAMES[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+
+inline int twoDigits(const char* p) {
+  if (p[0] < '0' || p[0] > '9' || p[1] < '0' || p[1] > '9') return -1;
+  return (p[0] - '0') * 10 + (p[1] - '0');
+}
+
+// Days from 1970-01-01 to a civil date (proleptic Gregorian); the inverse of
+// formatEpochUtc's conversion.
+inline long daysFromCivil(long y, int m, int d) {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static const char* const MONTH_NAMES[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                             "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// Parses an IMF-fixdate value, e.g. "Sat, 13 Jun 2026 07:30:00 GMT", with or
+// without the "Date:" prefix. Leaves `out` untouched and returns false if the
+// value doesn't look like one.
+inline bool parseHttpDate(const char* s, WallClock& out) {
+  while (*s == ' ' || *s == '\t') s++;
+  if (strncmp(s, "Date:", 5) == 0) {
+    s += 5;
+    while (*s == ' ' || *s == '\t') s++;
+  }
+  if (strlen(s) < 25) return false;
+  int w = -1;
+  for (int i = 0; i < 7; i++) if (strncmp(s, WDAY_NAMES[i], 3) == 0) w = i;
+  if (w < 0) return false;
+  int hh = twoDigits(s + 17);
+  int mm = twoDigits(s + 20);
+  if (hh < 0 || hh > 23 || mm < 0 || mm > 59) return false;
+  out.wday = w; out.hour = hh; out.min = mm; out.valid = true;
+  // The date too, for durations (the schedule needs only the above).
+  int day = twoDigits(s + 5), mon = -1, ss = twoDigits(s + 23);
+  int cy = twoDigits(s + 12), yy = twoDigits(s + 14);
+  for (int i = 0; i < 12; i++) if (strncmp(s + 8, MONTH_NAMES[i], 3) == 0) mon = i + 1;
+  out.epoch = day > 0 && mon > 0 && cy >= 0 && yy >= 0 && ss >= 0
+                  ? (unsigned long)daysFromCivil(cy * 100 + yy, mon, day) * 86400 + hh * 3600 + mm * 60 + ss
+                  : 0;
+  return true;
+}
+
+// Shifts a UTC clock by the schedule's offset (whole hours, any sign).
+inline void toLocal(const WallClock& c, int tz_offset, int& wday, int& hour) {
+  hour = c.hour + tz_offset;
+  wday = c.wday;
+  while (hour >= 24) { hour -= 24; wday = (wday + 1) % 7; }
+  while (hour < 0)   { hour += 24; wday = (wday + 6) % 7; }
+}
+
+// True if the siren may sound at `c`. Fails open until the time is known, so a
+// fresh boot never silently swallows alerts.
+inline bool alertsAllowed(const Schedule& s, const WallClock& c) {
+  if (!s.enabled || !c.valid) return true;
+  int w, h;
+  toLocal(c, s.tz_offset, w, h);
+  int dayBit = 1 << ((w + 6) % 7);   // 0=Sun..6=Sat -> bit0=Mon..bit6=Sun
+  for (int i = 0; i < BH_BLOCKS; i++) {
+    if (!(s.days[i] & dayBit)) continue;
+    int a = s.start[i], b = s.end[i];
+    bool inWin = (a <= b) ? (h >= a && h < b) : (h >= a || h < b);
+    if (inWin) return true;
+  }
+  return false;
+}
+
+// Local time as "Www HH:MM" ("--" if unknown); buf needs 12 bytes.
+inline const char* formatLocalTime(const WallClock& c, int tz_offset, char* buf, size_t size) {
+  if (!c.valid) { snprintf(buf, size, "--"); return buf; }
+  int w, h;
+  toLocal(c, tz_offset, w, h);
+  snprintf(buf, size, "%s %02d:%02d", WDAY_NAMES[w], h, c.min);
+  return buf;
+}
+
+// Seconds since the epoch as "2026-06-13T07:31:58+00:00", as icingadb-web
+// writes times; buf needs 26 bytes.
+inline const char* formatEpochUtc(unsigned long secs, char* buf, size_t size) {
+  long days = (long)(secs / 86400);
+  unsigned long rem = secs % 86400;
+  // Civil date from days since 1970-01-01 (proleptic Gregorian, 400-year eras).
+  days += 719468;
+  long era = days / 146097;
+  long doe = days - era * 146097;
+  long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  long mp = (5 * doy + 2) / 153;
+  int d = (int)(doy - (153 * mp + 2) / 5 + 1);
+  int m = (int)(mp < 10 ? mp + 3 : mp - 9);
+  long y = yoe + era * 400 + (m <= 2);
+  snprintf(buf, size, "%04d-%02d-%02dT%02d:%02d:%02d+00:00", (int)(y % 10000), m, d, (int)(rem / 3600),
+           (int)(rem / 60 % 60), (int)(rem % 60));
+  return buf;
+}
+
+// A time from an alert source as seconds since the epoch, 0 if it isn't one:
+// ISO-8601 ("2026-06-13T07:21:04+00:00", "..04.123Z", no zone = UTC) or a
+// plain number of seconds (the Icinga 2 API's; milliseconds above 1e11).
+inline unsigned long parseTimestamp(const char* s) {
+  if (!s) return 0;
+  while (*s == ' ') s++;
+  char* end;
+  double v = strtod(s, &end);
+  if (end != s && *end == '\0') return v >= 1e11 ? (unsigned long)(v / 1000) : v >= 1e9 ? (unsigned long)v : 0;
+  if (strlen(s) < 19 || s[4] != '-' || s[7] != '-' || (s[10] != 'T' && s[10] != ' ')) return 0;
+  int cy = twoDigits(s), yy = twoDigits(s + 2), mon = twoDigits(s + 5), day = twoDigits(s + 8);
+  int hh = twoDigits(s + 11), mm = twoDigits(s + 14), ss = twoDigits(s + 17);
+  if (cy < 0 || yy < 0 || mon < 1 || mon > 12 || day < 1 || hh < 0 || mm < 0 || ss < 0) return 0;
+  long t = daysFromCivil(cy * 100 + yy, mon, day) * 86400L + hh * 3600L + mm * 60L + ss;
+  const char* z = s + 19;
+  if (*z == '.') while (*++z >= '0' && *z <= '9') {}
+  if (*z == '+' || *z == '-') {
+    int oh = twoDigits(z + 1), om = twoDigits(z + (z[3] == ':' ? 4 : 3));
+    if (oh >= 0 && om >= 0) t -= (*z == '+' ? 1 : -1) * (oh * 3600L + om * 60L);
+  }
+  return t > 0 ? (unsigned long)t : 0;
+}
+
+// A duration as "45s", "12m", "3h 05m" or "2d 4h"; buf needs 12 bytes.
+inline const char* formatDuration(unsigned long secs, char* buf, size_t size) {
+  if (secs < 60) snprintf(buf, size, "%lus", secs);
+  else if (secs < 3600) snprintf(buf, size, "%lum", secs / 60);
+  else if (secs < 86400) snprintf(buf, size, "%luh %02lum", secs / 3600, secs / 60 % 60);
+  else snprintf(buf, size, "%lud %luh", secs / 86400, secs / 3600 % 24);
+  return buf;
+}
+
+// --- Confirmation -----------------------------------------------------------
+
+// Consecutive polls that saw a problem. The alarm arms once the count reaches
+// the threshold, which debounces transient/false positives.
+struct Confirmation {
+  int count;
+  Confirmation() : count(0) {}
+
+  // Records one poll; returns whether the alarm is armed.
+  bool update(bool problem, int threshold) {
+    if (problem) { if (count < threshold) count++; }
+    else count = 0;
+    return armed(threshold);
+  }
+  bool armed(int threshold) const { return count >= threshold; }
+  // A fresh problem still being confirmed (1 .. threshold-1).
+  bool confirming(int threshold) const { return count > 0 && count < threshold; }
+};
+
+// Adaptive cadence: poll fast while confirming, so a real problem doesn't wait
+// a full poll interval per confirmation.
+inline unsigned long pollInterval(const Config& c, const Confirmation& k) {
+  return k.confirming(c.confirm_threshold) ? c.recheck_ms : c.poll_ms;
+}
+
+// --- Relay state machine ----------------------------------------------------
+
+enum AlarmState { STATE_IDLE, STATE_INITIAL_ALARM, STATE_COOLDOWN, STATE_REMINDER_ALARM };
+const int STATE_COUNT = 4;
+
+inline const char* stateName(AlarmState s) {
+  static const char* const names[STATE_COUNT] = { "IDLE", "INITIAL_ALARM", "COOLDOWN", "REMINDER_ALARM" };
+  return (s >= 0 && s < STATE_COUNT) ? names[s] : "?";
+}
+enum SirenCommand { SIREN_KEEP, SIREN_ON, SIREN_OFF };
+
+// What one step asks of the relay, plus the transition it made (if any).
+struct RelayCommand {
+  SirenCommand siren;
+  AlarmState from;
+  AlarmState to;
+  bool changed() const { return from != to; }
+};
+
+// Siren pattern for a confirmed alarm: an initial pulse, then a reminder pulse
+// after every interval of silence, until the alarm clears.
+class AlarmMachine {
+public:
+  AlarmMachine() : state_(STATE_IDLE), since_(0) {}
+
+  AlarmState state() const { return state_; }
+  unsigned long since() const { return since_; }   // ms the state was entered
+
+  // Earliest time the state would change on its own (a pulse or the silence
+  // ending); 0 while idle.
+  unsigned long deadline(const Config& c) const {
+    switch (state_) {
+      case STATE_INITIAL_ALARM:  return since_ + c.init_alarm_ms;
+      case STATE_COOLDOWN:       return since_ + c.reminder_interval_ms;
+      case STATE_REMINDER_ALARM: return since_ + c.reminder_ms;
+      default:                   return 0;
+    }
+  }
+
+  // One pass at `now_ms`. A network error silences the siren but keeps the
+  // state (the alarm resumes where it was); quiet hours silence it and reset.
+  RelayCommand step(const Config& c, unsigned long now_ms, bool alarm,
+                    bool network_error, bool allowed) {
+    RelayCommand cmd;
+    cmd.siren = SIREN_KEEP;
+    cmd.from = state_;
+    if (network_error) { cmd.siren = SIREN_OFF; cmd.to = state_; return cmd; }
+    if (!allowed) {
+      cmd.siren = SIREN_OFF;
+      state_ = STATE_IDLE;
+      cmd.to = state_;
+      return cmd;
+    }
+
+    unsigned long elapsed = now_ms - since_;
+    switch (state_) {
+      case STATE_IDLE:
+        if (alarm) enter(STATE_INITIAL_ALARM, now_ms, SIREN_ON, cmd);
+        break;
+      case STATE_INITIAL_ALARM:
+        if (!alarm) { state_ = STATE_IDLE; cmd.siren = SIREN_OFF; }
+        else if (elapsed >= c.init_alarm_ms) enter(STATE_COOLDOWN, now_ms, SIREN_OFF, cmd);
+        break;
+      case STATE_COOLDOWN:
+        if (!alarm) state_ = STATE_IDLE;
+        else if (elapsed >= c.reminder_interval_ms) enter(STATE_REMINDER_ALARM, now_ms, SIREN_ON, cmd);
+        break;
+      case STATE_REMINDER_ALARM:
+        if (!alarm) { state_ = STATE_IDLE; cmd.siren = SIREN_OFF; }
+        else if (elapsed >= c.reminder_ms) enter(STATE_COOLDOWN, now_ms, SIREN_OFF, cmd);
+        break;
+    }
+    cmd.to = state_;
+    return cmd;
+  }
+
+private:
+  void enter(AlarmState s, unsigned long now_ms, SirenCommand siren, RelayCommand& cmd) {
+    state_ = s;
+    since_ = now_ms;
+    cmd.siren = siren;
+  }
+
+  AlarmState state_;
+  unsigned long since_;
+};
+
+// --- icingadb-web JSON detection --------------------------------------------
+
+// The first problem of a reply, truncated to fit (names are display-only).
+struct Problem {
+  char label[128];         // "host!service" for services, "host" for hosts
+  char next_check[40];     // ISO-8601 hint from Icinga, may be empty
+};
+
+enum ParseResult { PARSE_NONE, PARSE_PROBLEM, PARSE_ERROR };
+
+// Copies a C string into a fixed field, truncating.
+inline void copyField(char* dst, size_t size, const char* src) {
+  size_t i = 0;
+  for (; src && src[i] && i + 1 < size; i++) dst[i] = src[i];
+  dst[i] = '\0';
+}
+
+// Reads a problem array (a TOP-LEVEL ARRAY, see queryIcingaEndpoint) from any
+// ArduinoJson input: a Stream, a char*, a std::istream... Keeps only the few
+// fields we need (objects are huge), so memory stays small. The filter keeps a
+// handful of short fields per element, so even a reply without limit=1 stays
+// bounded; a NoMemory error counts as PARSE_ERROR.
+template <class TInput>
+ParseResult parseProblemJson(TInput& input, bool isService, Problem& out) {
+  StaticJsonDocument<256> filter;
+  filter[0]["name"] = true;
+  filter[0]["display_name"] = true;
+  filter[0]["host"]["display_name"] = true;
+  filter[0]["state"]["next_check"] = true;
+
+  DynamicJsonDocument doc(4096);
+  DeserializationError error =
+      deserializeJson(doc, input, DeserializationOption::Filter(filter));
+  if (error) return PARSE_ERROR;
+
+  JsonArray arr = doc.as<JsonArray>();
+  if (arr.isNull() || arr.size() == 0) return PARSE_NONE;
+
+  JsonObject o = arr[0];
+  const char* dn = o["display_name"] | o["name"] | "Unknown";
+  const char* hn = o["host"]["display_name"] | "";
+  if (isService && hn[0] != '\0') snprintf(out.label, sizeof(out.label), "%s!%s", hn, dn);
+  else snprintf(out.label, sizeof(out.label), "%s", dn);
+  snprintf(out.next_check, sizeof(out.next_check), "%s", (const char*)(o["state"]["next_check"] | ""));
+  return PARSE_PROBLEM;
+}
+
+// --- Problem list -------------------------------------------------------------
+
+// The problems behind the alarm, for the panel's list page: up to a set
+// number of rows (the setting, at most LIST_MAX) in reply order. Names are
+// kept in one fixed arena, each distinct string once (a host with ten
+// failing services stores its name once), so the list takes the same memory
+// however many problems there are; a row whose names no longer fit is
+// counted in dropped() instead. Plain values, copied whole.
+const int LIST_MAX = 32;          // rows
+const int LIST_ARENA = 2048;      // bytes of names, all rows together
+
+struct ProblemRow {
+  uint8_t source;                 // query it came from: 0 services, 1 hosts
+  uint16_t kind;                  // arena offsets: "Service", "Host", "Alert"..
+  uint16_t host;                  // "" on a host's own row
+  uint16_t name;
+  uint16_t state;                 // as the reply has it: "2", "critical"..
+  uint32_t since;                 // last state change, epoch seconds (0 = unknown)
+};
+
+class ProblemList {
+public:
+  struct Mark { int rows; uint16_t used; unsigned dropped; };
+
+  ProblemList() { clear(0); }
+
+  // Empties the list, which then takes up to `capacity` rows.
+  void clear(int capacity) {
+    capacity_ = capacity < 0 ? 0 : capacity > LIST_MAX ? LIST_MAX : capacity;
+    rows_ = 0;
+    dropped_ = 0;
+    arena_[0] = '\0';              // offset 0: ""
+    used_ = 1;
+    source_ = 0;
+    kind_ = 0;
+  }
+
+  // Rows added from now on come from query `source` and are of `kind`.
+  void begin(uint8_t source, const char* kind) {
+    source_ = source;
+    kind_ = intern(kind);
+    if (kind_ == NONE) kind_ = 0;
+  }
+
+  // False when the list is full, or (counted in dropped()) when the names
+  // don't fit in the arena any more.
+  bool add(const char* host, const char* name, const char* state, uint32_t since) {
+    if (full()) return false;
+    Mark m = mark();
+    ProblemRow& r = row_[rows_];
+    r.source = source_;
+    r.kind = kind_;
+    r.host = intern(host);
+    r.name = intern(name);
+    r.state = intern(state);
+    r.since = since;
+    if (r.host == NONE || r.name == NONE || r.state == NONE) {
+      rollback(m);
+      dropped_++;
+      return false;
+    }
+    rows_++;
+    return true;
+  }
+
+  // Copies another list's rows from one query (a reply that hasn't changed).
+  void copy(const ProblemList& from, uint8_t source) {
+    for (int i = 0; i < from.rows_; i++) {
+      const ProblemRow& r = from.row_[i];
+      if (r.source != source) continue;
+      begin(source, from.str(r.kind));
+      add(from.str(r.host), from.str(r.name), from.str(r.state), r.since);
+    }
+  }
+
+  // Undoes everything added since mark() (a reply that wasn't a problem).
+  Mark mark() const { Mark m = { rows_, used_, dropped_ }; return m; }
+  void rollback(const Mark& m) { rows_ = m.rows; used_ = m.used; dropped_ = m.dropped; }
+
+  bool full() const { return rows_ >= capacity_; }
+  int capacity() const { return capacity_; }
+  int size() const { return rows_; }
+  unsigned dropped() const { return dropped_; }
+  size_t used() const { return used_; }         // arena bytes
+  const ProblemRow& row(int i) const { return row_[i]; }
+  const char* str(uint16_t off) const { return arena_ + off; }
+
+private:
+  static const uint16_t NONE = 0xFFFF;
+
+  ProblemRow row_[LIST_MAX];
+  // Strings back to back, each after a length byte: [len]text\0 (cut to 255).
+  char arena_[LIST_ARENA];
+  uint16_t used_;
+  int rows_;
+  int capacity_;
+  unsigned dropped_;
+  uint8_t source_;
+  uint16_t kind_;
+
+  // Offset of `s` in the arena, added if it isn't there yet; NONE if full.
+  uint16_t intern(const char* s) {
+    if (!s || !s[0]) return 0;
+    size_t n = strlen(s);
+    if (n > 255) n = 255;
+    for (uint16_t p = 1; p < used_; p += (uint8_t)arena_[p] + 2)
+      if ((uint8_t)arena_[p] == n && memcmp(arena_ + p + 1, s, n) == 0) return p + 1;
+    if (used_ + n + 2 > (size_t)LIST_ARENA) return NONE;
+    uint16_t at = used_;
+    arena_[at] = (char)n;
+    memcpy(arena_ + at + 1, s, n);
+    arena_[at + 1 + n] = '\0';
+    used_ += n + 2;
+    return at + 1;
+  }
+};
+
+// --- JSON selectors (any alert source) ----------------------------------------
+
+// A source is described by three selectors, compiled once when the settings
+// load and then run over every reply as it streams in, one byte at a time in
+// fixed memory (no document is built, so the reply's size doesn't matter):
+//
+//   problem  when the reply means "alarm":
+//              count($) > 0               elements of the top-level array
+//              count($.data.alerts) >= 1
+//              $.status != "ok"           the path's first value vs a literal
+//              $.healthy == false         ($.x alone: present, not false/0/""/null)
+//   label    the problem's name: parts joined by "!", each a path with "|"
+//            fallbacks, empty parts left out
+//              $[0].labels.alertname ! $[0].labels.instance | $[0].labels.job
+//   hint     optional extra detail (icingadb's next check, an alert's startsAt)
+//
+// Paths: $ is the reply; .name or ['name'] a member, [N] an element, [*] or .*
+// any element or member. count(P) counts the values P matches, an array
+// counting as its elements. Everything else uses the first value P matches.
+//
+// A preset also says where its problems are, for the problem list: a path
+// ending in [*] (each element one problem) and, from @ = that element, its
+// host, name, state and since (the last state change), each with "|"
+// fallbacks. Custom sources have no list paths; their list holds the label.
+const int SEL_MAX_STEPS = 8;      // steps per path
+const int SEL_MAX_PATHS = 12;     // problem + label alternatives + hint + list fields
+const int SEL_NAME_MAX  = 32;     // member name in a path (longer: won't compile)
+const int SEL_VALUE_MAX = 64;     // value kept per path, cut to fit
+const int SEL_MAX_DEPTH = 32;     // nesting of the reply
+
+// The built-in sources; anything else is a custom one with its own selectors.
+struct SourcePreset {
+  const char* name;        // settings value
+  const char* title;       // for the panel
+  const char* kind;        // label prefix ("" = the query's: Service / Host)
+  const char* problem;
+  const char* label;
+  const char* hint;
+  const char* items;       // the problem list: each element one problem
+  const char* item_host;   // .. and from @ = that element
+  const char* item_name;
+  const char* item_state;
+  const char* item_since;
+};
+
+const SourcePreset SOURCE_PRESETS[] = {
+  { "icingadb", "Icinga DB Web", "", "count($) > 0",
+    "$[0].host.display_name ! $[0].display_name | $[0].name", "$[0].state.next_check",
+    "$[*]", "@.host.display_name", "@.display_name | @.name", "@.state.soft_state", "@.state.last_state_change" },
+  // GET /api/v2/alerts?active=true&silenced=false&inhibited=false
+  { "alertmanager", "Prometheus Alertmanager", "Alert", "count($) > 0",
+    "$[0].labels.alertname ! $[0].labels.instance | $[0].labels.job", "$[0].startsAt",
+    "$[*]", "@.labels.instance | @.labels.job", "@.labels.alertname", "@.labels.severity | @.status.state",
+    "@.startsAt" },
+  // Icinga 2 core API, /v1/objects/services and /hosts (filter and attrs in
+  // the request body); next_check is in seconds since the epoch
+  { "icinga2", "Icinga 2 API", "", "count($.results) > 0",
+    "$.results[0].joins.host.display_name ! $.results[0].attrs.display_name | $.results[0].name",
+    "$.results[0].attrs.next_check",
+    "$.results[*]", "@.joins.host.display_name", "@.attrs.display_name | @.name", "@.attrs.state",
+    "@.attrs.last_state_change" },
+};
+const int SOURCE_PRESET_COUNT = sizeof(SOURCE_PRESETS) / sizeof(SOURCE_PRESETS[0]);
+
+inline const SourcePreset* findSource(const char* name) {
+  for (int i = 0; i < SOURCE_PRESET_COUNT; i++)
+    if (strcmp(SOURCE_PRESETS[i].name, name) == 0) return &SOURCE_PRESETS[i];
+  return NULL;
+}
+
+class Selector {
+public:
+  Selector() { reset(); }
+
+  // Compiles a source. On a syntax error returns false, error() says where,
+  // and run() reports PARSE_ERROR for every reply.
+  bool compile(const char* problem, const char* label, const char* hint) {
+    reset();
+    ok_ = compileProblem(problem ? problem : "") && compileLabel(label ? label : "") && compileHint(hint ? hint : "");
+    return ok_;
+  }
+  bool compile(const SourcePreset& s) {
+    return compile(s.problem, s.label, s.hint) && (ok_ = compileList(s));
+  }
+  bool ok() const { return ok_; }
+  const char* error() const { return error_; }
+
+  // Scans one reply from anything with int read() (-1 at the end): a Stream,
+  // a transport. PARSE_PROBLEM fills out (label "Unknown" if it came out
+  // empty); malformed JSON is PARSE_ERROR. With a list, a problem also adds
+  // its rows there (begin() set their source and kind), up to the list's
+  // capacity; any other answer leaves the list as it was.
+  //
+  // Stops reading as soon as the answer can't change any more, and says so in
+  // *early: the problem predicate is settled and, for a problem, so is every
+  // label and hint path (each has its value, or the scan has left the
+  // container it would be in). count($) > 0 with $[0] paths settles with the
+  // first element, so a reply of thousands is read no further than that (a
+  // list: than its capacity). The rest is not looked at, so a syntax error
+  // there goes unnoticed.
+  template <class TInput>
+  ParseResult run(TInput& in, Problem& out, bool* early = NULL, ProblemList* list = NULL) const {
+    ProblemList::Mark m;
+    if (list) m = list->mark();
+    ParseResult r = scan(in, out, early, list && item_.steps ? list : NULL);
+    if (list && r != PARSE_PROBLEM) list->rollback(m);
+    else if (list && !item_.steps) list->add("", out.label, "", 0);
+    return r;
+  }
+
+private:
+  enum { STEP_MEMBER, STEP_INDEX, STEP_ANY };
+  enum { S_VALUE, S_VALUE_OR_CLOSE, S_KEY, S_KEY_OR_CLOSE, S_COLON, S_COMMA_OR_CLOSE, S_DONE };
+  enum { OP_TRUTHY, OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+  // T_NONE: no match (yet); T_CONTAINER: matched an object or array.
+  enum { T_NONE, T_CONTAINER, T_STRING, T_NUMBER, T_TRUE, T_FALSE, T_NULL };
+  enum { F_HOST = 1, F_NAME, F_STATE, F_SINCE };   // list fields
+
+  struct Step {
+    uint8_t kind;
+    uint8_t len;           // member name length
+    uint16_t arg;          // element index, or the name's offset in names_
+  };
+  struct Path {
+    uint8_t steps;
+    Step step[SEL_MAX_STEPS];
+  };
+
+  // One open container of the reply (only those a path can reach).
+  struct Frame {
+    uint16_t index;        // current element, arrays
+    uint8_t key_len;       // current member, objects
+    bool key_long;         // ... too long for any path to name it
+    char key[SEL_NAME_MAX];
+  };
+  struct Scan {
+    Frame frames[SEL_MAX_STEPS];
+    uint32_t arrays;       // bit d: the container at depth d is an array
+    int depth;             // containers open
+    unsigned long count;   // count() so far
+    int count_depth;       // depth of the array count() is in, -1 = none
+    uint8_t type[SEL_MAX_PATHS];
+    char value[SEL_MAX_PATHS][SEL_VALUE_MAX];
+    unsigned passed;       // bit i: path i can't match any more
+    bool changed;          // a capture, count or pass since the last settled()
+    ProblemList* list;     // rows go here, NULL = no list
+    int item_depth;        // depth of the list element being read, -1 = none
+    bool items_passed;     // the list's array has ended
+  };
+
+  template <class TInput>
+  ParseResult scan(TInput& in, Problem& out, bool* early, ProblemList* list) const {
+    out.label[0] = out.next_check[0] = '\0';
+    if (early) *early = false;
+    if (!ok_) return PARSE_ERROR;
+    Scan s;
+    memset(s.type, 0, sizeof(s.type));
+    s.depth = 0;
+    s.arrays = 0;
+    s.count = 0;
+    s.count_depth = -1;
+    s.passed = 0;
+    s.changed = false;
+    s.list = list;
+    s.item_depth = -1;
+    s.items_passed = false;
+    int pending = -1;      // a char read past the end of a number or literal
+
+    int state = S_VALUE;
+    while (state != S_DONE) {
+      int c = pending >= 0 ? pending : in.read();
+      pending = -1;
+      while (c == ' ' || c == '\t' || c == '\n' || c == '\r') c = in.read();
+      if (c < 0) return PARSE_ERROR;
+
+      if ((state == S_VALUE_OR_CLOSE && c == ']') || (state == S_KEY_OR_CLOSE && c == '}')) {
+        state = close(s);
+        continue;
+      }
+      switch (state) {
+        case S_VALUE:
+        case S_VALUE_OR_CLOSE: {
+          unsigned m = startValue(s);
+          if (c == '{' || c == '[') {
+            if (s.list && s.item_depth < 0 && matches(item_, s)) s.item_depth = s.depth;
+            if (!open(s, c == '[', m)) return PARSE_ERROR;
+            state = c == '[' ? S_VALUE_OR_CLOSE : S_KEY_OR_CLOSE;
+            continue;
+          }
+          char text[SEL_VALUE_MAX];
+          uint8_t type;
+          if (c == '"') {
+            if (!readString(in, text, sizeof(text), NULL)) return PARSE_ERROR;
+            type = T_STRING;
+          } else if (c == '-' || (c >= '0' && c <= '9')) {
+            size_t n = 0;
+            do {
+              if (n + 1 < sizeof(text)) text[n++] = (char)c;
+              c = in.read();
+            } while ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-');
+            text[n] = '\0';
+            pending = c;
+            type = T_NUMBER;
+          } else if (c == 't' || c == 'f' || c == 'n') {
+            const char* word = c == 't' ? "true" : c == 'f' ? "false" : "null";
+            for (const char* w = word + 1; *w; w++)
+              if (in.read() != *w) return PARSE_ERROR;
+            copyField(text, sizeof(text), word);
+            type = c == 't' ? T_TRUE : c == 'f' ? T_FALSE : T_NULL;
+          } else {
+            return PARSE_ERROR;
+          }
+          if (count_ && (m & 1)) { s.count++; s.changed = true; }
+          keep(s, m, type, text);
+          state = s.depth == 0 ? S_DONE : S_COMMA_OR_CLOSE;
+          break;
+        }
+        case S_KEY:
+        case S_KEY_OR_CLOSE: {
+          if (c != '"') return PARSE_ERROR;
+          int d = s.depth - 1;
+          if (d < SEL_MAX_STEPS) {
+            Frame& f = s.frames[d];
+            size_t total = 0;
+            if (!readString(in, f.key, sizeof(f.key), &total)) return PARSE_ERROR;
+            f.key_len = (uint8_t)strlen(f.key);
+            f.key_long = total >= sizeof(f.key);
+          } else {
+            char skip[4];
+            if (!readString(in, skip, sizeof(skip), NULL)) return PARSE_ERROR;
+          }
+          state = S_COLON;
+          break;
+        }
+        case S_COLON:
+          if (c != ':') return PARSE_ERROR;
+          state = S_VALUE;
+          break;
+        case S_COMMA_OR_CLOSE: {
+          bool array = (s.arrays >> (s.depth - 1)) & 1;
+          if (c == ',') {
+            if (array && s.depth - 1 < SEL_MAX_STEPS) s.frames[s.depth - 1].index++;
+            state = array ? S_VALUE : S_KEY;
+          } else if (c == (array ? ']' : '}')) {
+            state = close(s);
+          } else {
+            return PARSE_ERROR;
+          }
+          break;
+        }
+      }
+      if (s.changed && state != S_DONE) {
+        s.changed = false;
+        if (settled(s)) {
+          if (early) *early = true;
+          break;
+        }
+      }
+    }
+
+    if (!(count_ ? compareNumber(s.count, lit_num_) : test(s.type[0], s.value[0]))) return PARSE_NONE;
+    size_t n = 0;
+    for (int part = 1; part <= label_parts_; part++) {
+      for (int i = 1; i < list_first_; i++) {
+        if (part_[i] != part || s.type[i] < T_STRING || !s.value[i][0]) continue;
+        n += snprintf(out.label + n, sizeof(out.label) - n, "%s%s", n ? "!" : "", s.value[i]);
+        if (n >= sizeof(out.label)) n = sizeof(out.label) - 1;
+        break;
+      }
+    }
+    if (n == 0) copyField(out.label, sizeof(out.label), "Unknown");
+    if (hint_ >= 0 && s.type[hint_] >= T_STRING) copyField(out.next_check, sizeof(out.next_check), s.value[hint_]);
+    return PARSE_PROBLEM;
+  }
+
+  Path paths_[SEL_MAX_PATHS];   // [0] the problem's
+  uint8_t part_[SEL_MAX_PATHS]; // label part a path belongs to, 0 = none
+  uint8_t field_[SEL_MAX_PATHS];// list field of a path (F_*), 0 = none
+  int npaths_;
+  int label_parts_;
+  int hint_;                    // path index, -1 = no hint
+  int list_first_;              // first list field path (= npaths_ without)
+  Path item_;                   // the list's elements, no steps = no list
+  bool count_;                  // problem is count(paths_[0]) <op> number
+  uint8_t op_;
+  uint8_t lit_type_;
+  double lit_num_;
+  char lit_[SEL_VALUE_MAX];
+  char names_[256];             // member names of all paths, back to back
+  size_t names_len_;
+  bool ok_;
+  char error_[80];
+  const char* what_;            // selector being compiled, for error_
+
+  void reset() {
+    npaths_ = label_parts_ = list_first_ = 0;
+    item_.steps = 0;
+    hint_ = -1;
+    count_ = false;
+    op_ = OP_TRUTHY;
+    lit_type_ = T_NONE;
+    lit_num_ = 0;
+    lit_[0] = '\0';
+    names_len_ = 0;
+    ok_ = false;
+    error_[0] = '\0';
+    memset(part_, 0, sizeof(part_));
+    memset(field_, 0, sizeof(field_));
+  }
+
+  bool fail(const char* start, const char* at, const char* msg) {
+    snprintf(error_, sizeof(error_), "%s: %s at %d", what_, msg, (int)(at - start));
+    return false;
+  }
+
+  static void skipSpace(const char*& p) {
+    while (*p == ' ' || *p == '\t') p++;
+  }
+
+  static bool nameChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_' || c == '-' || c == '@';
+  }
+
+  bool addName(const char* start, const char* at, const char* b, size_t len, Step& st) {
+    if (len == 0) return fail(start, at, "name expected");
+    if (len >= (size_t)SEL_NAME_MAX) return fail(start, at, "name too long");
+    if (names_len_ + len > sizeof(names_)) return fail(start, at, "too many names");
+    memcpy(names_ + names_len_, b, len);
+    st.kind = STEP_MEMBER;
+    st.len = (uint8_t)len;
+    st.arg = (uint16_t)names_len_;
+    names_len_ += len;
+    return true;
+  }
+
+  // A path from $, or with `base` from @ (its steps first).
+  bool compilePath(const char* start, const char*& p, Path& out, const Path* base = NULL) {
+    skipSpace(p);
+    if (base && *p == '@') out = *base;
+    else if (*p == '$') out.steps = 0;
+    else return fail(start, p, base ? "path must start with @" : "path must start with $");
+    p++;
+    for (;;) {
+      Step st;
+      if (*p == '.') {
+        p++;
+        if (*p == '*') { p++; st.kind = STEP_ANY; st.len = 0; st.arg = 0; }
+        else {
+          const char* b = p;
+          while (nameChar(*p)) p++;
+          if (!addName(start, b, b, p - b, st)) return false;
+        }
+      } else if (*p == '[') {
+        p++;
+        if (*p == '*') { p++; st.kind = STEP_ANY; st.len = 0; st.arg = 0; }
+        else if (*p == '\'' || *p == '"') {
+          char q = *p++;
+          const char* b = p;
+          while (*p && *p != q) p++;
+          if (!*p) return fail(start, b, "unterminated name");
+          if (!addName(start, b, b, p - b, st)) return false;
+          p++;
+        } else if (*p >= '0' && *p <= '9') {
+          unsigned long n = 0;
+          while (*p >= '0' && *p <= '9' && n <= 65535) n = n * 10 + (*p++ - '0');
+          if (n > 65535) return fail(start, p, "index too large");
+          st.kind = STEP_INDEX; st.len = 0; st.arg = (uint16_t)n;
+        } else {
+          return fail(start, p, "index, * or 'name' expected");
+        }
+        if (*p != ']') return fail(start, p, "] expected");
+        p++;
+      } else {
+        return true;
+      }
+      if (out.steps == SEL_MAX_STEPS) return fail(start, p, "path too deep");
+      out.step[out.steps++] = st;
+    }
+  }
+
+  bool compileProblem(const char* start) {
+    what_ = "problem";
+    const char* p = start;
+    skipSpace(p);
+    if (strncmp(p, "count(", 6) == 0) {
+      p += 6;
+      count_ = true;
+      if (!compilePath(start, p, paths_[0])) return false;
+      skipSpace(p);
+      if (*p != ')') return fail(start, p, ") expected");
+      p++;
+    } else if (!compilePath(start, p, paths_[0])) {
+      return false;
+    }
+    npaths_ = 1;
+    skipSpace(p);
+    static const char* const ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+    static const uint8_t codes[] = { OP_EQ, OP_NE, OP_LE, OP_GE, OP_LT, OP_GT };
+    for (int i = 0; i < 6 && op_ == OP_TRUTHY; i++) {
+      size_t n = strlen(ops[i]);
+      if (strncmp(p, ops[i], n) == 0) { op_ = codes[i]; p += n; }
+    }
+    if (op_ == OP_TRUTHY) {
+      if (count_) return fail(start, p, "count() needs a comparison");
+    } else {
+      skipSpace(p);
+      if (*p == '"' || *p == '\'') {
+        char q = *p++;
+        size_t n = 0;
+        while (*p && *p != q) {
+          if (n + 1 >= sizeof(lit_)) return fail(start, p, "string too long");
+          lit_[n++] = *p++;
+        }
+        if (!*p) return fail(start, p, "unterminated string");
+        p++;
+        lit_[n] = '\0';
+        lit_type_ = T_STRING;
+      } else if (strncmp(p, "true", 4) == 0) { p += 4; lit_type_ = T_TRUE; }
+      else if (strncmp(p, "false", 5) == 0) { p += 5; lit_type_ = T_FALSE; }
+      else if (strncmp(p, "null", 4) == 0) { p += 4; lit_type_ = T_NULL; }
+      else {
+        char* end;
+        lit_num_ = strtod(p, &end);
+        if (end == p) return fail(start, p, "value expected");
+        p = end;
+        lit_type_ = T_NUMBER;
+      }
+      if (count_ && lit_type_ != T_NUMBER) return fail(start, p, "count() compares with a number");
+    }
+    skipSpace(p);
+    if (*p) return fail(start, p, "unexpected text");
+    return true;
+  }
+
+  bool compileLabel(const char* label) {
+    what_ = "label";
+    const char* p = label;
+    skipSpace(p);
+    while (*p) {
+      label_parts_++;
+      for (;;) {
+        if (npaths_ == SEL_MAX_PATHS - 1) return fail(label, p, "too many paths");   // one left for the hint
+        part_[npaths_] = (uint8_t)label_parts_;
+        if (!compilePath(label, p, paths_[npaths_++])) return false;
+        skipSpace(p);
+        if (*p != '|') break;
+        p++;
+      }
+      if (*p == '!') { p++; skipSpace(p); if (!*p) return fail(label, p, "path expected"); continue; }
+      if (*p) return fail(label, p, "! or | expected");
+    }
+    return true;
+  }
+
+  bool compileHint(const char* hint) {
+    what_ = "hint";
+    list_first_ = npaths_;
+    const char* p = hint;
+    skipSpace(p);
+    if (!*p) return true;
+    hint_ = npaths_;
+    if (!compilePath(hint, p, paths_[npaths_++])) return false;
+    list_first_ = npaths_;
+    skipSpace(p);
+    if (*p) return fail(hint, p, "unexpected text");
+    return true;
+  }
+
+  bool compileList(const SourcePreset& s) {
+    what_ = "list";
+    const char* p = s.items ? s.items : "";
+    skipSpace(p);
+    if (!*p) return true;
+    if (!compilePath(s.items, p, item_)) return false;
+    skipSpace(p);
+    if (*p) return fail(s.items, p, "unexpected text");
+    if (!item_.steps || item_.step[item_.steps - 1].kind != STEP_ANY) return fail(s.items, p, "list path must end in [*]");
+    return compileField(s.item_host, F_HOST) && compileField(s.item_name, F_NAME) &&
+           compileField(s.item_state, F_STATE) && compileField(s.item_since, F_SINCE);
+  }
+
+  bool compileField(const char* text, uint8_t field) {
+    const char* p = text ? text : "";
+    skipSpace(p);
+    if (!*p) return true;              // not in this source's replies
+    for (;;) {
+      if (npaths_ == SEL_MAX_PATHS) return fail(text, p, "too many paths");
+      field_[npaths_] = field;
+      if (!compilePath(text, p, paths_[npaths_++], &item_)) return false;
+      skipSpace(p);
+      if (*p != '|') break;
+      p++;
+    }
+    if (*p) return fail(text, p, "| expected");
+    return true;
+  }
+
+  // Do the path's first k steps lead to where the scan is at depth k? With
+  // exact, a [*] / .* step doesn't count (it leads elsewhere too).
+  bool leadsTo(const Path& pa, const Scan& s, int k, bool exact) const {
+    for (int i = 0; i < k; i++) {
+      const Step& st = pa.step[i];
+      const Frame& f = s.frames[i];
+      bool array = (s.arrays >> i) & 1;
+      if (st.kind == STEP_ANY && exact) return false;
+      if (st.kind == STEP_INDEX && (!array || f.index != st.arg)) return false;
+      if (st.kind == STEP_MEMBER && (array || f.key_long || f.key_len != st.len ||
+                                     memcmp(f.key, names_ + st.arg, st.len) != 0)) return false;
+    }
+    return true;
+  }
+
+  bool matches(const Path& pa, const Scan& s) const {
+    return pa.steps == s.depth && leadsTo(pa, s, s.depth, false);
+  }
+
+  // Can the answer still change? Settled once the predicate is (a count
+  // that only grows can be settled before its array ends) and, for a
+  // problem, every other path has a value or has been passed.
+  bool settled(const Scan& s) const {
+    bool truth;
+    if (count_) {
+      bool now = compareNumber(s.count, lit_num_);
+      if ((op_ == OP_GT || op_ == OP_GE) && now) truth = true;
+      else if ((op_ == OP_LT || op_ == OP_LE) && !now) truth = false;
+      else if (s.passed & 1) truth = now;
+      else return false;
+    } else {
+      if (s.type[0] == T_NONE && !(s.passed & 1)) return false;
+      truth = test(s.type[0], s.value[0]);
+    }
+    if (!truth) return true;
+    for (int i = 1; i < list_first_; i++)
+      if (s.type[i] == T_NONE && !(s.passed & (1u << i))) return false;
+    return !s.list || s.list->full() || s.items_passed;
+  }
+
+  // A value begins at the current depth: which paths it is the value of.
+  unsigned startValue(Scan& s) const {
+    if (count_ && s.count_depth >= 0 && s.count_depth == s.depth - 1) { s.count++; s.changed = true; }
+    unsigned m = 0;
+    int n = s.list ? npaths_ : list_first_;    // list fields only when listing
+    if (s.depth <= SEL_MAX_STEPS)
+      for (int i = 0; i < n; i++)
+        if (matches(paths_[i], s)) m |= 1u << i;
+    return m;
+  }
+
+  void keep(Scan& s, unsigned m, uint8_t type, const char* text) const {
+    for (int i = 0; i < npaths_; i++) {
+      if (!(m & (1u << i)) || s.type[i] != T_NONE) continue;
+      s.type[i] = type;
+      s.changed = true;
+      copyField(s.value[i], SEL_VALUE_MAX, text);
+    }
+  }
+
+  bool open(Scan& s, bool array, unsigned m) const {
+    if (s.depth >= SEL_MAX_DEPTH) return false;
+    if (count_ && (m & 1)) {
+      if (array && s.count_depth < 0) s.count_depth = s.depth;
+      else if (!array) { s.count++; s.changed = true; }
+    }
+    keep(s, m, T_CONTAINER, "");
+    if (array) s.arrays |= 1u << s.depth;
+    else s.arrays &= ~(1u << s.depth);
+    if (s.depth < SEL_MAX_STEPS) {
+      Frame& f = s.frames[s.depth];
+      f.index = 0;
+      f.key_len = 0;
+      f.key_long = false;
+      f.key[0] = '\0';
+    }
+    s.depth++;
+    return true;
+  }
+
+  // A container ends: paths leading only into it (or naming it) are passed,
+  // nothing they name can come any more.
+  int close(Scan& s) const {
+    s.depth--;
+    if (s.count_depth == s.depth) s.count_depth = -1;
+    if (s.item_depth == s.depth) endItem(s);
+    if (s.list && item_.steps > s.depth && leadsTo(item_, s, s.depth, true)) {
+      s.items_passed = true;
+      s.changed = true;
+    }
+    if (s.depth < SEL_MAX_STEPS)
+      for (int i = 0; i < npaths_; i++)
+        if (!(s.passed & (1u << i)) && paths_[i].steps >= s.depth && leadsTo(paths_[i], s, s.depth, true)) {
+          s.passed |= 1u << i;
+          s.changed = true;
+        }
+    return s.depth == 0 ? S_DONE : S_COMMA_OR_CLOSE;
+  }
+
+  // A list element ends: its fields (each the first alternative with a
+  // value) become a row, and the field paths start over for the next one.
+  void endItem(Scan& s) const {
+    const char* f[F_SINCE + 1] = { "", "", "", "", "" };
+    for (int i = list_first_; i < npaths_; i++) {
+      if (!f[field_[i]][0] && s.type[i] >= T_STRING && s.type[i] != T_NULL) f[field_[i]] = s.value[i];
+    }
+    s.list->add(f[F_HOST], f[F_NAME], f[F_STATE], parseTimestamp(f[F_SINCE]));
+    for (int i = list_first_; i < npaths_; i++) s.type[i] = T_NONE;
+    s.item_depth = -1;
+    s.changed = true;
+  }
+
+  // Reads a JSON string after its opening quote into buf (cut to fit, UTF-8);
+  // *total gets the full decoded length.
+  template <class TInput>
+  static bool readString(TInput& in, char* buf, size_t size, size_t* total) {
+    size_t n = 0, all = 0;
+    unsigned hi = 0;                       // pending high surrogate
+    for (;;) {
+      int c = in.read();
+      if (c < 0) return false;
+      if (c == '"') break;
+      unsigned cp = (unsigned char)c;
+      bool escaped = false;
+      if (c == '\\') {
+        c = in.read();
+        escaped = true;
+        switch (c) {
+          case '"': case '\\': case '/': cp = c; break;
+          case 'b': cp = '\b'; break;
+          case 'f': cp = '\f'; break;
+          case 'n': cp = '\n'; break;
+          case 'r': cp = '\r'; break;
+          case 't': cp = '\t'; break;
+          case 'u': {
+            cp = 0;
+            for (int i = 0; i < 4; i++) {
+              int h = in.read();
+              int v = (h >= '0' && h <= '9') ? h - '0' : (h >= 'a' && h <= 'f') ? h - 'a' + 10 :
+                      (h >= 'A' && h <= 'F') ? h - 'A' + 10 : -1;
+              if (v < 0) return false;
+              cp = cp * 16 + v;
+            }
+            if (cp >= 0xD800 && cp <= 0xDBFF) { hi = cp; continue; }
+            if (cp >= 0xDC00 && cp <= 0xDFFF) cp = hi ? 0x10000 + ((hi - 0xD800) << 10) + (cp - 0xDC00) : '?';
+            break;
+          }
+          default: return false;
+        }
+      }
+      hi = 0;
+      char u[4];
+      size_t k;
+      if (!escaped || cp < 0x80) { u[0] = (char)cp; k = 1; }
+      else if (cp < 0x800) { u[0] = (char)(0xC0 | cp >> 6); u[1] = (char)(0x80 | (cp & 0x3F)); k = 2; }
+      else if (cp < 0x10000) {
+        u[0] = (char)(0xE0 | cp >> 12); u[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        u[2] = (char)(0x80 | (cp & 0x3F)); k = 3;
+      } else {
+        u[0] = (char)(0xF0 | cp >> 18); u[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        u[2] = (char)(0x80 | ((cp >> 6) & 0x3F)); u[3] = (char)(0x80 | (cp & 0x3F)); k = 4;
+      }
+      for (size_t i = 0; i < k; i++, all++)
+        if (n + 1 < size) buf[n++] = u[i];
+    }
+    buf[n] = '\0';
+    if (total) *total = all;
+    return true;
+  }
+
+  bool compareNumber(double v, double lit) const {
+    switch (op_) {
+      case OP_EQ: return v == lit;
+      case OP_NE: return v != lit;
+      case OP_LT: return v < lit;
+      case OP_LE: return v <= lit;
+      case OP_GT: return v > lit;
+      case OP_GE: return v >= lit;
+      default:    return false;
+    }
+  }
+
+  // The problem predicate on a path's first value (T_NONE: absent).
+  bool test(uint8_t type, const char* v) const {
+    if (op_ == OP_TRUTHY)
+      return type != T_NONE && type != T_FALSE && type != T_NULL &&
+             !(type == T_STRING && !v[0]) && !(type == T_NUMBER && strtod(v, NULL) == 0);
+    if (op_ == OP_EQ || op_ == OP_NE) {
+      bool eq = type == lit_type_ &&
+                (type == T_NUMBER ? strtod(v, NULL) == lit_num_ : type != T_STRING || strcmp(v, lit_) == 0);
+      return op_ == OP_EQ ? eq : !eq;
+    }
+    return type == T_NUMBER && lit_type_ == T_NUMBER && compareNumber(strtod(v, NULL), lit_num_);
+  }
+};
+
+// --- Published status ---------------------------------------------------------
+
+// Everything a reader (panel, /api/status, LED, MQTT) shows about the device's
+// state, captured together at one moment, so a page can't pair one poll's
+// alarm with another poll's problem name. Plain values only: it is published
+// as raw words (Published).
+struct Status {
+  unsigned long at_ms;          // when it was published
+  AlarmState state;
+  bool alarm;                   // confirmed problem
+  bool quiet;                   // ... but the schedule mutes the siren now
+  bool reachable;               // the last poll got an answer from Icinga
+  bool network_error;
+  bool manual;                  // relay test mode
+  int confirm;                  // consecutive problem polls
+  int threshold;
+  unsigned long poll_ms;        // current cadence (recheck while confirming)
+  unsigned long last_poll_ms;   // millis() of the last poll, 0 = none yet
+  unsigned long last_data_ms;   // millis() of the last good answer
+  char link[5];                 // eth / wifi / ap
+  char status[48];              // "OK (200/wifi)", "Conn Fail (Service/eth)", ..
+  char problem[144];            // "Service: host!svc", "None"
+  char next_check[40];          // Icinga's next_check for it, may be empty
+};
+
+// One writer publishes whole values; any number of readers, on any core, take
+// consistent copies without locking. A seqlock: publish() makes the sequence
+// odd, stores the value and makes it even again; a reader copies the value
+// between two loads of the same even sequence, and tries again otherwise (it
+// only spins while a publish is under way, a few hundred bytes of stores).
+// The value lives in relaxed atomic words, so a copy racing a publish is
+// defined, and the fences order it on weakly ordered cores too (the snapshot
+// check runs under ThreadSanitizer: make core-tsan). T must be trivially
+// copyable.
+template <class T>
+class Published {
+public:
+  Published() : seq_(0) {
+    for (size_t i = 0; i < WORDS; i++) words_[i].store(0, std::memory_order_relaxed);
+  }
+
+  void publish(const T& v) {
+    uint32_t w[WORDS] = {};
+    memcpy(w, &v, sizeof(T));
+    unsigned s = seq_.load(std::memory_order_relaxed);
+    seq_.store(s + 1, std::memory_order_relaxed);            // odd: under way
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; i++) words_[i].store(w[i], std::memory_order_relaxed);
+    seq_.store(s + 2, std::memory_order_release);            // even: complete
+  }
+
+  T read() const {
+    uint32_t w[WORDS];
+    for (;;) {
+      unsigned s = seq_.load(std::memory_order_acquire);
+      if (s & 1) continue;
+      for (size_t i = 0; i < WORDS; i++) w[i] = words_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == s) break;
+    }
+    T v;
+    memcpy(&v, w, sizeof(T));
+    return v;
+  }
+
+  unsigned sequence() const { return seq_.load(std::memory_order_acquire) / 2; }   // publishes so far
+
+private:
+  static const size_t WORDS = (sizeof(T) + 3) / 4;
+  std::atomic<unsigned> seq_;
+  std::atomic<uint32_t> words_[WORDS];
+};
+
+// --- Delta firmware images (OTA) --------------------------------------------
+
+// A delta rebuilds the new image from the one running plus the bytes that
+// changed, so an update moves a fraction of the binary (ota-delta.py makes
+// it). All integers are little-endian u32:
+//
+//   header  "LHD1", base size, target size, SHA-256 of the base (its first
+//           base-size bytes), SHA-256 of the target
+//   ops     'C' offset length   copy from the running image
+//           'D' length bytes    literal bytes
+//
+// until target-size bytes are out; anything after that is an error.
+const size_t DELTA_HEADER_SIZE = 4 + 4 + 4 + 32 + 32;
+
+struct DeltaHeader {
+  uint32_t base_size;
+  uint32_t target_size;
+  uint8_t base_sha256[32];
+  uint8_t target_sha256[32];
+};
+
+// True if the upload starts like a delta (the ESP32 image magic is 0xE9).
+inline bool isDelta(const uint8_t* p, size_t n) {
+  return n >= 4 && memcmp(p, "LHD1", 4) == 0;
+}
+
+// Applies a delta as it arrives, in pieces of any size: keeps the header and
+// one op's fields, nothing of the image. The caller reads the running image
+// and writes the output (flash on the device) through Io.
+class DeltaDecoder {
+public:
+  struct Io {
+    virtual ~Io() {}
+    // The header is in; false rejects the delta (wrong base, too large...).
+    virtual bool header(const DeltaHeader& h) = 0;
+    virtual bool readBase(uint32_t offset, uint8_t* buf, size_t n) = 0;
+    virtual bool write(const uint8_t* buf, size_t n) = 0;
+  };
+  enum Result { MORE, DONE, BAD };
+
+  DeltaDecoder() { reset(); }
+
+  void reset() {
+    step_ = HEADER;
+    have_ = 0;
+    out_ = 0;
+    left_ = 0;
+    error_ = "";
+  }
+
+  // Takes the next n bytes. DONE once the whole target is out; after BAD,
+  // error() says why and further input is refused.
+  Result feed(const uint8_t* p, size_t n, Io& io) {
+    while (n > 0 && step_ != FAILED) {
+      switch (step_) {
+        case HEADER: {
+          size_t k = take(p, n, DELTA_HEADER_SIZE);
+          p += k; n -= k;
+          if (have_ < DELTA_HEADER_SIZE) break;
+          if (!isDelta(buf_, have_)) { fail("not a delta"); break; }
+          h_.base_size = u32(buf_ + 4);
+          h_.target_size = u32(buf_ + 8);
+          memcpy(h_.base_sha256, buf_ + 12, 32);
+          memcpy(h_.target_sha256, buf_ + 44, 32);
+          if (!io.header(h_)) { fail("delta rejected"); break; }
+          nextOp();
+          break;
+        }
+        case OP:
+          op_ = *p++; n--;
+          if (op_ != 'C' && op_ != 'D') { fail("bad op"); break; }
+          have_ = 0;
+          step_ = ARGS;
+          break;
+        case ARGS: {
+          size_t want = op_ == 'C' ? 8 : 4;
+          size_t k = take(p, n, want);
+          p += k; n -= k;
+          if (have_ < want) break;
+          if (op_ == 'C') { copy(u32(buf_), u32(buf_ + 4), io); break; }
+          left_ = u32(buf_);
+          if (left_ > h_.target_size - out_) fail("data past the end");
+          else if (left_ == 0) nextOp();
+          else step_ = DATA;
+          break;
+        }
+        case DATA: {
+          size_t k = n < left_ ? n : left_;
+          if (!io.write(p, k)) { fail("write failed"); break; }
+          p += k; n -= k;
+          out_ += k;
+          left_ -= k;
+          if (left_ == 0) nextOp();
+          break;
+        }
+        case END:
+          fail("data after the end");
+          break;
+        case FAILED:
+          break;
+      }
+    }
+    return step_ == FAILED ? BAD : step_ == END ? DONE : MORE;
+  }
+
+  const DeltaHeader& header() const { return h_; }
+  uint32_t produced() const { return out_; }
+  const char* error() const { return error_; }
+
+private:
+  enum Step { HEADER, OP, ARGS, DATA, END, FAILED };
+
+  size_t take(const uint8_t* p, size_t n, size_t want) {
+    size_t k = want - have_;
+    if (k > n) k = n;
+    memcpy(buf_ + have_, p, k);
+    have_ += k;
+    return k;
+  }
+
+  static uint32_t u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+
+  void nextOp() { step_ = out_ == h_.target_size ? END : OP; }
+
+  // Through a small stack buffer: the running image is read from flash.
+  void copy(uint32_t offset, uint32_t len, Io& io) {
+    if (offset > h_.base_size || len > h_.base_size - offset || len > h_.target_size - out_) {
+      fail("copy out of range");
+      return;
+    }
+    uint8_t chunk[256];
+    while (len > 0) {
+      size_t k = len < sizeof(chunk) ? len : sizeof(chunk);
+      if (!io.readBase(offset, chunk, k)) { fail("base read failed"); return; }
+      if (!io.write(chunk, k)) { fail("write failed"); return; }
+      offset += k; out_ += k; len -= k;
+    }
+    nextOp();
+  }
+
+  void fail(const char* why) {
+    error_ = why;
+    step_ = FAILED;
+  }
+
+  Step step_;
+  uint8_t buf_[DELTA_HEADER_SIZE];
+  size_t have_;
+  uint8_t op_;
+  DeltaHeader h_;
+  uint32_t out_;
+  uint32_t left_;
+  const char* error_;
+};
+
+}  // namespace lh
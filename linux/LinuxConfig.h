@@ -0,0 +1,361 @@
+#pragma once
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lighthouse_core.h"
+
+// The daemon's settings: what the firmware keeps in NVS and edits through the
+// web panel, kept here in a plain "key = value" file (# comments). Defaults
+// match the firmware's. Unknown keys and bad values are errors with file:line,
+// so a typo never silently falls back to a default.
+//
+//   url_services / url_hosts   icingadb-web queries (as on the device)
+//   user / password            Icinga Web login
+//   poll_s, recheck_s, confirm, alarm_s, reminder_every_min, reminder_s
+//   data_timeout_s             no good reply for this long = network error
+//   http_timeout_s             one request, connect to last byte
+//   schedule = on|off, tz_offset = system|<hours>
+//   block1..block4             "Mon-Fri 06-18", "Sat,Sun 22-06" or "off"
+//   tls_verify = yes|no, tls_ca = <file or dir/>
+//   gpio_chip                  /dev/gpiochipN, or "none" for a dry run
+//   siren_line, off_lines      line offsets: the siren, and relays held off
+//   active_low = yes|no        relay board switches on a low level
+
+struct DaemonConfig {
+    std::string url_svc = "http://192.168.1.100:8080/icingadb/services?service.state.soft_state=2&service.state.is_acknowledged=n&service.state.in_downtime=n&service.state.is_flapping=n&limit=1";
+    std::string url_host = "http://192.168.1.100:8080/icingadb/hosts?host.state.soft_state=1&host.state.is_acknowledged=n&host.state.in_downtime=n&host.state.is_flapping=n&limit=1";
+    std::string user = "admin";
+    std::string password = "admin";
+    unsigned long poll_ms = 30000;
+    unsigned long recheck_ms = 10000;
+    int confirm = 3;
+    unsigned long alarm_ms = 30000;
+    unsigned long reminder_every_ms = 300000;
+    unsigned long reminder_ms = 15000;
+    unsigned long data_timeout_ms = 60000;
+    unsigned long http_timeout_ms = 4000;
+    bool schedule = false;
+    bool tz_system = true;              // local time from the system zone
+    int tz_offset = 0;                  // else UTC + this many hours
+    int days[lh::BH_BLOCKS] = { 0x1F, 0, 0, 0 };
+    int start[lh::BH_BLOCKS] = { 6, 0, 0, 0 };
+    int end[lh::BH_BLOCKS] = { 18, 0, 0, 0 };
+    bool tls_verify = true;
+    std::string tls_ca;
+    std::string gpio_chip = "/dev/gpiochip0";
+    unsigned siren_line = 0;
+    std::vector<unsigned> off_lines;
+    bool active_low = false;
+
+    // The alarm core's view. The schedule's tz_offset is only used with a
+    // fixed offset; with tz_system the daemon hands it local time directly.
+    lh::Config core() const {
+        lh::Config c;
+        c.poll_ms = poll_ms;
+        c.recheck_ms = recheck_ms;
+        c.confirm_threshold = confirm;
+        c.init_alarm_ms = alarm_ms;
+        c.reminder_interval_ms = reminder_every_ms;
+        c.reminder_ms = reminder_ms;
+        c.schedule.enabled = schedule;
+        c.schedule.tz_offset = tz_system ? 0 : tz_offset;
+        for (int i = 0; i < lh::BH_BLOCKS; i++) {
+            c.schedule.days[i] = days[i];
+            c.schedule.start[i] = start[i];
+            c.schedule.end[i] = end[i];
+        }
+        return c;
+    }
+
+    // Applies one setting; false with `err` set if the key or value is bad.
+    bool set(const std::string& key, const std::string& v, std::string& err) {
+        if (key == "url_services") return setUrl(url_svc, v, false, err);
+        if (key == "url_hosts") return setUrl(url_host, v, true, err);
+        if (key == "user") { user = v; return true; }
+        if (key == "password") { password = v; return true; }
+        if (key == "poll_s") return setMs(poll_ms, v, 1000, 5, 86400, err);
+        if (key == "recheck_s") return setMs(recheck_ms, v, 1000, 1, 86400, err);
+        if (key == "confirm") {
+            unsigned long n;
+            if (!number(v, 1, 20, n, err)) return false;
+            confirm = (int)n;
+            return true;
+        }
+        if (key == "alarm_s") return setMs(alarm_ms, v, 1000, 1, 3600, err);
+        if (key == "reminder_every_min") return setMs(reminder_every_ms, v, 60000, 1, 1440, err);
+        if (key == "reminder_s") return setMs(reminder_ms, v, 1000, 1, 3600, err);
+        if (key == "data_timeout_s") return setMs(data_timeout_ms, v, 1000, 10, 86400, err);
+        if (key == "http_timeout_s") return setMs(http_timeout_ms, v, 1000, 1, 120, err);
+        if (key == "schedule") return flag(v, schedule, err);
+        if (key == "tz_offset") {
+            if (v == "system") { tz_system = true; return true; }
+            char* e = nullptr;
+            long h = strtol(v.c_str(), &e, 10);
+            if (v.empty() || *e || h < -12 || h > 14) { err = "expected 'system' or hours -12..14"; return false; }
+            tz_system = false;
+            tz_offset = (int)h;
+            return true;
+        }
+        if (key.size() == 6 && key.compare(0, 5, "block") == 0 && key[5] >= '1' && key[5] < '1' + lh::BH_BLOCKS)
+            return setBlock(key[5] - '1', v, err);
+        if (key == "tls_verify") return flag(v, tls_verify, err);
+        if (key == "tls_ca") { tls_ca = v; return true; }
+        if (key == "gpio_chip") {
+            if (v.empty()) { err = "expected a /dev/gpiochipN path or 'none'"; return false; }
+            gpio_chip = v;
+            return true;
+        }
+        if (key == "siren_line") {
+            unsigned long n;
+            if (!number(v, 0, 1023, n, err)) return false;
+            siren_line = (unsigned)n;
+            return true;
+        }
+        if (key == "off_lines") {
+            std::vector<unsigned> lines;
+            std::stringstream ss(v);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                unsigned long n;
+                if (!number(trim(item), 0, 1023, n, err)) return false;
+                lines.push_back((unsigned)n);
+            }
+            off_lines = lines;
+            return true;
+        }
+        if (key == "active_low") return flag(v, active_low, err);
+        err = "unknown setting '" + key + "'";
+        return false;
+    }
+
+    // The current value of `key`, in the file's syntax ("" if unknown).
+    std::string get(const std::string& key) const {
+        auto sec = [](unsigned long ms, unsigned long unit) { return std::to_string(ms / unit); };
+        if (key == "url_services") return url_svc;
+        if (key == "url_hosts") return url_host;
+        if (key == "user") return user;
+        if (key == "password") return password;
+        if (key == "poll_s") return sec(poll_ms, 1000);
+        if (key == "recheck_s") return sec(recheck_ms, 1000);
+        if (key == "confirm") return std::to_string(confirm);
+        if (key == "alarm_s") return sec(alarm_ms, 1000);
+        if (key == "reminder_every_min") return sec(reminder_every_ms, 60000);
+        if (key == "reminder_s") return sec(reminder_ms, 1000);
+        if (key == "data_timeout_s") return sec(data_timeout_ms, 1000);
+        if (key == "http_timeout_s") return sec(http_timeout_ms, 1000);
+        if (key == "schedule") return schedule ? "on" : "off";
+        if (key == "tz_offset") return tz_system ? "system" : std::to_string(tz_offset);
+        if (key.size() == 6 && key.compare(0, 5, "block") == 0 && key[5] >= '1' && key[5] < '1' + lh::BH_BLOCKS)
+            return blockStr(key[5] - '1');
+        if (key == "tls_verify") return tls_verify ? "yes" : "no";
+        if (key == "tls_ca") return tls_ca;
+        if (key == "gpio_chip") return gpio_chip;
+        if (key == "siren_line") return std::to_string(siren_line);
+        if (key == "off_lines") {
+            std::string s;
+            for (unsigned l : off_lines) s += (s.empty() ? "" : ",") + std::to_string(l);
+            return s;
+        }
+        if (key == "active_low") return active_low ? "yes" : "no";
+        return "";
+    }
+
+    static const std::vector<std::string>& keys() {
+        static const std::vector<std::string> k = {
+            "url_services", "url_hosts", "user", "password", "poll_s", "recheck_s", "confirm",
+            "alarm_s", "reminder_every_min", "reminder_s", "data_timeout_s", "http_timeout_s",
+            "schedule", "tz_offset", "block1", "block2", "block3", "block4", "tls_verify",
+            "tls_ca", "gpio_chip", "siren_line", "off_lines", "active_low" };
+        return k;
+    }
+
+    // Relay lines in request order: the siren first.
+    std::vector<unsigned> relayLines() const {
+        std::vector<unsigned> l = { siren_line };
+        for (unsigned o : off_lines) if (o != siren_line) l.push_back(o);
+        return l;
+    }
+
+    // Loads `path` over the defaults. A missing file is fine (defaults);
+    // anything else wrong is an error naming file:line.
+    bool load(const std::string& path, std::string& err) {
+        std::ifstream in(path);
+        if (!in) {
+            if (errno == ENOENT) return true;
+            err = path + ": " + strerror(errno);
+            return false;
+        }
+        std::string line;
+        for (int n = 1; std::getline(in, line); n++) {
+            std::string key, value;
+            if (!splitLine(line, key, value)) continue;
+            std::string why;
+            if (key.empty()) why = "expected 'key = value'";
+            else if (!set(key, value, why)) why = key + ": " + why;
+            if (!why.empty()) { err = path + ":" + std::to_string(n) + ": " + why; return false; }
+        }
+        return true;
+    }
+
+    // --set: validates `key=value` against the loaded config, then rewrites
+    // that one line of `path` in place (comments and order kept; appended if
+    // absent). Written to a temp file, fsync'ed and renamed over the original,
+    // so a crash or power cut leaves either the old or the new file.
+    bool update(const std::string& path, const std::string& kv, std::string& err) {
+        size_t eq = kv.find('=');
+        if (eq == std::string::npos) { err = "--set expects key=value"; return false; }
+        std::string key = trim(kv.substr(0, eq)), value = trim(kv.substr(eq + 1));
+        DaemonConfig probe = *this;
+        if (!probe.set(key, value, err)) { err = key + ": " + err; return false; }
+
+        std::vector<std::string> lines;
+        {
+            std::ifstream in(path);
+            std::string l;
+            while (std::getline(in, l)) lines.push_back(l);
+        }
+        bool found = false;
+        for (auto& l : lines) {
+            std::string k, v;
+            if (splitLine(l, k, v) && k == key) { l = key + " = " + value; found = true; }
+        }
+        if (!found) lines.push_back(key + " = " + value);
+
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) { err = tmp + ": " + strerror(errno); return false; }
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0) fchmod(fd, st.st_mode & 07777);   // keep the mode
+        std::string text;
+        for (auto& l : lines) text += l + "\n";
+        bool ok = ::write(fd, text.data(), text.size()) == (ssize_t)text.size() && fsync(fd) == 0;
+        ok = (::close(fd) == 0) && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            err = path + ": " + strerror(errno);
+            unlink(tmp.c_str());
+            return false;
+        }
+        *this = probe;
+        return true;
+    }
+
+    static std::string trim(const std::string& s) {
+        size_t a = s.find_first_not_of(" \t\r"), b = s.find_last_not_of(" \t\r");
+        return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+    }
+
+private:
+    // "key = value # comment" -> key, value; false for blank / comment lines.
+    // A '#' only starts a comment after whitespace, so URLs keep their anchors.
+    static bool splitLine(const std::string& raw, std::string& key, std::string& value) {
+        std::string line = raw;
+        for (size_t i = 0; i < line.size(); i++)
+            if (line[i] == '#' && (i == 0 || line[i - 1] == ' ' || line[i - 1] == '\t')) { line.resize(i); break; }
+        line = trim(line);
+        if (line.empty()) return false;
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) { key.clear(); return true; }
+        key = trim(line.substr(0, eq));
+        value = trim(line.substr(eq + 1));
+        return true;
+    }
+
+    static bool number(const std::string& v, unsigned long lo, unsigned long hi, unsigned long& out,
+                       std::string& err) {
+        char* e = nullptr;
+        unsigned long n = strtoul(v.c_str(), &e, 10);
+        if (v.empty() || *e || v[0] == '-' || n < lo || n > hi) {
+            err = "expected a number " + std::to_string(lo) + ".." + std::to_string(hi);
+            return false;
+        }
+        out = n;
+        return true;
+    }
+
+    static bool setMs(unsigned long& ms, const std::string& v, unsigned long unit, unsigned long lo,
+                      unsigned long hi, std::string& err) {
+        unsigned long n;
+        if (!number(v, lo, hi, n, err)) return false;
+        ms = n * unit;
+        return true;
+    }
+
+    static bool flag(const std::string& v, bool& out, std::string& err) {
+        if (v == "on" || v == "yes" || v == "true" || v == "1") { out = true; return true; }
+        if (v == "off" || v == "no" || v == "false" || v == "0") { out = false; return true; }
+        err = "expected on/off";
+        return false;
+    }
+
+    static bool setUrl(std::string& out, const std::string& v, bool optional, std::string& err) {
+        if ((optional && v.empty()) || v.compare(0, 7, "http://") == 0 || v.compare(0, 8, "https://") == 0) {
+            out = v;
+            return true;
+        }
+        err = "expected an http:// or https:// URL";
+        return false;
+    }
+
+    static int dayIndex(const std::string& d) {   // bit index, 0=Mon .. 6=Sun
+        static const char* names[7] = { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun" };
+        for (int i = 0; i < 7; i++) if (strcasecmp(d.c_str(), names[i]) == 0) return i;
+        return -1;
+    }
+
+    // "Mon-Fri 06-18", "Mon,Wed,Sat-Sun 22-06" or "off".
+    bool setBlock(int i, const std::string& v, std::string& err) {
+        if (v == "off") { days[i] = 0; start[i] = end[i] = 0; return true; }
+        err = "expected 'Mon-Fri 06-18' or 'off'";
+        size_t sp = v.find_last_of(" \t");
+        if (sp == std::string::npos) return false;
+        std::string dayPart = trim(v.substr(0, sp)), hourPart = v.substr(sp + 1);
+        int mask = 0;
+        std::stringstream ss(dayPart);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            item = trim(item);
+            size_t dash = item.find('-');
+            int a = dayIndex(item.substr(0, dash));
+            int b = dash == std::string::npos ? a : dayIndex(item.substr(dash + 1));
+            if (a < 0 || b < 0) return false;
+            for (int d = a;; d = (d + 1) % 7) { mask |= 1 << d; if (d == b) break; }
+        }
+        int s, e;
+        char tail;
+        if (sscanf(hourPart.c_str(), "%d-%d%c", &s, &e, &tail) != 2 || s < 0 || s > 23 || e < 0 || e > 24)
+            return false;
+        days[i] = mask;
+        start[i] = s;
+        end[i] = e;
+        err.clear();
+        return true;
+    }
+
+    std::string blockStr(int i) const {
+        static const char* names[7] = { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun" };
+        if (!days[i]) return "off";
+        std::string d;
+        for (int b = 0; b < 7; b++) {
+            if (!(days[i] & (1 << b))) continue;
+            int e = b;
+            while (e + 1 < 7 && (days[i] & (1 << (e + 1)))) e++;
+            d += (d.empty() ? "" : ",") + std::string(names[b]) + (e > b ? std::string("-") + names[e] : "");
+            b = e;
+        }
+        char h[16];
+        snprintf(h, sizeof(h), " %02d-%02d", start[i], end[i]);
+        return d + h;
+    }
+};
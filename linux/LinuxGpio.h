@@ -0,0 +1,92 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Relay outputs on a GPIO character device (/dev/gpiochipN), through the
+// kernel's line uAPI v2 directly - no libgpiod, so it builds against any
+// distribution's headers from Linux 5.10 on. One request holds every relay
+// line, so another process can't grab them while the daemon runs, and the
+// kernel releases them if it dies.
+//
+// Works the same for SoC GPIO headers, I2C/SPI expanders and USB bridges that
+// register a gpiochip (CP210x, FT232R/FT-X CBUS), and for the gpio-sim test
+// chip (see gpio-sim.sh). The chip "none" logs the edges instead, for a dry
+// run without hardware.
+class GpioOutputs {
+public:
+    GpioOutputs() = default;
+    ~GpioOutputs() { release(); }
+    GpioOutputs(const GpioOutputs&) = delete;
+    GpioOutputs& operator=(const GpioOutputs&) = delete;
+
+    // Requests `lines` (offsets on `chip`) as outputs, all driven off. Line 0
+    // of the list is index 0 for set(). False with `err` set on failure.
+    bool open(const std::string& chip, const std::vector<unsigned>& lines, bool active_low,
+              std::string& err) {
+        release();
+        chip_ = chip;
+        count_ = lines.size();
+        if (chip == "none") return true;
+        if (lines.empty() || lines.size() > GPIO_V2_LINES_MAX) { err = "bad relay line list"; return false; }
+
+        int chip_fd = ::open(chip.c_str(), O_RDONLY | O_CLOEXEC);
+        if (chip_fd < 0) { err = chip + ": " + strerror(errno); return false; }
+
+        gpio_v2_line_request req;
+        memset(&req, 0, sizeof(req));
+        for (size_t i = 0; i < lines.size(); i++) req.offsets[i] = lines[i];
+        req.num_lines = lines.size();
+        strncpy(req.consumer, "icinga-lighthouse", sizeof(req.consumer) - 1);
+        req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT | (active_low ? GPIO_V2_LINE_FLAG_ACTIVE_LOW : 0);
+        req.config.num_attrs = 1;                       // initial values: all off
+        req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        req.config.attrs[0].attr.values = 0;
+        req.config.attrs[0].mask = allMask();
+
+        int rc = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+        int e = errno;
+        ::close(chip_fd);
+        if (rc < 0) { err = chip + ": line request: " + strerror(e); return false; }
+        fd_ = req.fd;
+        values_ = 0;
+        return true;
+    }
+
+    // Drives relay `index` (logical on/off; active-low is handled by the
+    // kernel). Only touches that line.
+    bool set(size_t index, bool on) {
+        if (index >= count_) return false;
+        uint64_t bit = 1ULL << index;
+        values_ = on ? (values_ | bit) : (values_ & ~bit);
+        if (fd_ < 0) return chip_ == "none";
+        gpio_v2_line_values v;
+        v.bits = values_;
+        v.mask = bit;
+        return ioctl(fd_, GPIO_V2_LINE_SET_VALUES_IOCTL, &v) == 0;
+    }
+
+    bool get(size_t index) const { return index < count_ && (values_ >> index) & 1; }
+
+    void release() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        values_ = 0;
+    }
+
+private:
+    uint64_t allMask() const { return count_ >= 64 ? ~0ULL : ((1ULL << count_) - 1); }
+
+    std::string chip_;
+    size_t count_ = 0;
+    int fd_ = -1;
+    uint64_t values_ = 0;
+};
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifndef LH_TLS
+#define LH_TLS 1
+#endif
+#if LH_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+// One HTTP/1.0 GET at a time, driven by the daemon's epoll loop: start()
+// opens a non-blocking socket, then onEvent() advances connect -> (TLS
+// handshake) -> send -> receive on readiness, never blocking the loop. The
+// reply runs to EOF (Connection: close), like the firmware's pipeline, and
+// stays small (limit=1), so it is simply collected and parsed when done.
+//
+// Name resolution is the one blocking step (getaddrinfo); it is usually
+// answered from the local resolver cache, and the request deadline bounds
+// everything after it.
+
+// Minimal base64 (for the HTTP Basic auth header).
+inline std::string base64Encode(const std::string& in) {
+    static const char* t = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    unsigned val = 0;
+    int bits = -6;
+    for (unsigned char c : in) {
+        val = (val << 8) + c;
+        bits += 8;
+        while (bits >= 0) { out += t[(val >> bits) & 0x3F]; bits -= 6; }
+    }
+    if (bits > -6) out += t[((val << 8) >> (bits + 8)) & 0x3F];
+    while (out.size() % 4) out += '=';
+    return out;
+}
+
+#if LH_TLS
+// Shared client context: system CA store (plus an optional extra CA file or
+// directory), peer + host name verification unless turned off.
+class TlsContext {
+public:
+    ~TlsContext() { if (ctx_) SSL_CTX_free(ctx_); }
+
+    bool init(bool verify, const std::string& ca, std::string& err) {
+        if (ctx_) SSL_CTX_free(ctx_);
+        ctx_ = SSL_CTX_new(TLS_client_method());
+        if (!ctx_) { err = "SSL_CTX_new failed"; return false; }
+        SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        // The reply runs to EOF; many servers close without close_notify.
+        SSL_CTX_set_options(ctx_, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+        verify_ = verify;
+        if (verify) {
+            SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+            SSL_CTX_set_default_verify_paths(ctx_);
+            if (!ca.empty()) {
+                bool dir = ca.back() == '/';
+                if (SSL_CTX_load_verify_locations(ctx_, dir ? nullptr : ca.c_str(), dir ? ca.c_str() : nullptr) != 1) {
+                    err = "cannot load CA " + ca;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    SSL_CTX* get() const { return ctx_; }
+    bool verify() const { return verify_; }
+
+private:
+    SSL_CTX* ctx_ = nullptr;
+    bool verify_ = true;
+};
+#else
+class TlsContext {};
+#endif
+
+class HttpGet {
+public:
+    enum State { IDLE, CONNECTING, HANDSHAKE, SENDING, RECEIVING, DONE, FAILED };
+    static const size_t MAX_REPLY = 1 << 20;   // a limit=1 reply is a few KB
+
+    HttpGet() = default;
+    ~HttpGet() { reset(); }
+    HttpGet(const HttpGet&) = delete;
+    HttpGet& operator=(const HttpGet&) = delete;
+
+    // Begins a GET of an http:// or https:// URL. On false the request already
+    // FAILED (error() says why); otherwise watch fd() for events().
+    bool start(const std::string& url, const std::string& user, const std::string& pass,
+               TlsContext* tls) {
+        reset();
+        std::string rest;
+        if (url.compare(0, 7, "http://") == 0) { rest = url.substr(7); https_ = false; }
+        else if (url.compare(0, 8, "https://") == 0) { rest = url.substr(8); https_ = true; }
+        else return fail("bad URL");
+#if !LH_TLS
+        if (https_) return fail("https:// needs a TLS build");
+#endif
+        size_t slash = rest.find('/');
+        std::string hostport = rest.substr(0, slash);
+        std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+        size_t colon = hostport.rfind(':');
+        host_ = colon == std::string::npos ? hostport : hostport.substr(0, colon);
+        std::string port = colon == std::string::npos ? (https_ ? "443" : "80") : hostport.substr(colon + 1);
+        if (!host_.empty() && host_.front() == '[' && host_.back() == ']') host_ = host_.substr(1, host_.size() - 2);
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        int gai = getaddrinfo(host_.c_str(), port.c_str(), &hints, &res);
+        if (gai != 0) return fail(std::string("resolve ") + host_ + ": " + gai_strerror(gai));
+        fd_ = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int rc = fd_ < 0 ? -1 : connect(fd_, res->ai_addr, res->ai_addrlen);
+        int e = errno;
+        freeaddrinfo(res);
+        if (fd_ < 0) return fail(std::string("socket: ") + strerror(e));
+        if (rc < 0 && e != EINPROGRESS) return fail(std::string("connect: ") + strerror(e));
+
+        request_ = "GET " + path + " HTTP/1.0\r\nHost: " + hostport +
+                   "\r\nAuthorization: Basic " + base64Encode(user + ":" + pass) +
+                   "\r\nAccept: application/json\r\nUser-Agent: icinga-lighthouse\r\nConnection: close\r\n\r\n";
+#if LH_TLS
+        if (https_) {
+            ssl_ = SSL_new(tls->get());
+            if (!ssl_) return fail("SSL_new failed");
+            SSL_set_fd(ssl_, fd_);
+            SSL_set_tlsext_host_name(ssl_, host_.c_str());
+            verify_ = tls->verify();
+            if (verify_) SSL_set1_host(ssl_, host_.c_str());
+        }
+#else
+        (void)tls;
+#endif
+        state_ = CONNECTING;
+        return true;
+    }
+
+    int fd() const { return fd_; }
+    State state() const { return state_; }
+    bool busy() const { return state_ != IDLE && state_ != DONE && state_ != FAILED; }
+    bool https() const { return https_; }
+    // EPOLLIN / EPOLLOUT the current step waits for.
+    uint32_t events() const { return want_write_ ? EPOLLOUT : EPOLLIN; }
+
+    // Advances on readiness of fd(). After it returns, check state().
+    void onEvent() {
+        if (state_ == CONNECTING) {
+            int soerr = 0;
+            socklen_t len = sizeof(soerr);
+            getsockopt(fd_, SOL_SOCKET, SO_ERROR, &soerr, &len);
+            if (soerr) { fail(std::string("connect: ") + strerror(soerr)); return; }
+            state_ = https_ ? HANDSHAKE : SENDING;
+        }
+#if LH_TLS
+        if (state_ == HANDSHAKE) {
+            int rc = SSL_connect(ssl_);
+            if (rc != 1) { sslRetry(rc, "TLS handshake"); return; }
+            state_ = SENDING;
+        }
+#endif
+        if (state_ == SENDING) {
+            while (sent_ < request_.size()) {
+                long n = io(true, &request_[sent_], request_.size() - sent_);
+                if (n < 0) return;               // waiting or failed
+                sent_ += n;
+            }
+            state_ = RECEIVING;
+        }
+        if (state_ == RECEIVING) {
+            char buf[4096];
+            for (;;) {
+                long n = io(false, buf, sizeof(buf));
+                if (n < 0) return;
+                if (n == 0) { finish(); return; }
+                reply_.append(buf, n);
+                if (reply_.size() > MAX_REPLY) { fail("reply too large"); return; }
+            }
+        }
+    }
+
+    bool fail(const std::string& why) {
+        error_ = why;
+        state_ = FAILED;
+        closeConn();
+        return false;
+    }
+
+    // Results, once DONE.
+    int status() const { return status_; }
+    const std::string& body() const { return body_; }
+    const std::string& error() const { return error_; }
+    size_t bytesIn() const { return reply_.size(); }
+
+    void reset() {
+        closeConn();
+        state_ = IDLE;
+        request_.clear(); reply_.clear(); body_.clear(); error_.clear();
+        sent_ = 0; status_ = 0; want_write_ = true; https_ = false;
+    }
+
+private:
+    // One send/recv over the plain or TLS socket: bytes moved, 0 on EOF, -1
+    // while waiting (want_write_ updated) or after a failure.
+    long io(bool out, char* p, size_t n) {
+#if LH_TLS
+        if (ssl_) {
+            int rc = out ? SSL_write(ssl_, p, (int)n) : SSL_read(ssl_, p, (int)n);
+            if (rc > 0) return rc;
+            int e = SSL_get_error(ssl_, rc);
+            if (!out && e == SSL_ERROR_ZERO_RETURN) return 0;
+            // A close without close_notify, on OpenSSL before 3.0.
+            if (!out && e == SSL_ERROR_SYSCALL && ERR_peek_error() == 0) return 0;
+            sslRetry(rc, out ? "TLS write" : "TLS read");
+            return -1;
+        }
+#endif
+        long r = out ? send(fd_, p, n, MSG_NOSIGNAL) : recv(fd_, p, n, 0);
+        if (r >= 0) return r;
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) { want_write_ = out; return -1; }
+        fail(std::string(out ? "send: " : "recv: ") + strerror(errno));
+        return -1;
+    }
+
+#if LH_TLS
+    // True if the TLS call only has to wait (sets the direction), else fails.
+    bool sslRetry(int rc, const char* what) {
+        int e = SSL_get_error(ssl_, rc);
+        if (e == SSL_ERROR_WANT_READ)  { want_write_ = false; return true; }
+        if (e == SSL_ERROR_WANT_WRITE) { want_write_ = true; return true; }
+        std::string why = what;
+        long v = verify_ ? SSL_get_verify_result(ssl_) : X509_V_OK;
+        if (v != X509_V_OK) why += std::string(": ") + X509_verify_cert_error_string(v);
+        else if (unsigned long ec = ERR_get_error()) {
+            char buf[160];
+            ERR_error_string_n(ec, buf, sizeof(buf));
+            why += std::string(": ") + buf;
+        }
+        fail(why);
+        return false;
+    }
+#endif
+
+    void finish() {
+        size_t eoh = reply_.find("\r\n\r\n");
+        size_t sp = reply_.find(' ');
+        if (reply_.compare(0, 5, "HTTP/") != 0 || sp == std::string::npos || eoh == std::string::npos) {
+            fail("malformed reply");
+            return;
+        }
+        status_ = atoi(reply_.c_str() + sp + 1);
+        body_ = reply_.substr(eoh + 4);
+        state_ = DONE;
+        closeConn();
+    }
+
+    void closeConn() {
+#if LH_TLS
+        if (ssl_) { SSL_free(ssl_); ssl_ = nullptr; }
+#endif
+        if (fd_ >= 0) close(fd_);
+        fd_ = -1;
+    }
+
+    State state_ = IDLE;
+    int fd_ = -1;
+    bool https_ = false;
+    bool want_write_ = true;
+    std::string host_, request_, reply_, body_, error_;
+    size_t sent_ = 0;
+    int status_ = 0;
+#if LH_TLS
+    SSL* ssl_ = nullptr;
+    bool verify_ = true;
+#endif
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+// The systemd notification protocol (sd_notify(3)) without libsystemd: one
+// datagram per state change to $NOTIFY_SOCKET. Outside systemd (no socket in
+// the environment) every call is a no-op, so the daemon runs the same by hand.
+//
+// With WatchdogSec= set, systemd passes WATCHDOG_USEC; the daemon must send
+// WATCHDOG=1 more often than that or it is killed and restarted. We ping at
+// half the interval, from the main loop only, so a wedged loop stops pinging.
+class SdNotify {
+public:
+    SdNotify() {
+        const char* path = getenv("NOTIFY_SOCKET");
+        if (path && (path[0] == '/' || path[0] == '@') && strlen(path) < sizeof(addr_.sun_path)) {
+            addr_.sun_family = AF_UNIX;
+            strncpy(addr_.sun_path, path, sizeof(addr_.sun_path) - 1);
+            if (path[0] == '@') addr_.sun_path[0] = '\0';   // abstract namespace
+            addr_len_ = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+            fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        }
+        const char* usec = getenv("WATCHDOG_USEC");
+        const char* pid = getenv("WATCHDOG_PID");
+        if (usec && (!pid || atol(pid) == (long)getpid()))
+            watchdog_ms_ = strtoull(usec, nullptr, 10) / 2000;   // half, in ms
+    }
+    ~SdNotify() { if (fd_ >= 0) close(fd_); }
+    SdNotify(const SdNotify&) = delete;
+    SdNotify& operator=(const SdNotify&) = delete;
+
+    bool active() const { return fd_ >= 0; }
+    // Ping period in ms (half of WatchdogSec=), 0 if the watchdog is off.
+    unsigned long watchdogMs() const { return watchdog_ms_; }
+
+    void send(const std::string& state) {
+        if (fd_ < 0) return;
+        sendto(fd_, state.data(), state.size(), MSG_NOSIGNAL,
+               reinterpret_cast<const sockaddr*>(&addr_), addr_len_);
+    }
+    void ready()                        { send("READY=1"); }
+    void reloading() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        send("RELOADING=1\nMONOTONIC_USEC=" +
+             std::to_string((unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000));
+    }
+    void stopping()                     { send("STOPPING=1"); }
+    void watchdog()                     { send("WATCHDOG=1"); }
+    // Free-form one-liner shown by "systemctl status"; only sent on change.
+    void status(const std::string& s) {
+        if (s == last_status_) return;
+        last_status_ = s;
+        send("STATUS=" + s);
+    }
+
+private:
+    int fd_ = -1;
+    sockaddr_un addr_ = {};
+    socklen_t addr_len_ = 0;
+    unsigned long watchdog_ms_ = 0;
+    std::string last_status_;
+};
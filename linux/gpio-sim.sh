@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+# Creates a simulated GPIO chip (gpio-sim kernel module, Linux 5.17+) so the
+# daemon can be run and watched without a relay board:
+#   sudo ./gpio-sim.sh up          # prints the /dev/gpiochipN to put in gpio_chip
+#   sudo ./gpio-sim.sh watch 0     # follow line 0 (the siren) as the daemon drives it
+#   sudo ./gpio-sim.sh down
+set -euo pipefail
+
+CFG=/sys/kernel/config/gpio-sim
+BANK="$CFG/lighthouse/bank0"
+
+case "${1:-}" in
+  up)
+    modprobe gpio-sim
+    mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+    mkdir -p "$BANK"
+    echo 8 > "$BANK/num_lines"
+    echo 1 > "$CFG/lighthouse/live"
+    chip=$(cat "$BANK/chip_name")
+    echo "/dev/$chip (8 lines)"
+    ;;
+  watch)
+    line="${2:-0}"
+    chip=$(cat "$BANK/chip_name")
+    val="/sys/devices/platform/$(cat "$CFG/lighthouse/dev_name")/$chip/sim_gpio$line/value"
+    last=""
+    while sleep 0.2; do
+      v=$(cat "$val")
+      [ "$v" != "$last" ] && echo "$(date +%T) line $line = $v" && last="$v"
+    done
+    ;;
+  down)
+    echo 0 > "$CFG/lighthouse/live"
+    rmdir "$BANK" "$CFG/lighthouse"
+    ;;
+  *)
+    echo "usage: $0 up|watch [line]|down" >&2
+    exit 2
+    ;;
+esac
@@ -0,0 +1,772 @@
+// lighthouse-collector.cpp — one view of a whole fleet of lighthouses.
+//
+// Scrapes every device's GET /api/status (see handleStatusJson() in the
+// sketch) on a fixed interval and serves the aggregate:
+//
+//   /            text table, devices that need a look first
+//   /api/fleet   JSON: totals plus one object per device
+//   /metrics     Prometheus text: per-device gauges (label device="host:port")
+//                and the collector's own counters
+//
+// Built for thousands of devices at sub-second intervals on one core: a single
+// epoll loop drives every scrape as a non-blocking socket (no thread per
+// device), at most --concurrency of them in flight; devices wait in a min-heap
+// ordered by due time, and in-flight scrapes time out in start order, so each
+// wakeup costs O(log n). Replies are read into per-slot fixed buffers and
+// parsed in place (scanFlatJson below), so a scrape allocates nothing.
+//
+//   lighthouse-collector --targets devices.txt --interval-ms 1000 --listen 9110
+//   lighthouse-collector --range 127.0.0.1:9000-9499     # the fleet simulator
+//
+// Options:
+//   --targets FILE        one device per line, host[:port] (# comments)
+//   --range H:P1-P2       devices on consecutive ports (fleet sim --web-base)
+//   --user U, --password P   panel login (default admin / admin)
+//   --interval-ms N       scrape period per device (default 1000)
+//   --timeout-ms N        per scrape, connect to last byte (default 2000)
+//   --concurrency N       scrapes in flight at most (default 256)
+//   --listen PORT         serve the views (default 9110, 0 = none)
+//   --report S            stats line on stderr every S seconds (default 10, 0 = off)
+//   --duration S          exit after S seconds (default 0 = run until killed)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "LinuxHttp.h"   // base64Encode (built with LH_TLS=0: devices serve plain HTTP)
+
+static uint64_t nowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// --- Flat JSON scanner --------------------------------------------------------
+
+// /api/status is one flat object of strings, numbers and booleans. This reads
+// it in a single pass without a JSON library: the quotes that bound keys and
+// strings are found with memchr, which glibc vectorises (SSE2/AVX2, NEON), so
+// most of the body is crossed 16-32 bytes per step. Calls on(key, value) per
+// member; string values are raw (escapes kept, see copyStr), numbers and
+// booleans their literal text. False if the input is not a flat object.
+struct JsonValue {
+    const char* p;
+    size_t n;
+};
+
+template <class F>
+bool scanFlatJson(const char* p, const char* end, F on) {
+    auto ws = [&] { while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++; };
+    ws();
+    if (p >= end || *p++ != '{') return false;
+    for (;;) {
+        ws();
+        if (p < end && *p == '}') return true;
+        if (p >= end || *p != '"') return false;
+        const char* k = ++p;
+        const char* ke = (const char*)memchr(p, '"', end - p);
+        if (!ke) return false;
+        p = ke + 1;
+        ws();
+        if (p >= end || *p++ != ':') return false;
+        ws();
+        JsonValue v;
+        if (p < end && *p == '"') {
+            const char* s = ++p;
+            const char* q = s;
+            for (;;) {
+                q = (const char*)memchr(q, '"', end - q);
+                if (!q) return false;
+                size_t bs = 0;                       // an odd run of '\' escapes it
+                while (q - bs > s && q[-1 - (long)bs] == '\\') bs++;
+                if (bs % 2 == 0) break;
+                q++;
+            }
+            v = JsonValue{ s, (size_t)(q - s) };
+            p = q + 1;
+        } else {
+            const char* s = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ' ' && *p != '\n') p++;
+            if (p == s || *s == '{' || *s == '[') return false;
+            v = JsonValue{ s, (size_t)(p - s) };
+        }
+        on(k, (size_t)(ke - k), v);
+        ws();
+        if (p < end && *p == ',') { p++; continue; }
+        if (p < end && *p == '}') return true;
+        return false;
+    }
+}
+
+static long toLong(const JsonValue& v) {
+    char tmp[24];
+    size_t n = std::min(v.n, sizeof(tmp) - 1);
+    memcpy(tmp, v.p, n);
+    tmp[n] = '\0';
+    return strtol(tmp, nullptr, 10);
+}
+
+// Unescapes \" and \\ (all the device emits) into a fixed field, truncated.
+static void copyStr(const JsonValue& v, char* out, size_t size) {
+    size_t o = 0;
+    for (size_t i = 0; i < v.n && o + 1 < size; i++) {
+        char c = v.p[i];
+        if (c == '\\' && i + 1 < v.n) c = v.p[++i];
+        out[o++] = c;
+    }
+    out[o] = '\0';
+}
+
+// --- Device state ---------------------------------------------------------------
+
+struct Status {
+    char id[16], version[16], state[16], link[8], status[48], problem[96], config_rev[24];
+    bool alarm, siren, network_error, reachable, manual;
+    long uptime_s, confirm, threshold, poll_ms, last_poll_ms, last_data_ms, requests, failures;
+};
+
+enum Kind { K_STR, K_LONG, K_BOOL };
+struct Field { const char* key; size_t len; Kind kind; size_t off; size_t size; };
+#define STR_F(k)  { #k, sizeof(#k) - 1, K_STR, offsetof(Status, k), sizeof(Status::k) }
+#define LONG_F(k) { #k, sizeof(#k) - 1, K_LONG, offsetof(Status, k), 0 }
+#define BOOL_F(k) { #k, sizeof(#k) - 1, K_BOOL, offsetof(Status, k), 0 }
+static const Field FIELDS[] = {
+    STR_F(id), STR_F(version), STR_F(state), STR_F(link), STR_F(status), STR_F(problem), STR_F(config_rev),
+    BOOL_F(alarm), BOOL_F(siren), BOOL_F(network_error), BOOL_F(reachable), BOOL_F(manual),
+    LONG_F(uptime_s), LONG_F(confirm), LONG_F(threshold), LONG_F(poll_ms), LONG_F(last_poll_ms),
+    LONG_F(last_data_ms), LONG_F(requests), LONG_F(failures),
+};
+
+static bool parseStatus(const char* p, const char* end, Status& st) {
+    memset(&st, 0, sizeof(st));
+    bool any = false;
+    bool ok = scanFlatJson(p, end, [&](const char* k, size_t kn, const JsonValue& v) {
+        for (const Field& f : FIELDS) {
+            if (f.len != kn || memcmp(f.key, k, kn) != 0) continue;
+            char* dst = reinterpret_cast<char*>(&st) + f.off;
+            if (f.kind == K_STR) copyStr(v, dst, f.size);
+            else if (f.kind == K_LONG) *reinterpret_cast<long*>(dst) = toLong(v);
+            else *reinterpret_cast<bool*>(dst) = v.n == 4 && memcmp(v.p, "true", 4) == 0;
+            any = true;
+            return;
+        }
+    });
+    return ok && any;
+}
+
+enum Health { H_DOWN, H_ALARM, H_NETWORK, H_LATE, H_OK, H_COUNT };
+static const char* HEALTH_NAMES[H_COUNT] = { "down", "alarm", "network_error", "late", "ok" };
+
+struct Device {
+    std::string name;              // host:port, as given
+    sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    std::string request;
+    uint64_t due_us = 0;
+
+    bool have = false;             // st holds a parsed reply
+    Status st;
+    uint64_t last_ok_us = 0;
+    uint32_t scrape_us = 0;
+    unsigned long scrapes = 0, errors = 0;
+    char error[64] = "";
+
+    // Down: no good reply for 3 intervals. Late: the device hasn't started a
+    // poll for two of its own poll intervals (a stuck loop or a hung request).
+    Health health(uint64_t now, uint64_t interval_us) const {
+        if (!have || now - last_ok_us > 3 * interval_us + 1000000) return H_DOWN;
+        if (st.alarm) return H_ALARM;
+        if (st.network_error) return H_NETWORK;
+        if (st.poll_ms > 0 && st.last_poll_ms > 2 * st.poll_ms + 1000) return H_LATE;
+        return H_OK;
+    }
+};
+
+// One scrape in flight: a socket and a reply buffer, reused for the next one.
+struct Slot {
+    static const size_t BUF = 2048;       // a status reply is ~600 bytes
+    int dev = -1;                         // -1 = free
+    int fd = -1;
+    unsigned gen = 0;
+    uint64_t started_us = 0, deadline_us = 0;
+    size_t sent = 0, len = 0;
+    bool connected = false;
+    char buf[BUF];
+};
+
+// --- Collector ------------------------------------------------------------------
+
+class Collector {
+public:
+    std::vector<Device> devices;
+    std::string user = "admin", password = "admin";
+    uint64_t interval_us = 1000000, timeout_us = 2000000;
+    int concurrency = 256;
+    int listen_port = 9110;
+    unsigned report_s = 10, duration_s = 0;
+
+    int run() {
+        raiseFdLimit();
+        std::string auth = "Authorization: Basic " + base64Encode(user + ":" + password) + "\r\n";
+        for (Device& d : devices)
+            d.request = "GET /api/status HTTP/1.0\r\nHost: " + d.name + "\r\n" + auth + "Connection: close\r\n\r\n";
+        slots_.resize(concurrency);
+        for (int i = concurrency - 1; i >= 0; i--) free_.push_back(i);
+
+        ep_ = epoll_create1(EPOLL_CLOEXEC);
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGINT);
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+        sig_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        watch(sig_fd_, EPOLLIN, TAG_SIGNAL, 0);
+        if (listen_port && !openListener()) return 1;
+
+        // Spread the first round over one interval, so the fleet isn't scraped
+        // in one burst (and stays spread, since each device keeps its phase).
+        uint64_t now = nowUs();
+        for (size_t i = 0; i < devices.size(); i++) {
+            devices[i].due_us = now + interval_us * i / devices.size();
+            heap_.push(Due{ devices[i].due_us, (int)i });
+        }
+        started_us_ = last_report_us_ = now;
+        next_report_us_ = now;
+        next_report_us_ += report_s * (uint64_t)1000000;
+        fprintf(stderr, "collector: %zu devices every %llu ms, %d in flight at most%s\n", devices.size(),
+                (unsigned long long)(interval_us / 1000), concurrency,
+                listen_port ? (", serving :" + std::to_string(listen_port)).c_str() : "");
+
+        std::vector<epoll_event> ev(256);
+        while (!stop_) {
+            now = nowUs();
+            startDue(now);
+            expire(now);
+            if (report_s && now >= next_report_us_) report(now);
+            if (duration_s && now - started_us_ >= duration_s * (uint64_t)1000000) break;
+
+            int n = epoll_wait(ep_, ev.data(), (int)ev.size(), timeoutMs(nowUs()));
+            if (n < 0 && errno != EINTR) { perror("epoll_wait"); return 1; }
+            for (int i = 0; i < n; i++) {
+                uint32_t tag = ev[i].data.u64 >> 32, idx = (uint32_t)ev[i].data.u64;
+                if (tag == TAG_SLOT) onSlot((int)idx);
+                else if (tag == TAG_CLIENT) onClient((int)idx);
+                else if (tag == TAG_LISTEN) onAccept();
+                else stop_ = true;
+            }
+        }
+        return 0;
+    }
+
+private:
+    enum { TAG_SIGNAL = 1, TAG_LISTEN, TAG_SLOT, TAG_CLIENT };
+    struct Due {
+        uint64_t at;
+        int dev;
+        bool operator>(const Due& o) const { return at > o.at; }
+    };
+    struct Client {
+        std::string in, out;
+        size_t off = 0;
+    };
+
+    void watch(int fd, uint32_t events, uint32_t tag, uint32_t idx, int op = EPOLL_CTL_ADD) {
+        epoll_event e = {};
+        e.events = events;
+        e.data.u64 = ((uint64_t)tag << 32) | idx;
+        epoll_ctl(ep_, op, fd, &e);
+    }
+
+    static void raiseFdLimit() {
+        rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+
+    // --- Scraping ---
+
+    void startDue(uint64_t now) {
+        while (!heap_.empty() && heap_.top().at <= now && !free_.empty()) {
+            Due d = heap_.top();
+            heap_.pop();
+            int s = free_.back();
+            free_.pop_back();
+            if (d.at + interval_us <= now) stats_.skipped++;   // fell a full interval behind
+            start(s, d.dev, now);
+        }
+    }
+
+    void start(int s, int dev, uint64_t now) {
+        Slot& sl = slots_[s];
+        Device& d = devices[dev];
+        sl.dev = dev;
+        sl.gen++;
+        sl.started_us = now;
+        sl.deadline_us = now + timeout_us;
+        sl.sent = sl.len = 0;
+        sl.connected = false;
+        inflight_.push_back({ s, sl.gen });
+
+        sl.fd = socket(d.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sl.fd < 0) { finish(s, "socket: " + std::string(strerror(errno))); return; }
+        int one = 1;
+        setsockopt(sl.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(sl.fd, (sockaddr*)&d.addr, d.addr_len) < 0 && errno != EINPROGRESS) {
+            finish(s, "connect: " + std::string(strerror(errno)));
+            return;
+        }
+        watch(sl.fd, EPOLLOUT, TAG_SLOT, s);
+    }
+
+    void onSlot(int s) {
+        Slot& sl = slots_[s];
+        if (sl.dev < 0) return;
+        Device& d = devices[sl.dev];
+        if (!sl.connected) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(sl.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err) { finish(s, "connect: " + std::string(strerror(err))); return; }
+            sl.connected = true;
+        }
+        if (sl.sent < d.request.size()) {
+            ssize_t n = send(sl.fd, d.request.data() + sl.sent, d.request.size() - sl.sent, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN) { finish(s, "send: " + std::string(strerror(errno))); return; }
+            if (n > 0) sl.sent += n;
+            if (sl.sent == d.request.size()) watch(sl.fd, EPOLLIN, TAG_SLOT, s, EPOLL_CTL_MOD);
+            return;
+        }
+        for (;;) {
+            if (sl.len >= Slot::BUF) { finish(s, "reply too large"); return; }
+            ssize_t n = recv(sl.fd, sl.buf + sl.len, Slot::BUF - sl.len, 0);
+            if (n > 0) {
+                sl.len += n;
+                if (complete(sl)) { finish(s, ""); return; }
+                continue;
+            }
+            if (n == 0) { finish(s, ""); return; }
+            if (errno == EAGAIN || errno == EINTR) return;
+            finish(s, "recv: " + std::string(strerror(errno)));
+            return;
+        }
+    }
+
+    // True once the headers and Content-Length bytes of body are in, so the
+    // scrape doesn't wait for the device to close.
+    static bool complete(const Slot& sl) {
+        const char* b = sl.buf;
+        const char* eoh = (const char*)memmem(b, sl.len, "\r\n\r\n", 4);
+        if (!eoh) return false;
+        size_t body = sl.len - (eoh + 4 - b);
+        for (const char* line = b; line < eoh;) {
+            if (eoh - line >= 15 && strncasecmp(line, "Content-Length:", 15) == 0)
+                return body >= (size_t)atol(line + 15);
+            const char* nl = (const char*)memchr(line, '\n', eoh - line);
+            if (!nl) break;
+            line = nl + 1;
+        }
+        return false;
+    }
+
+    void finish(int s, const std::string& error) {
+        Slot& sl = slots_[s];
+        Device& d = devices[sl.dev];
+        uint64_t now = nowUs();
+        if (sl.fd >= 0) close(sl.fd);       // also drops it from the epoll set
+        sl.fd = -1;
+
+        std::string err = error;
+        Status parsed;
+        if (err.empty()) {
+            const char* b = sl.buf;
+            const char* end = b + sl.len;
+            const char* eoh = (const char*)memmem(b, sl.len, "\r\n\r\n", 4);
+            const char* sp = (const char*)memchr(b, ' ', sl.len);
+            int code = sp && sl.len > 12 ? atoi(sp + 1) : 0;
+            if (!eoh || code == 0) err = "malformed reply";
+            else if (code != 200) err = "HTTP " + std::to_string(code);
+            else if (!parseStatus(eoh + 4, end, parsed)) err = "bad status JSON";
+            else d.st = parsed;
+        }
+        d.scrapes++;
+        d.scrape_us = (uint32_t)std::min<uint64_t>(now - sl.started_us, UINT32_MAX);
+        if (err.empty()) {
+            d.have = true;
+            d.last_ok_us = now;
+            d.error[0] = '\0';
+            stats_.ok++;
+            stats_.lat_us.push_back(d.scrape_us);
+        } else {
+            d.errors++;
+            snprintf(d.error, sizeof(d.error), "%s", err.c_str());
+            stats_.errors++;
+        }
+
+        // Fixed rate per device; after a stall, resume one interval from now.
+        d.due_us += interval_us;
+        if (d.due_us <= now) d.due_us = now + interval_us;
+        heap_.push(Due{ d.due_us, sl.dev });
+        sl.dev = -1;
+        free_.push_back(s);
+    }
+
+    // All scrapes share one timeout, so start order is deadline order.
+    void expire(uint64_t now) {
+        while (!inflight_.empty()) {
+            auto f = inflight_.front();
+            Slot& sl = slots_[f.first];
+            if (sl.gen != f.second || sl.dev < 0) { inflight_.pop_front(); continue; }
+            if (sl.deadline_us > now) break;
+            inflight_.pop_front();
+            finish(f.first, "timeout");
+        }
+    }
+
+    int timeoutMs(uint64_t now) {
+        uint64_t next = UINT64_MAX;
+        if (!heap_.empty() && !free_.empty()) next = heap_.top().at;
+        for (auto& f : inflight_) {         // first live entry is the earliest
+            const Slot& sl = slots_[f.first];
+            if (sl.gen == f.second && sl.dev >= 0) { next = std::min(next, sl.deadline_us); break; }
+        }
+        if (report_s) next = std::min(next, next_report_us_);
+        if (duration_s) next = std::min(next, started_us_ + duration_s * (uint64_t)1000000);
+        if (next == UINT64_MAX) return -1;
+        if (next <= now) return 0;
+        return (int)std::min<uint64_t>((next - now + 999) / 1000, INT_MAX);
+    }
+
+    void report(uint64_t now) {
+        double secs = (now - last_report_us_) / 1e6;
+        if (secs <= 0) return;
+        std::vector<uint32_t>& v = stats_.lat_us;
+        auto pct = [&](double q) -> double {
+            if (v.empty()) return 0;
+            size_t k = std::min(v.size() - 1, (size_t)(q * v.size()));
+            std::nth_element(v.begin(), v.begin() + k, v.end());
+            return v[k] / 1000.0;
+        };
+        int h[H_COUNT] = {};
+        for (const Device& d : devices) h[d.health(now, interval_us)]++;
+        fprintf(stderr, "scrapes %.0f/s ok %lu err %lu behind %lu | p50 %.1f ms p99 %.1f ms | "
+                        "ok %d alarm %d net %d late %d down %d\n",
+                (stats_.ok + stats_.errors - last_done_) / secs, stats_.ok, stats_.errors, stats_.skipped,
+                pct(0.5), pct(0.99), h[H_OK], h[H_ALARM], h[H_NETWORK], h[H_LATE], h[H_DOWN]);
+        v.clear();
+        last_done_ = stats_.ok + stats_.errors;
+        last_report_us_ = now;
+        next_report_us_ = now + report_s * (uint64_t)1000000;
+    }
+
+    // --- Serving the views ---
+
+    bool openListener() {
+        int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1, zero = 0;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        sockaddr_in6 a = {};
+        a.sin6_family = AF_INET6;
+        a.sin6_port = htons(listen_port);
+        a.sin6_addr = in6addr_any;
+        if (fd < 0 || bind(fd, (sockaddr*)&a, sizeof(a)) < 0 || listen(fd, 64) < 0) {
+            fprintf(stderr, "listen :%d: %s\n", listen_port, strerror(errno));
+            return false;
+        }
+        listen_fd_ = fd;
+        watch(fd, EPOLLIN, TAG_LISTEN, 0);
+        return true;
+    }
+
+    void onAccept() {
+        for (;;) {
+            int c = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (c < 0) return;
+            if (clients_.size() >= 64) { close(c); continue; }
+            clients_[c] = Client();
+            watch(c, EPOLLIN, TAG_CLIENT, c);
+        }
+    }
+
+    void onClient(int fd) {
+        auto it = clients_.find(fd);
+        if (it == clients_.end()) return;
+        Client& c = it->second;
+        if (c.out.empty()) {
+            char buf[2048];
+            ssize_t n;
+            while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) c.in.append(buf, n);
+            if (n == 0 || (n < 0 && errno != EAGAIN) || c.in.size() > 16384) { dropClient(fd); return; }
+            if (c.in.find("\r\n\r\n") == std::string::npos) return;
+            c.out = respond(c.in);
+            watch(fd, EPOLLOUT, TAG_CLIENT, fd, EPOLL_CTL_MOD);
+        }
+        while (c.off < c.out.size()) {
+            ssize_t n = send(fd, c.out.data() + c.off, c.out.size() - c.off, MSG_NOSIGNAL);
+            if (n < 0) { if (errno != EAGAIN) dropClient(fd); return; }
+            c.off += n;
+        }
+        dropClient(fd);
+    }
+
+    void dropClient(int fd) {
+        close(fd);
+        clients_.erase(fd);
+    }
+
+    std::string respond(const std::string& req) {
+        size_t sp = req.find(' ');
+        std::string path = req.substr(sp + 1, req.find(' ', sp + 1) - sp - 1);
+        path = path.substr(0, path.find('?'));
+        std::string type = "text/plain; charset=utf-8", body;
+        int code = 200;
+        if (req.compare(0, 4, "GET ") != 0) { code = 405; body = "GET only\n"; }
+        else if (path == "/") body = renderText();
+        else if (path == "/api/fleet") { type = "application/json"; body = renderJson(); }
+        else if (path == "/metrics") { type = "text/plain; version=0.0.4"; body = renderMetrics(); }
+        else { code = 404; body = "not found\n"; }
+        return "HTTP/1.0 " + std::to_string(code) + (code == 200 ? " OK" : " Error") +
+               "\r\nContent-Type: " + type + "\r\nContent-Length: " + std::to_string(body.size()) +
+               "\r\nConnection: close\r\n\r\n" + body;
+    }
+
+    static std::string jsonStr(const char* s) {
+        std::string o = "\"";
+        for (; *s; s++) {
+            if (*s == '"' || *s == '\\') o += '\\';
+            o += (unsigned char)*s < 0x20 ? ' ' : *s;
+        }
+        return o + "\"";
+    }
+
+    // Indices ordered worst health first, then by name.
+    std::vector<int> ordered(uint64_t now, int* counts) const {
+        std::vector<int> idx(devices.size());
+        std::vector<Health> h(devices.size());
+        for (size_t i = 0; i < devices.size(); i++) {
+            idx[i] = (int)i;
+            h[i] = devices[i].health(now, interval_us);
+            counts[h[i]]++;
+        }
+        std::sort(idx.begin(), idx.end(), [&](int a, int b) {
+            return h[a] != h[b] ? h[a] < h[b] : devices[a].name < devices[b].name;
+        });
+        return idx;
+    }
+
+    std::string renderText() const {
+        uint64_t now = nowUs();
+        int n[H_COUNT] = {};
+        std::vector<int> idx = ordered(now, n);
+        char line[512];
+        snprintf(line, sizeof(line), "%zu devices: %d ok, %d alarm, %d network error, %d late, %d down\n\n",
+                 devices.size(), n[H_OK], n[H_ALARM], n[H_NETWORK], n[H_LATE], n[H_DOWN]);
+        std::string out = line;
+        snprintf(line, sizeof(line), "%-22s %-13s %-14s %-5s %-6s %9s %9s %7s  %s\n", "DEVICE", "HEALTH", "STATE",
+                 "SIREN", "LINK", "POLL AGO", "DATA AGO", "SCRAPE", "PROBLEM / ERROR");
+        out += line;
+        for (int i : idx) {
+            const Device& d = devices[i];
+            Health h = d.health(now, interval_us);
+            const Status& s = d.st;
+            std::string detail = d.error[0] ? std::string("(") + d.error + ")" : "";
+            if (d.have && strcmp(s.problem, "None") != 0) detail = std::string(s.problem) + " " + detail;
+            snprintf(line, sizeof(line), "%-22s %-13s %-14s %-5s %-6s %8.1fs %8.1fs %5.1fms  %s\n", d.name.c_str(),
+                     HEALTH_NAMES[h], d.have ? s.state : "-", d.have && s.siren ? "ON" : "-", d.have ? s.link : "-",
+                     d.have ? s.last_poll_ms / 1000.0 : 0, d.have ? s.last_data_ms / 1000.0 : 0,
+                     d.scrape_us / 1000.0, detail.c_str());
+            out += line;
+        }
+        return out;
+    }
+
+    std::string renderJson() const {
+        uint64_t now = nowUs();
+        int n[H_COUNT] = {};
+        std::vector<int> idx = ordered(now, n);
+        std::string out = "{\"devices_total\":" + std::to_string(devices.size());
+        for (int h = 0; h < H_COUNT; h++) out += ",\"" + std::string(HEALTH_NAMES[h]) + "\":" + std::to_string(n[h]);
+        out += ",\"devices\":[";
+        for (size_t k = 0; k < idx.size(); k++) {
+            const Device& d = devices[idx[k]];
+            const Status& s = d.st;
+            if (k) out += ',';
+            out += "{\"device\":" + jsonStr(d.name.c_str()) + ",\"health\":\"" +
+                   HEALTH_NAMES[d.health(now, interval_us)] + "\",\"scrape_ms\":" +
+                   std::to_string(d.scrape_us / 1000.0) + ",\"error\":" + jsonStr(d.error);
+            if (d.have) {
+                out += ",\"id\":" + jsonStr(s.id) + ",\"version\":" + jsonStr(s.version) + ",\"state\":" +
+                       jsonStr(s.state) + ",\"alarm\":" + (s.alarm ? "true" : "false") + ",\"siren\":" +
+                       (s.siren ? "true" : "false") + ",\"network_error\":" + (s.network_error ? "true" : "false") +
+                       ",\"confirm\":" + std::to_string(s.confirm) + ",\"poll_ms\":" + std::to_string(s.poll_ms) +
+                       ",\"last_poll_ms\":" + std::to_string(s.last_poll_ms) + ",\"last_data_ms\":" +
+                       std::to_string(s.last_data_ms) + ",\"uptime_s\":" + std::to_string(s.uptime_s) +
+                       ",\"link\":" + jsonStr(s.link) + ",\"problem\":" + jsonStr(s.problem) +
+                       ",\"config_rev\":" + jsonStr(s.config_rev);
+            }
+            out += '}';
+        }
+        return out + "]}\n";
+    }
+
+    std::string renderMetrics() const {
+        uint64_t now = nowUs();
+        int n[H_COUNT] = {};
+        for (const Device& d : devices) n[d.health(now, interval_us)]++;
+        std::string out;
+        out.reserve(devices.size() * 600 + 1024);
+        out += "# TYPE lighthouse_fleet_devices gauge\n";
+        for (int h = 0; h < H_COUNT; h++)
+            out += "lighthouse_fleet_devices{health=\"" + std::string(HEALTH_NAMES[h]) + "\"} " + std::to_string(n[h]) + "\n";
+
+        struct Metric { const char* name; const char* type; std::function<double(const Device&)> get; bool need; };
+        const Metric metrics[] = {
+            { "lighthouse_up", "gauge", [&](const Device& d) { return d.health(now, interval_us) != H_DOWN; }, false },
+            { "lighthouse_alarm", "gauge", [](const Device& d) { return d.st.alarm; }, true },
+            { "lighthouse_siren", "gauge", [](const Device& d) { return d.st.siren; }, true },
+            { "lighthouse_network_error", "gauge", [](const Device& d) { return d.st.network_error; }, true },
+            { "lighthouse_poll_late", "gauge", [&](const Device& d) { return d.health(now, interval_us) == H_LATE; }, true },
+            { "lighthouse_confirm_count", "gauge", [](const Device& d) { return d.st.confirm; }, true },
+            { "lighthouse_last_poll_age_seconds", "gauge", [](const Device& d) { return d.st.last_poll_ms / 1000.0; }, true },
+            { "lighthouse_last_data_age_seconds", "gauge", [](const Device& d) { return d.st.last_data_ms / 1000.0; }, true },
+            { "lighthouse_uptime_seconds", "gauge", [](const Device& d) { return (double)d.st.uptime_s; }, true },
+            { "lighthouse_scrape_duration_seconds", "gauge", [](const Device& d) { return d.scrape_us / 1e6; }, false },
+            { "lighthouse_scrape_errors_total", "counter", [](const Device& d) { return (double)d.errors; }, false },
+        };
+        char num[32];
+        for (const Metric& m : metrics) {
+            out += "# TYPE ";
+            out += m.name;
+            out += ' ';
+            out += m.type;
+            out += '\n';
+            for (const Device& d : devices) {
+                if (m.need && !d.have) continue;
+                snprintf(num, sizeof(num), "%g", m.get(d));
+                out += m.name;
+                out += "{device=\"" + d.name + "\",id=\"" + (d.have ? d.st.id : "") + "\"} ";
+                out += num;
+                out += '\n';
+            }
+        }
+        out += "# TYPE lighthouse_collector_scrapes_total counter\nlighthouse_collector_scrapes_total " +
+               std::to_string(stats_.ok + stats_.errors) + "\n";
+        out += "# TYPE lighthouse_collector_scrape_errors_total counter\nlighthouse_collector_scrape_errors_total " +
+               std::to_string(stats_.errors) + "\n";
+        out += "# TYPE lighthouse_collector_behind_total counter\nlighthouse_collector_behind_total " +
+               std::to_string(stats_.skipped) + "\n";
+        out += "# TYPE lighthouse_collector_inflight gauge\nlighthouse_collector_inflight " +
+               std::to_string(concurrency - free_.size()) + "\n";
+        return out;
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<int> free_;
+    std::deque<std::pair<int, unsigned>> inflight_;   // (slot, gen) in start order
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> heap_;
+    std::unordered_map<int, Client> clients_;
+    int ep_ = -1, sig_fd_ = -1, listen_fd_ = -1;
+    bool stop_ = false;
+    uint64_t started_us_ = 0, next_report_us_ = 0, last_report_us_ = 0;
+    unsigned long last_done_ = 0;
+    struct {
+        unsigned long ok = 0, errors = 0, skipped = 0;
+        std::vector<uint32_t> lat_us;
+    } stats_;
+};
+
+// "host", "host:port", "[v6]:port" -> a resolved device (port 80 by default).
+static bool addDevice(Collector& c, const std::string& spec) {
+    std::string host = spec, port = "80";
+    size_t colon = spec.rfind(':');
+    if (spec[0] == '[') {
+        size_t close = spec.find(']');
+        host = spec.substr(1, close - 1);
+        if (close + 1 < spec.size() && spec[close + 1] == ':') port = spec.substr(close + 2);
+    } else if (colon != std::string::npos && spec.find(':') == colon) {
+        host = spec.substr(0, colon);
+        port = spec.substr(colon + 1);
+    }
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (rc != 0) { fprintf(stderr, "%s: %s\n", spec.c_str(), gai_strerror(rc)); return false; }
+    Device d;
+    d.name = spec;
+    memcpy(&d.addr, res->ai_addr, res->ai_addrlen);
+    d.addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    c.devices.push_back(d);
+    return true;
+}
+
+static int usage() {
+    fprintf(stderr, "usage: lighthouse-collector (--targets FILE | --range HOST:P1-P2)... [--user U] [--password P]\n"
+                    "       [--interval-ms N] [--timeout-ms N] [--concurrency N] [--listen PORT]\n"
+                    "       [--report S] [--duration S]\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    Collector c;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (i + 1 >= argc) return usage();
+        std::string v = argv[++i];
+        if (a == "--targets") {
+            std::ifstream in(v);
+            if (!in) { fprintf(stderr, "%s: %s\n", v.c_str(), strerror(errno)); return 1; }
+            std::string line;
+            while (std::getline(in, line)) {
+                line = line.substr(0, line.find('#'));
+                line.erase(0, line.find_first_not_of(" \t\r"));
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+                if (!line.empty() && !addDevice(c, line)) return 1;
+            }
+        } else if (a == "--range") {
+            size_t colon = v.rfind(':'), dash = v.rfind('-');
+            if (colon == std::string::npos || dash == std::string::npos || dash < colon) return usage();
+            int p1 = atoi(v.c_str() + colon + 1), p2 = atoi(v.c_str() + dash + 1);
+            for (int p = p1; p <= p2; p++)
+                if (!addDevice(c, v.substr(0, colon) + ":" + std::to_string(p))) return 1;
+        }
+        else if (a == "--user") c.user = v;
+        else if (a == "--password") c.password = v;
+        else if (a == "--interval-ms") c.interval_us = strtoull(v.c_str(), nullptr, 10) * 1000;
+        else if (a == "--timeout-ms") c.timeout_us = strtoull(v.c_str(), nullptr, 10) * 1000;
+        else if (a == "--concurrency") c.concurrency = std::max(1, atoi(v.c_str()));
+        else if (a == "--listen") c.listen_port = atoi(v.c_str());
+        else if (a == "--report") c.report_s = (unsigned)atoi(v.c_str());
+        else if (a == "--duration") c.duration_s = (unsigned)atoi(v.c_str());
+        else return usage();
+    }
+    if (c.devices.empty() || c.interval_us == 0) return usage();
+    return c.run();
+}
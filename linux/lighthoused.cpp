@@ -0,0 +1,414 @@
+// lighthoused.cpp — icinga-lighthouse as a Linux daemon.
+//
+// Runs the same alarm core as the firmware (lighthouse_core.h: confirmation,
+// siren state machine, business-hours schedule, icingadb-web JSON detection)
+// on any small Linux box, with the relay board on a GPIO character device.
+//
+// One thread, one epoll set: a signalfd (TERM/INT stop, HUP reloads), an
+// inotify watch on the config file's directory (reload after an edit or a
+// --set), and the socket of the poll in flight. The epoll_wait timeout is the
+// next thing that is due - the next poll, the end of a siren pulse, the HTTP
+// deadline, the data timeout, the systemd watchdog ping - so between those the
+// process sleeps in the kernel and costs no CPU. Nothing spins.
+//
+//   lighthoused [--config FILE]          run (default /etc/icinga-lighthouse.conf)
+//   lighthoused --check [--config FILE]  print the effective settings, exit
+//   lighthoused --set key=value [...]    change a setting in the file, exit
+#include <limits.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "lighthouse_core.h"
+#include "LinuxConfig.h"
+#include "LinuxGpio.h"
+#include "LinuxHttp.h"
+#include "SdNotify.h"
+
+static const char* DEFAULT_CONFIG = "/etc/icinga-lighthouse.conf";
+
+// journald reads "<N>" syslog priorities off stderr; by hand, plain lines.
+static bool under_journal = getenv("JOURNAL_STREAM") != nullptr;
+
+static void logMsg(int prio, const char* fmt, ...) {
+    char msg[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    if (under_journal) fprintf(stderr, "<%d>%s\n", prio, msg);
+    else fprintf(stderr, "%s\n", msg);
+}
+
+static unsigned long nowMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+// Signed distance to a millis-style deadline (wrap-safe, like the firmware).
+static long until(unsigned long deadline, unsigned long now) { return (long)(deadline - now); }
+
+class Daemon {
+public:
+    explicit Daemon(const std::string& path) : path_(path) {}
+
+    int run() {
+        std::string err;
+        if (!cfg_.load(path_, err) || !applyHardware(cfg_, err)) {
+            logMsg(LOG_ERR, "%s", err.c_str());
+            return 1;
+        }
+        if (!setupLoop(err)) {
+            logMsg(LOG_ERR, "%s", err.c_str());
+            return 1;
+        }
+        logMsg(LOG_INFO, "icinga-lighthouse daemon: config %s, relays on %s line %u%s", path_.c_str(),
+             cfg_.gpio_chip.c_str(), cfg_.siren_line, cfg_.active_low ? " (active low)" : "");
+
+        unsigned long now = nowMs();
+        last_data_ = now;
+        next_poll_ = now;                   // first poll right away
+        next_ping_ = now;
+        sd_.ready();
+
+        while (!stop_) {
+            now = nowMs();
+            tick(now);
+            int timeout = nextTimeout(nowMs());
+            epoll_event ev[8];
+            int n = epoll_wait(ep_, ev, 8, timeout);
+            if (n < 0 && errno != EINTR) { logMsg(LOG_ERR, "epoll_wait: %s", strerror(errno)); break; }
+            for (int i = 0; i < n; i++) {
+                switch (ev[i].data.u32) {
+                    case TAG_SIGNAL:  onSignal(); break;
+                    case TAG_INOTIFY: onInotify(); break;
+                    case TAG_HTTP:    onHttp(); break;
+                }
+            }
+        }
+
+        sd_.stopping();
+        gpio_.set(0, false);                // never leave the siren on
+        gpio_.release();
+        logMsg(LOG_INFO, "stopped");
+        return 0;
+    }
+
+private:
+    enum { TAG_SIGNAL = 1, TAG_INOTIFY, TAG_HTTP };
+    enum Phase { PHASE_IDLE, PHASE_SERVICES, PHASE_HOSTS };
+
+    bool setupLoop(std::string& err) {
+        ep_ = epoll_create1(EPOLL_CLOEXEC);
+        if (ep_ < 0) { err = std::string("epoll_create1: ") + strerror(errno); return false; }
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGHUP);
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+        signal(SIGPIPE, SIG_IGN);           // a TLS write to a closed peer
+        sig_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (sig_fd_ < 0 || !watch(sig_fd_, EPOLLIN, TAG_SIGNAL)) {
+            err = std::string("signalfd: ") + strerror(errno);
+            return false;
+        }
+
+        // Watch the directory, not the file: editors and --set replace the
+        // file by rename, which a watch on the old inode would miss.
+        size_t slash = path_.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path_.substr(0, slash));
+        base_ = slash == std::string::npos ? path_ : path_.substr(slash + 1);
+        in_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (in_fd_ >= 0 && inotify_add_watch(in_fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0)
+            watch(in_fd_, EPOLLIN, TAG_INOTIFY);
+        else
+            logMsg(LOG_WARNING, "inotify on %s: %s (reload with SIGHUP)", dir.c_str(), strerror(errno));
+        return true;
+    }
+
+    bool watch(int fd, uint32_t events, uint32_t tag, int op = EPOLL_CTL_ADD) {
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.u32 = tag;
+        return epoll_ctl(ep_, op, fd, &ev) == 0;
+    }
+
+    // GPIO and TLS for `c`; on reload only redone when their settings change.
+    bool applyHardware(const DaemonConfig& c, std::string& err) {
+        bool first = !hw_applied_;
+        if (first || c.gpio_chip != cfg_.gpio_chip || c.relayLines() != cfg_.relayLines() ||
+            c.active_low != cfg_.active_low) {
+            gpio_.set(0, false);
+            gpio_.release();
+            if (!gpio_.open(c.gpio_chip, c.relayLines(), c.active_low, err)) return false;
+            siren_on_ = false;
+        }
+#if LH_TLS
+        if (first || c.tls_verify != cfg_.tls_verify || c.tls_ca != cfg_.tls_ca) {
+            if (!tls_.init(c.tls_verify, c.tls_ca, err)) return false;
+        }
+#endif
+        hw_applied_ = true;
+        return true;
+    }
+
+    // SIGHUP / config file change: load into a copy and switch only if it is
+    // valid, so a half-edited file never takes the daemon down.
+    void reload(const char* why) {
+        sd_.reloading();
+        DaemonConfig next;
+        std::string err;
+        if (!next.load(path_, err)) {
+            logMsg(LOG_ERR, "reload (%s) rejected, keeping the running config: %s", why, err.c_str());
+        } else if (!applyHardware(next, err)) {
+            logMsg(LOG_ERR, "reload (%s) rejected, keeping the running config: %s", why, err.c_str());
+            hw_applied_ = false;            // the old lines may be released: redo them
+            if (!applyHardware(cfg_, err)) logMsg(LOG_ERR, "%s", err.c_str());
+        } else {
+            cfg_ = next;
+            logMsg(LOG_NOTICE, "config reloaded (%s)", why);
+        }
+        // Reopened lines start off; put the siren back if a pulse is running.
+        siren_on_ = gpio_.get(0);
+        bool pulse = machine_.state() == lh::STATE_INITIAL_ALARM || machine_.state() == lh::STATE_REMINDER_ALARM;
+        setSiren(pulse && !network_error_);
+        sd_.ready();
+    }
+
+    void onSignal() {
+        signalfd_siginfo si;
+        while (read(sig_fd_, &si, sizeof(si)) == sizeof(si)) {
+            if (si.ssi_signo == SIGHUP) reload("SIGHUP");
+            else stop_ = true;
+        }
+    }
+
+    void onInotify() {
+        alignas(inotify_event) char buf[4096];
+        bool ours = false;
+        ssize_t n;
+        while ((n = read(in_fd_, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + n;) {
+                inotify_event* e = reinterpret_cast<inotify_event*>(p);
+                if (e->len && base_ == e->name) ours = true;
+                p += sizeof(inotify_event) + e->len;
+            }
+        }
+        if (ours) reload("file changed");
+    }
+
+    // --- Polling (service query first, hosts only if no service problem) ---
+
+    void startPoll(unsigned long now) {
+        poll_started_ = now;
+        problem_ = false;
+        startRequest(PHASE_SERVICES, cfg_.url_svc, now);
+    }
+
+    void startRequest(Phase phase, const std::string& url, unsigned long now) {
+        phase_ = phase;
+        http_deadline_ = now + cfg_.http_timeout_ms;
+        if (!http_.start(url, cfg_.user, cfg_.password, &tls_)) { requestDone(now); return; }
+        watch(http_.fd(), http_.events(), TAG_HTTP);
+    }
+
+    void onHttp() {
+        http_.onEvent();
+        if (http_.busy()) watch(http_.fd(), http_.events(), TAG_HTTP, EPOLL_CTL_MOD);
+        else requestDone(nowMs());          // the socket is closed, epoll dropped it
+    }
+
+    void requestDone(unsigned long now) {
+        const char* type = phase_ == PHASE_SERVICES ? "Service" : "Host";
+        std::string status;
+        bool found = false;
+        if (http_.state() == HttpGet::DONE && http_.status() == 200) {
+            last_data_ = now;
+            if (network_error_) logMsg(LOG_NOTICE, "Icinga reachable again");
+            network_error_ = false;
+            status = "OK";
+            lh::Problem p;
+            lh::ParseResult r = lh::parseProblemJson(http_.body(), phase_ == PHASE_SERVICES, p);
+            if (r == lh::PARSE_ERROR) status = std::string("JSON err (") + type + ")";
+            if (r == lh::PARSE_PROBLEM) {
+                found = true;
+                std::string label = std::string(type) + ": " + p.label;
+                if (label != problem_label_) logMsg(LOG_WARNING, "problem: %s", label.c_str());
+                problem_label_ = label;
+            }
+        } else if (http_.state() == HttpGet::DONE) {
+            status = "HTTP " + std::to_string(http_.status()) + " (" + type + ")";
+        } else {
+            status = http_.error() + " (" + type + ")";
+        }
+        if (status != conn_status_ && status != "OK") logMsg(LOG_WARNING, "poll: %s", status.c_str());
+        conn_status_ = status;
+        http_.reset();
+
+        if (found) problem_ = true;
+        if (phase_ == PHASE_SERVICES && !found && !cfg_.url_host.empty()) {
+            startRequest(PHASE_HOSTS, cfg_.url_host, now);
+            return;
+        }
+        phase_ = PHASE_IDLE;
+
+        if (!problem_ && !problem_label_.empty()) {
+            logMsg(LOG_NOTICE, "cleared: %s", problem_label_.c_str());
+            problem_label_.clear();
+        }
+        bool was = alarm_;
+        alarm_ = confirm_.update(problem_, cfg_.confirm);
+        if (alarm_ != was) logMsg(alarm_ ? LOG_WARNING : LOG_NOTICE, "alarm %s (confirm %d/%d)",
+                                alarm_ ? "ARMED" : "cleared", confirm_.count, cfg_.confirm);
+        next_poll_ = poll_started_ + lh::pollInterval(cfg_.core(), confirm_);
+    }
+
+    // --- Time ---------------------------------------------------------------
+
+    // The system clock, as the core's wall clock. With tz_offset = system it is
+    // already local (the core adds no offset); otherwise UTC + the fixed offset.
+    lh::WallClock wallClock() const {
+        lh::WallClock c;
+        time_t t = time(nullptr);
+        struct tm tm;
+        if (!(cfg_.tz_system ? localtime_r(&t, &tm) : gmtime_r(&t, &tm))) return c;
+        c.valid = true;
+        c.wday = tm.tm_wday;
+        c.hour = tm.tm_hour;
+        c.min = tm.tm_min;
+        return c;
+    }
+
+    // Everything that is due at `now`: poll start, HTTP deadline, data
+    // timeout, the siren, the watchdog, and the status line.
+    void tick(unsigned long now) {
+        if (phase_ == PHASE_IDLE && until(next_poll_, now) <= 0) startPoll(now);
+        if (http_.busy() && until(http_deadline_, now) <= 0) {
+            http_.fail("timeout");          // closes the socket (and its epoll entry)
+            requestDone(now);
+        }
+
+        // Soft watchdog, as on the device: no good reply for too long.
+        if (!network_error_ && now - last_data_ > cfg_.data_timeout_ms) {
+            network_error_ = true;
+            alarm_ = false;
+            logMsg(LOG_ERR, "data timeout: no reply from Icinga for %lus", cfg_.data_timeout_ms / 1000);
+        }
+
+        lh::Config core = cfg_.core();
+        lh::RelayCommand cmd = machine_.step(core, now, alarm_, network_error_,
+                                             lh::alertsAllowed(core.schedule, wallClock()));
+        if (cmd.changed()) logMsg(LOG_INFO, "state %s -> %s", lh::stateName(cmd.from), lh::stateName(cmd.to));
+        if (cmd.siren != lh::SIREN_KEEP) setSiren(cmd.siren == lh::SIREN_ON);
+
+        if (sd_.watchdogMs() && until(next_ping_, now) <= 0) {
+            sd_.watchdog();
+            next_ping_ = now + sd_.watchdogMs();
+        }
+        sd_.status(statusLine());
+    }
+
+    void setSiren(bool on) {
+        if (on == siren_on_) return;        // only touch the line on a change
+        siren_on_ = on;
+        if (!gpio_.set(0, on)) logMsg(LOG_ERR, "GPIO line %u: %s", cfg_.siren_line, strerror(errno));
+        logMsg(LOG_NOTICE, "siren %s", on ? "ON" : "off");
+    }
+
+    std::string statusLine() const {
+        if (network_error_) return "network error: " + conn_status_;
+        if (alarm_) return "ALARM " + problem_label_ + " [" + lh::stateName(machine_.state()) + "]";
+        if (confirm_.count) return "confirming " + problem_label_ + " (" + std::to_string(confirm_.count) +
+                                   "/" + std::to_string(cfg_.confirm) + ")";
+        return "OK, no unhandled problems";
+    }
+
+    // Milliseconds until the earliest pending deadline (-1: none).
+    int nextTimeout(unsigned long now) const {
+        long t = LONG_MAX;
+        auto at = [&](unsigned long deadline) { long d = until(deadline, now); if (d < t) t = d; };
+        if (phase_ == PHASE_IDLE) at(next_poll_);
+        if (http_.busy()) at(http_deadline_);
+        if (!network_error_) at(last_data_ + cfg_.data_timeout_ms + 1);
+        if (machine_.state() != lh::STATE_IDLE) at(machine_.deadline(cfg_.core()));
+        if (sd_.watchdogMs()) at(next_ping_);
+        // An armed alarm held back by the schedule: look again each minute.
+        if (alarm_ && cfg_.schedule && machine_.state() == lh::STATE_IDLE) {
+            time_t s = time(nullptr);
+            at(now + (60 - s % 60) * 1000);
+        }
+        if (t == LONG_MAX) return -1;
+        return t < 0 ? 0 : (t > INT_MAX ? INT_MAX : (int)t);
+    }
+
+    std::string path_, base_;
+    DaemonConfig cfg_;
+    GpioOutputs gpio_;
+    TlsContext tls_;
+    HttpGet http_;
+    SdNotify sd_;
+    bool hw_applied_ = false;
+    int ep_ = -1, sig_fd_ = -1, in_fd_ = -1;
+    bool stop_ = false;
+
+    Phase phase_ = PHASE_IDLE;
+    unsigned long poll_started_ = 0, next_poll_ = 0, http_deadline_ = 0;
+    unsigned long last_data_ = 0, next_ping_ = 0;
+    bool problem_ = false;
+    std::string problem_label_, conn_status_;
+
+    lh::Confirmation confirm_;
+    lh::AlarmMachine machine_;
+    bool alarm_ = false;
+    bool network_error_ = false;
+    bool siren_on_ = false;
+};
+
+static int usage() {
+    fprintf(stderr, "usage: lighthoused [--config FILE] [--check | --set key=value ...]\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    std::string path = DEFAULT_CONFIG;
+    bool check = false;
+    std::vector<std::string> sets;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--config" && i + 1 < argc) path = argv[++i];
+        else if (a == "--check") check = true;
+        else if (a == "--set" && i + 1 < argc) sets.push_back(argv[++i]);
+        else return usage();
+    }
+
+    if (check || !sets.empty()) {
+        DaemonConfig cfg;
+        std::string err;
+        if (!cfg.load(path, err)) { fprintf(stderr, "%s\n", err.c_str()); return 1; }
+        for (const auto& kv : sets) {
+            if (!cfg.update(path, kv, err)) { fprintf(stderr, "%s\n", err.c_str()); return 1; }
+        }
+        if (check) {
+            for (const auto& k : DaemonConfig::keys()) {
+                std::string v = k == "password" ? "********" : cfg.get(k);
+                printf("%s =%s%s\n", k.c_str(), v.empty() ? "" : " ", v.c_str());
+            }
+        }
+        return 0;
+    }
+
+    Daemon d(path);
+    return d.run();
+}
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# ota-delta.py — make a delta image for the panel's firmware update, so a
+#                device downloads only what changed between two builds.
+#
+#   ./ota-delta.py OLD.bin NEW.bin -o update.lhd     # OLD = what the device runs
+#   ./ota-delta.py --apply OLD.bin update.lhd -o out.bin   # rebuild, as the device would
+#
+# Upload it like a full image (the hash is optional, the delta carries it):
+#   curl -u admin:PASS -F image=@update.lhd http://DEVICE/update
+#
+# The format (LHD1) is described in lighthouse_core.h, which applies it on the
+# device. A delta only applies to the exact image it was made from: the device
+# checks the SHA-256 of its running slot against the one in the header.
+#
+# Matching: the old image is indexed every STRIDE bytes by BLOCK-byte keys, the
+# new one is scanned byte by byte; a hit is extended both ways and becomes a
+# copy when it is at least MIN_COPY bytes long, everything else a literal.
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = b"LHD1"
+BLOCK = 16
+STRIDE = 4
+MIN_COPY = 24        # a copy op costs 9 bytes, a literal run 5 + its bytes
+MAX_CANDIDATES = 8   # positions kept per key (padding repeats a lot)
+
+
+def match_len(a, i, b, j):
+    n = 0
+    limit = min(len(a) - i, len(b) - j)
+    while n + 64 <= limit and a[i + n:i + n + 64] == b[j + n:j + n + 64]:
+        n += 64
+    while n < limit and a[i + n] == b[j + n]:
+        n += 1
+    return n
+
+
+def make_delta(old, new):
+    index = {}
+    for i in range(0, len(old) - BLOCK + 1, STRIDE):
+        spots = index.setdefault(old[i:i + BLOCK], [])
+        if len(spots) < MAX_CANDIDATES:
+            spots.append(i)
+
+    ops = bytearray()
+    lit = 0            # start of the pending literal run
+    t = 0
+    copied = 0
+
+    def literal(end):
+        if end > lit:
+            ops.extend(b"D" + struct.pack("<I", end - lit) + new[lit:end])
+
+    while t + BLOCK <= len(new):
+        spots = index.get(new[t:t + BLOCK])
+        best = None
+        for o in spots or ():
+            n = match_len(old, o, new, t)
+            back = 0
+            while back < t - lit and back < o and old[o - back - 1] == new[t - back - 1]:
+                back += 1
+            if best is None or n + back > best[2]:
+                best = (o - back, t - back, n + back)
+        if best is None or best[2] < MIN_COPY:
+            t += 1
+            continue
+        o, start, n = best
+        literal(start)
+        ops.extend(b"C" + struct.pack("<II", o, n))
+        copied += n
+        t = lit = start + n
+    literal(len(new))
+
+    header = MAGIC + struct.pack("<II", len(old), len(new)) + \
+        hashlib.sha256(old).digest() + hashlib.sha256(new).digest()
+    return header + bytes(ops), copied
+
+
+def apply_delta(old, delta):
+    if delta[:4] != MAGIC:
+        raise ValueError("not a delta")
+    base_size, target_size = struct.unpack_from("<II", delta, 4)
+    base_sha, target_sha = delta[12:44], delta[44:76]
+    if base_size > len(old) or hashlib.sha256(old[:base_size]).digest() != base_sha:
+        raise ValueError("delta is for another image")
+    out = bytearray()
+    p = 76
+    while len(out) < target_size:
+        op = delta[p:p + 1]
+        if op == b"C":
+            o, n = struct.unpack_from("<II", delta, p + 1)
+            if o + n > base_size:
+                raise ValueError("copy out of range")
+            out += old[o:o + n]
+            p += 9
+        elif op == b"D":
+            (n,) = struct.unpack_from("<I", delta, p + 1)
+            out += delta[p + 5:p + 5 + n]
+            p += 5 + n
+        else:
+            raise ValueError("bad op at %d" % p)
+    if len(out) != target_size or p != len(delta):
+        raise ValueError("size mismatch")
+    if hashlib.sha256(out).digest() != target_sha:
+        raise ValueError("sha256 mismatch")
+    return bytes(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Make (or check) an OTA delta image.")
+    ap.add_argument("--apply", action="store_true", help="rebuild NEW from OLD + a delta")
+    ap.add_argument("old", help="image the device runs now")
+    ap.add_argument("new", help="image to install (with --apply: the delta)")
+    ap.add_argument("-o", "--output", required=True)
+    args = ap.parse_args()
+
+    old = open(args.old, "rb").read()
+    new = open(args.new, "rb").read()
+    if args.apply:
+        try:
+            out = apply_delta(old, new)
+        except ValueError as e:
+            sys.exit("ota-delta: %s" % e)
+        open(args.output, "wb").write(out)
+        print("%s: %d bytes, sha256 %s" % (args.output, len(out), hashlib.sha256(out).hexdigest()))
+        return
+
+    delta, copied = make_delta(old, new)
+    apply_delta(old, delta)          # never ship a delta that doesn't rebuild NEW
+    open(args.output, "wb").write(delta)
+    print("%s: %d bytes for a %d-byte image (%.1f%%), %d bytes copied from the old one" %
+          (args.output, len(delta), len(new), 100.0 * len(delta) / max(len(new), 1), copied))
+    print("target sha256 %s" % hashlib.sha256(new).hexdigest())
+
+
+if __name__ == "__main__":
+    main()
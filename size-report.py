@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+#
+# size-report.py — per-subsystem flash / IRAM / DRAM breakdown of a firmware
+#                  build, from the linker map, checked against budgets.
+#
+# build.sh runs it after every plain build. By hand:
+#   ./size-report.py .build/.pio/build/full/firmware.map
+#   ./size-report.py --profile minimal-wifi --budgets size-budgets.conf MAP
+#   ./size-report.py --detail tls MAP        # largest objects of one subsystem
+#   ./size-report.py --suggest 10 MAP        # budget rows: this build + 10%
+#
+# Each input section of the map is charged to a subsystem by the archive /
+# object it came from (RULES below), and to memory by the output section it
+# landed in: .flash.* -> flash, .iram0.* -> IRAM (+ flash, it's loaded from
+# the image), .dram0.data -> DRAM (+ flash), .dram0.bss / .noinit -> DRAM only.
+# Exit status 1 if any budget is exceeded (SIZE_BUDGET=warn: report only).
+#
+# test-env/size/esp32-excerpt.map is a short map in the ESP-IDF 4.4 layout
+# (wrapped section names, *fill*, COMMON, debug sections); the .report next
+# to it is what this script prints for it with --budgets /dev/null.
+import argparse
+import math
+import os
+import re
+import sys
+from collections import defaultdict
+
+# (subsystem, regex on the object path) — first match wins.
+RULES = [
+    ("app",       r"/src/[^/]*\.o$"),   # the sketch (+ lighthouse_core.h, ArduinoJson)
+    ("ethernet",  r"libEthernet\.a|/Ethernet/|libSPI\.a|/SPI/"),
+    ("mqtt",      r"libPubSubClient\.a|/PubSubClient/"),
+    ("tls",       r"libWiFiClientSecure\.a|/WiFiClientSecure/|libesp-tls\.a"),
+    ("mbedtls",   r"libmbed(tls|x509|crypto)"),
+    ("web",       r"libWebServer\.a|/WebServer/"),
+    ("ota",       r"libUpdate\.a|/Update/|libapp_update\.a"),
+    ("wifi",      r"libWiFi\.a|/WiFi/|libesp_wifi\.a|libnet80211\.a|libpp\.a|"
+                  r"libwpa_supplicant\.a|libcore\.a|libphy\.a|libmesh\.a|libespnow\.a|"
+                  r"libsmartconfig\.a|libwapi\.a|libcoexist\.a"),
+    ("lwip",      r"liblwip\.a|libesp_netif\.a|libtcpip_adapter\.a|libdhcpserver\.a"),
+    ("nvs",       r"libPreferences\.a|/Preferences/|libnvs_flash\.a"),
+    ("bluetooth", r"libbt\.a|libbtdm_app\.a"),
+    ("arduino",   r"libFrameworkArduino\.a|/FrameworkArduino/"),
+    ("freertos",  r"libfreertos\.a"),
+    ("libc",      r"lib(c|m|g|gcc|stdc\+\+|newlib|c_nano|nosys)\.a"),
+]
+RULES = [(name, re.compile(rx)) for name, rx in RULES]
+OTHER = "esp-idf"
+
+MEMS = ("flash", "iram", "dram")
+
+# Output section -> memories it occupies.
+def memories(out_section):
+    s = out_section
+    if s.startswith(".iram0"):
+        return ("iram", "flash")
+    if s.startswith(".dram0.bss") or s.startswith(".dram0.noinit") or s == ".noinit":
+        return ("dram",)
+    if s.startswith(".dram0"):
+        return ("dram", "flash")
+    if s.startswith(".flash") or (s.startswith(".rtc") and "bss" not in s):
+        return ("flash",)
+    return ()
+
+
+def classify(path):
+    p = path.replace("\\", "/")
+    for name, rx in RULES:
+        if rx.search(p):
+            return name
+    return OTHER
+
+
+OUT_RE = re.compile(r"^(\.\S+)(?:\s+0x[0-9a-fA-F]+\s+0x[0-9a-fA-F]+.*)?$")
+IN_RE = re.compile(r"^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+IN_CONT_RE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+IN_NAME_RE = re.compile(r"^ (\S+)$")
+
+
+def parse_map(path):
+    """{subsystem: {mem: bytes}}, {(subsystem, object): {mem: bytes}}"""
+    by_sub = defaultdict(lambda: defaultdict(int))
+    by_obj = defaultdict(lambda: defaultdict(int))
+    in_memory_map = False
+    out_mems = ()
+    pending = None  # input section name whose address/size is on the next line
+
+    def charge(name, size, obj):
+        if size == 0 or not out_mems or name == "*fill*":
+            return
+        sub = classify(obj)
+        for m in out_mems:
+            by_sub[sub][m] += size
+            by_obj[(sub, obj)][m] += size
+
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if not in_memory_map:
+                in_memory_map = line.startswith("Linker script and memory map")
+                continue
+            if not line.strip():
+                continue
+            if pending is not None:
+                m = IN_CONT_RE.match(line)
+                if m:
+                    charge(pending, int(m.group(2), 16), m.group(3).strip())
+                    pending = None
+                    continue
+                pending = None
+            if not line[0].isspace():
+                m = OUT_RE.match(line)
+                out_mems = memories(m.group(1)) if m else ()
+                continue
+            m = IN_RE.match(line)
+            if m:
+                charge(m.group(1), int(m.group(3), 16), m.group(4).strip())
+                continue
+            m = IN_NAME_RE.match(line)
+            if m and not m.group(1).startswith("0x"):
+                pending = m.group(1)
+    if not in_memory_map:
+        sys.exit("size-report: %s has no memory map section" % path)
+    return by_sub, by_obj
+
+
+def load_budgets(path, profile):
+    """Budgets in KiB: {subsystem: {mem: kib}} for '*' then [profile]."""
+    budgets = defaultdict(dict)
+    if not path or not os.path.exists(path):
+        return budgets
+    section = "*"
+    with open(path) as f:
+        for n, raw in enumerate(f, 1):
+            line = raw.split("#", 1)[0].strip()
+            if not line:
+                continue
+            if line.startswith("[") and line.endswith("]"):
+                section = line[1:-1].strip()
+                continue
+            if section not in ("*", profile):
+                continue
+            cols = line.split()
+            if len(cols) != 4:
+                sys.exit("size-report: %s:%d: expected 'subsystem flash iram dram'" % (path, n))
+            for mem, v in zip(MEMS, cols[1:]):
+                if v != "-":
+                    budgets[cols[0]][mem] = float(v)
+    return budgets
+
+
+def suggest(by_sub, total, headroom):
+    """size-budgets.conf rows for this build: each size + headroom %, whole KiB up."""
+    rows = sorted(by_sub.items(), key=lambda kv: -kv[1]["flash"]) + [("total", total)]
+    for name, sizes in rows:
+        cols = [("%d" % math.ceil(sizes.get(m, 0) * (1 + headroom / 100.0) / 1024.0))
+                if sizes.get(m, 0) else "-" for m in MEMS]
+        print("%-10s %5s %5s %5s" % (name, cols[0], cols[1], cols[2]))
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("map")
+    ap.add_argument("--profile", default="full")
+    ap.add_argument("--budgets", default=os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                                      "size-budgets.conf"))
+    ap.add_argument("--detail", metavar="SUBSYSTEM", help="also list its largest objects")
+    ap.add_argument("--suggest", type=float, metavar="PCT",
+                    help="only print budget rows for this build, PCT%% above its sizes")
+    args = ap.parse_args()
+
+    by_sub, by_obj = parse_map(args.map)
+    budgets = load_budgets(args.budgets, args.profile)
+    total = defaultdict(int)
+    for sizes in by_sub.values():
+        for m in MEMS:
+            total[m] += sizes[m]
+
+    if args.suggest is not None:
+        print("# %s (profile %s), +%g%%" % (args.map, args.profile, args.suggest))
+        suggest(by_sub, total, args.suggest)
+        return 0
+
+    over = []
+
+    def cell(name, sizes, mem):
+        kib = sizes.get(mem, 0) / 1024.0
+        b = budgets.get(name, {}).get(mem)
+        if b is None:
+            return "%9.1f" % kib + " " * 13
+        flag = "OVER" if kib > b else "ok"
+        if kib > b:
+            over.append("%s %s %.1f > %.1f KiB" % (name, mem, kib, b))
+        return "%9.1f /%6.0f %-4s" % (kib, b, flag)
+
+    print(">> Size by subsystem, KiB (profile %s, budget file %s)"
+          % (args.profile, os.path.basename(args.budgets) if budgets else "none"))
+    print("   %-10s %9s%13s %9s%13s %9s" % ("", "flash", "", "IRAM", "", "DRAM"))
+    rows = sorted(by_sub.items(), key=lambda kv: -kv[1]["flash"])
+    names = [n for n, _ in rows] + [n for n in budgets if n not in by_sub and n != "total"]
+    for name, sizes in [(n, by_sub.get(n, {})) for n in names] + [("total", total)]:
+        row = "   %-10s %s %s %s" % (name, cell(name, sizes, "flash"), cell(name, sizes, "iram"),
+                                    cell(name, sizes, "dram"))
+        print(row.rstrip())
+
+    if args.detail:
+        objs = [(o, s) for (sub, o), s in by_obj.items() if sub == args.detail]
+        objs.sort(key=lambda kv: -(kv[1]["flash"] + kv[1]["dram"]))
+        print(">> Largest objects in %s:" % args.detail)
+        for o, s in objs[:20]:
+            print("   %8.1f %8.1f %8.1f  %s" % (s["flash"] / 1024.0, s["iram"] / 1024.0,
+                                               s["dram"] / 1024.0, o))
+
+    if over:
+        print(">> Over budget: " + "; ".join(over), file=sys.stderr)
+        if os.environ.get("SIZE_BUDGET", "") != "warn":
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,94 @@
+// Shared by the benchmark binaries (bench.cpp: the whole sketch, corebench.cpp:
+// lighthouse_core.h alone): allocation accounting, the timing harness and the
+// representative payloads, so both report comparable JSON lines.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+// --- allocation accounting (global operator new replacement) ---------------
+static std::atomic<unsigned long> g_allocs{0};
+static std::atomic<unsigned long> g_alloc_bytes{0};
+
+// The replacement pair is malloc/free underneath, which is fine: every
+// operator delete in the program is this one. GCC 11+ can't see that once
+// both are inlined into a caller and reports the free() as mismatched, so
+// the warning is off for these definitions (it is issued at their lines).
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(size_t n) {
+    g_allocs++;
+    g_alloc_bytes += n;
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+// Representative icingadb-web replies (limit=1): one unhandled critical
+// service with the usual field bloat, one down host, and the empty array.
+static const char* kServiceJson = R"JSON([{"checkcommand_name":"http","environment_id":"1c3b6a2e7d9f","host_id":"8f2a1c","id":"b7e4c2a9d1","name":"svc-crit","name_ci":"svc-crit","display_name":"HTTP frontend","icon_image_alt":"","notes":"","notes_url":null,"action_url":null,"active_checks_enabled":"y","passive_checks_enabled":"y","event_handler_enabled":"y","notifications_enabled":"y","flapping_enabled":"n","perfdata_enabled":"y","is_volatile":"n","check_interval":60,"check_retry_interval":30,"max_check_attempts":3,"check_timeout":null,"command_endpoint_name":null,"host":{"id":"8f2a1c","name":"web-01.example.net","display_name":"web-01","address":"10.0.4.21","address6":"","checkcommand_name":"hostalive","state":{"soft_state":0,"hard_state":0,"is_problem":"n","is_handled":"n","is_reachable":"y"}},"state":{"environment_id":"1c3b6a2e7d9f","state_type":"hard","soft_state":2,"hard_state":2,"previous_soft_state":0,"previous_hard_state":0,"attempt":3,"severity":2176,"output":"CRITICAL - Socket timeout after 10 seconds","long_output":"","performance_data":"time=10.003s;;;0.000000 size=0B;;;0","normalized_performance_data":"time=10.003s;;;0 size=0B;;;0","check_commandline":"'/usr/lib/nagios/plugins/check_http' '-H' '10.0.4.21' '-t' '10'","is_problem":"y","is_handled":"n","is_reachable":"y","is_flapping":"n","is_overdue":"n","is_acknowledged":"n","acknowledgement_comment_id":null,"last_comment_id":null,"in_downtime":"n","execution_time":10004,"latency":1,"check_source":"icinga2","scheduling_source":"icinga2","last_update":"2026-06-13T07:29:58+00:00","last_state_change":"2026-06-13T07:21:04+00:00","next_check":"2026-06-13T07:30:58+00:00","next_update":"2026-06-13T07:31:58+00:00"}}])JSON";
+
+static const char* kHostJson = R"JSON([{"checkcommand_name":"hostalive","environment_id":"1c3b6a2e7d9f","id":"9a7c1e","name":"db-02.example.net","name_ci":"db-02.example.net","display_name":"db-02","address":"10.0.4.32","address6":"","active_checks_enabled":"y","passive_checks_enabled":"y","check_interval":60,"check_retry_interval":30,"max_check_attempts":3,"state":{"state_type":"hard","soft_state":1,"hard_state":1,"attempt":3,"severity":2048,"output":"PING CRITICAL - Packet loss = 100%","performance_data":"rta=0.000ms;3000.000;5000.000;0 pl=100%;80;100;0","is_problem":"y","is_handled":"n","is_reachable":"y","is_flapping":"n","is_acknowledged":"n","in_downtime":"n","last_state_change":"2026-06-13T06:58:41+00:00","next_check":"2026-06-13T07:30:41+00:00"}}])JSON";
+
+// GET /api/v2/alerts of a Prometheus Alertmanager, one firing alert.
+static const char* kAlertmanagerJson = R"JSON([{"annotations":{"description":"node-3:9100 of job node has been down for more than 1 minute.","summary":"Instance node-3:9100 down"},"endsAt":"2026-06-13T07:34:00.000Z","fingerprint":"6f4b2c1d9e8a7b30","receivers":[{"name":"ops"}],"startsAt":"2026-06-13T07:21:00.000Z","status":{"inhibitedBy":[],"silencedBy":[],"state":"active"},"updatedAt":"2026-06-13T07:30:00.000Z","generatorURL":"http://prometheus:9090/graph?g0.expr=up+%3D%3D+0&g0.tab=1","labels":{"alertname":"InstanceDown","instance":"node-3:9100","job":"node","severity":"critical"}}])JSON";
+
+// POST /v1/objects/services of the Icinga 2 API with the icinga2 source's
+// attrs / joins (X-HTTP-Method-Override: GET), and /v1/objects/hosts.
+static const char* kIcinga2ServiceJson = R"JSON({"results":[{"attrs":{"display_name":"https-cert","last_state_change":1781334864.204,"next_check":1781335918.512,"state":2.0},"joins":{"host":{"display_name":"web-01"}},"meta":{},"name":"web-01.example.net!https-cert","type":"Service"}]})JSON";
+static const char* kIcinga2HostJson = R"JSON({"results":[{"attrs":{"display_name":"db-02","last_state_change":1781333921.5,"next_check":1781335841.07,"state":1.0},"joins":{},"meta":{},"name":"db-02.example.net","type":"Host"}]})JSON";
+
+static const char* kEmptyJson = "[]";
+
+// --- harness ---------------------------------------------------------------
+static unsigned long g_min_ms = 300;
+static std::vector<std::string> g_filters;
+static volatile unsigned long g_sink = 0;   // keeps results alive
+
+template <typename F>
+static void bench(const char* name, F fn) {
+    if (!g_filters.empty()) {
+        bool hit = false;
+        for (const auto& f : g_filters) if (strstr(name, f.c_str())) hit = true;
+        if (!hit) return;
+    }
+    using clk = std::chrono::steady_clock;
+    for (int i = 0; i < 100; i++) fn();   // warm-up
+
+    unsigned long iters = 0;
+    unsigned long a0 = g_allocs, b0 = g_alloc_bytes;
+    auto t0 = clk::now();
+    auto tEnd = t0 + std::chrono::milliseconds(g_min_ms);
+    unsigned long batch = 16;
+    clk::time_point t1;
+    do {
+        for (unsigned long i = 0; i < batch; i++) fn();
+        iters += batch;
+        if (batch < 65536) batch *= 2;
+        t1 = clk::now();
+    } while (t1 < tEnd);
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    double allocs = double(g_allocs - a0) / iters;
+    double bytes = double(g_alloc_bytes - b0) / iters;
+
+    printf("{\"bench\":\"%s\",\"commit\":\"%s\",\"iters\":%lu,\"ns_per_op\":%.1f,"
+           "\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}\n",
+           name, BENCH_COMMIT, iters, ns / iters, allocs, bytes);
+    fflush(stdout);
+}
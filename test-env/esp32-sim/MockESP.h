@@ -10,12 +10,24 @@
 #include <curl/curl.h>
 #include <functional>
 #include <mutex>
+#include <memory>
 #include <atomic>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <cctype>
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
 
 #include <httplib.h>
 
+#include "SimNet.h"
+#include "SimNvs.h"
+
 // Mock Arduino Types
 class ArduinoString; // Forward decl
 
@@ -27,15 +39,26 @@ public:
     ArduinoString(int i) : std::string(std::to_string(i)) {}
     ArduinoString(long i) : std::string(std::to_string(i)) {}
     ArduinoString(unsigned long i) : std::string(std::to_string(i)) {}
+    ArduinoString(double v, unsigned char decimals = 2) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        assign(buf);
+    }
     
     // Concatenation
     ArduinoString operator+(const char* rhs) { return ArduinoString(std::string(*this) + rhs); }
     ArduinoString operator+(const ArduinoString& rhs) { return ArduinoString(std::string(*this) + std::string(rhs)); }
     
     void trim() {
-         // simplistic trim
+        size_t a = find_first_not_of(" \t\r\n");
+        if (a == npos) { clear(); return; }
+        assign(substr(a, find_last_not_of(" \t\r\n") - a + 1));
+    }
+    int toInt() { return (int)strtol(c_str(), nullptr, 10); }   // atol(), like Arduino
+    int indexOf(char c, unsigned int from = 0) const {
+        size_t i = find(c, from);
+        return i == npos ? -1 : (int)i;
     }
-    int toInt() { return empty() ? 0 : std::stoi(*this); }
     bool startsWith(const char* p) const { return rfind(p, 0) == 0; }
     bool startsWith(const std::string& p) const { return rfind(p, 0) == 0; }
     // Arduino-style substring: [from, to) with to exclusive (vs std::substr len).
@@ -100,27 +123,324 @@ typedef unsigned char byte;
 #define HTTP_CODE_OK 200
 #define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
 
+// Boot -> first poll timing: the driver calls simBootBegin() right before
+// setup(); the sketch's first poll_start event then logs the elapsed time and
+// emits {"ev":"first_poll","ms":...}.
+struct SimBootMark {
+    unsigned long setup_ms = 0;
+    bool awaiting_poll = false;
+};
+
+// Fleet mode (fleet.cpp) hosts many sketch instances in one process. Whatever
+// the mocks keep per device lives here; the scheduler points simDevice() at the
+// instance it is running on this thread (nullptr = the single-instance sim).
+struct SimDevice {
+    int id = 0;
+    unsigned long long boot_us = 0;   // process clock at power-on; millis() counts from here
+    double drift_ppm = 0;             // crystal error applied to this device's clock
+    int web_port = 0;                 // panel listener, 0 = none
+    std::map<int, int> pins;
+    std::map<std::string, std::string> env;   // per-device SIM_* overrides
+    std::recursive_mutex mu;          // held while loop() or a panel handler runs
+    std::unique_ptr<SimNvs> nvs;      // this device's flash (see simNvs())
+    std::atomic<bool> restart{false}; // ESP.restart() called, fleet reboots it
+    SimBootMark boot;
+};
+inline SimDevice*& simDevice() {
+    thread_local SimDevice* d = nullptr;
+    return d;
+}
+
+// ESP.restart(): drivers that emulate the reboot in-process (main.cpp, fleet)
+// install a handler that re-runs setup() on a fresh instance once the caller
+// returns; without one the sim just exits.
+inline std::function<void()>& simRestartHook() {
+    static std::function<void()> f;
+    return f;
+}
+
 // ESP object
 class ESPMock {
 public:
     void restart() { 
         std::cout << "[ESP] RESTARTING..." << std::endl;
+        if (simRestartHook()) { simRestartHook()(); return; }
         exit(0); 
     }
+    // Factory MAC; fleet devices get distinct ones.
+    uint64_t getEfuseMac() {
+        SimDevice* d = simDevice();
+        return 0x0000E5A1B2C3D400ULL + (uint64_t)(d ? d->id : 0);
+    }
 };
 static ESPMock ESP;
 
-
 // Mock Time
-inline unsigned long millis() {
-    using namespace std::chrono;
-    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+// Wall clock by default. Tools that replay long timelines (sweep.cpp) switch
+// to a virtual clock: time then only moves when delay() is called or the
+// driver advances it, so a week of polling runs in milliseconds.
+struct SimClock {
+    bool virtual_time = false;
+    unsigned long long now_us = 0;
+
+    void useVirtual(unsigned long long start_us) { virtual_time = true; now_us = start_us; }
+    void advanceTo(unsigned long long us) { if (us > now_us) now_us = us; }
+};
+inline SimClock& simClock() {
+    static SimClock c;
+    return c;
 }
 
+inline unsigned long micros() {
+    unsigned long long us;
+    if (simClock().virtual_time) {
+        us = simClock().now_us;
+    } else {
+        using namespace std::chrono;
+        us = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+    }
+    // A fleet device counts from its own power-on, at its own crystal's rate.
+    if (SimDevice* d = simDevice())
+        us = (unsigned long long)((us - d->boot_us) * (1.0 + d->drift_ppm * 1e-6));
+    return (unsigned long)us;
+}
+
+inline unsigned long millis() { return micros() / 1000; }
+
 inline void delay(unsigned long ms) {
+    if (simClock().virtual_time) { simClock().now_us += (unsigned long long)ms * 1000; return; }
     std::this_thread::sleep_for(std::chrono::milliseconds(ms));
 }
 
+// Simulator environment knobs (docker-compose passes them through). A fleet
+// device's own overrides win over the process environment.
+inline const char* simEnvRaw(const char* k) {
+    if (SimDevice* d = simDevice()) {
+        auto it = d->env.find(k);
+        if (it != d->env.end()) return it->second.c_str();
+    }
+    return getenv(k);
+}
+inline unsigned long simEnvULong(const char* k, unsigned long def) {
+    const char* v = simEnvRaw(k);
+    return (v && *v) ? strtoul(v, nullptr, 10) : def;
+}
+inline std::string simEnvStr(const char* k, const char* def) {
+    const char* v = simEnvRaw(k);
+    return (v && *v) ? std::string(v) : std::string(def);
+}
+
+// The device's NVS partition (SimNvs.h), created at first use. A fleet device
+// persists to SIM_NVS.<id>.
+inline SimNvs& simNvs() {
+    static std::unique_ptr<SimNvs> own;
+    SimDevice* d = simDevice();
+    std::unique_ptr<SimNvs>& slot = d ? d->nvs : own;
+    if (!slot) {
+        std::string path = simEnvStr("SIM_NVS", "");
+        if (d && !path.empty()) path += "." + std::to_string(d->id);
+        slot.reset(new SimNvs(path, simEnvULong("SIM_NVS_PAGES", 5)));
+    }
+    return *slot;
+}
+
+inline SimBootMark& simBootMark() {
+    static SimBootMark own;
+    SimDevice* d = simDevice();
+    return d ? d->boot : own;
+}
+
+// GPIO waveform capture with microsecond timestamps (micros(), so virtual time
+// when the virtual clock is on). Enabled by SIM_VCD=<path> (Value Change Dump,
+// opens in GTKWave) and/or SIM_WAVE=<path> (JSON lines for scripts). Besides
+// the relay and LED pins it records annotation tracks fed by the sketch's
+// SIM_EVENTs: poll (high while a poll runs), alarm, alarm_state (0 idle,
+// 1 initial, 2 cooldown, 3 reminder) and confirm. The JSON file also carries
+// every SIM_EVENT (boot has the timing config), so scripts/check-waveform.py
+// can check pulse lengths and spacing against the configuration.
+class SimWave {
+public:
+    typedef std::pair<const char*, long> Field;
+
+    static SimWave& get() {
+        static SimWave w;
+        return w;
+    }
+
+    void edge(int pin, int val) {
+        for (const auto& sig : sigs_)
+            if (sig.pin == pin) { change(sig, val); return; }
+    }
+
+    void event(const char* ev, std::initializer_list<Field> fields) {
+        if (!vcd_ && !json_) return;
+        std::lock_guard<std::mutex> lock(mu_);
+        if (json_) {
+            fprintf(json_, "{\"t_us\":%llu,\"ev\":\"%s\"", rel(), ev);
+            for (const auto& f : fields) fprintf(json_, ",\"%s\":%ld", f.first, f.second);
+            fputs("}\n", json_);
+            fflush(json_);
+        }
+        std::string e = ev;
+        if (e == "poll_start") set("poll", 1);
+        else if (e == "poll_skipped") set("poll", 0);
+        else if (e == "poll_end") {
+            set("poll", 0);
+            for (const auto& f : fields) {
+                if (!strcmp(f.first, "alarm")) set("alarm", f.second);
+                if (!strcmp(f.first, "confirm")) set("confirm", f.second);
+            }
+        } else if (e == "state") {
+            for (const auto& f : fields) if (!strcmp(f.first, "to")) set("alarm_state", f.second);
+        }
+    }
+
+private:
+    struct Sig { const char* name; int pin; int width; char id; };
+
+    SimWave() {
+        std::string vcd = simEnvStr("SIM_VCD", ""), json = simEnvStr("SIM_WAVE", "");
+        if (vcd.empty() && json.empty()) return;
+        t0_ = micros();
+        sigs_ = { { "relay1_gpio21", 21, 1, '!' }, { "relay2_gpio19", 19, 1, '"' },
+                  { "relay3_gpio18", 18, 1, '#' }, { "relay4_gpio5",   5, 1, '$' },
+                  { "led_gpio25",    25, 1, '%' }, { "poll",          -1, 1, '&' },
+                  { "alarm",         -1, 1, '\''}, { "alarm_state",   -1, 2, '(' },
+                  { "confirm",       -1, 8, ')' } };
+        if (!vcd.empty() && (vcd_ = fopen(vcd.c_str(), "w"))) {
+            time_t now = time(nullptr);
+            fprintf(vcd_, "$date %s$end\n$version icinga-lighthouse esp32-sim $end\n", ctime(&now));
+            fprintf(vcd_, "$timescale 1us $end\n$scope module lighthouse $end\n");
+            for (const auto& sig : sigs_)
+                fprintf(vcd_, "$var %s %d %c %s $end\n", sig.width == 1 ? "wire" : "integer",
+                        sig.width, sig.id, sig.name);
+            fprintf(vcd_, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+            for (const auto& sig : sigs_) writeVcd(sig, 0);
+            fprintf(vcd_, "$end\n");
+            fflush(vcd_);
+        }
+        for (const auto& sig : sigs_) last_[sig.id] = 0;   // everything starts low
+        if (!json.empty() && (json_ = fopen(json.c_str(), "w"))) {
+            fprintf(json_, "{\"timescale\":\"us\",\"t0_us\":%llu,\"signals\":[", t0_);
+            for (size_t i = 0; i < sigs_.size(); i++)
+                fprintf(json_, "%s\"%s\"", i ? "," : "", sigs_[i].name);
+            fputs("]}\n", json_);
+            fflush(json_);
+        }
+    }
+
+    unsigned long long rel() const { return (unsigned long long)micros() - t0_; }
+
+    void set(const char* name, long val) {
+        for (const auto& sig : sigs_)
+            if (!strcmp(sig.name, name)) { changeLocked(sig, val); return; }
+    }
+
+    void change(const Sig& sig, long val) {
+        if (!vcd_ && !json_) return;
+        std::lock_guard<std::mutex> lock(mu_);
+        changeLocked(sig, val);
+    }
+
+    void changeLocked(const Sig& sig, long val) {
+        long& last = last_[sig.id];
+        if (last == val) return;
+        last = val;
+        unsigned long long t = rel();
+        if (vcd_) {
+            if (t != lastT_) fprintf(vcd_, "#%llu\n", t);
+            lastT_ = t;
+            writeVcd(sig, val);
+            fflush(vcd_);
+        }
+        if (json_) {
+            fprintf(json_, "{\"t_us\":%llu,\"sig\":\"%s\",\"val\":%ld}\n", t, sig.name, val);
+            fflush(json_);
+        }
+    }
+
+    void writeVcd(const Sig& sig, long val) {
+        if (sig.width == 1) { fprintf(vcd_, "%d%c\n", val ? 1 : 0, sig.id); return; }
+        std::string bits;
+        for (int b = sig.width - 1; b >= 0; b--) bits += ((val >> b) & 1) ? '1' : '0';
+        fprintf(vcd_, "b%s %c\n", bits.c_str(), sig.id);
+    }
+
+    std::vector<Sig> sigs_;
+    std::map<char, long> last_;
+    FILE* vcd_ = nullptr;
+    FILE* json_ = nullptr;
+    unsigned long long t0_ = 0, lastT_ = 0;
+    std::mutex mu_;
+};
+
+// Structured, timestamped simulator events (JSON lines), for harnesses that
+// measure the firmware instead of grepping its log. Enabled by SIM_EVENTS=<path>
+// ("-" = stdout). The sketch emits them through SIM_EVENT(...), which is a
+// no-op on the device; the mocks add relay/GPIO and HTTP events. t_ms is the
+// same clock as millis(); in fleet mode that is the device's own clock and the
+// event carries its "dev" id.
+//   {"t_ms":1760000000123,"ev":"relay","pin":21,"val":1}
+class SimEvents {
+public:
+    typedef std::pair<const char*, long> Field;
+
+    static SimEvents& get() {
+        static SimEvents e;
+        return e;
+    }
+    bool enabled() const { return out_ != nullptr; }
+
+    void emit(const char* ev, std::initializer_list<Field> fields = {}) {
+        SimBootMark& b = simBootMark();
+        if (b.awaiting_poll && !strcmp(ev, "poll_start")) {
+            b.awaiting_poll = false;
+            long ms = (long)(millis() - b.setup_ms);
+            std::cout << "[SIM] Boot -> first poll: " << ms << " ms" << std::endl;
+            emit("first_poll", {{"ms", ms}});
+        }
+        SimWave::get().event(ev, fields);
+        if (!out_) return;
+        std::lock_guard<std::mutex> lock(mu_);
+        fprintf(out_, "{\"t_ms\":%lu,\"ev\":\"%s\"", millis(), ev);
+        if (SimDevice* d = simDevice()) fprintf(out_, ",\"dev\":%d", d->id);
+        for (const auto& f : fields) fprintf(out_, ",\"%s\":%ld", f.first, f.second);
+        fputs("}\n", out_);
+        fflush(out_);
+    }
+
+private:
+    SimEvents() {
+        std::string path = simEnvStr("SIM_EVENTS", "");
+        if (path == "-") out_ = stdout;
+        else if (!path.empty()) out_ = fopen(path.c_str(), "a");
+    }
+    FILE* out_ = nullptr;
+    std::mutex mu_;
+};
+#define SIM_EVENT(...) SimEvents::get().emit(__VA_ARGS__)
+
+inline void simBootBegin() {
+    simBootMark().setup_ms = millis();
+    simBootMark().awaiting_poll = true;
+}
+
+// Logs the flash cost since `since` (an earlier simNvs().totals()) and the
+// partition's wear, and emits it as an "nvs" event. Returns the new totals.
+inline SimNvs::Totals simNvsReport(const SimNvs::Totals& since) {
+    SimNvs& nvs = simNvs();
+    SimNvs::Totals t = nvs.totals();
+    long programs = (long)(t.programs - since.programs), bytes = (long)(t.bytes - since.bytes);
+    long erases = (long)(t.erases - since.erases), skipped = (long)(t.skipped - since.skipped);
+    std::cout << "[NVS] " << programs << " flash writes (" << bytes << " B), " << erases
+              << " page erases, " << skipped << " unchanged values skipped; "
+              << nvs.usedEntries() << "/" << nvs.pages() * SimNvs::ENTRIES << " entries used, erases per page:";
+    for (const auto& w : nvs.wear()) std::cout << " " << w.erases;
+    std::cout << std::endl;
+    SIM_EVENT("nvs", {{"writes", programs}, {"bytes", bytes}, {"erases", erases}, {"skipped", skipped}});
+    return t;
+}
+
 // Mock Serial
 class SerialMock {
 public:
@@ -133,19 +453,37 @@ static SerialMock Serial;
 
 // Mock GPIO
 static std::map<int, int> pinStates;
+inline std::map<int, int>& simPins() {
+    SimDevice* d = simDevice();
+    return d ? d->pins : pinStates;
+}
+// Optional observer of every pin edge (replay tools, waveform capture).
+inline std::function<void(int, int)>& simGpioObserver() {
+    static std::function<void(int, int)> f;
+    return f;
+}
 inline void pinMode(int pin, int mode) { }
 inline void digitalWrite(int pin, int val) {
-    if (pinStates[pin] != val) {
-        pinStates[pin] = val;
+    std::map<int, int>& pins = simPins();
+    if (pins[pin] != val) {
+        pins[pin] = val;
+        if (simGpioObserver()) simGpioObserver()(pin, val);
+        SimWave::get().edge(pin, val);
         // Specifically log Relays
         if (pin == 21 || pin == 19 || pin == 18 || pin == 5) {
             std::cout << "\033[1;33m[GPIO] RELAY Pin " << pin << " -> " << (val ? "ON" : "OFF") << "\033[0m" << std::endl;
+            SIM_EVENT("relay", {{"pin", pin}, {"val", val}});
         } else {
              std::cout << "[GPIO] Pin " << pin << " -> " << val << std::endl;
         }
     }
 }
-inline int digitalRead(int pin) { return pinStates[pin]; }
+inline int digitalRead(int pin) { return simPins()[pin]; }
+// Reset: every output drops low (relays release), as on a real reboot.
+inline void simGpioReset() {
+    std::map<int, int> pins = simPins();
+    for (const auto& kv : pins) if (kv.second) digitalWrite(kv.first, LOW);
+}
 
 // Mock WiFi
 class WiFiMock {
@@ -167,17 +505,56 @@ public:
 };
 static WiFiMock WiFi;
 
-// Mock Preferences
+// Mock Preferences, on the emulated NVS partition (SimNvs.h)
 class Preferences {
 public:
-    std::map<String, String> store;
-    void begin(const char* name, bool ro) {}
-    void putString(const char* key, String val) { store[key] = val; }
-    String getString(const char* key, String def) { return store.count(key) ? store[key] : def; }
-    void putULong(const char* key, unsigned long val) { store[key] = std::to_string(val); }
-    unsigned long getULong(const char* key, unsigned long def) { return store.count(key) ? std::stoul(store[key]) : def; }
-    void putInt(const char* key, int val) { store[key] = std::to_string(val); }
-    int getInt(const char* key, int def) { return store.count(key) ? std::stoi(store[key]) : def; }
+    bool begin(const char* name, bool ro) {
+        ro_ = ro;
+        ns_ = simNvs().openNamespace(name, ro);
+        return ns_ != 0;
+    }
+    void end() { ns_ = 0; }
+    bool isKey(const char* key) { return ns_ && simNvs().has(ns_, key); }
+    size_t putString(const char* key, String val) {
+        return writable() && simNvs().setStr(ns_, key, val) ? val.length() : 0;
+    }
+    String getString(const char* key, String def) {
+        std::string v;
+        return ns_ && simNvs().getStr(ns_, key, v) ? String(v) : def;
+    }
+    size_t putULong(const char* key, unsigned long val) {
+        return writable() && simNvs().setU32(ns_, SimNvs::U32, key, (uint32_t)val) ? 4 : 0;
+    }
+    unsigned long getULong(const char* key, unsigned long def) {
+        uint32_t v;
+        return ns_ && simNvs().getU32(ns_, SimNvs::U32, key, v) ? v : def;
+    }
+    size_t putInt(const char* key, int val) {
+        return writable() && simNvs().setU32(ns_, SimNvs::I32, key, (uint32_t)val) ? 4 : 0;
+    }
+    int getInt(const char* key, int def) {
+        uint32_t v;
+        return ns_ && simNvs().getU32(ns_, SimNvs::I32, key, v) ? (int)(int32_t)v : def;
+    }
+
+private:
+    bool writable() const { return ns_ && !ro_; }
+    uint8_t ns_ = 0;
+    bool ro_ = false;
+};
+
+// File uploads (multipart/form-data) reach the upload handler in pieces of
+// up to HTTP_UPLOAD_BUFLEN bytes, as on the ESP32 WebServer.
+#define HTTP_UPLOAD_BUFLEN 1436
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+struct HTTPUpload {
+    HTTPUploadStatus status;
+    String filename;
+    String name;
+    String type;
+    size_t totalSize;
+    size_t currentSize;
+    uint8_t buf[HTTP_UPLOAD_BUFLEN];
 };
 
 // Mock WebServer (real HTTP server via cpp-httplib)
@@ -185,20 +562,38 @@ class WebServer {
 public:
     explicit WebServer(int port) : port_(port) {}
 
+    // Handlers are std::function, as THandlerFunction in the ESP32 core.
+    typedef std::function<void()> Handler;
+
     // Register GET handler (default)
-    void on(const char* uri, void (*fn)()) {
-        routes_.push_back(Route{uri, HTTP_GET, fn});
+    void on(const char* uri, Handler fn) {
+        routes_.push_back(Route{uri, HTTP_GET, fn, nullptr});
     }
 
     // Register handler with method
-    void on(const char* uri, int method, void (*fn)()) {
-        routes_.push_back(Route{uri, method, fn});
+    void on(const char* uri, int method, Handler fn) {
+        routes_.push_back(Route{uri, method, fn, nullptr});
+    }
+
+    // POST with a file upload: ufn sees the file as it streams in (upload()),
+    // then fn answers. Form fields other than the file aren't parsed; pass
+    // parameters in the query string.
+    void on(const char* uri, int method, Handler fn, Handler ufn) {
+        routes_.push_back(Route{uri, method, fn, ufn});
     }
 
+    HTTPUpload& upload() { return upload_; }
+
     void begin() {
         // Build routes into the HTTP server
         for (const auto& r : routes_) {
-            if (r.method == HTTP_POST) {
+            if (r.method == HTTP_POST && r.upload) {
+                // Streamed: the body never sits in memory as a whole.
+                http_.Post(r.path.c_str(), [this, r](const httplib::Request& req, httplib::Response& res,
+                                                     const httplib::ContentReader& reader) {
+                    dispatch(req, res, [&] { receiveUpload(req, reader, r.upload); r.fn(); });
+                });
+            } else if (r.method == HTTP_POST) {
                 http_.Post(r.path.c_str(), [this, r](const httplib::Request& req, httplib::Response& res) {
                     dispatch(req, res, r.fn);
                 });
@@ -209,17 +604,44 @@ public:
             }
         }
 
+        // SIM_WEB_PORT remaps the listener (0 = no listener, for replay tools).
+        // A fleet device uses the port the fleet assigned it, and a single
+        // worker so hundreds of idle panels don't cost thousands of threads.
+        port_ = (int)simEnvULong("SIM_WEB_PORT", (unsigned long)port_);
+        dev_ = simDevice();
+        if (dev_) {
+            port_ = dev_->web_port;
+            http_.new_task_queue = [] { return new httplib::ThreadPool(1); };
+        }
+        if (port_ == 0) return;
+
         // Start listener thread
         running_ = true;
         thread_ = std::thread([this]() {
             http_.listen("0.0.0.0", port_);
+            listen_done_ = true;
         });
-        thread_.detach();
+    }
+
+    // Stops the listener when an in-process restart drops the instance; waits
+    // for a handler still in flight.
+    ~WebServer() {
+        if (!thread_.joinable()) return;
+        while (!http_.is_running() && !listen_done_)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        http_.stop();
+        thread_.join();
     }
 
     // Arduino WebServer expects polling; in sim we run in a background thread.
     void handleClient() {}
 
+    // Runs a handler in-process against a hand-built request, without the
+    // listener thread (used by the benchmarks).
+    void invoke(Handler fn, const httplib::Request& req, httplib::Response& res) {
+        dispatch(req, res, fn);
+    }
+
     bool authenticate(const char* u, const char* p) {
         if (!current_req_) return false;
         const auto auth = current_req_->get_header_value("Authorization");
@@ -275,14 +697,83 @@ public:
         return "";
     }
 
+    bool hasArg(const char* name) {
+        return current_req_ && name && current_req_->has_param(name);
+    }
+
+    // By position, as the ESP32 core's args() / argName(i) / arg(i).
+    int args() { return current_req_ ? (int)current_req_->params.size() : 0; }
+    String argName(int i) {
+        if (i < 0 || i >= args()) return "";
+        return std::next(current_req_->params.begin(), i)->first;
+    }
+    String arg(int i) {
+        if (i < 0 || i >= args()) return "";
+        return std::next(current_req_->params.begin(), i)->second;
+    }
+
 private:
     struct Route {
         std::string path;
         int method;
-        void (*fn)();
+        Handler fn;
+        Handler upload;
     };
 
-    void dispatch(const httplib::Request& req, httplib::Response& res, void (*fn)()) {
+    // Feeds the multipart file parts to ufn the way the ESP32 WebServer does:
+    // START, a WRITE per full buffer (and the rest), END - or ABORTED when
+    // the client goes away mid-file.
+    void receiveUpload(const httplib::Request& req, const httplib::ContentReader& reader, const Handler& ufn) {
+        bool open = false;
+        auto flush = [&] {
+            if (!upload_.currentSize) return;
+            upload_.totalSize += upload_.currentSize;
+            upload_.status = UPLOAD_FILE_WRITE;
+            ufn();
+            upload_.currentSize = 0;
+        };
+        auto close = [&] {
+            if (!open) return;
+            flush();
+            upload_.status = UPLOAD_FILE_END;
+            ufn();
+            open = false;
+        };
+        bool ok = req.is_multipart_form_data() && reader(
+            [&](const httplib::MultipartFormData& part) {
+                close();
+                if (part.filename.empty()) return true;
+                upload_.filename = part.filename;
+                upload_.name = part.name;
+                upload_.type = part.content_type;
+                upload_.totalSize = upload_.currentSize = 0;
+                upload_.status = UPLOAD_FILE_START;
+                ufn();
+                open = true;
+                return true;
+            },
+            [&](const char* p, size_t n) {
+                while (open && n > 0) {
+                    size_t k = std::min(n, (size_t)HTTP_UPLOAD_BUFLEN - upload_.currentSize);
+                    memcpy(upload_.buf + upload_.currentSize, p, k);
+                    upload_.currentSize += k;
+                    p += k; n -= k;
+                    if (upload_.currentSize == HTTP_UPLOAD_BUFLEN) flush();
+                }
+                return true;
+            });
+        if (ok) close();
+        else if (open) { upload_.status = UPLOAD_FILE_ABORTED; ufn(); }
+    }
+
+    void dispatch(const httplib::Request& req, httplib::Response& res, const Handler& fn) {
+        // Fleet: run the handler as its device, never concurrently with its loop().
+        SimDevice* prev = simDevice();
+        std::unique_lock<std::recursive_mutex> devLock;
+        if (dev_) {
+            simDevice() = dev_;
+            devLock = std::unique_lock<std::recursive_mutex>(dev_->mu);
+        }
         current_req_ = &req;
         {
             std::lock_guard<std::mutex> lock(mu_);
@@ -303,6 +794,7 @@ private:
         res.set_content(resp_body_, resp_type_);
 
         current_req_ = nullptr;
+        simDevice() = prev;
     }
 
     // Minimal Base64 decoder for Basic Auth
@@ -340,15 +832,29 @@ private:
 
     std::thread thread_;
     std::atomic<bool> running_{false};
+    std::atomic<bool> listen_done_{false};
     const httplib::Request* current_req_ = nullptr;
+    SimDevice* dev_ = nullptr;
+    HTTPUpload upload_;
 };
 #define CONTENT_LENGTH_UNKNOWN 0
 
-// Helper Stream for ArduinoJson
+// Mock Stream (Arduino's Stream + the parts of Print the sketch uses).
 class Stream {
 public:
     virtual int read() = 0;
+    virtual int available() { return 0; }
+    virtual int peek() { return -1; }
+    virtual size_t write(uint8_t b) { return 0; }
+    virtual size_t write(const uint8_t* buf, size_t n) {
+        size_t i = 0;
+        while (i < n && write(buf[i])) i++;
+        return i;
+    }
+    void setTimeout(unsigned long ms) { streamTimeout_ = ms; }
     virtual ~Stream() {}
+protected:
+    unsigned long streamTimeout_ = 1000;
 };
 
 class StringStream : public Stream {
@@ -362,128 +868,675 @@ public:
     }
 };
 
+// Optional in-process responder standing in for the network: given the URL,
+// fills the body and response headers and returns the status code. Replay
+// tools that must not touch a real server install it; WiFiClient then serves
+// the reply without opening a socket.
+typedef std::function<int(const std::string& url, std::string& body,
+                          std::map<std::string, std::string>& headers)> SimHttpResponder;
+inline SimHttpResponder& simHttpResponder() {
+    static SimHttpResponder r;
+    return r;
+}
+
+// Optional observer of every completed request (status, wall time from
+// connect to close in us), e.g. the fleet's aggregate load statistics.
+typedef std::function<void(int code, unsigned long us)> SimHttpObserver;
+inline SimHttpObserver& simHttpObserver() {
+    static SimHttpObserver o;
+    return o;
+}
+
+// Status code of the response in `rx` ("HTTP/1.0 200 OK..."), -1 if none.
+inline int simHttpStatus(const std::string& rx) {
+    size_t sp = rx.find(' ');
+    if (rx.compare(0, 5, "HTTP/") != 0 || sp == std::string::npos) return -1;
+    return atoi(rx.c_str() + sp + 1);
+}
+
 // Mock WiFiClient / WiFiClientSecure.
-// WiFiClientSecure derives from WiFiClient (as on real ESP32) so the firmware
-// can drive either transport through a WiFiClient* base pointer.
-class WiFiClient {
+// A TCP (or, for WiFiClientSecure, TLS without peer verification) connection
+// through libcurl's connect-only mode, with the link timing from SimNet (see
+// SimNet.h) applied on top: connect costs a handshake (plus two round trips
+// for TLS) and waits out lost SYNs, the reply starts a round trip after the
+// request went out, and the body is released one segment at a time at the
+// link's bandwidth, lost segments waiting for a retransmission timeout. A gap
+// longer than the client's timeout stalls the connection, as a dead link
+// would. As with lwIP, available() and read() never wait for the server;
+// whoever reads does the waiting. WiFiClientSecure derives from WiFiClient
+// (as on real ESP32).
+class WiFiClient : public Stream {
 public:
-    void setTimeout(int s) {}
-    virtual ~WiFiClient() {}
+    virtual ~WiFiClient() { stop(); }
+
+    // ESP32 core 2.x: seconds; bounds connect and every stall.
+    int setTimeout(uint32_t seconds) { timeoutMs_ = seconds ? seconds * 1000UL : 1; return 0; }
+
+    int connect(const char* host, uint16_t port) {
+        stop();
+        host_ = host;
+        port_ = port;
+        t0_ = millis();
+        us0_ = micros();
+        if (simHttpResponder()) { open_ = true; return 1; }
+
+        SimNet& net = SimNet::get();
+        if (net.refused()) {
+            delay(net.rtt());
+            std::cout << "[WiFi] Error: connection refused (emulated)" << std::endl;
+            finish(-1);
+            return 0;
+        }
+        unsigned long wait = 0, syn = SimNet::SYN_RTO_MS;
+        while (net.lost()) { wait += syn; syn *= 2; }   // SYN retransmits
+        wait += net.rtt();                              // TCP handshake
+        if (tls()) wait += 2 * net.rtt();               // TLS 1.2 handshake
+        if (wait > timeoutMs_) {
+            delay(timeoutMs_);
+            std::cout << "[WiFi] Error: connect timeout (emulated)" << std::endl;
+            finish(-1);
+            return 0;
+        }
+
+        easy_ = curl_easy_init();
+        if (!easy_) return 0;
+        std::string url = std::string(tls() ? "https://" : "http://") + host + ":" + std::to_string(port) + "/";
+        curl_easy_setopt(easy_, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(easy_, CURLOPT_CONNECT_ONLY, 1L);
+        curl_easy_setopt(easy_, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(easy_, CURLOPT_SSL_VERIFYHOST, 0L);
+        curl_easy_setopt(easy_, CURLOPT_CONNECTTIMEOUT_MS, (long)timeoutMs_);
+        CURLcode rc = curl_easy_perform(easy_);
+        if (rc != CURLE_OK) {
+            std::cout << "[WiFi] Error: " << curl_easy_strerror(rc) << std::endl;
+            curl_easy_cleanup(easy_);
+            easy_ = nullptr;
+            finish(-1);
+            return 0;
+        }
+        delay(wait);
+        connectMs_ = millis() - t0_;
+        open_ = true;
+        return 1;
+    }
+
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* buf, size_t n) override {
+        if (!open_) return 0;
+        if (tx_.empty() && n && isupper(buf[0])) {
+            std::string line((const char*)buf, n);
+            line = line.substr(0, line.find('\r'));
+            std::cout << "[HTTP] " << line << " (" << host_ << ":" << port_ << (tls() ? ", TLS" : "") << ")" << std::endl;
+        }
+        tx_.append((const char*)buf, n);
+        awaiting_ = true;
+        if (!easy_) return n;
+        size_t sent = 0;
+        unsigned long start = millis();
+        while (sent < n) {
+            size_t k = 0;
+            CURLcode rc = curl_easy_send(easy_, buf + sent, n - sent, &k);
+            if (rc == CURLE_AGAIN) {
+                if (millis() - start > timeoutMs_) break;
+                waitSocket(false, 10);
+                continue;
+            }
+            if (rc != CURLE_OK) { eof_ = true; break; }
+            sent += k;
+        }
+        return sent;
+    }
+
+    // Bytes the emulated link has delivered. Releasing the next segment costs
+    // its (emulated) transfer time.
+    int available() override {
+        if (!open_) return 0;
+        if (released_ > rxPos_) return (int)(released_ - rxPos_);
+        pump(0);
+        if (released_ > rxPos_) return (int)(released_ - rxPos_);   // served in-process
+        if (stalled_ || rx_.size() <= rxPos_) return 0;
+        SimNet& net = SimNet::get();
+        unsigned long gap;
+        if (released_ == 0 || awaiting_) {
+            gap = net.rtt();                            // request -> first byte
+            if (net.lost()) gap += net.rto();
+            if (released_ == 0) ttfbMs_ = millis() - t0_ + gap;
+            awaiting_ = false;                          // (a kept connection pays it per request)
+        } else {
+            gap = net.transferMs(SimNet::MSS);          // next segment
+            if (net.lost()) gap += net.rto();
+        }
+        if (gap > timeoutMs_) {
+            delay(timeoutMs_);
+            stalled_ = true;
+            return 0;
+        }
+        delay(gap);
+        released_ = std::min(rx_.size(), rxPos_ + SimNet::MSS);
+        return (int)(released_ - rxPos_);
+    }
+
+    int read() override {
+        uint8_t b;
+        return read(&b, 1) == 1 ? b : -1;
+    }
+    int read(uint8_t* buf, size_t n) {
+        size_t k = std::min(n, released_ > rxPos_ ? released_ - rxPos_ : (size_t)0);
+        if (k == 0) return -1;
+        memcpy(buf, rx_.data() + rxPos_, k);
+        rxPos_ += k;
+        return (int)k;
+    }
+    int peek() override { return released_ > rxPos_ ? (unsigned char)rx_[rxPos_] : -1; }
+
+    // Open, or closed by the server with data still to read.
+    uint8_t connected() {
+        if (!open_) return 0;
+        if (rx_.size() > rxPos_ || stalled_) return 1;
+        pump(0);
+        return (eof_ && rx_.size() <= rxPos_) ? 0 : 1;
+    }
+
+    void stop() {
+        if (!open_) return;
+        if (!SimNet::get().ideal() || stalled_) {
+            std::cout << "[HTTP] " << rxPos_ << " B, ttfb " << ttfbMs_ << " ms (connect "
+                      << connectMs_ << " ms), total " << (millis() - t0_) << " ms"
+                      << (stalled_ ? ", TIMEOUT" : "") << std::endl;
+        }
+        finish(simHttpStatus(rx_));
+        if (easy_) curl_easy_cleanup(easy_);
+        easy_ = nullptr;
+        open_ = stalled_ = eof_ = awaiting_ = false;
+        rx_.clear();
+        tx_.clear();
+        rxPos_ = released_ = 0;
+        ttfbMs_ = connectMs_ = 0;
+    }
+
+protected:
+    virtual bool tls() const { return false; }
+
+private:
+    // Reads whatever has arrived, waiting up to `ms` for the socket.
+    void pump(int ms) {
+        if (eof_) return;
+        if (!easy_) { serve(); return; }
+        char buf[16384];
+        for (;;) {
+            size_t k = 0;
+            CURLcode rc = curl_easy_recv(easy_, buf, sizeof(buf), &k);
+            if (rc == CURLE_AGAIN) {
+                if (ms <= 0 || !waitSocket(true, ms)) return;
+                ms = 0;
+                continue;
+            }
+            if (rc != CURLE_OK || k == 0) { eof_ = true; return; }
+            rx_.append(buf, k);
+        }
+    }
+
+    bool waitSocket(bool in, int ms) {
+        curl_socket_t fd = CURL_SOCKET_BAD;
+        curl_easy_getinfo(easy_, CURLINFO_ACTIVESOCKET, &fd);
+        if (fd == CURL_SOCKET_BAD) return false;
+        pollfd p = {(int)fd, (short)(in ? POLLIN : POLLOUT), 0};
+        return poll(&p, 1, ms) == 1;
+    }
+
+    // The responder's reply to the request written so far, as HTTP/1.0.
+    void serve() {
+        size_t end = tx_.find("\r\n\r\n");
+        if (end == std::string::npos || !rx_.empty()) return;
+        size_t sp = tx_.find(' '), sp2 = tx_.find(' ', sp + 1);
+        std::string path = tx_.substr(sp + 1, sp2 - sp - 1);
+        std::string url = std::string(tls() ? "https://" : "http://") + host_ + ":" + std::to_string(port_) + path;
+        std::string body;
+        std::map<std::string, std::string> headers;
+        int code = simHttpResponder()(url, body, headers);
+        rx_ = "HTTP/1.0 " + std::to_string(code) + " X\r\n";
+        for (const auto& h : headers) rx_ += h.first + ": " + h.second + "\r\n";
+        rx_ += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        released_ = rx_.size();
+        eof_ = true;
+    }
+
+    void finish(int code) {
+        if (simHttpObserver()) simHttpObserver()(code, micros() - us0_);
+    }
+
+    std::string host_;
+    uint16_t port_ = 0;
+    unsigned long timeoutMs_ = 3000;      // WIFI_CLIENT_DEF_CONN_TIMEOUT_MS
+    CURL* easy_ = nullptr;
+    bool open_ = false, eof_ = false, stalled_ = false;
+    bool awaiting_ = false;               // written since the last reply segment: next one costs an RTT
+    std::string tx_;                      // request as written
+    std::string rx_;                      // received from the server
+    size_t rxPos_ = 0;                    // next byte the firmware reads
+    size_t released_ = 0;                 // rx_ bytes the emulated link has delivered
+    unsigned long t0_ = 0, us0_ = 0, connectMs_ = 0, ttfbMs_ = 0;
 };
 class WiFiClientSecure : public WiFiClient {
 public:
     void setInsecure() {}
+protected:
+    bool tls() const override { return true; }
 };
 
-// Mock HTTPClient
-class HTTPClient {
-    String payload;
-    StringStream* stream = nullptr;
+// Mock SPI / Ethernet / EthernetClient (WIZnet W5500 on the T-Relay shield).
+// The shield is absent unless SIM_ETH=1; then setupEthernet() finds a W5500,
+// leases SIM_ETH_IP (default 10.20.0.2) and the sketch's Ethernet transport
+// talks to the real server over a POSIX socket. What a request would cost on the device is
+// charged with delay(), so benchmarks and the waveform see the device timing:
+//   - SPI: every register or buffer access is one frame, a 3-byte header
+//     (offset + control) plus data, clocked at SIM_W5500_SPI_HZ (default
+//     14 MHz). The library's read() pulls one byte per frame and updates
+//     RX_RD/RECV every 250 bytes, which is where most of the time goes.
+//   - Socket buffers: SIM_W5500_BUF bytes per socket (default 2048, the
+//     8-socket split). The chip advertises its free RX space as the TCP
+//     window, so each further buffer-full of a body costs a round trip.
+//   - Link: SIM_ETH_LINK="down@30,up@90" (seconds since power-on) pulls and
+//     replugs the cable on a schedule; SIGUSR1 toggles it. Without link DHCP
+//     runs into its timeout, connect() times out and an open transfer stalls
+//     until the read timeout, so the firmware's WiFi fallback can be tested.
+//   - Latency, bandwidth, loss and refusals come from SimNet, as for WiFi.
+// Every request ends with an "eth_http" event (ms, spi_ms, tx, rx); link
+// changes emit "eth_link".
+enum EthernetHardwareStatus { EthernetNoHardware, EthernetW5100, EthernetW5200, EthernetW5500 };
+enum EthernetLinkStatus { Unknown, LinkON, LinkOFF };
+
+class IPAddress {
 public:
-    void useHTTP10(bool b) {}
-    void setTimeout(int ms) {}
-    bool begin(WiFiClient& client, String url) {
-        this->url = url;
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : o_{a, b, c, d} {}
+    bool fromString(const std::string& s) {
+        unsigned a, b, c, d;
+        char tail;
+        if (sscanf(s.c_str(), "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 ||
+            a > 255 || b > 255 || c > 255 || d > 255) return false;
+        *this = IPAddress(a, b, c, d);
         return true;
     }
-    void setAuthorization(const char* u, const char* p) { user = u; pass = p; }
-    void addHeader(String k, String v) { reqHeaders.push_back(std::string(k) + ": " + std::string(v)); }
-    void collectHeaders(const char** keys, size_t count) { (void)keys; (void)count; } // capture all anyway
-    String header(const char* name) {
-        std::string key = name; for (auto& c : key) c = (char)tolower(c);
-        auto it = respHeaders.find(key);
-        return it != respHeaders.end() ? String(it->second) : String("");
-    }
-    int GET() {
-        std::cout << "[HTTP] GET " << url << std::endl;
-
-        CURL *curl;
-        CURLcode res;
-        std::string readBuffer;
-
-        curl = curl_easy_init();
-        if(curl) {
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-
-            if (!user.empty()) {
-                curl_easy_setopt(curl, CURLOPT_HTTPAUTH, (long)CURLAUTH_BASIC);
-                curl_easy_setopt(curl, CURLOPT_USERNAME, user.c_str());
-                curl_easy_setopt(curl, CURLOPT_PASSWORD, pass.c_str());
-            }
+    bool operator==(const IPAddress& o) const { return memcmp(o_, o.o_, 4) == 0; }
+    bool operator!=(const IPAddress& o) const { return !(*this == o); }
+    String toString() const {
+        return std::to_string(o_[0]) + "." + std::to_string(o_[1]) + "." +
+               std::to_string(o_[2]) + "." + std::to_string(o_[3]);
+    }
+private:
+    uint8_t o_[4] = {0, 0, 0, 0};
+};
+
+// Arduino's Client interface, for the sketch's own wrappers (the mock
+// WiFiClient / EthernetClient are used directly and don't derive from it).
+class Client : public Stream {
+public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char* host, uint16_t port) = 0;
+    size_t write(uint8_t b) override = 0;
+    size_t write(const uint8_t* buf, size_t n) override = 0;
+    int available() override = 0;
+    int read() override = 0;
+    virtual int read(uint8_t* buf, size_t n) = 0;
+    int peek() override = 0;
+    virtual void flush() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+};
+
+class SPIClass {
+public:
+    void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+};
+static SPIClass SPI __attribute__((unused));   // unused in builds without LH_ETH
+
+// SIGUSR1 flips every emulated cable (docker kill -s USR1 il-esp32-sim).
+inline std::atomic<unsigned>& simEthToggles() {
+    static std::atomic<unsigned> n{0};
+    return n;
+}
+
+// One W5500: presence, lease, cable state and the SPI clock.
+class SimW5500 {
+public:
+    static const unsigned HDR = 3;          // SPI frame header: 16-bit offset + control byte
+    static const unsigned RECV_BATCH = 250; // library updates RX_RD/RECV this often
 
-            // Forward the request headers the firmware set (notably
-            // "Accept: application/json", without which Icinga Web redirects
-            // to its HTML login instead of returning JSON).
-            struct curl_slist* hdrs = nullptr;
-            for (const auto& h : reqHeaders) hdrs = curl_slist_append(hdrs, h.c_str());
-            if (hdrs) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
-
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
-            curl_easy_setopt(curl, CURLOPT_HEADERDATA, &respHeaders);
-
-            res = curl_easy_perform(curl);
-            long httpCode = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
-            if (hdrs) curl_slist_free_all(hdrs);
-            curl_easy_cleanup(curl);
-
-            if(res != CURLE_OK) {
-                std::cout << "[HTTP] Error: " << curl_easy_strerror(res) << std::endl;
-                return 500;
+    // This device's chip (fleet devices each have one).
+    static SimW5500& get() {
+        static std::mutex mu;
+        static std::map<SimDevice*, SimW5500> chips;
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = chips.find(simDevice());
+        if (it == chips.end()) it = chips.emplace(simDevice(), SimW5500()).first;
+        return it->second;
+    }
+
+    bool present = false;
+    bool powered = false;     // reset pulse waited out (first Ethernet.begin)
+    bool leased = false;
+    IPAddress ip;
+    unsigned long buf = 2048;
+    double spi_us = 0;        // total SPI bus time, for the per-request report
+
+    // n frames carrying `bytes` of payload between them.
+    void spi(unsigned frames, size_t bytes) {
+        double us = (frames * HDR + bytes) * 8e6 / hz_;
+        spi_us += us;
+        debt_us_ += us;
+        if (debt_us_ >= 1000) {
+            unsigned long ms = (unsigned long)(debt_us_ / 1000);
+            debt_us_ -= ms * 1000.0;
+            delay(ms);
+        }
+    }
+
+    bool link() {
+        unsigned long t = millis() - t0_;
+        bool up = true;
+        for (const auto& ev : schedule_) if (t >= ev.first) up = ev.second;
+        if (simEthToggles() % 2) up = !up;
+        if (up != link_) {
+            link_ = up;
+            std::cout << "[ETH] Link " << (up ? "up" : "down") << std::endl;
+            SIM_EVENT("eth_link", {{"up", up ? 1 : 0}});
+        }
+        return up;
+    }
+
+    SimW5500() {
+        present = simEnvULong("SIM_ETH", 0) != 0;
+        buf = simEnvULong("SIM_W5500_BUF", 2048);
+        hz_ = (double)simEnvULong("SIM_W5500_SPI_HZ", 14000000);
+        if (hz_ <= 0) hz_ = 14000000;
+        if (!ip.fromString(simEnvStr("SIM_ETH_IP", "10.20.0.2"))) ip = IPAddress(10, 20, 0, 2);
+        t0_ = millis();
+        // "down@30,up@90": cable state from that second on.
+        std::string s = simEnvStr("SIM_ETH_LINK", "");
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t end = s.find(',', pos);
+            std::string item = s.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+            size_t at = item.find('@');
+            if (at != std::string::npos)
+                schedule_.push_back({strtoul(item.c_str() + at + 1, nullptr, 10) * 1000UL,
+                                     item.compare(0, at, "down") != 0});
+            if (end == std::string::npos) break;
+            pos = end + 1;
+        }
+        static bool hooked = false;
+        if (present && !hooked) {
+            hooked = true;
+            signal(SIGUSR1, [](int) { simEthToggles()++; });
+        }
+    }
+
+private:
+    double hz_ = 14000000;
+    double debt_us_ = 0;      // SPI time not yet charged (delay() has ms resolution)
+    unsigned long t0_ = 0;
+    bool link_ = true;
+    std::vector<std::pair<unsigned long, bool>> schedule_;
+};
+
+class EthernetClass {
+public:
+    void init(uint8_t cs) {}
+    // DHCP. Returns 1 with a lease, 0 without (no chip, no link, no answer).
+    int begin(uint8_t* mac, unsigned long timeout = 60000, unsigned long responseTimeout = 4000) {
+        SimW5500& w = SimW5500::get();
+        if (!w.powered) {
+            w.powered = true;
+            delay(560);       // the library waits out the shield's reset pulse once
+        }
+        w.spi(4, 4);          // VERSIONR probe + mode reset
+        if (!w.present) {
+            std::cout << "[ETH] No W5500 (SIM_ETH=1 fits the shield)" << std::endl;
+            return 0;
+        }
+        char m[18];
+        snprintf(m, sizeof(m), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        std::cout << "[ETH] W5500 MAC " << m << ", DHCP..." << std::endl;
+        w.leased = false;
+        if (!w.link()) {
+            delay(timeout);
+            std::cout << "[ETH] DHCP timeout (no link)" << std::endl;
+            return 0;
+        }
+        // DISCOVER/OFFER and REQUEST/ACK: ~300-byte UDP datagrams through the
+        // socket buffers; a lost one waits for the response timeout.
+        SimNet& net = SimNet::get();
+        unsigned long t0 = millis();
+        for (int exchange = 0; exchange < 2; exchange++) {
+            while (net.lost()) {
+                delay(responseTimeout);
+                if (millis() - t0 >= timeout) { std::cout << "[ETH] DHCP timeout" << std::endl; return 0; }
             }
+            w.spi(20, 600);
+            delay(net.rtt());
+        }
+        w.leased = true;
+        std::cout << "[ETH] Lease " << w.ip.toString() << " (" << millis() - t0 << " ms)" << std::endl;
+        return 1;
+    }
+    EthernetHardwareStatus hardwareStatus() {
+        return SimW5500::get().present ? EthernetW5500 : EthernetNoHardware;
+    }
+    EthernetLinkStatus linkStatus() {
+        SimW5500& w = SimW5500::get();
+        if (!w.present) return Unknown;
+        w.spi(1, 1);          // PHYCFGR
+        return w.link() ? LinkON : LinkOFF;
+    }
+    IPAddress localIP() {
+        SimW5500& w = SimW5500::get();
+        return w.leased ? w.ip : IPAddress();
+    }
+    int maintain() { return 0; }   // DHCP_CHECK_NONE: the emulated lease never expires
+};
+static EthernetClass Ethernet __attribute__((unused));
+
+// One TCP socket on the W5500. Like the library's, available() and read()
+// never wait for the server; a stall longer than setTimeout() is treated as
+// a dead connection.
+class EthernetClient : public Stream {
+public:
+    ~EthernetClient() { close(); }
+
+    void setTimeout(unsigned long ms) { timeout_ = ms; }
+    void setConnectionTimeout(uint16_t ms) { connTimeout_ = ms; }
 
-            payload = readBuffer;
-            return (int)httpCode;
+    int connect(IPAddress ip, uint16_t port) { return connect(ip.toString().c_str(), port); }
+    int connect(const char* host, uint16_t port) {
+        SimW5500& w = SimW5500::get();
+        SimNet& net = SimNet::get();
+        stop();
+        t0_ = millis();
+        spi0_ = w.spi_us;
+        if (!w.present || !w.leased) return 0;
+        if (!w.link()) { delay(connTimeout_); return 0; }
+
+        IPAddress numeric;
+        if (!numeric.fromString(host)) {
+            w.spi(25, 150);   // DNS query over a UDP socket
+            delay(net.rtt());
+        }
+        addrinfo hints = {}, *res = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &res) != 0 || !res) {
+            std::cout << "[ETH] DNS failed for " << host << std::endl;
+            return 0;
         }
-        return 500;
+
+        // socketBegin (close, MR, PORT, OPEN, SR) + socketConnect (DIPR, DPORT, CONNECT).
+        w.spi(11, 17);
+        if (net.refused()) { delay(net.rtt()); freeaddrinfo(res); return 0; }
+        unsigned long wait = net.rtt(), syn = 200;   // W5500 RTR default: 200 ms
+        while (net.lost()) { wait += syn; syn *= 2; }
+        if (wait >= connTimeout_) { delay(connTimeout_); freeaddrinfo(res); return 0; }
+
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int flags = fcntl(fd_, F_GETFL, 0);
+        fcntl(fd_, F_SETFL, flags | O_NONBLOCK);
+        int rc = ::connect(fd_, res->ai_addr, res->ai_addrlen);
+        freeaddrinfo(res);
+        if (rc != 0 && errno == EINPROGRESS) {
+            pollfd p = {fd_, POLLOUT, 0};
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (poll(&p, 1, (int)connTimeout_) == 1) getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+            else err = ETIMEDOUT;
+            rc = err ? -1 : 0;
+        }
+        if (rc != 0) { close(); return 0; }
+        delay(wait + 1);      // the library polls Sn_SR once per ms
+        w.spi((unsigned)wait + 1, wait + 1);
+        return 1;
     }
-    
-    Stream& getStream() {
-        if (stream) delete stream;
-        stream = new StringStream(payload);
-        return *stream;
+
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* data, size_t n) override {
+        if (fd_ < 0) return 0;
+        SimW5500& w = SimW5500::get();
+        SimNet& net = SimNet::get();
+        size_t sent = 0;
+        while (sent < n) {
+            // TX_FSR (read twice), TX_WR, data, TX_WR, SEND + poll, IR poll + clear.
+            size_t chunk = std::min(n - sent, (size_t)w.buf);
+            w.spi(9, chunk + 12);
+            if (!w.link()) { delay(timeout_); close(); return sent; }
+            delay(net.transferMs(chunk));
+            if (sent + chunk < n) delay(net.rtt());   // TX buffer full until ACKed
+            if (::send(fd_, data + sent, chunk, MSG_NOSIGNAL) != (ssize_t)chunk) { close(); return sent; }
+            sent += chunk;
+        }
+        tx_ += n;
+        return n;
     }
-    
-    void end() {
-        if (stream) { delete stream; stream = nullptr; }
+
+    // RX_RSR (read until stable). Taking in the next buffer-full costs its
+    // network time, see fill().
+    int available() override {
+        if (fd_ < 0) return 0;
+        SimW5500::get().spi(2, 4);
+        if (rxPos_ >= chipEnd_) fill();
+        return (int)(chipEnd_ - rxPos_);
     }
-    
+
+    // socketRecv(): one SPI frame for the data, and RX_RD + RECV once 250
+    // bytes have been taken or the buffer is drained.
+    int read(uint8_t* buf, size_t n) {
+        size_t k = std::min(n, chipEnd_ - rxPos_);
+        if (k == 0) return -1;
+        SimW5500& w = SimW5500::get();
+        w.spi(1, k);
+        memcpy(buf, rx_.data() + rxPos_, k);
+        rxPos_ += k;
+        sinceRecv_ += k;
+        if (sinceRecv_ > SimW5500::RECV_BATCH || rxPos_ == chipEnd_) {
+            w.spi(3, 4);      // RX_RD + RECV + command poll
+            sinceRecv_ = 0;
+        }
+        return (int)k;
+    }
+    int read() override {
+        uint8_t b;
+        return read(&b, 1) == 1 ? b : -1;
+    }
+    int peek() override { return rxPos_ < chipEnd_ ? (unsigned char)rx_[rxPos_] : -1; }
+    void flush() {}
+
+    // Established, or closed by the peer with data still to read.
+    uint8_t connected() {
+        if (fd_ < 0) return 0;
+        if (rxPos_ < rx_.size() || stalled_) return 1;
+        pull(0);
+        return eof_ ? 0 : 1;
+    }
+
+    void stop() {
+        if (fd_ < 0) return;
+        SimW5500& w = SimW5500::get();
+        w.spi(4, 4);          // DISCON + wait for Sn_SR CLOSED
+        if (w.link()) delay(SimNet::get().rtt());
+        long ms = (long)(millis() - t0_), spi = (long)((w.spi_us - spi0_) / 1000);
+        std::cout << "[ETH] " << tx_ << " B out, " << rxPos_ << " B in, " << ms << " ms (SPI "
+                  << spi << " ms)" << std::endl;
+        SIM_EVENT("eth_http", {{"ms", ms}, {"spi_ms", spi}, {"tx", (long)tx_}, {"rx", (long)rxPos_}});
+        if (simHttpObserver()) simHttpObserver()(simHttpStatus(rx_), (unsigned long)ms * 1000);
+        close();
+    }
+
 private:
-    String url;
-    String user, pass;
-    std::vector<std::string> reqHeaders;
-    std::map<std::string, std::string> respHeaders;
-
-    static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp) {
-        ((std::string*)userp)->append((char*)contents, size * nmemb);
-        return size * nmemb;
-    }
-
-    static size_t HeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata) {
-        size_t len = size * nitems;
-        std::string line(buffer, len);
-        auto pos = line.find(':');
-        if (pos != std::string::npos) {
-            std::string key = line.substr(0, pos);
-            std::string val = line.substr(pos + 1);
-            for (auto &c : key) c = (char)tolower(c);
-            size_t a = val.find_first_not_of(" \t");
-            size_t b = val.find_last_not_of("\r\n \t");
-            if (a != std::string::npos) val = val.substr(a, b - a + 1); else val.clear();
-            (*(std::map<std::string, std::string>*)userdata)[key] = val;
-        }
-        return len;
+    // Moves up to one socket buffer of what the server sent into the chip,
+    // charging the network time it takes to arrive. Nothing arrives without
+    // link.
+    bool fill() {
+        SimW5500& w = SimW5500::get();
+        SimNet& net = SimNet::get();
+        if (stalled_ || !w.link()) return false;
+        if (rxPos_ >= rx_.size()) pull(1);
+        if (rxPos_ >= rx_.size()) return false;
+        size_t win = std::min(rx_.size() - rxPos_, (size_t)w.buf);
+        unsigned long gap = net.transferMs(win);
+        if (chipEnd_ == 0 || lastWin_ == w.buf) gap += net.rtt();   // request, or window reopened
+        if (net.lost()) gap += net.rto();
+        if (gap >= timeout_) { delay(timeout_); stalled_ = true; return false; }
+        delay(gap);
+        chipEnd_ = rxPos_ + win;
+        lastWin_ = win;
+        return true;
+    }
+
+    // Appends whatever the socket has within `ms`.
+    void pull(int ms) {
+        pollfd p = {fd_, POLLIN, 0};
+        if (poll(&p, 1, ms) != 1) return;
+        char buf[16384];
+        ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+        if (n > 0) rx_.append(buf, (size_t)n);
+        else if (n == 0 || (errno != EAGAIN && errno != EINTR)) eof_ = true;
     }
+
+    void close() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        rx_.clear();
+        rxPos_ = chipEnd_ = lastWin_ = 0;
+        sinceRecv_ = 0;
+        tx_ = 0;
+        eof_ = stalled_ = false;
+    }
+
+    int fd_ = -1;
+    std::string rx_;          // bytes the server sent so far
+    size_t rxPos_ = 0;        // next byte the firmware reads
+    size_t chipEnd_ = 0;      // rx_ up to here is in the W5500's RX buffer
+    size_t lastWin_ = 0;
+    unsigned sinceRecv_ = 0;
+    size_t tx_ = 0;
+    bool eof_ = false;
+    bool stalled_ = false;    // a gap outlasted the timeout: the link is dead to us
+    unsigned long timeout_ = 1000, connTimeout_ = 1000;
+    unsigned long t0_ = 0;
+    double spi0_ = 0;
 };
 
 // Mock specific ESP32 macros/functions
 #define WRITE_PERI_REG(reg, val)
 #define RTC_CNTL_BROWN_OUT_REG 0
 
+// FreeRTOS (queues, mutexes, tasks) and the MQTT client; both need SimDevice
+// and millis() from above.
+#include "SimRtos.h"
+#include "SimMqtt.h"
+#include "SimOta.h"
+#include "SimPower.h"
+#include "SimSha1.h"
+
 // Include ArduinoJson (Header only)
 // Note: In real world we would need to download it or expect it in include path.
 // For the sake of this demo, we will try to include it.
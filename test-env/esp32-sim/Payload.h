@@ -0,0 +1,158 @@
+// Synthetic icingadb-web replies for the parser scaling benchmark (scale.cpp):
+// what the device gets when someone drops limit=1 from a URL and thousands of
+// problems come back, or objects carry long plugin output and custom vars.
+//
+// Objects follow the real API's shape and field order (BenchKit.h's fixtures
+// are trimmed copies of real replies): the fields the firmware reads sit in
+// the middle of each object, after ~40 it doesn't. `bloat` adds about that
+// many bytes per object, split between multi-line plugin output (with escapes
+// and a \u sequence, as check_* plugins produce), performance data and a
+// nested "vars" object. Deterministic for a given seed.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+struct Payload {
+    std::string json;
+    std::string first_label;   // what the firmware should show: "host!service" / "host"
+    std::string first_next_check;
+};
+
+class PayloadGen {
+public:
+    explicit PayloadGen(unsigned seed) : s_(seed ? seed : 1) {}
+
+    // `count` unhandled problems (0 = the empty array) of `hosts` or services.
+    Payload make(bool hosts, int count, int bloat) {
+        Payload p;
+        p.json.reserve(64 + (size_t)count * (hosts ? 900 : 1900) + (size_t)count * bloat);
+        p.json += '[';
+        for (int i = 0; i < count; i++) {
+            if (i) p.json += ',';
+            std::string host = pick(kHosts) + "-" + num(1 + next() % 40, 2);
+            std::string svc = pick(kServices);
+            std::string when = stamp(next() % 3600);
+            if (i == 0) {
+                p.first_label = hosts ? host : host + "!" + svc;
+                p.first_next_check = when;
+            }
+            if (hosts) hostObj(p.json, host, when, bloat);
+            else serviceObj(p.json, host, svc, when, bloat);
+        }
+        p.json += ']';
+        return p;
+    }
+
+private:
+    uint32_t s_;
+
+    uint32_t next() {               // xorshift32
+        s_ ^= s_ << 13;
+        s_ ^= s_ >> 17;
+        s_ ^= s_ << 5;
+        return s_;
+    }
+
+    template <size_t N>
+    std::string pick(const char* const (&list)[N]) { return list[next() % N]; }
+
+    static std::string num(unsigned v, int width) {
+        char b[16];
+        snprintf(b, sizeof(b), "%0*u", width, v);
+        return b;
+    }
+
+    static std::string stamp(unsigned offset_s) {
+        char b[32];
+        snprintf(b, sizeof(b), "2026-06-13T%02u:%02u:%02u+00:00", 7 + offset_s / 3600, (offset_s / 60) % 60, offset_s % 60);
+        return b;
+    }
+
+    std::string hex(int n) {
+        static const char* d = "0123456789abcdef";
+        std::string s;
+        for (int i = 0; i < n; i++) s += d[next() % 16];
+        return s;
+    }
+
+    // About `n` bytes of plugin output: lines of text, a quoted word, a tab
+    // and a \u escape now and then, as JSON string content.
+    std::string output(int n) {
+        std::string s;
+        while ((int)s.size() < n) {
+            switch (next() % 6) {
+                case 0: s += "CRITICAL - Socket timeout after 10 seconds\\n"; break;
+                case 1: s += "HTTP/1.1 503 Service Unavailable - 512 bytes in 0.004 second response time\\n"; break;
+                case 2: s += "disk \\\"/var\\\" usage 97% (3.1 GiB free)\\t"; break;
+                case 3: s += "connection refused by 10.0.4." + std::to_string(next() % 250) + ":" + std::to_string(1024 + next() % 60000) + "\\n"; break;
+                case 4: s += "temp 81\\u00b0C over threshold\\n"; break;
+                default: s += "check_by_ssh: Remote command execution failed: exit 255\\n"; break;
+            }
+        }
+        return s;
+    }
+
+    std::string perfdata(int n) {
+        std::string s;
+        for (int i = 0; (int)s.size() < n; i++)
+            s += "m" + std::to_string(i) + "=" + std::to_string(next() % 10000) + "ms;3000;5000;0 ";
+        return s;
+    }
+
+    // Custom vars, a couple of levels deep, arrays included (~n bytes).
+    std::string vars(int n) {
+        std::string s = "{";
+        for (int i = 0; (int)s.size() < n; i++) {
+            if (i) s += ',';
+            s += "\"var_" + std::to_string(i) + "\":{\"owner\":\"team-" + pick(kTeams) + "\",\"tags\":[\"" +
+                 pick(kTeams) + "\",\"tier-" + std::to_string(next() % 4) + "\"],\"sla\":" +
+                 std::to_string(90 + next() % 10) + "." + std::to_string(next() % 10) + ",\"paged\":" +
+                 (next() % 2 ? "true" : "false") + ",\"runbook\":null}";
+        }
+        return s + "}";
+    }
+
+    void serviceObj(std::string& o, const std::string& host, const std::string& svc, const std::string& next_check, int bloat) {
+        std::string env = hex(12), hid = hex(6);
+        o += "{\"checkcommand_name\":\"" + svc + "\",\"environment_id\":\"" + env + "\",\"host_id\":\"" + hid +
+             "\",\"id\":\"" + hex(10) + "\",\"name\":\"" + svc + "\",\"name_ci\":\"" + svc + "\",\"display_name\":\"" + svc +
+             "\",\"icon_image_alt\":\"\",\"notes\":\"\",\"notes_url\":null,\"action_url\":null,"
+             "\"active_checks_enabled\":\"y\",\"passive_checks_enabled\":\"y\",\"event_handler_enabled\":\"y\","
+             "\"notifications_enabled\":\"y\",\"flapping_enabled\":\"n\",\"perfdata_enabled\":\"y\",\"is_volatile\":\"n\","
+             "\"check_interval\":60,\"check_retry_interval\":30,\"max_check_attempts\":3,\"check_timeout\":null,"
+             "\"command_endpoint_name\":null,\"vars\":" + vars(bloat / 4) + ","
+             "\"host\":{\"id\":\"" + hid + "\",\"name\":\"" + host + ".example.net\",\"display_name\":\"" + host +
+             "\",\"address\":\"10.0.4." + std::to_string(next() % 250) + "\",\"address6\":\"\",\"checkcommand_name\":\"hostalive\","
+             "\"state\":{\"soft_state\":0,\"hard_state\":0,\"is_problem\":\"n\",\"is_handled\":\"n\",\"is_reachable\":\"y\"}},"
+             "\"state\":{\"environment_id\":\"" + env + "\",\"state_type\":\"hard\",\"soft_state\":2,\"hard_state\":2,"
+             "\"previous_soft_state\":0,\"previous_hard_state\":0,\"attempt\":3,\"severity\":2176,"
+             "\"output\":\"" + output(40 + bloat / 2) + "\",\"long_output\":\"\",\"performance_data\":\"" + perfdata(30 + bloat / 4) +
+             "\",\"normalized_performance_data\":\"\",\"check_commandline\":\"'/usr/lib/nagios/plugins/check_" + svc +
+             "' '-H' '10.0.4.21' '-t' '10'\",\"is_problem\":\"y\",\"is_handled\":\"n\",\"is_reachable\":\"y\","
+             "\"is_flapping\":\"n\",\"is_overdue\":\"n\",\"is_acknowledged\":\"n\",\"acknowledgement_comment_id\":null,"
+             "\"last_comment_id\":null,\"in_downtime\":\"n\",\"execution_time\":" + std::to_string(next() % 20000) +
+             ",\"latency\":1,\"check_source\":\"icinga2\",\"scheduling_source\":\"icinga2\","
+             "\"last_update\":\"2026-06-13T07:29:58+00:00\",\"last_state_change\":\"2026-06-13T07:21:04+00:00\","
+             "\"next_check\":\"" + next_check + "\",\"next_update\":\"2026-06-13T07:31:58+00:00\"}}";
+    }
+
+    void hostObj(std::string& o, const std::string& host, const std::string& next_check, int bloat) {
+        o += "{\"checkcommand_name\":\"hostalive\",\"environment_id\":\"" + hex(12) + "\",\"id\":\"" + hex(6) +
+             "\",\"name\":\"" + host + ".example.net\",\"display_name\":\"" + host + "\",\"address\":\"10.0.4." +
+             std::to_string(next() % 250) + "\",\"address6\":\"\",\"active_checks_enabled\":\"y\","
+             "\"passive_checks_enabled\":\"y\",\"check_interval\":60,\"check_retry_interval\":30,\"max_check_attempts\":3,"
+             "\"vars\":" + vars(bloat / 4) + ","
+             "\"state\":{\"state_type\":\"hard\",\"soft_state\":1,\"hard_state\":1,\"attempt\":3,\"severity\":2048,"
+             "\"output\":\"" + output(30 + bloat / 2) + "\",\"performance_data\":\"" + perfdata(30 + bloat / 4) +
+             "\",\"is_problem\":\"y\",\"is_handled\":\"n\",\"is_reachable\":\"y\",\"is_flapping\":\"n\","
+             "\"is_acknowledged\":\"n\",\"in_downtime\":\"n\",\"last_state_change\":\"2026-06-13T06:58:41+00:00\","
+             "\"next_check\":\"" + next_check + "\"}}";
+    }
+
+    static constexpr const char* const kHosts[] = { "web", "db", "cache", "lb", "mq", "k8s-node", "backup", "mail" };
+    static constexpr const char* const kServices[] = { "http", "https-cert", "disk-var", "load", "swap", "ntp",
+                                                       "postgres-replication", "smtp", "ping6", "procs-zombie" };
+    static constexpr const char* const kTeams[] = { "ops", "dba", "web", "net", "storage" };
+};
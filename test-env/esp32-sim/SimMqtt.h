@@ -0,0 +1,236 @@
+#pragma once
+
+// Mock PubSubClient (knolleary/PubSubClient 2.8): the subset the sketch uses -
+// connect with a last will, QoS 0 publish, keep-alive - speaking real MQTT
+// 3.1.1 to a broker, so the sim can be watched with mosquitto_sub.
+//
+// The library runs over whatever Client the sketch hands to setClient(); the
+// mock opens its own blocking POSIX socket instead (the WiFi / W5500 mocks
+// model one HTTP exchange per connection, not a long-lived session). Every
+// wait is sliced so a rebooting device's task unwinds (simTaskCheck(),
+// SimRtos.h). Included from MockESP.h after SimRtos.h.
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+#define MQTT_CONNECT_BAD_PROTOCOL    1
+#define MQTT_CONNECT_BAD_CLIENT_ID   2
+#define MQTT_CONNECT_UNAVAILABLE     3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED    5
+
+class PubSubClient {
+public:
+    PubSubClient() {}
+    ~PubSubClient() { drop(MQTT_DISCONNECTED); }
+
+    template <class C> PubSubClient& setClient(C&) { return *this; }
+    PubSubClient& setServer(const char* host, uint16_t port) { host_ = host; port_ = port; return *this; }
+    PubSubClient& setKeepAlive(uint16_t s) { keepAlive_ = s; return *this; }
+    PubSubClient& setSocketTimeout(uint16_t s) { timeout_ = s; return *this; }
+    bool setBufferSize(uint16_t n) { bufferSize_ = n; return true; }
+
+    bool connect(const char* id, const char* user, const char* pass, const char* willTopic,
+                 uint8_t willQos, bool willRetain, const char* willMessage) {
+        drop(MQTT_DISCONNECTED);
+        if (!open()) { state_ = MQTT_CONNECT_FAILED; return false; }
+
+        std::string v;
+        str(v, "MQTT");
+        v += (char)4;                                     // protocol level 3.1.1
+        uint8_t flags = 0x02;                             // clean session
+        if (willTopic) flags |= 0x04 | (willQos << 3) | (willRetain ? 0x20 : 0);
+        if (user) flags |= 0x80;
+        if (pass) flags |= 0x40;
+        v += (char)flags;
+        v += (char)(keepAlive_ >> 8);
+        v += (char)keepAlive_;
+        str(v, id);
+        if (willTopic) { str(v, willTopic); str(v, willMessage); }
+        if (user) str(v, user);
+        if (pass) str(v, pass);
+        if (!sendPacket(0x10, v)) { drop(MQTT_CONNECT_FAILED); return false; }
+
+        uint8_t type;
+        std::string ack;
+        if (!readPacket(type, ack, timeout_ * 1000)) { drop(MQTT_CONNECTION_TIMEOUT); return false; }
+        if (type != 0x20 || ack.size() < 2 || ack[1] != 0) {
+            drop(ack.size() >= 2 ? ack[1] : MQTT_CONNECT_FAILED);
+            return false;
+        }
+        state_ = MQTT_CONNECTED;
+        lastOut_ = lastIn_ = millis();
+        std::cout << "[MQTT] connected to " << host_ << ":" << port_ << " as " << id << std::endl;
+        return true;
+    }
+
+    bool publish(const char* topic, const char* payload, bool retained) {
+        if (!connected()) return false;
+        std::string v;
+        str(v, topic);
+        v += payload;
+        if (5 + v.size() > bufferSize_) return false;      // as the library: won't fit its buffer
+        return sendPacket(retained ? 0x31 : 0x30, v);
+    }
+
+    // Keep-alive as the library does it: after keepAlive_ s without traffic
+    // either way send PINGREQ; if that one is still unanswered by then, the
+    // session is dead.
+    bool loop() {
+        if (!connected()) return false;
+        unsigned long now = millis();
+        uint8_t type;
+        std::string body;
+        while (readable(0)) {
+            if (!readPacket(type, body, timeout_ * 1000)) { drop(MQTT_CONNECTION_LOST); return false; }
+            lastIn_ = now;
+            pingOut_ = false;
+        }
+        unsigned long ka = keepAlive_ * 1000UL;
+        if (now - lastIn_ > ka || now - lastOut_ > ka) {
+            if (pingOut_) { drop(MQTT_CONNECTION_TIMEOUT); return false; }
+            if (!sendPacket(0xC0, "")) return false;
+            pingOut_ = true;
+        }
+        return true;
+    }
+
+    bool connected() { return fd_ >= 0 && state_ == MQTT_CONNECTED; }
+    int state() { return state_; }
+
+    void disconnect() {
+        if (fd_ >= 0) sendPacket(0xE0, "");
+        drop(MQTT_DISCONNECTED);
+    }
+
+private:
+    bool open() {
+        addrinfo hints = {}, *res = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (host_.empty() || getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &res) != 0 || !res) {
+            std::cout << "[MQTT] cannot resolve " << host_ << std::endl;
+            return false;
+        }
+        fd_ = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int rc = fd_ < 0 ? -1 : ::connect(fd_, res->ai_addr, res->ai_addrlen);
+        freeaddrinfo(res);
+        if (rc < 0 && errno == EINPROGRESS) {
+            int err = -1;
+            socklen_t len = sizeof(err);
+            if (wait(false, timeout_ * 1000)) getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+            rc = err == 0 ? 0 : -1;
+        }
+        if (rc < 0) {
+            std::cout << "[MQTT] connect to " << host_ << ":" << port_ << " failed" << std::endl;
+            if (fd_ >= 0) ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return true;
+    }
+
+    void drop(int state) {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        state_ = state;
+        pingOut_ = false;
+    }
+
+    static void str(std::string& v, const char* s) {
+        size_t n = strlen(s);
+        v += (char)(n >> 8);
+        v += (char)n;
+        v += s;
+    }
+
+    bool sendPacket(uint8_t header, const std::string& v) {
+        std::string p(1, (char)header);
+        size_t n = v.size();
+        do {
+            uint8_t b = n % 128;
+            n /= 128;
+            p += (char)(n ? b | 0x80 : b);
+        } while (n);
+        p += v;
+        size_t off = 0;
+        while (off < p.size()) {
+            if (!wait(false, timeout_ * 1000)) { drop(MQTT_CONNECTION_LOST); return false; }
+            ssize_t k = send(fd_, p.data() + off, p.size() - off, MSG_NOSIGNAL);
+            if (k < 0 && errno == EAGAIN) continue;
+            if (k <= 0) { drop(MQTT_CONNECTION_LOST); return false; }
+            off += k;
+        }
+        lastOut_ = millis();
+        return true;
+    }
+
+    bool readPacket(uint8_t& type, std::string& body, unsigned long ms) {
+        uint8_t b;
+        if (!readFull(&b, 1, ms)) return false;
+        type = b & 0xF0;
+        size_t len = 0, mul = 1;
+        do {
+            if (!readFull(&b, 1, ms)) return false;
+            len += (b & 0x7F) * mul;
+            mul *= 128;
+        } while ((b & 0x80) && mul <= 128 * 128 * 128);
+        body.resize(len);
+        return len == 0 || readFull((uint8_t*)&body[0], len, ms);
+    }
+
+    bool readFull(uint8_t* p, size_t n, unsigned long ms) {
+        while (n) {
+            if (!wait(true, ms)) return false;
+            ssize_t k = recv(fd_, p, n, 0);
+            if (k < 0 && errno == EAGAIN) continue;
+            if (k <= 0) return false;
+            p += k;
+            n -= k;
+        }
+        return true;
+    }
+
+    bool readable(int ms) {
+        pollfd p = {fd_, POLLIN, 0};
+        return poll(&p, 1, ms) == 1;
+    }
+
+    // Up to `ms` for the socket, in slices a stopping task notices.
+    bool wait(bool in, unsigned long ms) {
+        unsigned long t0 = millis();
+        for (;;) {
+            simTaskCheck();
+            pollfd p = {fd_, (short)(in ? POLLIN : POLLOUT), 0};
+            if (poll(&p, 1, 20) == 1) return true;
+            if (millis() - t0 >= ms) return false;
+        }
+    }
+
+    std::string host_;
+    uint16_t port_ = 1883;
+    uint16_t keepAlive_ = 15;      // MQTT_KEEPALIVE
+    uint16_t timeout_ = 15;        // MQTT_SOCKET_TIMEOUT, seconds
+    uint16_t bufferSize_ = 256;    // MQTT_MAX_PACKET_SIZE
+    int fd_ = -1;
+    int state_ = MQTT_DISCONNECTED;
+    bool pingOut_ = false;
+    unsigned long lastOut_ = 0, lastIn_ = 0;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+// Network condition emulation for the simulator's HTTP layer. Thread-safe, as
+// fleet mode issues requests from many threads.
+//
+// The mock WiFiClient (MockESP.h) still talks to the real server through
+// libcurl, but the bytes it hands to the firmware are released on the schedule
+// a real link would produce: connection setup costs round trips, segments are
+// paced by the link bandwidth, lost segments wait for a retransmission timeout
+// and new connections can be refused. The firmware's own timeouts are applied
+// to those emulated gaps, so slow links and timeouts show up exactly where the
+// device would notice them.
+//
+// Selected by environment variables (read once, at the first request):
+//   SIM_NET_PROFILE   ideal | lan | wifi | bad-wifi | congested-vpn | gprs
+//   SIM_NET_LATENCY_MS, SIM_NET_JITTER_MS, SIM_NET_BW (bytes/s, 0 = unlimited),
+//   SIM_NET_LOSS, SIM_NET_REFUSE (probabilities 0..1) override single fields.
+//   SIM_NET_SEED      RNG seed, for reproducible runs.
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <mutex>
+#include <cstdlib>
+
+struct NetProfile {
+    std::string name;
+    unsigned long latency_ms;   // one-way delay
+    unsigned long jitter_ms;    // uniform +/- jitter applied to each one-way trip
+    unsigned long bandwidth;    // downstream bytes/s, 0 = unlimited
+    double loss;                // per-segment loss probability
+    double refuse;              // probability that a NEW connection is refused
+};
+
+class SimNet {
+public:
+    static const unsigned MSS = 1460;           // bytes per emulated TCP segment
+    static const unsigned long SYN_RTO_MS = 1000; // initial SYN retransmit timeout (Linux/lwIP)
+
+    static SimNet& get() {
+        static SimNet net;
+        return net;
+    }
+
+    static const NetProfile* byName(const std::string& n) {
+        static const NetProfile profiles[] = {
+            // name             lat  jit   bytes/s   loss   refuse
+            { "ideal",            0,   0,        0, 0.000, 0.00 },
+            { "lan",              1,   0, 12500000, 0.000, 0.00 },
+            { "wifi",             4,   3,  2500000, 0.001, 0.00 },
+            { "bad-wifi",        60,  50,    60000, 0.050, 0.02 },
+            { "congested-vpn",  180,  90,    30000, 0.020, 0.01 },
+            { "gprs",           400, 150,     5000, 0.030, 0.05 },
+        };
+        for (const auto& p : profiles) if (p.name == n) return &p;
+        return nullptr;
+    }
+
+    const NetProfile& profile() const { return p_; }
+    bool ideal() const {
+        return p_.latency_ms == 0 && p_.jitter_ms == 0 && p_.bandwidth == 0 &&
+               p_.loss <= 0 && p_.refuse <= 0;
+    }
+
+    // One one-way trip, jitter included.
+    unsigned long oneWay() {
+        std::lock_guard<std::mutex> lock(mu_);
+        long d = (long)p_.latency_ms;
+        if (p_.jitter_ms) {
+            std::uniform_int_distribution<long> j(-(long)p_.jitter_ms, (long)p_.jitter_ms);
+            d += j(rng_);
+        }
+        return d < 0 ? 0 : (unsigned long)d;
+    }
+    unsigned long rtt() { return oneWay() + oneWay(); }
+
+    // Retransmission timeout for a lost data segment (RFC 6298 floor of 200ms
+    // as used by lwIP/Linux, or two base RTTs on slow links).
+    unsigned long rto() const {
+        unsigned long r = 4 * p_.latency_ms;
+        return r < 200 ? 200 : r;
+    }
+
+    bool lost()    { return chance(p_.loss); }
+    bool refused() { return chance(p_.refuse); }
+
+    // Time to push n bytes through the link.
+    unsigned long transferMs(unsigned long n) const {
+        return p_.bandwidth ? (n * 1000UL + p_.bandwidth - 1) / p_.bandwidth : 0;
+    }
+
+private:
+    SimNet() {
+        const char* name = getenv("SIM_NET_PROFILE");
+        const NetProfile* base = byName(name && *name ? name : "ideal");
+        if (!base) {
+            std::cout << "[NET] Unknown SIM_NET_PROFILE '" << name << "', using ideal" << std::endl;
+            base = byName("ideal");
+        }
+        p_ = *base;
+        p_.latency_ms = envULong("SIM_NET_LATENCY_MS", p_.latency_ms);
+        p_.jitter_ms  = envULong("SIM_NET_JITTER_MS", p_.jitter_ms);
+        p_.bandwidth  = envULong("SIM_NET_BW", p_.bandwidth);
+        p_.loss       = envDouble("SIM_NET_LOSS", p_.loss);
+        p_.refuse     = envDouble("SIM_NET_REFUSE", p_.refuse);
+        rng_.seed(envULong("SIM_NET_SEED", std::random_device{}()));
+        if (!ideal()) {
+            std::cout << "[NET] Profile " << p_.name << ": latency " << p_.latency_ms
+                      << "+/-" << p_.jitter_ms << " ms, "
+                      << (p_.bandwidth ? std::to_string(p_.bandwidth) + " B/s" : std::string("unlimited"))
+                      << ", loss " << p_.loss * 100 << "%, refuse " << p_.refuse * 100 << "%"
+                      << std::endl;
+        }
+    }
+
+    bool chance(double p) {
+        if (p <= 0) return false;
+        std::lock_guard<std::mutex> lock(mu_);
+        std::uniform_real_distribution<double> u(0.0, 1.0);
+        return u(rng_) < p;
+    }
+
+    static unsigned long envULong(const char* k, unsigned long def) {
+        const char* v = getenv(k);
+        return (v && *v) ? strtoul(v, nullptr, 10) : def;
+    }
+    static double envDouble(const char* k, double def) {
+        const char* v = getenv(k);
+        return (v && *v) ? strtod(v, nullptr) : def;
+    }
+
+    NetProfile p_;
+    std::mt19937 rng_;
+    std::mutex mu_;
+};
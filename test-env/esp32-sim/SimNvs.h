@@ -0,0 +1,355 @@
+#pragma once
+
+// NVS (non-volatile storage) emulation behind the mock Preferences.
+//
+// Keeps the byte layout of ESP-IDF's NVS partition: 4 KB pages, each a 32-byte
+// header (state, sequence number, version, CRC), a 32-byte entry-state bitmap
+// (2 bits per entry: empty / written / erased) and 126 32-byte entries. An
+// item is one entry (key, namespace, type, 8 data bytes); a string adds one
+// entry per 32 bytes of text. Items are appended to the active page; updating
+// a key writes the new item first and then marks the old one erased. When the
+// active page is full the next empty page becomes active; one page is always
+// kept free, and when only that one is left the full page with the most erased
+// entries is compacted into it and erased. Writing a value that is already
+// stored is skipped, as ESP-IDF does.
+//
+// Every flash program and sector erase is counted per page, so wear and the
+// cost of a settings save can be measured.
+//
+// SIM_NVS=<file>   persist the partition image there (and wear counters in
+//                  <file>.wear); unset = in memory, lost on exit.
+// SIM_NVS_PAGES    partition size in pages (default 5, the Arduino default
+//                  "nvs" partition of 0x5000 bytes).
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class SimNvs {
+public:
+    static const size_t PAGE = 4096;
+    static const int ENTRIES = 126;
+    static const size_t ENTRY = 32;
+
+    enum Type : uint8_t { U8 = 0x01, I32 = 0x14, U32 = 0x04, STR = 0x21 };
+
+    struct Wear {
+        unsigned long erases = 0;     // sector erases
+        unsigned long programs = 0;   // program operations (header, bitmap, entries)
+        unsigned long bytes = 0;      // bytes programmed
+    };
+    struct Totals {
+        unsigned long erases = 0, programs = 0, bytes = 0, skipped = 0;
+    };
+
+    SimNvs(const std::string& path, size_t pages) : path_(path), pages_(pages < 2 ? 2 : pages) {
+        img_.assign(pages_, Page());
+        wear_.assign(pages_, Wear());
+        for (auto& p : img_) p.fill(0xff);
+        if (!path_.empty()) load();
+    }
+
+    // Namespace index for name (created on first use unless readOnly); 0 = none.
+    uint8_t openNamespace(const std::string& name, bool readOnly) {
+        std::lock_guard<std::recursive_mutex> lock(mu_);
+        Ref r = find(0, name);
+        if (r.page >= 0) return entry(r)[24];
+        if (readOnly) return 0;
+        uint8_t next = 1;
+        forEachItem([&](int, int, const uint8_t* e) {
+            if (e[0] == 0 && e[24] >= next) next = e[24] + 1;
+        });
+        uint8_t data[8];
+        memset(data, 0xff, sizeof(data));
+        data[0] = next;
+        return write(0, U8, name, data, nullptr, 0) ? next : 0;
+    }
+
+    bool setU32(uint8_t ns, Type t, const std::string& key, uint32_t v) {
+        std::lock_guard<std::recursive_mutex> lock(mu_);
+        uint8_t data[8];
+        memset(data, 0xff, sizeof(data));
+        memcpy(data, &v, sizeof(v));
+        return write(ns, t, key, data, nullptr, 0);
+    }
+    bool getU32(uint8_t ns, Type t, const std::string& key, uint32_t& v) {
+        std::lock_guard<std::recursive_mutex> lock(mu_);
+        Ref r = find(ns, key);
+        if (r.page < 0 || entry(r)[1] != t) return false;
+        memcpy(&v, entry(r) + 24, sizeof(v));
+        return true;
+    }
+
+    bool setStr(uint8_t ns, const std::string& key, const std::string& s) {
+        std::lock_guard<std::recursive_mutex> lock(mu_);
+        std::string z = s + '\0';
+        uint8_t data[8];
+        uint16_t size = (uint16_t)z.size();
+        uint32_t crc = crc32(z.data(), z.size());
+        memcpy(data, &size, 2);
+        data[2] = data[3] = 0xff;
+        memcpy(data + 4, &crc, 4);
+        return write(ns, STR, key, data, z.data(), z.size());
+    }
+    bool getStr(uint8_t ns, const std::string& key, std::string& s) {
+        std::lock_guard<std::recursive_mutex> lock(mu_);
+        Ref r = find(ns, key);
+        if (r.page < 0 || entry(r)[1] != STR) return false;
+        uint16_t size;
+        memcpy(&size, entry(r) + 24, 2);
+        const char* text = (const char*)(entry(r) + ENTRY);
+        s.assign(text, size ? size - 1 : 0);
+        return true;
+    }
+
+    bool has(uint8_t ns, const std::string& key) {
+        std::lock_guard<std::recursive_mutex> lock(mu_);
+        return find(ns, key).page >= 0;
+    }
+
+    std::vector<Wear> wear() const { std::lock_guard<std::recursive_mutex> lock(mu_); return wear_; }
+    Totals totals() const { std::lock_guard<std::recursive_mutex> lock(mu_); return totals_; }
+    size_t pages() const { return pages_; }
+
+    // Entries in use (written) / total, over the whole partition.
+    int usedEntries() const {
+        std::lock_guard<std::recursive_mutex> lock(mu_);
+        int n = 0;
+        for (size_t p = 0; p < pages_; p++)
+            for (int i = 0; i < ENTRIES; i++) n += entryState((int)p, i) == WRITTEN;
+        return n;
+    }
+
+private:
+    typedef std::array<uint8_t, PAGE> Page;
+    enum : uint32_t { P_EMPTY = 0xffffffff, P_ACTIVE = 0xfffffffe, P_FULL = 0xfffffffc,
+                      P_FREEING = 0xfffffff8 };
+    enum { E_ERASED = 0, WRITTEN = 2, E_EMPTY = 3 };
+    struct Ref { int page = -1, index = -1; };
+
+    // --- raw page access -----------------------------------------------------
+    uint32_t pageState(int p) const { uint32_t s; memcpy(&s, &img_[p][0], 4); return s; }
+    uint32_t pageSeq(int p) const { uint32_t s; memcpy(&s, &img_[p][4], 4); return s; }
+    int entryState(int p, int i) const { return (img_[p][32 + i / 4] >> ((i % 4) * 2)) & 3; }
+    uint8_t* entry(const Ref& r) { return &img_[r.page][64 + r.index * ENTRY]; }
+    uint8_t* entry(int p, int i) { return &img_[p][64 + i * ENTRY]; }
+
+    void program(int p, size_t off, const void* data, size_t n) {
+        const uint8_t* d = (const uint8_t*)data;
+        for (size_t i = 0; i < n; i++) img_[p][off + i] &= d[i];   // flash only clears bits
+        wear_[p].programs++;
+        wear_[p].bytes += n;
+        totals_.programs++;
+        totals_.bytes += n;
+        dirty_ = true;
+    }
+    void setPageState(int p, uint32_t s) { program(p, 0, &s, 4); }
+    void setEntryStates(int p, int from, int count, int state) {
+        // One program per bitmap word touched, as the IDF driver does.
+        for (int w = from / 16; w <= (from + count - 1) / 16; w++) {
+            uint32_t word;
+            memcpy(&word, &img_[p][32 + w * 4], 4);
+            for (int i = from; i < from + count; i++)
+                if (i / 16 == w) word &= ~(3u << ((i % 16) * 2)) | ((uint32_t)state << ((i % 16) * 2));
+            program(p, 32 + w * 4, &word, 4);
+        }
+    }
+    void erasePage(int p) {
+        img_[p].fill(0xff);
+        wear_[p].erases++;
+        totals_.erases++;
+        dirty_ = true;
+    }
+    void initPage(int p, uint32_t seq) {
+        uint8_t h[32];
+        memset(h, 0xff, sizeof(h));
+        uint32_t st = P_ACTIVE;
+        memcpy(h, &st, 4);
+        memcpy(h + 4, &seq, 4);
+        h[8] = 0xfe;                                    // format version 2
+        uint32_t crc = crc32(h + 4, 24);
+        memcpy(h + 28, &crc, 4);
+        program(p, 0, h, sizeof(h));
+    }
+
+    // --- items ---------------------------------------------------------------
+    template <typename F>
+    void forEachItem(F f) {
+        for (int p = 0; p < (int)pages_; p++) {
+            uint32_t st = pageState(p);
+            if (st != P_ACTIVE && st != P_FULL && st != P_FREEING) continue;
+            for (int i = 0; i < ENTRIES;) {
+                if (entryState(p, i) != WRITTEN) { i++; continue; }
+                const uint8_t* e = entry(p, i);
+                f(p, i, e);
+                i += e[2] ? e[2] : 1;
+            }
+        }
+    }
+
+    Ref find(uint8_t ns, const std::string& key) {
+        Ref r;
+        forEachItem([&](int p, int i, const uint8_t* e) {
+            if (e[0] == ns && strncmp((const char*)e + 8, key.c_str(), 16) == 0) { r.page = p; r.index = i; }
+        });
+        return r;
+    }
+
+    int nextFree(int p) const {
+        int i = ENTRIES;
+        while (i > 0 && entryState(p, i - 1) == E_EMPTY) i--;
+        return i;
+    }
+
+    int activePage() {
+        for (int p = 0; p < (int)pages_; p++) if (pageState(p) == P_ACTIVE) return p;
+        return -1;
+    }
+
+    uint32_t maxSeq() const {
+        uint32_t m = 0;
+        for (int p = 0; p < (int)pages_; p++)
+            if (pageState(p) != P_EMPTY && pageSeq(p) >= m) m = pageSeq(p) + 1;
+        return m;
+    }
+
+    // Makes a fresh page active, compacting the most-erased full page into the
+    // reserved free page when it is the only one left.
+    int newPage() {
+        std::vector<int> empty;
+        for (int p = 0; p < (int)pages_; p++) if (pageState(p) == P_EMPTY) empty.push_back(p);
+        if (empty.empty()) return -1;
+        // Least-erased first: freed pages go to the back of the list, as in IDF.
+        std::stable_sort(empty.begin(), empty.end(),
+                         [&](int a, int b) { return wear_[a].erases < wear_[b].erases; });
+        if (empty.size() > 1) {
+            initPage(empty[0], maxSeq());
+            return empty[0];
+        }
+        int victim = -1, most = 0;
+        for (int p = 0; p < (int)pages_; p++) {
+            if (pageState(p) != P_FULL) continue;
+            int erased = 0;
+            for (int i = 0; i < ENTRIES; i++) erased += entryState(p, i) == E_ERASED;
+            if (erased > most) { most = erased; victim = p; }
+        }
+        if (victim < 0) return -1;                      // partition is full
+        int to = empty[0];
+        setPageState(victim, P_FREEING);
+        initPage(to, maxSeq());
+        int at = 0;
+        for (int i = 0; i < ENTRIES;) {
+            if (entryState(victim, i) != WRITTEN) { i++; continue; }
+            int span = entry(victim, i)[2] ? entry(victim, i)[2] : 1;
+            program(to, 64 + at * ENTRY, entry(victim, i), span * ENTRY);
+            setEntryStates(to, at, span, WRITTEN);
+            at += span;
+            i += span;
+        }
+        erasePage(victim);
+        return to;
+    }
+
+    bool write(uint8_t ns, Type t, const std::string& key, const uint8_t data[8],
+               const char* extra, size_t extraLen) {
+        Ref old = find(ns, key);
+        if (old.page >= 0) {
+            const uint8_t* e = entry(old);
+            bool same = e[1] == t && memcmp(e + 24, data, 8) == 0 &&
+                        (!extra || memcmp(e + ENTRY, extra, extraLen) == 0);
+            if (same) { totals_.skipped++; return true; }
+        }
+        int span = 1 + (int)((extraLen + ENTRY - 1) / ENTRY);
+        if (span > ENTRIES) return false;
+        int p = activePage();
+        if (p < 0 || ENTRIES - nextFree(p) < span) {
+            if (p >= 0) setPageState(p, P_FULL);
+            p = newPage();
+            if (p < 0) return false;
+            if (ENTRIES - nextFree(p) < span) return false;
+            old = find(ns, key);                        // compaction may have moved it
+        }
+        int at = nextFree(p);
+        uint8_t e[ENTRY];
+        memset(e, 0xff, sizeof(e));
+        e[0] = ns;
+        e[1] = t;
+        e[2] = (uint8_t)span;
+        strncpy((char*)e + 8, key.c_str(), 15);
+        e[8 + std::min<size_t>(key.size(), 15)] = 0;
+        memcpy(e + 24, data, 8);
+        uint32_t crc = crc32(e, 4) ^ crc32(e + 8, 24);
+        memcpy(e + 4, &crc, 4);
+        program(p, 64 + at * ENTRY, e, ENTRY);
+        if (extraLen) {
+            std::vector<uint8_t> body((span - 1) * ENTRY, 0xff);
+            memcpy(body.data(), extra, extraLen);
+            program(p, 64 + (at + 1) * ENTRY, body.data(), body.size());
+        }
+        setEntryStates(p, at, span, WRITTEN);
+        if (old.page >= 0) setEntryStates(old.page, old.index, entry(old)[2] ? entry(old)[2] : 1, E_ERASED);
+        if (ENTRIES - nextFree(p) == 0) setPageState(p, P_FULL);
+        save();
+        return true;
+    }
+
+    // --- persistence ---------------------------------------------------------
+    void load() {
+        if (FILE* f = fopen(path_.c_str(), "rb")) {
+            std::vector<uint8_t> buf(pages_ * PAGE);
+            size_t n = fread(buf.data(), 1, buf.size(), f);
+            fclose(f);
+            if (n == buf.size())
+                for (size_t p = 0; p < pages_; p++) memcpy(img_[p].data(), &buf[p * PAGE], PAGE);
+            else
+                fprintf(stderr, "[NVS] %s has the wrong size, starting blank\n", path_.c_str());
+        }
+        if (FILE* f = fopen((path_ + ".wear").c_str(), "r")) {
+            unsigned p;
+            Wear w;
+            while (fscanf(f, "%u %lu %lu %lu", &p, &w.erases, &w.programs, &w.bytes) == 4)
+                if (p < pages_) wear_[p] = w;
+            fclose(f);
+        }
+        // A page left FREEING by a reset mid-compaction: its items were copied.
+        for (int p = 0; p < (int)pages_; p++) if (pageState(p) == P_FREEING) erasePage(p);
+        save();
+    }
+
+    void save() {
+        if (path_.empty() || !dirty_) return;
+        dirty_ = false;
+        if (FILE* f = fopen(path_.c_str(), "wb")) {
+            for (const auto& p : img_) fwrite(p.data(), 1, PAGE, f);
+            fclose(f);
+        }
+        if (FILE* f = fopen((path_ + ".wear").c_str(), "w")) {
+            for (size_t p = 0; p < pages_; p++)
+                fprintf(f, "%zu %lu %lu %lu\n", p, wear_[p].erases, wear_[p].programs, wear_[p].bytes);
+            fclose(f);
+        }
+    }
+
+    static uint32_t crc32(const void* data, size_t n) {
+        uint32_t c = 0xffffffff;
+        const uint8_t* d = (const uint8_t*)data;
+        for (size_t i = 0; i < n; i++) {
+            c ^= d[i];
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0xedb88320 & (0 - (c & 1)));
+        }
+        return ~c;
+    }
+
+    std::string path_;
+    size_t pages_;
+    std::vector<Page> img_;
+    std::vector<Wear> wear_;
+    Totals totals_;
+    bool dirty_ = false;
+    mutable std::recursive_mutex mu_;   // panel handlers save from another thread
+};
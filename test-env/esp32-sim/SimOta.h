@@ -0,0 +1,271 @@
+#pragma once
+
+// OTA for the sketch's /update: the Update library, the esp_ota / esp_partition
+// calls around it, and mbedTLS SHA-256.
+// Included from MockESP.h after SimRtos.h.
+//
+// Two app slots as in the default partition table (app0 / app1, 1.25 MiB),
+// each backed by a file. At power-on the running slot holds SIM_FW_IMAGE
+// (default: the simulator's own binary), so deltas can be made against it;
+// Update writes the other slot to SIM_OTA_DIR/lighthouse-ota<slot>.bin
+// (default /tmp; fleet devices add .<id>). The image isn't checked for the
+// ESP32 magic byte, so any file can stand in for a firmware.
+//
+// Boot-slot selection follows the ESP-IDF bootloader with rollback enabled:
+// an image Update.end() installs boots as NEW and is then PENDING_VERIFY; a
+// reset before esp_ota_mark_app_valid_cancel_rollback() marks it ABORTED and
+// the previous slot runs again. The drivers call simOtaBoot() on every
+// in-process reboot (main.cpp, fleet.cpp), where that choice is made.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_NOT_FOUND 0x105
+
+typedef enum {
+    ESP_OTA_IMG_NEW = 0x0,
+    ESP_OTA_IMG_PENDING_VERIFY = 0x1,
+    ESP_OTA_IMG_VALID = 0x2,
+    ESP_OTA_IMG_INVALID = 0x3,
+    ESP_OTA_IMG_ABORTED = 0x4,
+    ESP_OTA_IMG_UNDEFINED = 0xFFFFFFFF,
+} esp_ota_img_states_t;
+
+struct esp_partition_t {
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+};
+
+// One device's flash: the two slots, their states and an update in progress.
+struct SimOtaFlash {
+    esp_partition_t part[2] = {{0x10000, 0x140000, "app0"}, {0x150000, 0x140000, "app1"}};
+    std::string file[2];
+    esp_ota_img_states_t state[2] = {ESP_OTA_IMG_UNDEFINED, ESP_OTA_IMG_UNDEFINED};
+    int running = 0, boot = 0;
+
+    FILE* out = nullptr;          // Update in progress, into slot 1 - running
+    std::string out_path;
+    size_t size = 0, progress = 0;
+    std::string error;
+};
+
+inline std::mutex& simOtaMutex() {
+    static std::mutex mu;
+    return mu;
+}
+
+inline SimOtaFlash& simOta() {
+    static std::map<SimDevice*, SimOtaFlash> flash;
+    std::lock_guard<std::mutex> g(simOtaMutex());
+    SimOtaFlash& f = flash[simDevice()];
+    if (f.file[0].empty()) f.file[0] = simEnvStr("SIM_FW_IMAGE", "/proc/self/exe");
+    return f;
+}
+
+inline std::string simOtaPath(int slot) {
+    std::string p = simEnvStr("SIM_OTA_DIR", "/tmp") + "/lighthouse-ota" + std::to_string(slot) + ".bin";
+    if (SimDevice* d = simDevice()) p += "." + std::to_string(d->id);
+    return p;
+}
+
+// The bootloader's pick on a reboot of the current device.
+inline void simOtaBoot() {
+    SimOtaFlash& f = simOta();
+    int s = f.boot;
+    if (f.state[s] == ESP_OTA_IMG_PENDING_VERIFY) {
+        f.state[s] = ESP_OTA_IMG_ABORTED;
+        s = f.boot = 1 - s;
+        std::cout << "[OTA] " << f.part[1 - s].label << " was never confirmed, rolling back to "
+                  << f.part[s].label << std::endl;
+    }
+    if (f.state[s] == ESP_OTA_IMG_NEW) f.state[s] = ESP_OTA_IMG_PENDING_VERIFY;
+    if (s != f.running) std::cout << "[OTA] booting " << f.part[s].label << " (" << f.file[s] << ")" << std::endl;
+    f.running = s;
+}
+
+inline const esp_partition_t* esp_ota_get_running_partition() {
+    SimOtaFlash& f = simOta();
+    return &f.part[f.running];
+}
+
+inline const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t*) {
+    SimOtaFlash& f = simOta();
+    return &f.part[1 - f.running];
+}
+
+inline esp_err_t esp_ota_get_state_partition(const esp_partition_t* p, esp_ota_img_states_t* state) {
+    SimOtaFlash& f = simOta();
+    int s = p == &f.part[0] ? 0 : p == &f.part[1] ? 1 : -1;
+    if (s < 0 || !state) return ESP_ERR_INVALID_ARG;
+    if (f.state[s] == ESP_OTA_IMG_UNDEFINED) return ESP_ERR_NOT_FOUND;
+    *state = f.state[s];
+    return ESP_OK;
+}
+
+inline esp_err_t esp_ota_mark_app_valid_cancel_rollback() {
+    SimOtaFlash& f = simOta();
+    f.state[f.running] = ESP_OTA_IMG_VALID;
+    std::cout << "[OTA] " << f.part[f.running].label << " marked valid" << std::endl;
+    return ESP_OK;
+}
+
+// On the device this doesn't return; here the reboot waits for the driver.
+inline esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot() {
+    SimOtaFlash& f = simOta();
+    f.state[f.running] = ESP_OTA_IMG_INVALID;
+    f.boot = 1 - f.running;
+    std::cout << "[OTA] " << f.part[f.running].label << " marked invalid" << std::endl;
+    ESP.restart();
+    return ESP_OK;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* p, size_t offset, void* dst, size_t size) {
+    SimOtaFlash& f = simOta();
+    int s = p == &f.part[0] ? 0 : p == &f.part[1] ? 1 : -1;
+    if (s < 0 || offset + size > p->size) return ESP_ERR_INVALID_ARG;
+    memset(dst, 0xFF, size);                         // erased flash past the image
+    FILE* in = fopen(f.file[s].c_str(), "rb");
+    if (!in) return ESP_FAIL;
+    if (fseek(in, (long)offset, SEEK_SET) == 0) fread(dst, 1, size, in);
+    fclose(in);
+    return ESP_OK;
+}
+
+// Arduino's Update (Updater.h): the subset the sketch uses.
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+
+class UpdateClass {
+public:
+    bool begin(size_t size = UPDATE_SIZE_UNKNOWN) {
+        SimOtaFlash& f = simOta();
+        if (f.out) { f.error = "Already Running"; return false; }
+        f.error.clear();
+        int slot = 1 - f.running;
+        if (size != UPDATE_SIZE_UNKNOWN && size > f.part[slot].size) { f.error = "Not Enough Space"; return false; }
+        f.out_path = simOtaPath(slot) + ".part";
+        f.out = fopen(f.out_path.c_str(), "wb");
+        if (!f.out) { f.error = "Flash Write Failed"; return false; }
+        f.size = size == UPDATE_SIZE_UNKNOWN ? f.part[slot].size : size;
+        f.progress = 0;
+        return true;
+    }
+
+    size_t write(uint8_t* data, size_t len) {
+        SimOtaFlash& f = simOta();
+        if (!f.out || !f.error.empty()) return 0;
+        if (len > f.size - f.progress) { f.error = "Not Enough Space"; abort(); return 0; }
+        if (fwrite(data, 1, len, f.out) != len) { f.error = "Flash Write Failed"; abort(); return 0; }
+        f.progress += len;
+        return len;
+    }
+
+    bool end(bool evenIfRemaining = false) {
+        SimOtaFlash& f = simOta();
+        if (!f.out || !f.error.empty()) return false;
+        if (!evenIfRemaining && f.progress != f.size) { f.error = "Bad Size Given"; abort(); return false; }
+        fclose(f.out);
+        f.out = nullptr;
+        int slot = 1 - f.running;
+        f.file[slot] = simOtaPath(slot);
+        rename(f.out_path.c_str(), f.file[slot].c_str());
+        f.state[slot] = ESP_OTA_IMG_NEW;
+        f.boot = slot;
+        std::cout << "[OTA] " << f.progress << " bytes into " << f.part[slot].label << ", boots next" << std::endl;
+        return true;
+    }
+
+    void abort() {
+        SimOtaFlash& f = simOta();
+        if (f.out) { fclose(f.out); remove(f.out_path.c_str()); }
+        f.out = nullptr;
+        if (f.error.empty()) f.error = "Aborted";
+    }
+
+    bool isRunning() { return simOta().out != nullptr; }
+    bool hasError() { return !simOta().error.empty(); }
+    const char* errorString() { return simOta().error.c_str(); }
+    size_t progress() { return simOta().progress; }
+    size_t size() { return simOta().size; }
+};
+static UpdateClass Update;
+
+// mbedtls/sha256.h (FIPS 180-4), for the streamed image hash.
+struct mbedtls_sha256_context {
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t buf[64];
+    size_t used;
+};
+
+inline void mbedtls_sha256_init(mbedtls_sha256_context* c) { memset(c, 0, sizeof(*c)); }
+inline void mbedtls_sha256_free(mbedtls_sha256_context*) {}
+
+inline int mbedtls_sha256_starts(mbedtls_sha256_context* c, int is224) {
+    static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    (void)is224;
+    memcpy(c->h, iv, sizeof(iv));
+    c->len = 0;
+    c->used = 0;
+    return 0;
+}
+
+inline void simSha256Block(uint32_t* h, const uint8_t* p) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    auto ror = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = hh + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+inline int mbedtls_sha256_update(mbedtls_sha256_context* c, const unsigned char* p, size_t n) {
+    c->len += n;
+    while (n > 0) {
+        size_t k = 64 - c->used < n ? 64 - c->used : n;
+        memcpy(c->buf + c->used, p, k);
+        c->used += k; p += k; n -= k;
+        if (c->used == 64) { simSha256Block(c->h, c->buf); c->used = 0; }
+    }
+    return 0;
+}
+
+inline int mbedtls_sha256_finish(mbedtls_sha256_context* c, unsigned char out[32]) {
+    uint64_t bits = c->len * 8;
+    uint8_t pad[72] = {0x80};
+    size_t n = (c->used < 56 ? 56 : 120) - c->used;
+    for (int i = 0; i < 8; i++) pad[n + i] = (uint8_t)(bits >> (56 - 8 * i));
+    mbedtls_sha256_update(c, pad, n + 8);
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 4; j++) out[4 * i + j] = (uint8_t)(c->h[i] >> (24 - 8 * j));
+    return 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+// Power management for the sketch's power modes: esp_pm (frequency scaling,
+// automatic light sleep, PM locks) and the Arduino CPU clock calls. Included
+// from MockESP.h after SimOta.h (esp_err_t).
+//
+// The stock Arduino core is built without CONFIG_PM_ENABLE, so by default
+// esp_pm_configure() fails the way it does there and the sketch falls back to
+// a fixed clock. SIM_PM=1 plays a core built with power management. Either
+// way the clock is only recorded (nothing runs slower), and a PM lock counts
+// its holds, so a missing release shows up in the log at the next acquire.
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define ESP_ERR_NOT_SUPPORTED 0x106
+
+typedef enum {
+    ESP_PM_CPU_FREQ_MAX,
+    ESP_PM_APB_FREQ_MAX,
+    ESP_PM_NO_LIGHT_SLEEP,
+} esp_pm_lock_type_t;
+
+typedef struct {
+    int max_freq_mhz;
+    int min_freq_mhz;
+    bool light_sleep_enable;
+} esp_pm_config_esp32_t;
+
+struct SimPmLock {
+    const char* name;
+    int held = 0;
+};
+typedef SimPmLock* esp_pm_lock_handle_t;
+
+// One device's clock and locks. Rebuilt from scratch on a reboot, as the
+// sketch configures it again in setup().
+struct SimPower {
+    uint32_t cpu_mhz = 240;
+    bool configured = false;
+    esp_pm_config_esp32_t config = {240, 240, false};
+    std::vector<std::unique_ptr<SimPmLock>> locks;
+};
+
+inline std::mutex& simPowerMutex() {
+    static std::mutex mu;
+    return mu;
+}
+
+inline SimPower& simPower() {
+    static std::map<SimDevice*, SimPower> power;
+    std::lock_guard<std::mutex> g(simPowerMutex());
+    return power[simDevice()];
+}
+
+inline void simPowerBoot() {
+    simPower() = SimPower();
+}
+
+inline esp_err_t esp_pm_configure(const void* vconfig) {
+    const esp_pm_config_esp32_t* c = (const esp_pm_config_esp32_t*)vconfig;
+    if (simEnvULong("SIM_PM", 0) == 0) return ESP_ERR_NOT_SUPPORTED;
+    if (!c || c->min_freq_mhz > c->max_freq_mhz) return ESP_ERR_INVALID_ARG;
+    SimPower& p = simPower();
+    p.configured = true;
+    p.config = *c;
+    p.cpu_mhz = c->min_freq_mhz;
+    std::cout << "[PM] scaling " << c->min_freq_mhz << "-" << c->max_freq_mhz << " MHz"
+              << (c->light_sleep_enable ? ", light sleep" : "") << std::endl;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int arg, const char* name,
+                                    esp_pm_lock_handle_t* out) {
+    (void)type; (void)arg;
+    SimPower& p = simPower();
+    if (!p.configured) return ESP_ERR_NOT_SUPPORTED;
+    SimPmLock* l = new SimPmLock;
+    l->name = name;
+    p.locks.emplace_back(l);
+    *out = l;
+    return ESP_OK;
+}
+
+// Only CPU_FREQ_MAX locks are created by the sketch: held = full clock.
+inline esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t l) {
+    if (l->held++ > 0) std::cout << "[PM] lock " << l->name << " taken twice" << std::endl;
+    simPower().cpu_mhz = simPower().config.max_freq_mhz;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t l) {
+    if (l->held == 0) return ESP_ERR_INVALID_ARG;
+    if (--l->held == 0) simPower().cpu_mhz = simPower().config.min_freq_mhz;
+    return ESP_OK;
+}
+
+inline bool setCpuFrequencyMhz(uint32_t mhz) {
+    if (mhz != 240 && mhz != 160 && mhz != 80) return false;   // with WiFi; XTAL rates too on the device
+    simPower().cpu_mhz = mhz;
+    std::cout << "[PM] CPU fixed at " << mhz << " MHz" << std::endl;
+    return true;
+}
+
+inline uint32_t getCpuFrequencyMhz() { return simPower().cpu_mhz; }
@@ -0,0 +1,214 @@
+#pragma once
+
+// The FreeRTOS calls the sketch uses (queues, mutexes, tasks), on std::thread.
+// Included from MockESP.h after SimDevice: a task runs bound to the device
+// that created it, so millis(), pins and SIM_* overrides are that device's.
+//
+// One tick is one millisecond, as configTICK_RATE_HZ=1000 on the ESP32 core.
+// Waits are real time even under the sweep's virtual clock (nothing there
+// starts a task).
+//
+// A device's tasks are stopped when it reboots: simRtosStop() flags them and
+// every blocking call (vTaskDelay, queue receive, mutex take, or
+// simTaskCheck() inside another mock's wait) then unwinds the task with
+// SimTaskStop. The driver calls it before dropping the sketch instance, so no
+// task outlives the members it uses; queues and mutexes are freed with it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+struct SimTaskStop {};
+
+struct SimTask {
+    std::thread thread;
+    std::atomic<bool> stop{false};
+    const char* name = "";
+};
+
+struct SimQueue {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    size_t len = 0, size = 0;
+};
+
+struct SimMutex {
+    std::timed_mutex mu;
+};
+
+typedef SimTask* TaskHandle_t;
+typedef SimQueue* QueueHandle_t;
+typedef SimMutex* SemaphoreHandle_t;
+
+// Everything one device created, so its reboot can tear it down.
+struct SimRtosOwned {
+    std::vector<std::unique_ptr<SimTask>> tasks;
+    std::vector<std::unique_ptr<SimQueue>> queues;
+    std::vector<std::unique_ptr<SimMutex>> mutexes;
+};
+
+class SimRtos {
+public:
+    static SimRtos& get() {
+        static SimRtos r;
+        return r;
+    }
+
+    SimRtosOwned& owned() {      // caller holds mu
+        return owned_[simDevice()];
+    }
+    std::mutex mu;
+
+    // The task running on this thread (nullptr on the loop thread).
+    static SimTask*& current() {
+        thread_local SimTask* t = nullptr;
+        return t;
+    }
+
+private:
+    std::map<SimDevice*, SimRtosOwned> owned_;
+};
+
+// Unwinds the calling task if its device is rebooting. No-op elsewhere.
+inline void simTaskCheck() {
+    SimTask* t = SimRtos::current();
+    if (t && t->stop) throw SimTaskStop();
+}
+
+// Waits `ticks` (portMAX_DELAY = forever) for pred() in short slices, so a
+// stopping task notices. True once pred() held.
+template <class Lock, class Pred>
+inline bool simRtosWait(std::condition_variable& cv, Lock& lock, TickType_t ticks, Pred pred) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks);
+    while (!pred()) {
+        simTaskCheck();
+        auto slice = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+        if (ticks != portMAX_DELAY) {
+            if (std::chrono::steady_clock::now() >= until) return false;
+            slice = std::min(slice, until);
+        }
+        cv.wait_until(lock, slice);
+    }
+    return true;
+}
+
+inline QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t size) {
+    std::lock_guard<std::mutex> g(SimRtos::get().mu);
+    SimQueue* q = new SimQueue;
+    q->len = len;
+    q->size = size;
+    SimRtos::get().owned().queues.emplace_back(q);
+    return q;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(q->mu);
+    if (!simRtosWait(q->cv, lock, ticks, [&] { return q->items.size() < q->len; })) return pdFALSE;
+    const uint8_t* p = (const uint8_t*)item;
+    q->items.emplace_back(p, p + q->size);
+    q->cv.notify_all();
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(q->mu);
+    if (!simRtosWait(q->cv, lock, ticks, [&] { return !q->items.empty(); })) return pdFALSE;
+    memcpy(item, q->items.front().data(), q->size);
+    q->items.pop_front();
+    q->cv.notify_all();
+    return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    std::lock_guard<std::mutex> g(q->mu);
+    return (UBaseType_t)q->items.size();
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+    std::lock_guard<std::mutex> g(SimRtos::get().mu);
+    SimMutex* m = new SimMutex;
+    SimRtos::get().owned().mutexes.emplace_back(m);
+    return m;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t ticks) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks);
+    for (;;) {
+        simTaskCheck();
+        if (m->mu.try_lock_for(std::chrono::milliseconds(20))) return pdTRUE;
+        if (ticks != portMAX_DELAY && std::chrono::steady_clock::now() >= until) return pdFALSE;
+    }
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t m) {
+    m->mu.unlock();
+    return pdTRUE;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks);
+    do {
+        simTaskCheck();
+        std::this_thread::sleep_for(std::min(std::chrono::steady_clock::duration(std::chrono::milliseconds(20)),
+                                             until - std::chrono::steady_clock::now()));
+    } while (std::chrono::steady_clock::now() < until);
+}
+
+// The sketch passes a member function as the task in its class-body build, so
+// any callable is accepted here (the device wants a plain function pointer).
+inline BaseType_t xTaskCreatePinnedToCore(std::function<void(void*)> fn, const char* name,
+                                          uint32_t stack, void* arg, UBaseType_t prio,
+                                          TaskHandle_t* handle, BaseType_t core) {
+    (void)stack; (void)prio; (void)core;
+    std::lock_guard<std::mutex> g(SimRtos::get().mu);
+    SimTask* t = new SimTask;
+    t->name = name;
+    SimDevice* dev = simDevice();
+    t->thread = std::thread([t, dev, fn, arg] {
+        simDevice() = dev;
+        SimRtos::current() = t;
+        try { fn(arg); } catch (const SimTaskStop&) {}
+    });
+    SimRtos::get().owned().tasks.emplace_back(t);
+    if (handle) *handle = t;
+    return pdPASS;
+}
+
+// vTaskDelete(NULL) from inside a task ends it; other handles aren't used.
+inline void vTaskDelete(TaskHandle_t t) {
+    if (!t || t == SimRtos::current()) throw SimTaskStop();
+}
+
+// Reboot of the current device (simDevice(), nullptr for the single sim):
+// stops and joins its tasks, then frees its queues and mutexes.
+inline void simRtosStop() {
+    SimRtosOwned owned;
+    {
+        std::lock_guard<std::mutex> g(SimRtos::get().mu);
+        std::swap(owned, SimRtos::get().owned());
+    }
+    for (auto& t : owned.tasks) t->stop = true;
+    for (auto& t : owned.tasks) if (t->thread.joinable()) t->thread.join();
+}
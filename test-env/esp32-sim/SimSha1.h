@@ -0,0 +1,67 @@
+#pragma once
+
+// mbedtls/sha1.h (FIPS 180-4), for the MariaDB login of the SQL backend
+// (mysql_native_password scrambles the password with SHA-1). Included from
+// MockESP.h after SimPower.h.
+
+#include <cstdint>
+#include <cstring>
+
+struct mbedtls_sha1_context {
+    uint32_t h[5];
+    uint64_t len;
+    uint8_t buf[64];
+    size_t used;
+};
+
+inline void mbedtls_sha1_init(mbedtls_sha1_context* c) { memset(c, 0, sizeof(*c)); }
+inline void mbedtls_sha1_free(mbedtls_sha1_context*) {}
+
+inline int mbedtls_sha1_starts(mbedtls_sha1_context* c) {
+    static const uint32_t iv[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    memcpy(c->h, iv, sizeof(iv));
+    c->len = 0;
+    c->used = 0;
+    return 0;
+}
+
+inline void simSha1Block(uint32_t* h, const uint8_t* p) {
+    auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) { f = (b & c) | (~b & d); k = 0x5a827999; }
+        else if (i < 40) { f = b ^ c ^ d; k = 0x6ed9eba1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+        else { f = b ^ c ^ d; k = 0xca62c1d6; }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d; d = c; c = rol(b, 30); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+inline int mbedtls_sha1_update(mbedtls_sha1_context* c, const unsigned char* p, size_t n) {
+    c->len += n;
+    while (n > 0) {
+        size_t k = 64 - c->used < n ? 64 - c->used : n;
+        memcpy(c->buf + c->used, p, k);
+        c->used += k; p += k; n -= k;
+        if (c->used == 64) { simSha1Block(c->h, c->buf); c->used = 0; }
+    }
+    return 0;
+}
+
+inline int mbedtls_sha1_finish(mbedtls_sha1_context* c, unsigned char out[20]) {
+    uint64_t bits = c->len * 8;
+    uint8_t pad[72] = {0x80};
+    size_t n = (c->used < 56 ? 56 : 120) - c->used;
+    for (int i = 0; i < 8; i++) pad[n + i] = (uint8_t)(bits >> (56 - 8 * i));
+    mbedtls_sha1_update(c, pad, n + 8);
+    for (int i = 0; i < 5; i++)
+        for (int j = 0; j < 4; j++) out[4 * i + j] = (uint8_t)(c->h[i] >> (24 - 8 * j));
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <ArduinoJson.h>
+
+#include "MockESP.h"
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+// Micro-benchmarks for the firmware's hot functions, compiled from the real
+// sketch (LINUX_SIM) like the simulator itself.
+//
+//   make bench                 # build + run everything
+//   ./esp32-bench esc base64   # run only benchmarks whose name contains a filter
+//
+// One JSON object per line on stdout, e.g.
+//   {"bench":"esc","commit":"1a2d631","iters":2000000,"ns_per_op":41.3,"allocs_per_op":1.00,"bytes_per_op":64.0}
+// so runs from two commits can be diffed or joined with jq. BENCH_MIN_MS sets
+// the minimum measuring time per benchmark (default 300).
+
+#include "BenchKit.h"
+
+#include "trelaylaatern.ino"
+
+// Non-owning stream over a payload, so the benchmark doesn't count its own
+// copies as allocations of the code under test.
+class MemStream : public Stream {
+public:
+    MemStream(const char* p, size_t n) : p_(p), e_(p + n) {}
+    int read() override { return p_ < e_ ? (unsigned char)*p_++ : -1; }
+private:
+    const char* p_;
+    const char* e_;
+};
+
+static bool parse(const char* json, const char* type) {
+    MemStream s(json, strlen(json));
+    return applyProblemJson(s, type);
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) g_filters.push_back(argv[i]);
+    if (const char* v = getenv("BENCH_MIN_MS")) g_min_ms = strtoul(v, nullptr, 10);
+
+    // Quiet the sketch's Serial chatter and load the default config/texts.
+    std::cout.setstate(std::ios::failbit);
+    loadSettings();
+    std::cout.clear();
+
+    // Sanity: the parser must still reach the right decision on the payloads.
+    if (!parse(kServiceJson, "Service") || !parse(kHostJson, "Host") || parse(kEmptyJson, "Service")) {
+        fprintf(stderr, "bench: applyProblemJson gave a wrong decision, aborting\n");
+        return 1;
+    }
+
+    const String dateHdr = "Sat, 13 Jun 2026 07:30:00 GMT";
+    bench("captureHttpDate", [&] { captureHttpDate(dateHdr); g_sink += wall_clock.min; });
+
+    bh_enabled = true;
+    tz_offset = 2;
+    bh_days[1] = 0x20; bh_s[1] = 8; bh_e[1] = 14;   // plus a Saturday block
+    bench("alertsAllowedNow", [] { g_sink += alertsAllowedNow(); });
+    bench("localTimeStr", [] { g_sink += localTimeStr().length(); });
+
+    const String plain = "web-01!HTTP frontend";
+    const String markup = "Service: <b>\"db\" & 'cache'</b> > 90% full";
+    bench("esc/plain", [&] { g_sink += esc(plain).length(); });
+    bench("esc/markup", [&] { g_sink += esc(markup).length(); });
+
+    const String cred = "icinga-lighthouse:s3cr3t-Passw0rd";
+    bench("base64Encode", [&] { g_sink += base64Encode(cred).length(); });
+
+    bench("applyProblemJson/service", [] { g_sink += parse(kServiceJson, "Service"); });
+    bench("applyProblemJson/host", [] { g_sink += parse(kHostJson, "Host"); });
+    bench("applyProblemJson/empty", [] { g_sink += parse(kEmptyJson, "Service"); });
+
+    // The same poll against an Alertmanager (selectors swapped, as on a save).
+    alert_source = "alertmanager";
+    compileSource(problem_selector, alert_source, sel_problem, sel_label, sel_hint);
+    if (!parse(kAlertmanagerJson, "Service") || last_icinga_object_name != "Alert: InstanceDown!node-3:9100") {
+        fprintf(stderr, "bench: alertmanager source gave a wrong decision, aborting\n");
+        return 1;
+    }
+    bench("applyProblemJson/alertmanager", [] { g_sink += parse(kAlertmanagerJson, "Service"); });
+    alert_source = "icinga2";
+    compileSource(problem_selector, alert_source, sel_problem, sel_label, sel_hint);
+    if (!parse(kIcinga2ServiceJson, "Service") || last_icinga_object_name != "Service: web-01!https-cert" ||
+        last_next_check != "2026-06-13T07:31:58+00:00" || !parse(kIcinga2HostJson, "Host")) {
+        fprintf(stderr, "bench: icinga2 source gave a wrong decision, aborting\n");
+        return 1;
+    }
+    bench("applyProblemJson/icinga2", [] { g_sink += parse(kIcinga2ServiceJson, "Service"); });
+    alert_source = "icingadb";
+    compileSource(problem_selector, alert_source, sel_problem, sel_label, sel_hint);
+
+    // Full panel render through the mock WebServer, alarm banner included.
+    httplib::Request req;
+    req.headers.emplace("Authorization", "Basic YWRtaW46YWRtaW4=");   // admin:admin
+    icinga_reachable = true;
+    is_alarm_active = true;
+    alarm_confirm.count = confirm_threshold;
+    last_icinga_object_name = "Service: web-01!HTTP frontend";
+    last_next_check = "2026-06-13T07:30:58+00:00";
+    publishStatus();                 // the page renders the published snapshot
+    bench("handleRoot", [&] {
+        httplib::Response res;
+        server.invoke(handleRoot, req, res);
+        g_sink += res.body.size();
+    });
+    return 0;
+}
@@ -0,0 +1,465 @@
+#include <ArduinoJson.h>
+
+#include "lighthouse_core.h"
+
+// The alarm core (lighthouse_core.h) built natively on its own: no MockESP, no
+// sketch, no network, no emulated clock. Two parts:
+//
+//  1. timing checks - scenarios driven one loop pass per millisecond under a
+//     synthetic clock, whose siren edges are known exactly from the settings.
+//     Any deviation prints the two edge lists and exits 1, so a change to the
+//     decision logic can't silently shift when the siren sounds. Plus one
+//     concurrency check: the status snapshot read while another thread
+//     publishes must never come out torn (make core-tsan runs it under
+//     ThreadSanitizer, which checks the ordering on any memory model).
+//  2. micro-benchmarks - same JSON lines as esp32-bench, so the core's cost can
+//     be compared against the full-sketch functions that wrap it.
+//
+//   make core-bench              # build + run everything
+//   ./esp32-corebench step json  # checks, then only benchmarks matching a filter
+//
+// Each check reports {"check":..,"ok":..,"edges":..,"passes":..,"ms":..}; the
+// pass rate is how fast the whole decision path runs per loop() iteration.
+
+#include "BenchKit.h"
+
+#include <thread>
+
+// --- timing checks -----------------------------------------------------------
+
+struct Edge {
+    unsigned long t;
+    bool on;
+    bool operator==(const Edge& o) const { return t == o.t && on == o.on; }
+};
+
+// One firmware instance reduced to its decisions: polls when due (first poll
+// one interval after boot, like loop()), then steps the relay machine.
+struct CoreSim {
+    lh::Config cfg;
+    lh::Confirmation confirm;
+    lh::AlarmMachine machine;
+    lh::WallClock clock;
+    unsigned long last_poll = 0;
+    bool alarm = false;
+    bool siren = false;
+    std::vector<Edge> edges;
+
+    template <class Problem, class NetError>
+    void run(unsigned long end_ms, Problem problem, NetError net_error) {
+        for (unsigned long t = 0; t <= end_ms; t++) {
+            if (t - last_poll >= lh::pollInterval(cfg, confirm)) {
+                last_poll = t;
+                alarm = confirm.update(problem(t), cfg.confirm_threshold);
+            }
+            lh::RelayCommand cmd = machine.step(cfg, t, alarm, net_error(t),
+                                                lh::alertsAllowed(cfg.schedule, clock));
+            bool next = cmd.siren == lh::SIREN_ON ? true : cmd.siren == lh::SIREN_OFF ? false : siren;
+            if (next != siren) edges.push_back({t, next});
+            siren = next;
+        }
+    }
+};
+
+// The firmware defaults (trelaylaatern.ino).
+static lh::Config defaultConfig() {
+    lh::Config c;
+    c.poll_ms = 30000;
+    c.recheck_ms = 10000;
+    c.confirm_threshold = 3;
+    c.init_alarm_ms = 30000;
+    c.reminder_interval_ms = 300000;
+    c.reminder_ms = 15000;
+    c.schedule.enabled = false;
+    c.schedule.tz_offset = 0;
+    for (int i = 0; i < lh::BH_BLOCKS; i++) {
+        c.schedule.days[i] = 0;
+        c.schedule.start[i] = 0;
+        c.schedule.end[i] = 0;
+    }
+    c.schedule.days[0] = 0x1F; c.schedule.start[0] = 6; c.schedule.end[0] = 18;
+    return c;
+}
+
+// Expected siren edges for a problem that never clears: armed at `armed_ms`,
+// then the initial pulse and a reminder pulse after every interval.
+static std::vector<Edge> sirenPattern(const lh::Config& c, unsigned long armed_ms, unsigned long end_ms) {
+    std::vector<Edge> e;
+    unsigned long on = armed_ms, len = c.init_alarm_ms;
+    while (on <= end_ms) {
+        e.push_back({on, true});
+        if (on + len > end_ms) break;
+        e.push_back({on + len, false});
+        on += len + c.reminder_interval_ms;
+        len = c.reminder_ms;
+    }
+    return e;
+}
+
+// First poll sees the problem at poll_ms, the rest follow at recheck_ms.
+static unsigned long armedAt(const lh::Config& c) {
+    return c.poll_ms + (unsigned long)(c.confirm_threshold - 1) * c.recheck_ms;
+}
+
+static int g_failed = 0;
+
+template <class Setup>
+static void check(const char* name, unsigned long end_ms, Setup setup) {
+    using clk = std::chrono::steady_clock;
+    CoreSim sim;
+    sim.cfg = defaultConfig();
+    std::vector<Edge> expected;
+    auto t0 = clk::now();
+    setup(sim, expected, end_ms);
+    double ms = std::chrono::duration<double, std::milli>(clk::now() - t0).count();
+
+    bool ok = sim.edges == expected;
+    printf("{\"check\":\"%s\",\"commit\":\"%s\",\"ok\":%s,\"edges\":%zu,\"passes\":%lu,\"ms\":%.1f}\n",
+           name, BENCH_COMMIT, ok ? "true" : "false", sim.edges.size(), end_ms + 1, ms);
+    fflush(stdout);
+    if (ok) return;
+    g_failed++;
+    auto dump = [](const char* what, const std::vector<Edge>& v) {
+        fprintf(stderr, "  %s:", what);
+        for (const Edge& e : v) fprintf(stderr, " %s@%lu", e.on ? "ON" : "OFF", e.t);
+        fprintf(stderr, "\n");
+    };
+    fprintf(stderr, "corebench: check %s failed\n", name);
+    dump("expected", expected);
+    dump("got     ", sim.edges);
+}
+
+static bool never(unsigned long) { return false; }
+static bool always(unsigned long) { return true; }
+
+static void runChecks() {
+    const unsigned long HOUR = 3600000;
+
+    // A problem that never clears: initial pulse, then reminders.
+    check("pattern", HOUR, [&](CoreSim& s, std::vector<Edge>& exp, unsigned long end) {
+        s.run(end, always, never);
+        exp = sirenPattern(s.cfg, armedAt(s.cfg), end);
+    });
+
+    // Seen on one poll only: the confirmation debounces it, no siren.
+    check("debounce", HOUR, [&](CoreSim& s, std::vector<Edge>&, unsigned long end) {
+        s.run(end, [](unsigned long t) { return t < 35000; }, never);
+    });
+
+    // Cleared during the first silence: the next poll ends the alarm.
+    check("clear", HOUR, [&](CoreSim& s, std::vector<Edge>& exp, unsigned long end) {
+        unsigned long armed = armedAt(s.cfg);
+        s.run(end, [=](unsigned long t) { return t < armed + 100000; }, never);
+        exp = { {armed, true}, {armed + s.cfg.init_alarm_ms, false} };
+    });
+
+    // A network error mid-pulse silences the siren but keeps the state, so the
+    // cut-short pulse is not resumed and the reminders stay on schedule.
+    check("network", HOUR, [&](CoreSim& s, std::vector<Edge>& exp, unsigned long end) {
+        unsigned long armed = armedAt(s.cfg);
+        s.run(end, always, [=](unsigned long t) { return t >= armed + 10000 && t < armed + 20000; });
+        exp = sirenPattern(s.cfg, armed, end);
+        exp[1].t = armed + 10000;
+    });
+
+    // Business hours Mon-Fri 06-18 local (UTC+2): Saturday stays silent, a
+    // weekday morning sounds as usual. The clock comes from a Date header.
+    check("quiet-hours", HOUR, [&](CoreSim& s, std::vector<Edge>&, unsigned long end) {
+        s.cfg.schedule.enabled = true;
+        s.cfg.schedule.tz_offset = 2;
+        lh::parseHttpDate("Date: Sat, 13 Jun 2026 07:30:00 GMT", s.clock);
+        s.run(end, always, never);
+    });
+    check("business-hours", HOUR, [&](CoreSim& s, std::vector<Edge>& exp, unsigned long end) {
+        s.cfg.schedule.enabled = true;
+        s.cfg.schedule.tz_offset = 2;
+        lh::parseHttpDate("Mon, 15 Jun 2026 07:30:00 GMT", s.clock);
+        s.run(end, always, never);
+        exp = sirenPattern(s.cfg, armedAt(s.cfg), end);
+    });
+
+    // A day at the fastest supported settings, mostly for the pass rate.
+    check("day-fast", 24 * HOUR, [&](CoreSim& s, std::vector<Edge>& exp, unsigned long end) {
+        s.cfg.poll_ms = 1000;
+        s.cfg.recheck_ms = 1000;
+        s.cfg.confirm_threshold = 1;
+        s.cfg.init_alarm_ms = 5000;
+        s.cfg.reminder_interval_ms = 10000;
+        s.cfg.reminder_ms = 1000;
+        s.run(end, always, never);
+        exp = sirenPattern(s.cfg, armedAt(s.cfg), end);
+    });
+}
+
+// A writer thread publishes snapshots whose fields all carry the same counter
+// while this thread reads them as fast as it can; a copy mixing two publishes
+// (or going back in time) fails the check.
+static void checkSnapshot() {
+    using clk = std::chrono::steady_clock;
+    lh::Published<lh::Status> board;
+    std::atomic<bool> stop(false);
+    std::thread writer([&] {
+        lh::Status st = {};
+        for (unsigned long i = 1; !stop; i++) {
+            st.at_ms = st.last_poll_ms = st.last_data_ms = i;
+            st.confirm = (int)i;
+            snprintf(st.problem, sizeof(st.problem), "Service: host!svc-%lu", i);
+            board.publish(st);
+        }
+    });
+    unsigned long reads = 0, torn = 0, last = 0;
+    auto t0 = clk::now();
+    while (clk::now() - t0 < std::chrono::milliseconds(300)) {
+        lh::Status st = board.read();
+        char want[sizeof(st.problem)];
+        snprintf(want, sizeof(want), "Service: host!svc-%lu", st.at_ms);
+        if (st.at_ms < last || (st.at_ms && (st.last_poll_ms != st.at_ms || st.last_data_ms != st.at_ms ||
+                                             (unsigned long)st.confirm != st.at_ms || strcmp(st.problem, want) != 0)))
+            torn++;
+        last = st.at_ms;
+        reads++;
+    }
+    stop = true;
+    writer.join();
+    double ms = std::chrono::duration<double, std::milli>(clk::now() - t0).count();
+
+    bool ok = torn == 0 && last > 0;
+    printf("{\"check\":\"snapshot\",\"commit\":\"%s\",\"ok\":%s,\"reads\":%lu,\"publishes\":%u,\"torn\":%lu,\"ms\":%.1f}\n",
+           BENCH_COMMIT, ok ? "true" : "false", reads, board.sequence(), torn, ms);
+    fflush(stdout);
+    if (!ok) {
+        g_failed++;
+        fprintf(stderr, "corebench: check snapshot failed (%lu torn reads, last %lu)\n", torn, last);
+    }
+}
+
+// --- micro-benchmarks --------------------------------------------------------
+
+// Minimal ArduinoJson reader over a payload (read() is all it needs), so the
+// parse isn't measured through a copy.
+struct MemReader {
+    const char* p;
+    const char* e;
+    int read() { return p < e ? (unsigned char)*p++ : -1; }
+    size_t readBytes(char* buf, size_t n) {
+        size_t k = (size_t)(e - p) < n ? (size_t)(e - p) : n;
+        memcpy(buf, p, k);
+        p += k;
+        return k;
+    }
+};
+
+static lh::ParseResult parse(const char* json, bool isService) {
+    MemReader r = { json, json + strlen(json) };
+    lh::Problem p;
+    return lh::parseProblemJson(r, isService, p);
+}
+
+static lh::ParseResult runSelector(const lh::Selector& sel, const char* json, lh::Problem& p) {
+    MemReader r = { json, json + strlen(json) };
+    return sel.run(r, p);
+}
+
+// The icingadb preset must read Icinga's replies exactly as parseProblemJson
+// does (same decision, label and hint), and the alertmanager one its own.
+static void checkSelectors() {
+    lh::Selector icinga, am, api;
+    bool ok = icinga.compile(*lh::findSource("icingadb")) && am.compile(*lh::findSource("alertmanager")) &&
+              api.compile(*lh::findSource("icinga2"));
+    const char* fixtures[] = { kServiceJson, kHostJson, kEmptyJson, "[{" };
+    for (int i = 0; ok && i < 4; i++) {
+        lh::Problem want = {}, got;
+        MemReader r = { fixtures[i], fixtures[i] + strlen(fixtures[i]) };
+        lh::ParseResult rw = lh::parseProblemJson(r, i == 0, want);
+        lh::ParseResult rg = runSelector(icinga, fixtures[i], got);
+        ok = rw == rg && (rw != lh::PARSE_PROBLEM ||
+                          (strcmp(want.label, got.label) == 0 && strcmp(want.next_check, got.next_check) == 0));
+    }
+    lh::Problem p;
+    ok = ok && runSelector(am, kAlertmanagerJson, p) == lh::PARSE_PROBLEM &&
+         strcmp(p.label, "InstanceDown!node-3:9100") == 0 && strcmp(p.next_check, "2026-06-13T07:21:00.000Z") == 0 &&
+         runSelector(am, kEmptyJson, p) == lh::PARSE_NONE;
+    char when[32];
+    ok = ok && runSelector(api, kIcinga2ServiceJson, p) == lh::PARSE_PROBLEM &&
+         strcmp(p.label, "web-01!https-cert") == 0 && strcmp(p.next_check, "1781335918.512") == 0 &&
+         runSelector(api, kIcinga2HostJson, p) == lh::PARSE_PROBLEM && strcmp(p.label, "db-02") == 0 &&
+         runSelector(api, "{\"results\":[]}", p) == lh::PARSE_NONE &&
+         strcmp(lh::formatEpochUtc(1781335918, when, sizeof(when)), "2026-06-13T07:31:58+00:00") == 0;
+    lh::Selector bad;
+    ok = ok && !bad.compile("count($.a > 0", "", "") && bad.error()[0];
+    printf("{\"check\":\"selectors\",\"commit\":\"%s\",\"ok\":%s}\n", BENCH_COMMIT, ok ? "true" : "false");
+    if (!ok) {
+        g_failed++;
+        fprintf(stderr, "corebench: check selectors failed\n");
+    }
+}
+
+// A reply of `n` copies of the fixture's one element.
+static std::string repeated(const char* one, int n) {
+    std::string obj(one + 1, strlen(one) - 2), out = "[";
+    for (int i = 0; i < n; i++) out += (i ? "," : "") + obj;
+    return out + "]";
+}
+
+// The problem list: rows per element up to the capacity (reading no further),
+// names interned, nothing kept from a reply that isn't a problem, the arena
+// never overrun, and the times the sources write all understood.
+static void checkProblemList() {
+    lh::Selector icinga, am, api, custom;
+    bool ok = icinga.compile(*lh::findSource("icingadb")) && am.compile(*lh::findSource("alertmanager")) &&
+              api.compile(*lh::findSource("icinga2")) && custom.compile("$.down", "$.who", "");
+    lh::ProblemList list;
+    lh::Problem p;
+    char when[32];
+    std::string three = repeated(kServiceJson, 3);
+    list.clear(20);
+    list.begin(0, "Service");
+    ok = ok && runSelector(icinga, three.c_str(), p) == lh::PARSE_PROBLEM;   // no list: unchanged
+    MemReader r = { three.data(), three.data() + three.size() };
+    bool early = false;
+    ok = ok && icinga.run(r, p, &early, &list) == lh::PARSE_PROBLEM && list.size() == 3 && r.p == r.e &&
+         strcmp(list.str(list.row(2).host), "web-01") == 0 && strcmp(list.str(list.row(2).name), "HTTP frontend") == 0 &&
+         strcmp(list.str(list.row(0).state), "2") == 0 && strcmp(list.str(list.row(1).kind), "Service") == 0 &&
+         list.row(0).host == list.row(2).host && list.used() < 40 &&
+         strcmp(lh::formatEpochUtc(list.row(0).since, when, sizeof(when)), "2026-06-13T07:21:04+00:00") == 0;
+    list.begin(1, "Host");
+    MemReader h = { kHostJson, kHostJson + strlen(kHostJson) };
+    MemReader e = { kEmptyJson, kEmptyJson + strlen(kEmptyJson) };
+    ok = ok && icinga.run(h, p, NULL, &list) == lh::PARSE_PROBLEM && list.size() == 4 &&
+         list.row(3).source == 1 && strcmp(list.str(list.row(3).host), "") == 0 &&
+         strcmp(list.str(list.row(3).name), "db-02") == 0 &&
+         icinga.run(e, p, NULL, &list) == lh::PARSE_NONE && list.size() == 4;
+    list.clear(2);
+    r = { three.data(), three.data() + three.size() };
+    ok = ok && icinga.run(r, p, &early, &list) == lh::PARSE_PROBLEM && list.size() == 2 && early && r.p < r.e;
+
+    lh::ProblemList copy;
+    copy.clear(20);
+    copy.copy(list, 0);
+    ok = ok && copy.size() == 2 && strcmp(copy.str(copy.row(1).name), "HTTP frontend") == 0;
+
+    list.clear(20);
+    list.begin(0, "Alert");
+    MemReader a = { kAlertmanagerJson, kAlertmanagerJson + strlen(kAlertmanagerJson) };
+    MemReader s = { kIcinga2ServiceJson, kIcinga2ServiceJson + strlen(kIcinga2ServiceJson) };
+    const char* cj = "{\"down\":true,\"who\":\"ups-1\"}";
+    MemReader c = { cj, cj + strlen(cj) };
+    ok = ok && am.run(a, p, NULL, &list) == lh::PARSE_PROBLEM && list.size() == 1 &&
+         strcmp(list.str(list.row(0).host), "node-3:9100") == 0 && strcmp(list.str(list.row(0).name), "InstanceDown") == 0 &&
+         strcmp(list.str(list.row(0).state), "critical") == 0 &&
+         api.run(s, p, NULL, &list) == lh::PARSE_PROBLEM && list.size() == 2 &&
+         strcmp(list.str(list.row(1).host), "web-01") == 0 && strcmp(list.str(list.row(1).state), "2.0") == 0 &&
+         list.row(1).since == 1781334864UL &&
+         custom.run(c, p, NULL, &list) == lh::PARSE_PROBLEM && list.size() == 3 &&
+         strcmp(list.str(list.row(2).name), "ups-1") == 0;
+
+    // Distinct 100-byte names until the arena is full: rows are refused, the
+    // arena stays within its size.
+    list.clear(lh::LIST_MAX);
+    list.begin(0, "Service");
+    char name[104];
+    for (int i = 0; i < lh::LIST_MAX; i++) {
+        snprintf(name, sizeof(name), "%02d-%097d", i, 0);
+        list.add("host", name, "2", 0);
+    }
+    ok = ok && list.dropped() > 0 && list.size() + (int)list.dropped() == lh::LIST_MAX && list.used() <= (size_t)lh::LIST_ARENA;
+
+    lh::WallClock clock;
+    ok = ok && lh::parseTimestamp("2026-06-13T09:21:04+02:00") == lh::parseTimestamp("2026-06-13T07:21:04.123Z") &&
+         lh::parseTimestamp("2026-06-13T07:21:04") == 1781335264UL &&
+         lh::parseTimestamp("1781334864204") == 1781334864UL && lh::parseTimestamp("2") == 0 &&
+         lh::parseTimestamp("soon") == 0 && lh::parseHttpDate("Sat, 13 Jun 2026 07:30:00 GMT", clock) &&
+         strcmp(lh::formatEpochUtc(clock.epoch, when, sizeof(when)), "2026-06-13T07:30:00+00:00") == 0 &&
+         strcmp(lh::formatDuration(3 * 3600 + 5 * 60 + 7, when, sizeof(when)), "3h 05m") == 0 &&
+         strcmp(lh::formatDuration(2 * 86400 + 4 * 3600, when, sizeof(when)), "2d 4h") == 0;
+    printf("{\"check\":\"problem-list\",\"commit\":\"%s\",\"ok\":%s,\"row_bytes\":%zu,\"list_bytes\":%zu}\n",
+           BENCH_COMMIT, ok ? "true" : "false", sizeof(lh::ProblemRow), sizeof(lh::ProblemList));
+    if (!ok) {
+        g_failed++;
+        fprintf(stderr, "corebench: check problem-list failed\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) g_filters.push_back(argv[i]);
+    if (const char* v = getenv("BENCH_MIN_MS")) g_min_ms = strtoul(v, nullptr, 10);
+
+    runChecks();
+    checkSnapshot();
+    checkSelectors();
+    checkProblemList();
+
+    if (parse(kServiceJson, true) != lh::PARSE_PROBLEM || parse(kHostJson, false) != lh::PARSE_PROBLEM ||
+        parse(kEmptyJson, true) != lh::PARSE_NONE || parse("[{", true) != lh::PARSE_ERROR) {
+        fprintf(stderr, "corebench: parseProblemJson gave a wrong decision\n");
+        g_failed++;
+    }
+    if (g_failed) {
+        fprintf(stderr, "corebench: %d check(s) failed, aborting\n", g_failed);
+        return 1;
+    }
+
+    lh::WallClock clock;
+    bench("core/parseHttpDate", [&] {
+        lh::parseHttpDate("Sat, 13 Jun 2026 07:30:00 GMT", clock);
+        g_sink += clock.min;
+    });
+
+    lh::Config cfg = defaultConfig();
+    cfg.schedule.enabled = true;
+    cfg.schedule.tz_offset = 2;
+    cfg.schedule.days[1] = 0x20; cfg.schedule.start[1] = 8; cfg.schedule.end[1] = 14;   // plus a Saturday block
+    bench("core/alertsAllowed", [&] { g_sink += lh::alertsAllowed(cfg.schedule, clock); });
+    bench("core/formatLocalTime", [&] {
+        char buf[12];
+        g_sink += lh::formatLocalTime(clock, cfg.schedule.tz_offset, buf, sizeof(buf))[0];
+    });
+
+    lh::Confirmation confirm;
+    unsigned long n = 0;
+    bench("core/confirm+pollInterval", [&] {
+        g_sink += confirm.update((++n & 7) != 0, cfg.confirm_threshold);
+        g_sink += lh::pollInterval(cfg, confirm);
+    });
+
+    // One loop() pass worth of relay decisions, time advancing 1 ms per call
+    // through the whole pulse/reminder cycle.
+    lh::AlarmMachine machine;
+    unsigned long now = 0;
+    bench("core/AlarmMachine::step", [&] {
+        lh::RelayCommand cmd = machine.step(cfg, ++now, true, false, true);
+        g_sink += cmd.siren;
+    });
+
+    bench("core/parseProblemJson/service", [] { g_sink += parse(kServiceJson, true); });
+    bench("core/parseProblemJson/host", [] { g_sink += parse(kHostJson, false); });
+    bench("core/parseProblemJson/empty", [] { g_sink += parse(kEmptyJson, true); });
+
+    // The same replies through the compiled selectors (what the sketch runs).
+    lh::Selector icinga, am;
+    icinga.compile(*lh::findSource("icingadb"));
+    am.compile(*lh::findSource("alertmanager"));
+    lh::Problem sp;
+    bench("core/Selector::run/service", [&] { g_sink += runSelector(icinga, kServiceJson, sp); });
+    bench("core/Selector::run/host", [&] { g_sink += runSelector(icinga, kHostJson, sp); });
+    bench("core/Selector::run/empty", [&] { g_sink += runSelector(icinga, kEmptyJson, sp); });
+    bench("core/Selector::run/alertmanager", [&] { g_sink += runSelector(am, kAlertmanagerJson, sp); });
+    bench("core/Selector::compile", [&] { g_sink += icinga.compile(*lh::findSource("icingadb")); });
+    // A poll's worth of list rows: 20 problems into a 20-row list.
+    std::string twenty = repeated(kServiceJson, 20);
+    lh::ProblemList list;
+    bench("core/Selector::run/list20", [&] {
+        list.clear(20);
+        list.begin(0, "Service");
+        MemReader r = { twenty.data(), twenty.data() + twenty.size() };
+        g_sink += icinga.run(r, sp, NULL, &list) + list.size();
+    });
+
+    // What loop() pays per pass to publish, and a reader per page.
+    lh::Published<lh::Status> board;
+    lh::Status st = {};
+    lh::copyField(st.problem, sizeof(st.problem), "Service: web1.example.com!http");
+    bench("core/Published::publish", [&] { st.at_ms++; board.publish(st); });
+    bench("core/Published::read", [&] { g_sink += board.read().at_ms; });
+    return 0;
+}
@@ -0,0 +1,306 @@
+#include <ArduinoJson.h>
+
+#include "MockESP.h"
+#include "lighthouse_core.h"   // namespace scope; the sketch's own include is then a no-op
+
+// Fleet mode: N independent firmware instances in one process, to load-test
+// Icinga Web the way a building full of lighthouses would.
+//
+//   make esp32-fleet
+//   SIM_ICINGA_BASE=http://localhost:8090 ./esp32-fleet --devices 500 --duration 300
+//
+// The sketch is compiled as the body of a class (SIM_INSTANCE), so every
+// instance has its own globals, NVS (SIM_NVS.<id> when SIM_NVS is set) and
+// relay/LED pins, and ESP.restart() reboots just that instance. The mocks look
+// up the instance running on the current thread (simDevice(), MockESP.h) for
+// its clock, GPIO, panel port and SIM_* overrides. Instances are scheduled
+// cooperatively on a thread pool: a worker runs one instance's setup()/loop()
+// to completion, as the device's single loop task would, then moves on to the
+// instance due next. Blocking calls (delay(), HTTP) hold their worker, so size
+// --threads for the expected number of requests in flight.
+//
+// Per-device jitter, as in a real fleet: power-on is spread over --boot-spread
+// seconds, each device's crystal runs off by up to +/- --drift-ppm, and every
+// loop pass takes --loop-ms plus up to --loop-jitter-ms. SIM_NET_PROFILE adds
+// network latency/jitter as usual.
+//
+// Options:
+//   --devices N          instances (default 100)
+//   --threads N          worker threads (default 64)
+//   --duration S         stop after S seconds (default 0 = run until killed)
+//   --report S           report interval (default 10)
+//   --boot-spread S      power-on spread (default: one poll interval)
+//   --drift-ppm P        max crystal error (default 40)
+//   --loop-ms MS, --loop-jitter-ms MS   loop cadence (default 10, 2)
+//   --web-base PORT      device i serves its panel on PORT+i (default 0 = none)
+//   --env KEY=V1[,V2..]  per-device SIM_* override, values dealt round-robin
+//                        (e.g. --env SIM_POLL_MS=6000,10000,30000)
+//   --seed N             RNG seed for the jitter
+//   --json               final summary as one JSON object
+//   --verbose            keep the firmware's own log output
+//
+// Each report line gives the fleet's request rate and the latency the devices
+// observed (connect to close, emulated network included), plus how
+// late the scheduler ran loop passes - if that grows, add threads.
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <queue>
+#include <random>
+#include <sstream>
+
+#define SIM_INSTANCE
+struct Lighthouse {
+#include "trelaylaatern.ino"
+};
+
+struct Node {
+    SimDevice dev;
+    std::unique_ptr<Lighthouse> fw;
+    bool booted = false;
+    unsigned long loop_us = 0;   // this device's loop period
+};
+
+// --- statistics --------------------------------------------------------------
+struct Window {
+    unsigned long requests = 0, ok = 0, errors = 0;
+    std::vector<unsigned long> lat_us;   // per request
+    std::vector<unsigned long> lag_us;   // scheduler lateness per loop pass
+};
+
+static std::mutex g_statsMu;
+static Window g_window, g_total;
+
+static double pct(std::vector<unsigned long>& v, double q) {
+    if (v.empty()) return 0;
+    size_t k = std::min(v.size() - 1, (size_t)(q * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k] / 1000.0;
+}
+
+static double maxMs(const std::vector<unsigned long>& v) {
+    return v.empty() ? 0 : *std::max_element(v.begin(), v.end()) / 1000.0;
+}
+
+static void merge(Window& into, const Window& w) {
+    into.requests += w.requests;
+    into.ok += w.ok;
+    into.errors += w.errors;
+    into.lat_us.insert(into.lat_us.end(), w.lat_us.begin(), w.lat_us.end());
+    into.lag_us.insert(into.lag_us.end(), w.lag_us.begin(), w.lag_us.end());
+}
+
+// --- scheduler ---------------------------------------------------------------
+struct Slot {
+    unsigned long long due_us;
+    size_t node;
+    bool operator>(const Slot& o) const { return due_us > o.due_us; }
+};
+
+static std::vector<std::unique_ptr<Node>> g_nodes;
+static std::priority_queue<Slot, std::vector<Slot>, std::greater<Slot>> g_queue;
+static std::mutex g_queueMu;
+static std::condition_variable g_queueCv;
+static std::atomic<bool> g_stop{false};
+static std::atomic<int> g_up{0};
+static unsigned long g_loopJitterUs = 2000;
+
+static unsigned long long nowUs() { return micros(); }   // no device bound: process clock
+
+static void worker(unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<unsigned long> jitter(0, g_loopJitterUs);
+    std::unique_lock<std::mutex> lock(g_queueMu);
+    while (!g_stop) {
+        if (g_queue.empty()) { g_queueCv.wait(lock); continue; }
+        Slot s = g_queue.top();
+        unsigned long long now = nowUs();
+        if (s.due_us > now) {
+            g_queueCv.wait_for(lock, std::chrono::microseconds(s.due_us - now));
+            continue;
+        }
+        g_queue.pop();
+        lock.unlock();
+
+        Node& n = *g_nodes[s.node];
+        simDevice() = &n.dev;
+        {
+            std::lock_guard<std::recursive_mutex> devLock(n.dev.mu);
+            if (!n.booted) {
+                simBootBegin();
+                n.fw->setup();
+                n.booted = true;
+                g_up++;
+            } else {
+                n.fw->loop();
+            }
+        }
+        if (n.dev.restart) {
+            // Reboot: fresh RAM (a new instance), clock from zero, relays released.
+            n.dev.restart = false;
+            simRtosStop();
+            simOtaBoot();
+            simPowerBoot();
+            n.fw.reset();
+            simGpioReset();
+            simDevice() = nullptr;
+            n.dev.boot_us = nowUs();
+            simDevice() = &n.dev;
+            n.fw.reset(new Lighthouse);
+            n.booted = false;
+            g_up--;
+        }
+        simDevice() = nullptr;
+        {
+            std::lock_guard<std::mutex> st(g_statsMu);
+            g_window.lag_us.push_back((unsigned long)(now - s.due_us));
+        }
+
+        lock.lock();
+        g_queue.push(Slot{nowUs() + n.loop_us + jitter(rng), s.node});
+        g_queueCv.notify_one();
+    }
+}
+
+// --- main --------------------------------------------------------------------
+static void usage() {
+    fprintf(stderr, "usage: esp32-fleet [--devices N] [--threads N] [--duration S] [--report S]\n"
+                    "                   [--boot-spread S] [--drift-ppm P] [--loop-ms MS] [--loop-jitter-ms MS]\n"
+                    "                   [--web-base PORT] [--env KEY=V1[,V2..]]... [--seed N] [--json] [--verbose]\n");
+}
+
+static std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep)) out.push_back(item);
+    return out;
+}
+
+static void report(double t_s, Window& w, double interval_s) {
+    printf("[fleet] t=%5.0fs up=%d/%zu req=%lu (%.1f/s) ok=%lu err=%lu "
+           "lat_ms p50=%.1f p95=%.1f p99=%.1f max=%.1f | loop lag_ms p99=%.1f max=%.1f\n",
+           t_s, g_up.load(), g_nodes.size(), w.requests, w.requests / interval_s, w.ok, w.errors,
+           pct(w.lat_us, 0.50), pct(w.lat_us, 0.95), pct(w.lat_us, 0.99), maxMs(w.lat_us),
+           pct(w.lag_us, 0.99), maxMs(w.lag_us));
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    size_t devices = 100;
+    int threads = 64;
+    double duration = 0, every = 10, ppm = 40, spread = -1;
+    unsigned long loopMs = 10, webBase = 0;
+    unsigned long seed = std::random_device{}();
+    bool json = false, verbose = false;
+    std::vector<std::pair<std::string, std::vector<std::string>>> env;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--json") { json = true; continue; }
+        if (a == "--verbose") { verbose = true; continue; }
+        const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!v) { usage(); return 2; }
+        if (a == "--devices") devices = strtoul(v, nullptr, 10);
+        else if (a == "--threads") threads = atoi(v);
+        else if (a == "--duration") duration = atof(v);
+        else if (a == "--report") every = atof(v);
+        else if (a == "--boot-spread") spread = atof(v);
+        else if (a == "--drift-ppm") ppm = atof(v);
+        else if (a == "--loop-ms") loopMs = strtoul(v, nullptr, 10);
+        else if (a == "--loop-jitter-ms") g_loopJitterUs = strtoul(v, nullptr, 10) * 1000;
+        else if (a == "--web-base") webBase = strtoul(v, nullptr, 10);
+        else if (a == "--seed") seed = strtoul(v, nullptr, 10);
+        else if (a == "--env") {
+            std::string kv = v;
+            size_t eq = kv.find('=');
+            if (eq == std::string::npos) { usage(); return 2; }
+            env.push_back({kv.substr(0, eq), split(kv.substr(eq + 1), ',')});
+        }
+        else { usage(); return 2; }
+        i++;
+    }
+    if (devices == 0 || threads < 1 || every <= 0) { usage(); return 2; }
+    if (spread < 0) spread = simEnvULong("SIM_POLL_MS", 6000) / 1000.0;
+
+    // One process-wide waveform would interleave every device's pins.
+    unsetenv("SIM_VCD");
+    unsetenv("SIM_WAVE");
+    if (!verbose) std::cout.setstate(std::ios::failbit);
+
+    printf("[fleet] %zu devices, %d threads, boot spread %.1fs, drift +/-%.0f ppm, loop %lu+%lu ms, net %s\n",
+           devices, threads, spread, ppm, loopMs, g_loopJitterUs / 1000,
+           SimNet::get().profile().name.c_str());
+    fflush(stdout);
+
+    simRestartHook() = [] { if (SimDevice* d = simDevice()) d->restart = true; };
+    simHttpObserver() = [](int code, unsigned long us) {
+        std::lock_guard<std::mutex> st(g_statsMu);
+        g_window.requests++;
+        if (code == HTTP_CODE_OK) g_window.ok++; else g_window.errors++;
+        g_window.lat_us.push_back(us);
+    };
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> drift(-ppm, ppm);
+    std::uniform_real_distribution<double> phase(0, spread * 1e6);
+    unsigned long long t0 = nowUs();
+    for (size_t i = 0; i < devices; i++) {
+        std::unique_ptr<Node> n(new Node);
+        n->dev.id = (int)i;
+        n->dev.drift_ppm = drift(rng);
+        n->dev.boot_us = t0 + (unsigned long long)phase(rng);
+        n->dev.web_port = webBase ? (int)(webBase + i) : 0;
+        for (const auto& e : env) n->dev.env[e.first] = e.second[i % e.second.size()];
+        n->loop_us = loopMs * 1000;
+        simDevice() = &n->dev;          // member initialisers may read the clock
+        n->fw.reset(new Lighthouse);
+        simDevice() = nullptr;
+        g_queue.push(Slot{n->dev.boot_us, i});
+        g_nodes.push_back(std::move(n));
+    }
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) pool.emplace_back(worker, (unsigned)(seed + 1 + i));
+
+    unsigned long long last = t0;
+    while (duration <= 0 || (nowUs() - t0) / 1e6 < duration) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        unsigned long long now = nowUs();
+        if ((now - last) / 1e6 < every) continue;
+        Window w;
+        {
+            std::lock_guard<std::mutex> st(g_statsMu);
+            std::swap(w, g_window);
+        }
+        report((now - t0) / 1e6, w, (now - last) / 1e6);
+        merge(g_total, w);
+        last = now;
+    }
+
+    g_stop = true;
+    g_queueCv.notify_all();
+    for (auto& t : pool) t.join();
+    {
+        std::lock_guard<std::mutex> st(g_statsMu);
+        merge(g_total, g_window);
+    }
+
+    double secs = (nowUs() - t0) / 1e6;
+    Window& w = g_total;
+    if (json) {
+        printf("{\"devices\":%zu,\"seconds\":%.1f,\"requests\":%lu,\"req_per_s\":%.2f,\"ok\":%lu,"
+               "\"errors\":%lu,\"lat_ms\":{\"p50\":%.2f,\"p95\":%.2f,\"p99\":%.2f,\"max\":%.2f},"
+               "\"loop_lag_ms\":{\"p99\":%.2f,\"max\":%.2f}}\n",
+               devices, secs, w.requests, w.requests / secs, w.ok, w.errors,
+               pct(w.lat_us, 0.50), pct(w.lat_us, 0.95), pct(w.lat_us, 0.99), maxMs(w.lat_us),
+               pct(w.lag_us, 0.99), maxMs(w.lag_us));
+    } else {
+        printf("[fleet] total over %.0fs:\n", secs);
+        report(secs, w, secs);
+    }
+    // Panel listener threads are detached and never stop; don't unwind under them.
+    fflush(stdout);
+    _exit(0);
+}
@@ -1,16 +1,36 @@
 #include "MockESP.h"
+#include "lighthouse_core.h"   // namespace scope; the sketch's own include is then a no-op
 
-// Include the sketch file directly
-// The sketch must have #ifdef LINUX_SIM guards around hardware-specific includes
+// The sketch is compiled as the body of a class (SIM_INSTANCE), so ESP.restart()
+// can be emulated in-process: the instance is dropped and a fresh one - RAM
+// reset, settings read back from the emulated NVS - runs setup() again.
+#define SIM_INSTANCE
+struct Lighthouse {
 #include "trelaylaatern.ino"
+};
 
 int main() {
     printf("--- VIRTUAL ESP32 SIMULATOR STARTED ---\n");
-    setup();
-    while(1) {
-        loop();
-        // Add a small sleep to prevent 100% CPU usage in the loop
-        usleep(10000); // 10ms
+    std::atomic<bool> restart{false};
+    simRestartHook() = [&] { restart = true; };
+    SimNvs::Totals nvs = simNvs().totals();
+    while (1) {
+        std::unique_ptr<Lighthouse> fw(new Lighthouse);
+        simBootBegin();
+        fw->setup();
+        while (!restart) {
+            fw->loop();
+            // Add a small sleep to prevent 100% CPU usage in the loop
+            usleep(10000); // 10ms
+        }
+        restart = false;
+        simRtosStop();               // its tasks go down with it
+        simOtaBoot();                // the bootloader picks the app slot
+        simPowerBoot();              // clock and PM locks as at power-on
+        fw.reset();
+        std::cout << "[ESP] Restart: re-running setup()" << std::endl;
+        nvs = simNvsReport(nvs);     // flash cost of the save that triggered it
+        simGpioReset();
     }
     return 0;
 }
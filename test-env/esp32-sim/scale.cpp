@@ -0,0 +1,307 @@
+#include <ArduinoJson.h>
+
+#include "MockESP.h"
+
+#include <malloc.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+// Parser scaling: how the poll's JSON handling behaves as replies grow, from
+// the empty array to thousands of problems with bloated objects (someone
+// dropped limit=1 from a URL, or plugins print pages of output). Synthetic
+// icingadb-web replies (Payload.h) go through each parser in turn, compiled
+// from the real sketch (LINUX_SIM) like esp32-bench:
+//
+//   applyProblemJson   what the sketch runs per poll (the compiled selector)
+//   problemList        the same, filling the problem list (/problems) as the
+//                      sketch does by default: up to problem_list_max rows
+//   parseProblemJson   lh::parseProblemJson, the ArduinoJson filter the Linux
+//                      daemon uses (a 4 KB document, as on the device)
+//
+//   make scale
+//   ./esp32-scale --count 0,1,10,100,1000,5000 --bloat 0,2048 --kind services,hosts
+//   ./esp32-scale --emit 5000 --bloat 2048 > big.json     # just the payload
+//
+// One JSON line per parser x kind x count x bloat on stdout:
+//   {"scale":"applyProblemJson","commit":..,"kind":"services","count":5000,"bloat":0,
+//    "bytes":8336986,"read":1650,"us":6.9,"ns_per_byte":0.00,"peak_heap":128,"allocs":7,"ok":true}
+// `read` is how much of the reply the parser took before returning: the
+// sketch stops once the first object has settled the poll (the rest is never
+// read off the socket), ArduinoJson's filter reads to the end. `peak_heap`
+// is the most heap live at once during one parse, above what was live before
+// it (with glibc malloc is wrapped, so ArduinoJson's counts too);
+// `ok` says whether the decision and label matched the payload's first
+// object. A chart of time and peak heap against reply size follows on
+// stderr, so cliffs stand out without a plotting tool.
+
+#include "Payload.h"
+
+#include "trelaylaatern.ino"
+
+// --- heap accounting ----------------------------------------------------------
+
+static std::atomic<long> g_live{0};
+static std::atomic<long> g_peak{0};
+static std::atomic<unsigned long> g_mallocs{0};
+
+static void grew(void* p) {
+    if (!p) return;
+    g_mallocs++;
+    long live = g_live += (long)malloc_usable_size(p);
+    long peak = g_peak;
+    while (live > peak && !g_peak.compare_exchange_weak(peak, live)) {}
+}
+
+#if defined(__GLIBC__)
+// malloc itself is wrapped, so ArduinoJson's allocator (plain malloc) counts.
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+extern "C" void __libc_free(void*);
+
+extern "C" void* malloc(size_t n) {
+    void* p = __libc_malloc(n);
+    grew(p);
+    return p;
+}
+extern "C" void* calloc(size_t n, size_t k) {
+    void* p = __libc_calloc(n, k);
+    grew(p);
+    return p;
+}
+extern "C" void* realloc(void* old, size_t n) {
+    if (old) g_live -= (long)malloc_usable_size(old);
+    void* p = __libc_realloc(old, n);
+    if (p) grew(p);
+    else if (old && n) g_live += (long)malloc_usable_size(old);   // failed: old block stays
+    return p;
+}
+extern "C" void free(void* p) {
+    if (p) g_live -= (long)malloc_usable_size(p);
+    __libc_free(p);
+}
+#else
+// musl (the Docker image) can't be wrapped like that: operator new only, so
+// ArduinoJson's document is left out (fixed at its capacity, 4 KB).
+void* operator new(size_t n) {
+    void* p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    grew(p);
+    return p;
+}
+void operator delete(void* p) noexcept {
+    if (p) g_live -= (long)malloc_usable_size(p);
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+#endif
+
+// Non-owning stream over a payload (as in bench.cpp).
+class MemStream : public Stream {
+public:
+    MemStream(const char* p, size_t n) : b_(p), p_(p), e_(p + n) {}
+    size_t consumed() const { return (size_t)(p_ - b_); }
+    int read() override { return p_ < e_ ? (unsigned char)*p_++ : -1; }
+    size_t readBytes(char* buf, size_t n) {
+        size_t k = (size_t)(e_ - p_) < n ? (size_t)(e_ - p_) : n;
+        memcpy(buf, p_, k);
+        p_ += k;
+        return k;
+    }
+private:
+    const char* b_;
+    const char* p_;
+    const char* e_;
+};
+
+// --- the parsers under test -------------------------------------------------
+
+struct Outcome {
+    bool problem;
+    std::string label;        // as the firmware would show it after the type prefix
+    size_t read;              // bytes taken from the reply before the parser returned
+};
+
+struct Parser {
+    const char* name;
+    Outcome (*run)(const std::string& json, bool hosts);
+};
+
+static Outcome viaSketch(const std::string& json, bool hosts) {
+    MemStream s(json.data(), json.size());
+    const char* type = hosts ? "Host" : "Service";
+    Outcome o;
+    o.problem = applyProblemJson(s, type);
+    o.read = s.consumed();
+    std::string shown = last_icinga_object_name.c_str();
+    std::string prefix = std::string(type) + ": ";
+    o.label = shown.compare(0, prefix.size(), prefix) == 0 ? shown.substr(prefix.size()) : shown;
+    return o;
+}
+
+static Outcome viaSketchList(const std::string& json, bool hosts) {
+    MemStream s(json.data(), json.size());
+    const char* type = hosts ? "Host" : "Service";
+    problem_scratch.clear(problem_list_max);
+    Outcome o;
+    o.problem = applyProblemJson(s, type, NULL, &problem_scratch);
+    o.read = s.consumed();
+    std::string shown = last_icinga_object_name.c_str();
+    std::string prefix = std::string(type) + ": ";
+    o.label = shown.compare(0, prefix.size(), prefix) == 0 ? shown.substr(prefix.size()) : shown;
+    if (o.problem && problem_scratch.size() == 0) o.label = "(empty list)";
+    return o;
+}
+
+static Outcome viaArduinoJson(const std::string& json, bool hosts) {
+    MemStream s(json.data(), json.size());
+    lh::Problem p;
+    Outcome o;
+    o.problem = lh::parseProblemJson(s, !hosts, p) == lh::PARSE_PROBLEM;
+    o.label = o.problem ? p.label : "";
+    o.read = s.consumed();
+    return o;
+}
+
+static const Parser kParsers[] = {
+    { "applyProblemJson", viaSketch },
+    { "problemList", viaSketchList },
+    { "parseProblemJson", viaArduinoJson },
+};
+
+// --- driver -----------------------------------------------------------------
+
+struct Row {
+    std::string parser, kind;
+    int count, bloat;
+    size_t bytes, read;
+    double us;
+    long peak;
+    bool ok;
+};
+
+static std::vector<int> parseList(const char* v) {
+    std::vector<int> out;
+    for (const char* p = v; p && *p;) {
+        out.push_back(atoi(p));
+        p = strchr(p, ',');
+        if (p) p++;
+    }
+    return out;
+}
+
+static unsigned long g_min_ms = 200;
+
+static Row measure(const Parser& parser, bool hosts, int count, int bloat, const Payload& pl) {
+    using clk = std::chrono::steady_clock;
+    Row r = { parser.name, hosts ? "hosts" : "services", count, bloat, pl.json.size(), 0, 0, 0, true };
+
+    // One parse with the heap watched, then timed repeats.
+    long base = g_live;
+    g_peak = base;
+    unsigned long m0 = g_mallocs;
+    Outcome o = parser.run(pl.json, hosts);
+    r.peak = g_peak - base;
+    r.read = o.read;
+    unsigned long allocs = g_mallocs - m0;
+    r.ok = o.problem == (count > 0) && (count == 0 || o.label == pl.first_label);
+
+    unsigned long iters = 0;
+    auto t0 = clk::now(), t1 = t0;
+    do {
+        parser.run(pl.json, hosts);
+        iters++;
+        t1 = clk::now();
+    } while (t1 - t0 < std::chrono::milliseconds(g_min_ms) && iters < 100000);
+    r.us = std::chrono::duration<double, std::micro>(t1 - t0).count() / iters;
+
+    printf("{\"scale\":\"%s\",\"commit\":\"%s\",\"kind\":\"%s\",\"count\":%d,\"bloat\":%d,\"bytes\":%zu,"
+           "\"read\":%zu,\"us\":%.1f,\"ns_per_byte\":%.2f,\"peak_heap\":%ld,\"allocs\":%lu,\"ok\":%s}\n",
+           r.parser.c_str(), BENCH_COMMIT, r.kind.c_str(), count, bloat, r.bytes, r.read, r.us,
+           r.bytes ? r.us * 1000.0 / r.bytes : 0.0, r.peak, allocs, r.ok ? "true" : "false");
+    fflush(stdout);
+    return r;
+}
+
+// Log-scale bar over 30 columns: `decades` powers of ten above `lo`.
+static std::string bar(double v, double lo, double decades) {
+    int n = v <= lo ? 0 : (int)(log10(v / lo) * 30 / decades + 0.5);
+    return std::string(n > 30 ? 30 : n, '#');
+}
+
+static void chart(const std::vector<Row>& rows) {
+    fprintf(stderr, "\n%-17s %-8s %6s %5s %10s  %-40s %-40s\n", "parser", "kind", "count", "bloat", "bytes",
+            "time per poll (log, 1 us..10 s)", "peak heap (log, 10 B..10 MB)");
+    for (const Row& r : rows) {
+        char t[24], h[24];
+        snprintf(t, sizeof(t), "%.0f us", r.us);
+        snprintf(h, sizeof(h), "%ld B", r.peak);
+        fprintf(stderr, "%-17s %-8s %6d %5d %10zu  %-30s%10s %-30s%10s%s\n", r.parser.c_str(), r.kind.c_str(),
+                r.count, r.bloat, r.bytes, bar(r.us, 1, 7).c_str(), t,
+                bar((double)r.peak, 10, 6).c_str(), h, r.ok ? "" : "  WRONG DECISION");
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> counts = { 0, 1, 10, 100, 1000, 5000 };
+    std::vector<int> bloats = { 0, 2048 };
+    std::vector<bool> kinds = { false, true };
+    unsigned seed = 1;
+    int emit = -1;
+    const char* only = nullptr;
+    if (const char* v = getenv("BENCH_MIN_MS")) g_min_ms = strtoul(v, nullptr, 10);
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!v) { fprintf(stderr, "%s needs a value\n", a.c_str()); return 2; }
+        if (a == "--count") counts = parseList(v);
+        else if (a == "--bloat") bloats = parseList(v);
+        else if (a == "--kind") {
+            kinds.clear();
+            if (strstr(v, "services")) kinds.push_back(false);
+            if (strstr(v, "hosts")) kinds.push_back(true);
+        }
+        else if (a == "--parser") only = v;
+        else if (a == "--seed") seed = strtoul(v, nullptr, 10);
+        else if (a == "--emit") emit = atoi(v);
+        else { fprintf(stderr, "unknown option %s\n", a.c_str()); return 2; }
+        i++;
+    }
+
+    if (emit >= 0) {
+        PayloadGen gen(seed);
+        Payload p = gen.make(!kinds.empty() && kinds[0], emit, bloats.empty() ? 0 : bloats[0]);
+        fwrite(p.json.data(), 1, p.json.size(), stdout);
+        fprintf(stderr, "%zu bytes, first: %s\n", p.json.size(), p.first_label.c_str());
+        return 0;
+    }
+
+    std::cout.setstate(std::ios::failbit);     // the sketch's Serial chatter
+    loadSettings();
+    std::cout.clear();
+
+    std::vector<Row> rows;
+    bool all_ok = true;
+    for (bool hosts : kinds) {
+        for (int bloat : bloats) {
+            for (int count : counts) {
+                PayloadGen gen(seed);
+                Payload pl = gen.make(hosts, count, bloat);
+                for (const Parser& p : kParsers) {
+                    if (only && !strstr(p.name, only)) continue;
+                    rows.push_back(measure(p, hosts, count, bloat, pl));
+                    // Only the sketch's own paths fail the run; the others are
+                    // there to be compared, cliffs included.
+                    if (&p != &kParsers[2]) all_ok = all_ok && rows.back().ok;
+                }
+            }
+        }
+    }
+    chart(rows);
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,295 @@
+#include <ArduinoJson.h>
+
+#include "MockESP.h"
+
+// Trace-driven parameter sweep: replays a timeline of Icinga problem states
+// against the unmodified alarm logic (the real sketch, LINUX_SIM) under the
+// virtual clock, once per combination of poll interval, recheck interval and
+// confirmation threshold, and reports what each combination would have done.
+//
+//   make esp32-sweep
+//   ./esp32-sweep --trace ../traces/sample-week.csv --poll 10,15,30,60 --recheck 2,5,10 --confirm 1,2,3,4
+//
+// Trace CSV (header optional, '#' comments allowed), sorted by time:
+//   time,problems[,name]
+// time is unix seconds or ISO-8601 UTC (2026-06-08T07:30:00Z); problems is the
+// number of unhandled problems from that moment on (0 = all clear). Each row
+// is a state change; the last row marks the end of the replay.
+//
+// Ground truth: a problem episode lasting at least --min-problem seconds
+// (default 300) is real and should fire the siren; a shorter one is a blip,
+// and a siren during it counts as a false alarm.
+//
+// Output: one CSV row per combination (stdout), e.g.
+//   poll_s,recheck_s,confirm,real,detected,missed,lat_p50_s,lat_p95_s,lat_max_s,false_alarms,requests,req_per_h
+// Combinations run in parallel forked children (--jobs, default: all cores),
+// each with a fresh copy of the sketch's globals.
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include "trelaylaatern.ino"
+
+struct TracePoint {
+    unsigned long long t_ms;
+    int problems;
+    std::string name;
+};
+
+struct Episode {
+    unsigned long long start_ms, end_ms;
+    bool real;
+    bool fired = false;
+    unsigned long long fired_ms = 0;
+};
+
+static std::vector<TracePoint> g_trace;
+
+static bool parseTime(const std::string& s, unsigned long long& ms) {
+    if (s.empty()) return false;
+    if (s.find('-') == std::string::npos) {
+        char* end = nullptr;
+        double v = strtod(s.c_str(), &end);
+        if (end == s.c_str()) return false;
+        ms = (unsigned long long)(v * 1000.0);
+        return true;
+    }
+    struct tm tm = {};
+    if (!strptime(s.c_str(), "%Y-%m-%dT%H:%M:%S", &tm) &&
+        !strptime(s.c_str(), "%Y-%m-%d %H:%M:%S", &tm)) return false;
+    ms = (unsigned long long)timegm(&tm) * 1000ULL;
+    return true;
+}
+
+static bool loadTrace(const char* path) {
+    std::ifstream in(path);
+    if (!in) { fprintf(stderr, "sweep: cannot open %s\n", path); return false; }
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        if (line.empty() || line[0] == '#') continue;
+        std::stringstream ss(line);
+        std::string t, p, name;
+        std::getline(ss, t, ',');
+        std::getline(ss, p, ',');
+        std::getline(ss, name);
+        TracePoint tp;
+        if (!parseTime(t, tp.t_ms)) {
+            if (g_trace.empty() && !isdigit((unsigned char)t[0])) continue;   // header
+            fprintf(stderr, "sweep: %s:%d: bad time '%s'\n", path, lineNo, t.c_str());
+            return false;
+        }
+        tp.problems = atoi(p.c_str());
+        tp.name = name.empty() ? "svc-trace" : name;
+        if (!g_trace.empty() && tp.t_ms < g_trace.back().t_ms) {
+            fprintf(stderr, "sweep: %s:%d: trace not sorted by time\n", path, lineNo);
+            return false;
+        }
+        g_trace.push_back(tp);
+    }
+    if (g_trace.size() < 2) { fprintf(stderr, "sweep: trace needs at least 2 rows\n"); return false; }
+    return true;
+}
+
+static std::vector<unsigned long> parseList(const char* s) {
+    std::vector<unsigned long> v;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) if (!item.empty()) v.push_back(strtoul(item.c_str(), nullptr, 10));
+    return v;
+}
+
+static std::string httpDate(unsigned long long ms) {
+    time_t t = (time_t)(ms / 1000);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[40];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+static unsigned long long percentile(std::vector<unsigned long long> v, double q) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t i = (size_t)(q * (v.size() - 1) + 0.5);
+    return v[std::min(i, v.size() - 1)];
+}
+
+// One replay in a forked child. Writes its CSV row to fd.
+static void runCombination(unsigned long poll_s, unsigned long recheck_s, unsigned long confirm,
+                           unsigned long min_problem_s, int fd) {
+    std::cout.setstate(std::ios::failbit);   // the sketch's Serial chatter
+    setenv("SIM_POLL_MS", std::to_string(poll_s * 1000).c_str(), 1);
+    setenv("SIM_RECHECK_MS", std::to_string(recheck_s * 1000).c_str(), 1);
+    setenv("SIM_CONFIRM", std::to_string(confirm).c_str(), 1);
+    setenv("SIM_WEB_PORT", "0", 1);
+
+    // Ground-truth episodes.
+    std::vector<Episode> eps;
+    for (size_t i = 0; i + 1 < g_trace.size(); i++) {
+        bool on = g_trace[i].problems > 0;
+        bool wasOn = i > 0 && g_trace[i - 1].problems > 0;
+        if (on && !wasOn) eps.push_back(Episode{g_trace[i].t_ms, 0, false});
+        if (!on && wasOn) eps.back().end_ms = g_trace[i].t_ms;
+    }
+    const unsigned long long tEnd = g_trace.back().t_ms;
+    for (auto& e : eps) {
+        if (!e.end_ms) e.end_ms = tEnd;
+        e.real = (e.end_ms - e.start_ms) >= min_problem_s * 1000ULL;
+    }
+
+    size_t cursor = 0;              // trace row in effect at the current time
+    unsigned long requests = 0;
+    auto rowAt = [&](unsigned long long now) -> const TracePoint& {
+        while (cursor + 1 < g_trace.size() && g_trace[cursor + 1].t_ms <= now) cursor++;
+        return g_trace[cursor];
+    };
+
+    simHttpResponder() = [&](const std::string& url, std::string& body,
+                             std::map<std::string, std::string>& headers) {
+        requests++;
+        unsigned long long now = simClock().now_us / 1000;
+        const TracePoint& tp = rowAt(now);
+        headers["date"] = httpDate(now);
+        if (tp.problems > 0 && url.find("/services") != std::string::npos) {
+            body = "[{\"name\":\"" + tp.name + "\",\"display_name\":\"" + tp.name +
+                   "\",\"host\":{\"display_name\":\"trace\"},\"state\":{\"soft_state\":2}}]";
+        } else {
+            body = "[]";
+        }
+        return 200;
+    };
+
+    // Attribute every siren start (relay 1 rising from IDLE) to the episode in
+    // progress, or the one that just ended.
+    int falseAlarms = 0;
+    simGpioObserver() = [&](int pin, int val) {
+        if (pin != RELAY_1_PIN || val != RELAY_ON) return;
+        unsigned long long now = simClock().now_us / 1000;
+        Episode* hit = nullptr;
+        for (auto& e : eps) {
+            if (e.start_ms > now) break;
+            hit = &e;
+        }
+        if (!hit) { falseAlarms++; return; }
+        if (hit->fired) return;           // reminder of an episode already counted
+        hit->fired = true;
+        hit->fired_ms = now;
+        if (!hit->real) falseAlarms++;
+    };
+
+    simClock().useVirtual(g_trace.front().t_ms * 1000ULL);
+    setup();
+
+    while (millis() < tEnd) {
+        loop();
+
+        // Jump straight to the next moment anything can change: poll due,
+        // relay timer, watchdog or the next trace row.
+        unsigned long long now = millis();
+        unsigned long long next = tEnd;
+        auto consider = [&](unsigned long long t) { if (t > now && t < next) next = t; };
+        lh::Config cfg = coreConfig();
+        consider((unsigned long long)last_poll_time + lh::pollInterval(cfg, alarm_confirm));
+        if (unsigned long t = alarm_machine.deadline(cfg)) consider(t);
+        consider((unsigned long long)last_successful_data_time + watchdog_timeout_ms + 1);
+        if (cursor + 1 < g_trace.size()) consider(g_trace[cursor + 1].t_ms);
+        simClock().advanceTo(next * 1000ULL);
+    }
+
+    int real = 0, detected = 0;
+    std::vector<unsigned long long> lat;
+    for (const auto& e : eps) {
+        if (!e.real) continue;
+        real++;
+        if (e.fired) { detected++; lat.push_back(e.fired_ms - e.start_ms); }
+    }
+    double hours = (tEnd - g_trace.front().t_ms) / 3600000.0;
+    char row[256];
+    int n = snprintf(row, sizeof(row), "%lu,%lu,%lu,%d,%d,%d,%.1f,%.1f,%.1f,%d,%lu,%.1f\n",
+                     poll_s, recheck_s, confirm, real, detected, real - detected,
+                     percentile(lat, 0.5) / 1000.0, percentile(lat, 0.95) / 1000.0,
+                     percentile(lat, 1.0) / 1000.0, falseAlarms, requests,
+                     hours > 0 ? requests / hours : 0.0);
+    if (write(fd, row, n) != n) _exit(1);
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: esp32-sweep --trace FILE [--poll S,..] [--recheck S,..] [--confirm N,..]\n"
+            "                   [--min-problem S] [--jobs N]\n");
+}
+
+int main(int argc, char** argv) {
+    const char* trace = nullptr;
+    std::vector<unsigned long> polls = {10, 15, 20, 30, 45, 60, 90, 120};
+    std::vector<unsigned long> rechecks = {2, 5, 10, 15, 20};
+    std::vector<unsigned long> confirms = {1, 2, 3, 4, 5};
+    unsigned long minProblem = 300;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!v) { usage(); return 2; }
+        if (a == "--trace") trace = v;
+        else if (a == "--poll") polls = parseList(v);
+        else if (a == "--recheck") rechecks = parseList(v);
+        else if (a == "--confirm") confirms = parseList(v);
+        else if (a == "--min-problem") minProblem = strtoul(v, nullptr, 10);
+        else if (a == "--jobs") jobs = strtol(v, nullptr, 10);
+        else { usage(); return 2; }
+        i++;
+    }
+    if (!trace || !loadTrace(trace)) { usage(); return 2; }
+    if (jobs < 1) jobs = 1;
+
+    struct Combo { unsigned long p, r, c; };
+    std::vector<Combo> combos;
+    for (auto p : polls) for (auto r : rechecks) for (auto c : confirms) combos.push_back({p, r, c});
+
+    fflush(stdout);
+    std::vector<std::string> rows(combos.size());
+    std::map<pid_t, std::pair<size_t, int>> running;   // pid -> (combo, read fd)
+    size_t nextCombo = 0;
+    auto reap = [&]() {
+        int status = 0;
+        pid_t pid = wait(&status);
+        auto it = running.find(pid);
+        if (it == running.end()) return;
+        char buf[256];
+        ssize_t n = read(it->second.second, buf, sizeof(buf) - 1);
+        close(it->second.second);
+        if (n > 0) { buf[n] = 0; rows[it->second.first] = buf; }
+        else fprintf(stderr, "sweep: combination %zu failed\n", it->second.first);
+        running.erase(it);
+    };
+    while (nextCombo < combos.size() || !running.empty()) {
+        if (nextCombo < combos.size() && (long)running.size() < jobs) {
+            int fds[2];
+            if (pipe(fds) != 0) { perror("pipe"); return 1; }
+            const Combo& c = combos[nextCombo];
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                runCombination(c.p, c.r, c.c, minProblem, fds[1]);
+                _exit(0);
+            }
+            close(fds[1]);
+            running[pid] = {nextCombo++, fds[0]};
+        } else {
+            reap();
+        }
+    }
+
+    printf("poll_s,recheck_s,confirm,real,detected,missed,lat_p50_s,lat_p95_s,lat_max_s,"
+           "false_alarms,requests,req_per_h\n");
+    for (const auto& r : rows) fputs(r.c_str(), stdout);
+    return 0;
+}
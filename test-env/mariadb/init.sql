@@ -10,4 +10,8 @@ CREATE DATABASE IF NOT EXISTS icingaweb CHARACTER SET utf8mb4 COLLATE utf8mb4_un
 CREATE USER IF NOT EXISTS 'icingaweb'@'%' IDENTIFIED BY 'icingaweb';
 GRANT ALL ON icingaweb.* TO 'icingaweb'@'%';
 
+-- Read-only login for the lighthouse's SQL backend (mysql:// Services URL)
+CREATE USER IF NOT EXISTS 'lighthouse'@'%' IDENTIFIED BY 'lighthouse';
+GRANT SELECT ON icingadb.* TO 'lighthouse'@'%';
+
 FLUSH PRIVILEGES;
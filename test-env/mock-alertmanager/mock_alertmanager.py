@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""
+Mock Prometheus Alertmanager for the firmware's "alertmanager" source.
+
+Serves the one endpoint the firmware polls, shaped like Alertmanager's v2 API
+(top-level array of alerts, the active / silenced / inhibited filters
+honoured):
+
+    GET /api/v2/alerts?active=true&silenced=false&inhibited=false
+
+Alerts are driven over a small control API instead of Prometheus rules:
+
+    POST /mock/alert?name=<alertname>&instance=<i>[&job=<j>]&state=firing|resolved[&silenced=1]
+    GET  /mock/alert                                dump the current alerts
+
+    ./mock-alertmanager/mock_alertmanager.py --port 9093 &
+    curl -X POST "http://localhost:9093/mock/alert?name=InstanceDown&instance=node-3:9100"
+
+Standard library only.
+"""
+import argparse
+import hashlib
+import json
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+lock = threading.Lock()
+alerts = {}   # (alertname, instance) -> {"job":.., "silenced":.., "since":..}
+
+
+def iso(ts):
+    return time.strftime("%Y-%m-%dT%H:%M:%S.000Z", time.gmtime(ts))
+
+
+def alert_obj(name, instance, a):
+    now = time.time()
+    fp = hashlib.sha1(("%s/%s" % (name, instance)).encode()).hexdigest()[:16]
+    return {
+        "annotations": {"summary": "%s on %s (set via mock_alertmanager)" % (name, instance)},
+        "endsAt": iso(now + 240),
+        "fingerprint": fp,
+        "receivers": [{"name": "default"}],
+        "startsAt": iso(a["since"]),
+        "status": {
+            "inhibitedBy": [],
+            "silencedBy": ["mock-silence"] if a["silenced"] else [],
+            "state": "suppressed" if a["silenced"] else "active",
+        },
+        "updatedAt": iso(now),
+        "generatorURL": "http://prometheus:9090/graph",
+        "labels": {"alertname": name, "instance": instance, "job": a["job"], "severity": "critical"},
+    }
+
+
+def flag(q, name, default):
+    v = q.get(name, [None])[0]
+    return default if v is None else v.lower() in ("1", "true", "yes")
+
+
+class Server(ThreadingHTTPServer):
+    request_queue_size = 1024   # as mock-icinga: a simulated fleet connects at once
+    daemon_threads = True
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def reply(self, code, body, ctype="application/json"):
+        data = body.encode() if isinstance(body, str) else body
+        self.send_response(code)
+        self.send_header("Content-Type", ctype)
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        q = parse_qs(url.query)
+        with lock:
+            if url.path == "/api/v2/alerts":
+                active, silenced = flag(q, "active", True), flag(q, "silenced", True)
+                flag(q, "inhibited", True)   # nothing is ever inhibited here
+                objs = [alert_obj(n, i, a) for (n, i), a in sorted(alerts.items())
+                        if (active if not a["silenced"] else silenced)]
+            elif url.path == "/mock/alert":
+                return self.reply(200, json.dumps(
+                    [dict(alertname=n, instance=i, **a) for (n, i), a in sorted(alerts.items())]))
+            else:
+                return self.reply(404, "not found", "text/plain")
+        self.reply(200, json.dumps(objs))
+
+    def do_POST(self):
+        url = urlparse(self.path)
+        q = parse_qs(url.query)
+        if url.path != "/mock/alert":
+            return self.reply(404, "not found", "text/plain")
+        if "name" not in q:
+            return self.reply(400, "need name=", "text/plain")
+        key = (q["name"][0], q.get("instance", ["localhost:9100"])[0])
+        with lock:
+            if q.get("state", ["firing"])[0] == "resolved":
+                alerts.pop(key, None)
+            else:
+                prev = alerts.get(key)
+                alerts[key] = {
+                    "job": q.get("job", ["node"])[0],
+                    "silenced": flag(q, "silenced", False),
+                    "since": prev["since"] if prev else time.time(),
+                }
+        self.reply(200, "ok", "text/plain")
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            super().log_message(fmt, *args)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("--port", type=int, default=9093)
+    ap.add_argument("--bind", default="0.0.0.0")
+    ap.add_argument("-v", "--verbose", action="store_true")
+    args = ap.parse_args()
+    srv = Server((args.bind, args.port), Handler)
+    srv.verbose = args.verbose
+    print(f"mock alertmanager on {args.bind}:{args.port}", flush=True)
+    srv.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,304 @@
+#!/usr/bin/env python3
+"""
+Mock icingadb-web for the simulator and the benchmark harnesses.
+
+Serves the two endpoints the firmware polls, with the same shape as the real
+icingadb-web JSON API (top-level array, `limit` honoured):
+
+    GET /icingadb/services?...   unhandled CRITICAL services
+    GET /icingadb/hosts?...      unhandled DOWN hosts
+
+and the Icinga 2 core API's object queries, for the firmware's icinga2 source
+(POST with X-HTTP-Method-Override: GET, filter and attrs in the body; the
+filter is taken as the firmware's, `attrs` / `joins` are honoured; Basic auth
+root:icinga as in the icinga2 container):
+
+    POST /v1/objects/services   {"results":[{"attrs":..,"joins":..,"name":..}]}
+    POST /v1/objects/hosts
+
+State is driven over a small control API instead of the Icinga 2 core API:
+
+    POST /mock/state?service=<name>&exit=<0..3>   push a service state
+    POST /mock/state?host=<name>&exit=<0|1>       push a host state
+    POST /mock/bulk?services=<n>[&exit=<0..3>]    n services at once (bulk-0000..)
+    POST /mock/bulk?hosts=<n>[&exit=<0|1>]        n hosts at once
+    GET  /mock/state                              dump the current state
+
+Big replies, for the firmware's early abort (see test-env/README.md):
+--bloat N pads every object's plugin output with N bytes, and --ignore-limit
+serves the whole list whatever `limit` says, as a URL that lost limit=1 would.
+
+--validators adds ETag and Last-Modified to the lists and answers
+If-None-Match / If-Modified-Since with 304 Not Modified, for the firmware's
+conditional polls. next_check is always the next full minute, so a list only
+changes when a state does or a minute turns over.
+
+--provision DIR also serves the firmware's provisioning documents, as a
+central config server would: GET /provision/<id> answers DIR/<id>.conf, or
+DIR/default.conf, always with ETag / Last-Modified and 304s (point the sim
+at it with SIM_PROV_URL=http://localhost:8090/provision/{id}).
+
+test-env/scripts/_lib.sh talks to it when ICINGA_MOCK is set, so
+set-critical.sh / set-ok.sh work unchanged:
+
+    ./mock-icinga/mock_icinga.py --port 8090 &
+    ICINGA_MOCK=http://localhost:8090 ./scripts/set-critical.sh
+
+Standard library only.
+"""
+import argparse
+import base64
+import email.utils
+import hashlib
+import json
+import os
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+HOST = "test-host"
+PAD = ""            # --bloat
+IGNORE_LIMIT = False
+VALIDATORS = False
+PROVISION = None    # --provision
+API_LOGIN = "root:icinga"
+
+lock = threading.Lock()
+services = {}   # name -> exit status
+hosts = {}      # name -> exit status
+since = {}      # ("service"|"host", name) -> unix time of last state change
+changed = time.time()   # last state push, for Last-Modified
+
+
+def iso(ts):
+    return time.strftime("%Y-%m-%dT%H:%M:%S+00:00", time.gmtime(ts))
+
+
+def next_minute(ts):
+    return (int(ts) // 60 + 1) * 60
+
+
+def service_obj(name, state):
+    now = time.time()
+    return {
+        "name": name,
+        "display_name": name,
+        "host": {"name": HOST, "display_name": HOST},
+        "state": {
+            "soft_state": state,
+            "hard_state": state,
+            "output": "CRITICAL: set via mock_icinga" + PAD,
+            "is_problem": "y",
+            "is_handled": "n",
+            "is_acknowledged": "n",
+            "in_downtime": "n",
+            "is_flapping": "n",
+            "last_state_change": iso(since.get(("service", name), now)),
+            "next_check": iso(next_minute(now)),
+        },
+    }
+
+
+def host_obj(name, state):
+    now = time.time()
+    return {
+        "name": name,
+        "display_name": name,
+        "state": {
+            "soft_state": state,
+            "hard_state": state,
+            "output": "DOWN: set via mock_icinga" + PAD,
+            "is_problem": "y",
+            "is_handled": "n",
+            "is_acknowledged": "n",
+            "in_downtime": "n",
+            "is_flapping": "n",
+            "last_state_change": iso(since.get(("host", name), now)),
+            "next_check": iso(next_minute(now)),
+        },
+    }
+
+
+class Server(ThreadingHTTPServer):
+    # The stdlib default backlog of 5 drops SYNs under a simulated fleet
+    # (esp32-sim/fleet.cpp), which then shows up as 1 s retransmit latency.
+    request_queue_size = 1024
+    daemon_threads = True
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def reply(self, code, body, ctype="application/json", headers=()):
+        data = body.encode() if isinstance(body, str) else body
+        self.send_response(code)
+        for name, value in headers:
+            self.send_header(name, value)
+        if code == 304:
+            return self.end_headers()
+        self.send_header("Content-Type", ctype)
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    # A list with its validators, or 304 when the client's still hold. The
+    # body changes with a state push or at a full minute (next_check).
+    def reply_list(self, body, modified):
+        if not VALIDATORS:
+            return self.reply(200, body)
+        etag = '"%s"' % hashlib.sha1(body.encode()).hexdigest()[:16]
+        headers = (("ETag", etag), ("Last-Modified", email.utils.formatdate(modified, usegmt=True)))
+        match = self.headers.get("If-None-Match")
+        since_hdr = self.headers.get("If-Modified-Since")
+        if match is not None:
+            fresh = etag in [m.strip() for m in match.split(",")]
+        elif since_hdr:
+            try:
+                fresh = int(modified) <= email.utils.parsedate_to_datetime(since_hdr).timestamp()
+            except (TypeError, ValueError):
+                fresh = False
+        else:
+            fresh = False
+        self.reply(304 if fresh else 200, body, headers=headers)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        q = parse_qs(url.query)
+        limit = int(q.get("limit", ["0"])[0] or 0)
+        with lock:
+            if url.path == "/icingadb/services":
+                objs = [service_obj(n, s) for n, s in sorted(services.items()) if s == 2]
+            elif url.path == "/icingadb/hosts":
+                objs = [host_obj(n, s) for n, s in sorted(hosts.items()) if s == 1]
+            elif url.path == "/mock/state":
+                return self.reply(200, json.dumps({"services": services, "hosts": hosts}))
+            elif url.path.startswith("/provision/") and PROVISION:
+                return self.provision(url.path[len("/provision/"):])
+            else:
+                return self.reply(404, "not found", "text/plain")
+            modified = max(changed, int(time.time()) // 60 * 60)
+        if limit > 0 and not IGNORE_LIMIT:
+            objs = objs[:limit]
+        self.reply_list(json.dumps(objs), modified)
+
+    # /provision/<id>: the device's document, else the default one.
+    def provision(self, dev):
+        for name in (os.path.basename(dev) + ".conf", "default.conf"):
+            path = os.path.join(PROVISION, name)
+            if os.path.isfile(path):
+                break
+        else:
+            return self.reply(404, "no document", "text/plain")
+        body = open(path, "rb").read()
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()[:16]
+        headers = (("ETag", etag), ("Last-Modified", email.utils.formatdate(os.path.getmtime(path), usegmt=True)))
+        if etag in [m.strip() for m in self.headers.get("If-None-Match", "").split(",")]:
+            return self.reply(304, b"", headers=headers)
+        self.reply(200, body, "text/plain", headers)
+
+    # /v1/objects/<type>: the core API's shape, only the attributes asked for.
+    def api_objects(self, url):
+        if self.headers.get("X-HTTP-Method-Override", "").upper() != "GET":
+            return self.reply(405, json.dumps({"error": 405, "status": "Use X-HTTP-Method-Override: GET"}))
+        auth = self.headers.get("Authorization", "")
+        if auth != "Basic " + base64.b64encode(API_LOGIN.encode()).decode():
+            return self.reply(401, json.dumps({"error": 401, "status": "Unauthorized"}))
+        n = int(self.headers.get("Content-Length", "0") or 0)
+        try:
+            req = json.loads(self.rfile.read(n) or b"{}")
+        except ValueError:
+            return self.reply(400, json.dumps({"error": 400, "status": "Invalid request body"}))
+        hosts_q = url.path == "/v1/objects/hosts"
+        with lock:
+            if hosts_q:
+                objs = [host_obj(n, st) for n, st in sorted(hosts.items()) if st == 1]
+            else:
+                objs = [service_obj(n, st) for n, st in sorted(services.items()) if st == 2]
+        results = []
+        for o in objs:
+            full = {"display_name": o["display_name"], "name": o["name"], "state": o["state"]["soft_state"],
+                    "acknowledgement": 0, "downtime_depth": 0, "flapping": False,
+                    "last_state_change": since.get(("host" if hosts_q else "service", o["name"]), time.time()),
+                    "next_check": float(next_minute(time.time())),
+                    "last_check_result": {"output": o["state"]["output"]}}
+            if not hosts_q:
+                full["host_name"] = HOST
+            attrs = req.get("attrs")
+            r = {"attrs": {k: v for k, v in full.items() if attrs is None or k in attrs}}
+            joins = req.get("joins") or []
+            if not hosts_q and joins:
+                host = {"name": HOST, "display_name": HOST, "state": 0}
+                r["joins"] = {"host": {k.split(".", 1)[1]: host.get(k.split(".", 1)[1]) for k in joins if k.startswith("host.")}}
+            else:
+                r["joins"] = {}
+            r["meta"] = {}
+            r["name"] = (HOST + "!" + o["name"]) if not hosts_q else o["name"]
+            r["type"] = "Host" if hosts_q else "Service"
+            results.append(r)
+        self.reply_list(json.dumps({"results": results}), max(changed, int(time.time()) // 60 * 60))
+
+    def do_POST(self):
+        global changed
+        url = urlparse(self.path)
+        if url.path in ("/v1/objects/services", "/v1/objects/hosts"):
+            return self.api_objects(url)
+        q = parse_qs(url.query)
+        if url.path not in ("/mock/state", "/mock/bulk"):
+            return self.reply(404, "not found", "text/plain")
+        code = int(q.get("exit", ["0"])[0])
+        if url.path == "/mock/bulk":
+            kind, table = ("service", services) if "services" in q else ("host", hosts)
+            n = int(q.get(kind + "s", ["0"])[0])
+            with lock:
+                changed = time.time()
+                for i in range(n):
+                    name = "bulk-%04d" % i
+                    if table.get(name) != code:
+                        since[(kind, name)] = time.time()
+                    table[name] = code
+            return self.reply(200, "ok", "text/plain")
+        with lock:
+            changed = time.time()
+            if "service" in q:
+                name = q["service"][0]
+                if services.get(name) != code:
+                    since[("service", name)] = time.time()
+                services[name] = code
+            elif "host" in q:
+                name = q["host"][0]
+                if hosts.get(name) != code:
+                    since[("host", name)] = time.time()
+                hosts[name] = code
+            else:
+                return self.reply(400, "need service= or host=", "text/plain")
+        self.reply(200, "ok", "text/plain")
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            super().log_message(fmt, *args)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("--port", type=int, default=8090)
+    ap.add_argument("--bind", default="0.0.0.0")
+    ap.add_argument("--bloat", type=int, default=0, help="extra bytes of output per object")
+    ap.add_argument("--ignore-limit", action="store_true", help="serve every object whatever limit= says")
+    ap.add_argument("--validators", action="store_true", help="send ETag / Last-Modified, answer 304")
+    ap.add_argument("--provision", metavar="DIR", help="serve provisioning documents from DIR")
+    ap.add_argument("-v", "--verbose", action="store_true")
+    args = ap.parse_args()
+    global PAD, IGNORE_LIMIT, VALIDATORS, PROVISION
+    PAD = (" | padding" * (args.bloat // 10 + 1))[:args.bloat]
+    IGNORE_LIMIT = args.ignore_limit
+    VALIDATORS = args.validators
+    PROVISION = args.provision
+    srv = Server((args.bind, args.port), Handler)
+    srv.verbose = args.verbose
+    print(f"mock icingadb-web on {args.bind}:{args.port}", flush=True)
+    srv.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
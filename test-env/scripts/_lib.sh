@@ -15,8 +15,15 @@ icinga_post() { # <path> <json>
     -d "$2"
 }
 
-# Push a passive check result for test-host!<service>.
+# Push a passive check result for test-host!<service>. With ICINGA_MOCK set
+# (e.g. http://localhost:8090) the state goes to mock-icinga/mock_icinga.py
+# instead of Icinga 2.
 set_state() { # <service> <exit_status> <text>
+  if [ -n "${ICINGA_MOCK:-}" ]; then
+    curl -fsS -X POST "$ICINGA_MOCK/mock/state?service=$1&exit=$2" >/dev/null
+    echo "  $1 -> exit=$2 ($3) [mock]"
+    return
+  fi
   icinga_post "actions/process-check-result?service=${HOST}!$1" \
     "{\"exit_status\": $2, \"plugin_output\": \"$3\", \"check_source\": \"lighthouse-test\"}" \
     >/dev/null
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""
+Checks a simulator waveform (SIM_WAVE=<file>, see esp32-sim/MockESP.h) against
+the timing the firmware was configured with (taken from the boot event):
+
+  - alarm state dwell: INITIAL lasts init_ms, COOLDOWN rint_ms, REMINDER rdur_ms
+    (only for dwells that ended in the next state, not in a clear);
+  - siren (relay 1) is on exactly while the state is INITIAL or REMINDER;
+  - siren pulse lengths, reminder spacing and poll spacing;
+  - status LED half-periods are 1000 ms (Icinga reachable) or 200 ms (not).
+
+The firmware loop is cooperative, so every interval may run late by up to one
+loop pass or a blocking HTTP request; --tol sets that slack. Intervals that run
+short, or late beyond the slack, fail the check.
+
+    SIM_WAVE=out/run.jsonl SIM_VCD=out/run.vcd ./esp32-sim/esp32-sim
+    ./scripts/check-waveform.py out/run.jsonl --tol 300
+
+Exit status 0 when every check passed. Standard library only.
+"""
+import argparse
+import json
+import sys
+
+STATES = {0: "IDLE", 1: "INITIAL", 2: "COOLDOWN", 3: "REMINDER"}
+SIREN = "relay1_gpio21"
+LED = "led_gpio25"
+
+
+def load(path):
+    boot, events, edges = None, [], {}
+    with open(path) as f:
+        for line in f:
+            try:
+                rec = json.loads(line)
+            except ValueError:
+                continue
+            if "sig" in rec:
+                edges.setdefault(rec["sig"], []).append((rec["t_us"], rec["val"]))
+            elif "ev" in rec:
+                if rec["ev"] == "boot" and boot is None:
+                    boot = rec
+                events.append(rec)
+    return boot, events, edges
+
+
+def pulses(edges):
+    """(start_us, end_us) of every completed high pulse."""
+    out, start = [], None
+    for t, v in edges:
+        if v and start is None:
+            start = t
+        elif not v and start is not None:
+            out.append((start, t))
+            start = None
+    return out
+
+
+class Report:
+    def __init__(self, tol_ms, quiet):
+        self.tol = tol_ms
+        self.quiet = quiet
+        self.fails = 0
+
+    def interval(self, what, got_ms, want_ms):
+        late = got_ms - want_ms
+        ok = -1 <= late <= self.tol          # 1 ms: millis() rounding
+        if not ok:
+            self.fails += 1
+        elif self.quiet:
+            return
+        print(f"  {'ok ' if ok else 'BAD'} {what:<34} {got_ms:9.0f} ms (want {want_ms} +{self.tol})")
+
+    def fail(self, msg):
+        self.fails += 1
+        print(f"  BAD {msg}")
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Check simulator waveform timing")
+    ap.add_argument("wave", help="JSON-lines waveform written via SIM_WAVE")
+    ap.add_argument("--tol", type=float, default=250, help="allowed lateness per interval (ms)")
+    ap.add_argument("--quiet", action="store_true", help="print only failures and the verdict")
+    args = ap.parse_args()
+
+    boot, events, edges = load(args.wave)
+    if not boot:
+        sys.exit("no boot event in waveform - was SIM_WAVE set from process start?")
+    rep = Report(args.tol, args.quiet)
+
+    want = {1: boot["init_ms"], 2: boot["rint_ms"], 3: boot["rdur_ms"]}
+    print(f"config: poll {boot['poll_ms']} ms, recheck {boot['recheck_ms']} ms, threshold "
+          f"{boot['threshold']}, siren {want[1]} ms, reminder every {want[2]} ms for {want[3]} ms")
+
+    # State dwell times, and where the siren must be on.
+    print("state machine:")
+    trans = [(e["t_us"], e["from"], e["to"]) for e in events if e["ev"] == "state"]
+    for (t0, _, s), (t1, _, nxt) in zip(trans, trans[1:]):
+        if s in want and nxt != 0:
+            rep.interval(f"{STATES[s]} -> {STATES[nxt]}", (t1 - t0) / 1000, want[s])
+    siren = edges.get(SIREN, [])
+    for t, _, to in trans:
+        # The relay is written just before the state changes, in the same pass.
+        level = next((v for ts, v in reversed(siren) if ts <= t), 0)
+        if level != (to in (1, 3)):
+            rep.fail(f"siren {'off' if to in (1, 3) else 'on'} after entering {STATES[to]} "
+                     f"at {t / 1e6:.3f}s")
+
+    # Siren pulses: first one per episode is the initial alarm, then reminders.
+    print("siren:")
+    ps = pulses(siren)
+    for i, (a, b) in enumerate(ps):
+        state = next((to for t, _, to in reversed(trans) if t <= a + 1000), None)
+        ended = next((to for t, _, to in trans if t >= b - 1000), None)
+        if state in want and ended == 2:
+            rep.interval(f"pulse {i + 1} ({STATES[state]})", (b - a) / 1000, want[state])
+        elif not args.quiet:
+            print(f"  --  pulse {i + 1} {(b - a) / 1000:9.0f} ms (cut short: alarm cleared)")
+    for (a0, b0), (a1, _) in zip(ps, ps[1:]):
+        if not any(a0 < t < a1 and to == 0 for t, _, to in trans):   # same episode
+            rep.interval("reminder spacing (off time)", (a1 - b0) / 1000, want[2])
+
+    # Polls: a new cycle starts poll_ms after the previous one started, or
+    # recheck_ms while a problem is being confirmed. A skipped poll (the W5500
+    # was busy) is tried again at once and doesn't count.
+    print("polls:")
+    starts = []
+    for e in events:
+        if e["ev"] == "poll_start":
+            starts.append(e)
+        elif e["ev"] == "poll_skipped":
+            starts.pop()
+    for p0, p1 in zip(starts, starts[1:]):
+        confirming = 0 < p1["confirm"] < boot["threshold"]
+        w = boot["recheck_ms"] if confirming else boot["poll_ms"]
+        rep.interval("poll spacing" + (" (recheck)" if confirming else ""),
+                     (p1["t_us"] - p0["t_us"]) / 1000, w)
+
+    # LED blink: the rate follows Icinga reachability when the toggle happens.
+    print("status LED:")
+    led = edges.get(LED, [])
+    polls = [e for e in events if e["ev"] == "poll_end"]
+    for (t0, _), (t1, _) in zip(led, led[1:]):
+        done = [e for e in polls if e["t_us"] <= t1]
+        reach = done[-1]["reachable"] if done else False   # icinga_reachable starts false
+        rep.interval("LED half-period", (t1 - t0) / 1000, 1000 if reach else 200)
+
+    print(f"{'PASS' if rep.fails == 0 else 'FAIL'}: {rep.fails} check(s) failed")
+    sys.exit(1 if rep.fails else 0)
+
+
+if __name__ == "__main__":
+    main()
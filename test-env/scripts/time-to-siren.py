@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""
+End-to-end time-to-siren benchmark.
+
+Drives a problem through set-critical.sh / set-ok.sh and timestamps every stage
+from the simulator's structured events (SIM_EVENTS, see esp32-sim/MockESP.h):
+
+    injected -> first poll that sees it -> confirmation complete -> RELAY 1 ON
+    cleared  -> first poll without it (alarm disarmed) -> RELAY 1 OFF
+
+Each run waits a random fraction of the poll interval before injecting, so the
+distributions cover every phase of the poll cycle. Timestamps share one clock:
+the sim's millis() is wall-clock ms, like time.time() here.
+
+Full stack (sim started with SIM_EVENTS=-):
+    SIM_EVENTS=- docker-compose --profile sim up -d
+    ./scripts/time-to-siren.py --runs 20
+
+Mock server, no containers:
+    ./mock-icinga/mock_icinga.py --port 8090 &
+    ICINGA_MOCK=http://localhost:8090 ./scripts/time-to-siren.py --runs 20 \\
+        --events "env SIM_EVENTS=- SIM_ICINGA_BASE=http://localhost:8090 ./esp32-sim/esp32-sim"
+
+Standard library only.
+"""
+import argparse
+import json
+import os
+import queue
+import random
+import shlex
+import statistics
+import subprocess
+import sys
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SIREN_PIN = 21
+
+
+class Events:
+    """Reads JSON event lines from a command's stdout (other lines ignored)."""
+
+    def __init__(self, cmd):
+        self.proc = subprocess.Popen(cmd, shell=True, stdout=subprocess.PIPE,
+                                     stderr=subprocess.STDOUT, text=True, bufsize=1)
+        self.q = queue.Queue()
+        self.boot = None
+        threading.Thread(target=self._pump, daemon=True).start()
+
+    def _pump(self):
+        for line in self.proc.stdout:
+            line = line.strip()
+            if not line.startswith('{"t_ms"'):
+                continue
+            try:
+                ev = json.loads(line)
+            except ValueError:
+                continue
+            if ev["ev"] == "boot":
+                self.boot = ev
+            self.q.put(ev)
+
+    def wait(self, pred, since_ms, timeout_s):
+        """Returns the first event after since_ms matching pred, or None."""
+        deadline = time.time() + timeout_s
+        while time.time() < deadline:
+            try:
+                ev = self.q.get(timeout=max(0.05, deadline - time.time()))
+            except queue.Empty:
+                break
+            if ev["t_ms"] >= since_ms and pred(ev):
+                return ev
+        return None
+
+    def drain(self):
+        while not self.q.empty():
+            self.q.get_nowait()
+
+    def close(self):
+        self.proc.terminate()
+
+
+def now_ms():
+    return int(time.time() * 1000)
+
+
+def script(name, svc):
+    subprocess.run([os.path.join(HERE, name), svc], check=True, stdout=subprocess.DEVNULL)
+
+
+def is_poll(problem=None, alarm=None):
+    def pred(ev):
+        if ev["ev"] != "poll_end":
+            return False
+        if problem is not None and ev["problem"] != problem:
+            return False
+        return alarm is None or ev["alarm"] == alarm
+    return pred
+
+
+def is_relay(val):
+    return lambda ev: ev["ev"] == "relay" and ev["pin"] == SIREN_PIN and ev["val"] == val
+
+
+def summary(name, xs):
+    if not xs:
+        return f"{name:<28} (no samples)"
+    xs = sorted(xs)
+    p = lambda q: xs[min(len(xs) - 1, int(q * len(xs)))]
+    return (f"{name:<28} n={len(xs):<3} min={xs[0]/1000:6.2f}s p50={p(0.5)/1000:6.2f}s "
+            f"p90={p(0.9)/1000:6.2f}s max={xs[-1]/1000:6.2f}s mean={statistics.mean(xs)/1000:6.2f}s")
+
+
+def main():
+    ap = argparse.ArgumentParser(description="End-to-end time-to-siren benchmark")
+    ap.add_argument("--runs", type=int, default=10)
+    ap.add_argument("--svc", default="svc-crit")
+    ap.add_argument("--events", default="docker logs -f --since 1s il-esp32-sim",
+                    help="command whose stdout carries the sim's JSON events")
+    ap.add_argument("--timeout", type=float, default=180, help="per-stage timeout (s)")
+    ap.add_argument("--json", action="store_true", help="print raw samples as JSON")
+    args = ap.parse_args()
+
+    ev = Events(args.events)
+    try:
+        # Settle: problem cleared and at least one clean poll observed.
+        script("set-ok.sh", args.svc)
+        if not ev.wait(is_poll(problem=0), now_ms(), args.timeout):
+            sys.exit("no clean poll seen - is the simulator running with SIM_EVENTS=- ?")
+        poll_ms = (ev.boot or {}).get("poll_ms", 6000)
+
+        stages = {k: [] for k in ("seen", "confirmed", "siren", "cleared", "siren_off")}
+        for run in range(args.runs):
+            time.sleep(random.uniform(0, poll_ms / 1000.0))
+            ev.drain()
+            t0 = now_ms()
+            script("set-critical.sh", args.svc)
+            seen = ev.wait(is_poll(problem=1), t0, args.timeout)
+            conf = seen and ev.wait(is_poll(alarm=1), t0, args.timeout)
+            siren = conf and ev.wait(is_relay(1), t0, args.timeout)
+            t1 = now_ms()
+            script("set-ok.sh", args.svc)
+            clear = ev.wait(is_poll(problem=0, alarm=0), t1, args.timeout)
+            off = ev.wait(is_relay(0), t1, 5) if siren else None
+
+            for k, e, base in (("seen", seen, t0), ("confirmed", conf, t0), ("siren", siren, t0),
+                               ("cleared", clear, t1), ("siren_off", off, t1)):
+                if e:
+                    stages[k].append(e["t_ms"] - base)
+            print(f"run {run + 1:>3}/{args.runs}: seen {fmt(seen, t0)} confirmed {fmt(conf, t0)} "
+                  f"siren {fmt(siren, t0)} | cleared {fmt(clear, t1)}", flush=True)
+    finally:
+        ev.close()
+
+    b = ev.boot or {}
+    print()
+    print(f"settings: poll {b.get('poll_ms', '?')} ms, recheck {b.get('recheck_ms', '?')} ms, "
+          f"threshold {b.get('threshold', '?')}")
+    print(summary("inject -> first poll sees", stages["seen"]))
+    print(summary("inject -> confirmed", stages["confirmed"]))
+    print(summary("inject -> RELAY 1 ON", stages["siren"]))
+    print(summary("clear  -> alarm disarmed", stages["cleared"]))
+    print(summary("clear  -> RELAY 1 OFF", stages["siren_off"]))
+    if args.json:
+        print(json.dumps({"settings": b, "samples_ms": stages}))
+
+
+def fmt(e, base):
+    return f"{(e['t_ms'] - base) / 1000:6.2f}s" if e else "   --  "
+
+
+if __name__ == "__main__":
+    main()
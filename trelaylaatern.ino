@@ -17,6 +17,35 @@
  * Note: In simulation, use your PC's IP address for Icinga, not localhost!
  */
 
+// --- BUILD PROFILE ---
+// Subsystems can be compiled out entirely (build.sh PROFILE=minimal-wifi /
+// eth-only / full, or -D LH_...=0 by hand). Without flags everything is in,
+// as in the Arduino IDE and the simulator.
+#ifndef LH_WIFI
+  #define LH_WIFI 1      // WiFi station uplink (the config AP is always built)
+#endif
+#ifndef LH_ETH
+  #define LH_ETH 1       // W5500 shield: Ethernet library + SPI
+#endif
+#ifndef LH_TLS
+  #define LH_TLS 1       // https:// URLs (WiFiClientSecure + mbedTLS)
+#endif
+#ifndef LH_LANG_PL
+  #define LH_LANG_PL 1   // Polish UI texts
+#endif
+#ifndef LH_MQTT
+  #define LH_MQTT 1      // MQTT state publishing (PubSubClient)
+#endif
+#ifndef LH_PROV_URL
+  #define LH_PROV_URL "" // provisioning URL baked into the image (see "Provisioning")
+#endif
+#if !LH_WIFI && !LH_ETH
+  #error "build profile needs an uplink: LH_WIFI and/or LH_ETH"
+#endif
+#if LH_TLS && !LH_WIFI
+  #error "LH_TLS needs LH_WIFI (the W5500 has no TLS)"
+#endif
+
 // --- SIMULATION MODE ---
 // To run in Podman/Docker (Linux Simulation):
 // This block allows compiling the .ino file as a C++ Linux app.
@@ -24,21 +53,41 @@
   #include "MockESP.h"
   // REMOVED DEFINITIONS FROM HERE TO AVOID REDEFINITION ERROR
 #else
-  #include <WiFi.h>
+  #include <WiFi.h>                // station and/or the config AP
   #include <WebServer.h>
-  #include <HTTPClient.h>
+  #if LH_TLS
   #include <WiFiClientSecure.h>
+  #endif
   #include <ArduinoJson.h>
   #include <Preferences.h>
+  #include <Update.h>
+  #include "esp_ota_ops.h"
+  #include "mbedtls/sha256.h"
+  #include "mbedtls/sha1.h"
+  #include "esp_pm.h"
+  #if LH_ETH
   #include <Ethernet.h>            // WIZnet W5500 (T-Relay W5500 shield H671)
   #include <SPI.h>
+  #endif
+  #if LH_MQTT
+  #include <PubSubClient.h>
+  #endif
   #include "soc/soc.h"
   #include "soc/rtc_cntl_reg.h"
   
   // Configuration for Real ESP32
   // ... (Wokwi or Physical)
+
+  #define SIM_EVENT(...)           // simulator instrumentation (MockESP.h); no-op here
 #endif    
 
+// Alarm decisions (confirmation, relay state machine, schedule, Date + JSON
+// parsing) are hardware-independent and live in the header; this sketch feeds
+// it and drives the pins.
+#include "lighthouse_core.h"
+
+#define FW_VERSION "5.3.0"
+
 // --- PIN DEFINITIONS ---
 #define RELAY_1_PIN 21
 #define RELAY_2_PIN 19
@@ -59,7 +108,7 @@
 #define RELAY_OFF LOW   
 
 Preferences preferences;
-WebServer server(80);
+WebServer server{80};
 
 // --- LANGUAGE DICTIONARY STRUCT ---
 struct LangText {
@@ -96,9 +145,23 @@ String wifi_pass = "";
 // We ask Icinga *Web* for unhandled problems, so acknowledged / in-downtime /
 // flapping objects are filtered out server-side (is_acknowledged=n, etc.).
 // http:// uses a plain socket; https:// uses TLS (insecure / no cert check).
-// limit=1 keeps the JSON tiny — we only need "is there any problem?".
-String icinga_url_svc = "http://192.168.1.100:8080/icingadb/services?service.state.soft_state=2&service.state.is_acknowledged=n&service.state.in_downtime=n&service.state.is_flapping=n&limit=1";
-String icinga_url_host = "http://192.168.1.100:8080/icingadb/hosts?host.state.soft_state=1&host.state.is_acknowledged=n&host.state.in_downtime=n&host.state.is_flapping=n&limit=1";
+// limit=20 keeps the JSON small: enough for the problem list, and the reply
+// is read no further than the list needs anyway.
+String icinga_url_svc = "http://192.168.1.100:8080/icingadb/services?service.state.soft_state=2&service.state.is_acknowledged=n&service.state.in_downtime=n&service.state.is_flapping=n&limit=20";
+String icinga_url_host = "http://192.168.1.100:8080/icingadb/hosts?host.state.soft_state=1&host.state.is_acknowledged=n&host.state.in_downtime=n&host.state.is_flapping=n&limit=20";
+
+// Alert source: how a reply is read (lh::Selector, see lighthouse_core.h).
+// "icingadb" reads the URLs above; "alertmanager" a Prometheus Alertmanager's
+// /api/v2/alerts (services URL; hosts URL empty); "custom" any JSON API, with
+// the three selectors below. Compiled once when the settings load.
+String alert_source = "icingadb";
+String sel_problem = "count($) > 0";
+String sel_label = "";
+String sel_hint = "";
+
+// Problem list: how many of the current problems each poll keeps for the
+// /problems page (0 = off), at most lh::LIST_MAX. See "Problem list".
+int problem_list_max = 20;
 
 String icinga_user = "admin";   // Icinga Web login (not the icinga2 API user)
 String icinga_pass = "admin";
@@ -107,9 +170,31 @@ String web_pass = "admin";
 String system_lang = "en";
 String tls_fingerprint = ""; // Stores SHA1 fingerprint (reserved; TLS is insecure for now)
 
+// Provisioning: settings fetched from a central server at boot and every
+// prov_interval_ms, {id} in the URL standing for the device id (see
+// "Provisioning"). "" = off.
+String prov_url = LH_PROV_URL;
+unsigned long prov_interval_ms = 15UL * 60 * 1000;
+const unsigned long PROV_RETRY_MS = 60000;   // after a fetch that failed
+
 // Ethernet (W5500): auto-used when the shield is detected, unless disabled here.
 bool eth_disabled = false;   // panel toggle: force WiFi even if a W5500 is present
 
+// MQTT: retained state topics for building automation and dashboards (see
+// "MQTT state publishing" below). Off while the broker host is empty.
+String mqtt_host = "";
+int mqtt_port = 1883;
+String mqtt_user = "";
+String mqtt_pass = "";
+String mqtt_base = "";                        // topic prefix, "" = lighthouse/<device id>
+unsigned long mqtt_heartbeat_ms = 60000;
+
+// Power mode: what the device does between polls (see "Power management").
+#define PWR_PERFORMANCE 0     // full clock, radio always on, loop() never idles
+#define PWR_BALANCED    1     // lower / scaled clock, modem sleep, short idles
+#define PWR_LOW         2     // + longer idles, automatic light sleep with esp_pm
+int power_mode = PWR_PERFORMANCE;
+
 // Timings
 unsigned long poll_interval_ms = 30000;       // normal poll cadence
 unsigned long recheck_interval_ms = 10000;    // fast re-poll while confirming a fresh problem
@@ -129,7 +214,7 @@ int confirm_threshold = 3;
 //
 // Each block = a day mask (bit0=Mon .. bit6=Sun; 0 disables the block) plus an
 // [start, end) hour window. The siren fires if ANY block matches now.
-#define BH_BLOCKS 4
+#define BH_BLOCKS lh::BH_BLOCKS
 bool bh_enabled = false;          // restrict siren to the schedule
 int  tz_offset  = 0;              // hours added to UTC for local time (e.g. +2)
 int  bh_days[BH_BLOCKS] = { 0x1F, 0, 0, 0 };   // default block 1: Mon-Fri
@@ -154,11 +239,43 @@ bool icinga_reachable = false;
 bool is_alarm_active = false;
 bool is_network_error = false;
 bool wifi_connected_mode = false;
-int alarm_confirm_count = 0;       // consecutive polls that saw a problem
+lh::Confirmation alarm_confirm;    // consecutive polls that saw a problem
+lh::Selector problem_selector;     // alert_source, compiled (compileSource())
 String last_next_check = "";       // next_check hint from Icinga (for the UI)
 bool eth_present = false;          // W5500 chip detected on SPI at boot
 bool eth_active = false;           // Ethernet has an IP (updated from net events)
+String eth_ip_str;                 // its address as last read (localIPStr())
+unsigned long last_eth_check = 0;  // last link/lease check in loop()
 bool config_ap_active = false;     // the config access point is currently up
+bool ota_pending = false;          // running image installed by OTA, not confirmed yet
+unsigned long power_web_ms = 0;    // last panel login; loop() stays responsive after it
+unsigned long pwr_passes = 0;      // loop() passes so far (each one a wake-up)
+unsigned long pwr_idle_ms = 0;     // time loop() gave back between them
+
+// What readers show (panel, /api/status, /metrics, the LED, MQTT): the state
+// above, published as one snapshot at the end of every loop() pass by
+// publishStatus(). Readers take status_board.read() instead of the loose
+// globals, so they never see half of a poll's update and need no lock on
+// another core.
+lh::Published<lh::Status> status_board;
+
+// The problem list (/problems): the rows of the last poll that got an
+// answer, and the one being filled by the poll in progress. Fixed size
+// (lh::ProblemList), whatever the replies hold.
+lh::ProblemList problem_list;
+lh::ProblemList problem_scratch;
+unsigned long problem_list_ms = 0;     // millis() of that poll, 0 = none yet
+unsigned long problem_list_epoch = 0;  // the server's clock then, 0 = unknown
+unsigned problem_list_gen = 0;         // lists published so far (PollCache)
+bool problem_list_partial = false;     // without host rows: that poll's host read failed
+
+// Provisioning state: when the next fetch is due (0 = first pass with a
+// link), what the last one did, and the document applied (rev, kept in NVS
+// with its validators and hash).
+unsigned long prov_due_ms = 0;
+String prov_status = "";
+unsigned long prov_status_ms = 0;
+String prov_rev = "";
 
 // Brute-force protection for the web panel: slow every failed login and lock the
 // panel after too many in a row. Lockout is global (a sustained attack briefly
@@ -169,35 +286,95 @@ int auth_fail_count = 0;
 unsigned long auth_lock_until = 0;             // millis deadline; 0 = not locked
 
 // Current time, parsed from the HTTP "Date" header (UTC).
-bool time_valid = false;
-int cur_utc_hour = 0;
-int cur_utc_min = 0;
-int cur_wday = 0;                  // 0=Sun .. 6=Sat (UTC)
+lh::WallClock wall_clock;
+
+lh::AlarmMachine alarm_machine;    // siren pattern (initial pulse, reminders)
+
+// The W5500 is driven from loop() (polls, lease upkeep) and, for MQTT over
+// Ethernet, from the MQTT task; the WIZnet library isn't thread-safe, so both
+// hold spi_lock around chip access. Stays NULL (no locking) unless the MQTT
+// task exists in an Ethernet build.
+SemaphoreHandle_t spi_lock = NULL;
+
+class BusLock {
+public:
+  BusLock(SemaphoreHandle_t m, TickType_t wait) : m_(m), held_(!m || xSemaphoreTake(m, wait) == pdTRUE) {}
+  ~BusLock() { if (m_ && held_) xSemaphoreGive(m_); }
+  bool held() const { return held_; }
+private:
+  SemaphoreHandle_t m_;
+  bool held_;
+};
 
-enum AlarmState { STATE_IDLE, STATE_INITIAL_ALARM, STATE_COOLDOWN, STATE_REMINDER_ALARM };
-AlarmState current_state = STATE_IDLE;
-unsigned long state_start_time = 0;
+// Held while the CPU has real work to do (TLS handshake, JSON parsing): keeps
+// the clock at its maximum and light sleep out. NULL (no-op) unless esp_pm
+// runs, see powerBegin().
+esp_pm_lock_handle_t pm_cpu_lock = NULL;
+
+class PmLock {
+public:
+  explicit PmLock(esp_pm_lock_handle_t l) : l_(l) { if (l_) esp_pm_lock_acquire(l_); }
+  ~PmLock() { if (l_) esp_pm_lock_release(l_); }
+private:
+  esp_pm_lock_handle_t l_;
+};
+
+// What one query found. POLL_SKIPPED: it never ran (the W5500 was busy with
+// the MQTT task), so the poll changes nothing and loop() tries again on its
+// next pass.
+enum PollAnswer { POLL_CLEAR, POLL_PROBLEM, POLL_SKIPPED };
 
-// Declarations
+// Declarations (skipped when the simulator compiles this sketch as a class
+// body, to run restartable or many instances; members can't be redeclared)
+#ifndef SIM_INSTANCE
 void loadSettings();
 void setLanguage(); 
 void setupWiFi();
 void setupNetwork();
 bool networkUp();
 String localIPStr();
+String buildFeatures();
 void handleRoot();
 void handleSave();
 void handleToggle();
-void checkIcinga();
+void handleStatusJson();
+void handleMetrics();
+void handleProblems();
+void handleConfig();
+String configDocument();
+void provisionFetch();
+bool checkIcinga();
 bool requireAuth();
-bool queryIcingaEndpoint(String url, String typeName);
+PollAnswer queryIcingaEndpoint(String url, String typeName);
+PollAnswer querySqlEndpoint(const String& url, const String& typeName);
+bool compileSource(lh::Selector& sel, const String& source, const String& problem,
+                   const String& label, const String& hint);
+String base64Encode(String in);
 void captureHttpDate(String d);
 bool alertsAllowedNow();
 String localTimeStr();
+lh::Config coreConfig();
 void updateRelayLogic();
 void ensureWiFiConnection();
 void updateStatusLED();
 String getUptimeStr();
+String deviceId();
+void otaBegin();
+void otaConfirm();
+void otaWatch();
+void handleUpload();
+void handleUpdate();
+String otaSummary();
+void publishStatus();
+void powerBegin();
+void powerIdle();
+String powerSummary();
+#if LH_MQTT
+void mqttBegin();
+void mqttNote();
+String mqttSummary();
+#endif
+#endif
 
 void setup() {
   // --- SIMULATION MODE ---
@@ -211,7 +388,7 @@ void setup() {
 
   Serial.begin(115200);
   delay(1000);
-  Serial.println("\n--- icinga-lighthouse v5.3.0 (Icinga DB Web + Ethernet + Schedule blocks) Booting... ---");
+  Serial.println("\n--- icinga-lighthouse v" FW_VERSION " (Icinga DB Web + Ethernet + Schedule blocks) Booting... ---");
 
   pinMode(RELAY_1_PIN, OUTPUT);
   pinMode(RELAY_2_PIN, OUTPUT);
@@ -226,28 +403,81 @@ void setup() {
   digitalWrite(STATUS_LED_PIN, LOW);
 
   loadSettings();
+  otaBegin();
 
   #ifdef LINUX_SIM
-    // Override settings for the Docker test-env AFTER loadSettings()
-    // (Preferences are not persisted in the Linux mock). Point at icingadb-web.
-    wifi_ssid = "DOCKER_NET";
-    wifi_pass = "";
-    icinga_user = "admin";
-    icinga_pass = "admin";
-    icinga_url_svc = "http://icingaweb2:8080/icingadb/services?service.state.soft_state=2&service.state.is_acknowledged=n&service.state.in_downtime=n&service.state.is_flapping=n&limit=1";
-    icinga_url_host = "http://icingaweb2:8080/icingadb/hosts?host.state.soft_state=1&host.state.is_acknowledged=n&host.state.in_downtime=n&host.state.is_flapping=n&limit=1";
-    // Fast cadence so the demo reacts quickly.
-    poll_interval_ms = 6000;
-    recheck_interval_ms = 2000;
+    // Defaults for the Docker test-env, applied AFTER loadSettings() to whatever
+    // the (emulated, SIM_NVS-backed) flash doesn't hold yet: point at
+    // icingadb-web with a fast cadence so the demo reacts quickly. Settings
+    // saved through the panel survive restarts like on the device.
+    // SIM_ICINGA_BASE / SIM_POLL_MS / SIM_RECHECK_MS / SIM_CONFIRM always win,
+    // so harnesses can point the sim at the mock server and sweep the timings.
+    if (!preferences.isKey("ssid")) wifi_ssid = "DOCKER_NET";
+    if (!preferences.isKey("iuser")) icinga_user = "admin";
+    if (!preferences.isKey("ipass")) icinga_pass = "admin";
+    // SIM_SOURCE=alertmanager / icinga2 reads SIM_ICINGA_BASE as that server
+    // (icinga2: the test-env API login); a mysql:// base is the Icinga DB
+    // database itself (test-env login).
+    alert_source = simEnvStr("SIM_SOURCE", alert_source.c_str());
+    String base = simEnvStr("SIM_ICINGA_BASE", "");
+    if (!preferences.isKey("iurl_s") || base.length()) {
+      if (base.startsWith("mysql://")) {
+        icinga_url_svc = base;
+        icinga_url_host = "";
+        if (!preferences.isKey("iuser")) icinga_user = "lighthouse";
+        if (!preferences.isKey("ipass")) icinga_pass = "lighthouse";
+      } else if (alert_source == "icinga2") {
+        if (!base.length()) base = "https://icinga2:5665";
+        icinga_url_svc = base + "/v1/objects/services";
+        icinga_url_host = base + "/v1/objects/hosts";
+        if (!preferences.isKey("iuser")) icinga_user = "root";
+        if (!preferences.isKey("ipass")) icinga_pass = "icinga";
+      } else if (alert_source == "alertmanager") {
+        if (!base.length()) base = "http://mock-alertmanager:9093";
+        icinga_url_svc = base + "/api/v2/alerts?active=true&silenced=false&inhibited=false";
+        icinga_url_host = "";
+      } else {
+        if (!base.length()) base = "http://icingaweb2:8080";
+        icinga_url_svc = base + "/icingadb/services?service.state.soft_state=2&service.state.is_acknowledged=n&service.state.in_downtime=n&service.state.is_flapping=n&limit=20";
+        icinga_url_host = base + "/icingadb/hosts?host.state.soft_state=1&host.state.is_acknowledged=n&host.state.in_downtime=n&host.state.is_flapping=n&limit=20";
+      }
+    }
+    compileSource(problem_selector, alert_source, sel_problem, sel_label, sel_hint);
+    poll_interval_ms = simEnvULong("SIM_POLL_MS", preferences.isKey("poll") ? poll_interval_ms : 6000);
+    recheck_interval_ms = simEnvULong("SIM_RECHECK_MS", preferences.isKey("rchk") ? recheck_interval_ms : 2000);
+    confirm_threshold = (int)simEnvULong("SIM_CONFIRM", confirm_threshold);
+    power_mode = constrain((int)simEnvULong("SIM_POWER", power_mode), PWR_PERFORMANCE, PWR_LOW);
+    prov_url = simEnvStr("SIM_PROV_URL", prov_url.c_str());
+    String mq = simEnvStr("SIM_MQTT", "");           // broker as host[:port]
+    if (mq.length()) {
+      int colon = mq.indexOf(':');
+      mqtt_host = colon < 0 ? mq : mq.substring(0, colon);
+      if (colon >= 0) mqtt_port = mq.substring(colon + 1).toInt();
+    }
   #endif
 
+  powerBegin();
   setupNetwork();
+#if LH_MQTT
+  mqttBegin();
+#endif
 
-  server.on("/", handleRoot);
-  server.on("/save", HTTP_POST, handleSave);
-  server.on("/toggle", handleToggle);
-  server.begin();
+  // Lambdas (not bare function names) so the handlers also bind as members in
+  // the simulator's class-body build (SIM_INSTANCE).
+  server.on("/", [&] { handleRoot(); });
+  server.on("/save", HTTP_POST, [&] { handleSave(); });
+  server.on("/toggle", [&] { handleToggle(); });
+  server.on("/api/status", [&] { handleStatusJson(); });
+  server.on("/metrics", [&] { handleMetrics(); });
+  server.on("/problems", [&] { handleProblems(); });
+  server.on("/config", [&] { handleConfig(); });
+  server.on("/update", HTTP_POST, [&] { handleUpdate(); }, [&] { handleUpload(); });
   last_successful_data_time = millis(); 
+  publishStatus();
+  server.begin();
+  SIM_EVENT("boot", {{"poll_ms", (long)poll_interval_ms}, {"recheck_ms", (long)recheck_interval_ms},
+                     {"threshold", confirm_threshold}, {"init_ms", (long)init_alarm_duration_ms},
+                     {"rint_ms", (long)reminder_interval_ms}, {"rdur_ms", (long)reminder_duration_ms}});
 }
 
 void loop() {
@@ -255,15 +485,17 @@ void loop() {
   unsigned long current_millis = millis();
   updateStatusLED();
 
-#ifndef LINUX_SIM
+#if LH_ETH
   // Keep the Ethernet lease alive and track cable plug/unplug at runtime.
   if (eth_present) {
-    static unsigned long last_eth_check = 0;
     if (current_millis - last_eth_check > 3000) {
-      last_eth_check = current_millis;
-      Ethernet.maintain();
-      eth_active = (Ethernet.linkStatus() == LinkON) &&
-                   (Ethernet.localIP() != IPAddress(0, 0, 0, 0));
+      BusLock bus(spi_lock, 0);        // MQTT task on the chip: next pass
+      if (bus.held()) {
+        last_eth_check = current_millis;
+        Ethernet.maintain();
+        eth_active = (Ethernet.linkStatus() == LinkON) &&
+                     (Ethernet.localIP() != IPAddress(0, 0, 0, 0));
+      }
     }
   }
 #endif
@@ -276,16 +508,17 @@ void loop() {
 
   bool ap_mode = (!eth_active && !wifi_connected_mode);
   if (!ap_mode) {
+#if LH_WIFI
     if (wifi_connected_mode && !eth_active) ensureWiFiConnection();
+#endif
     if (networkUp()) {
-       // Adaptive cadence: while a fresh problem is still being confirmed
-       // (count between 1 and threshold-1) poll fast, so we don't wait a full
-       // poll_interval for the next confirmation. Otherwise use the normal rate.
-       bool confirming = (alarm_confirm_count > 0 && alarm_confirm_count < confirm_threshold);
-       unsigned long effective_interval = confirming ? recheck_interval_ms : poll_interval_ms;
+       // Provisioning first, so a fresh device polls with its fleet settings.
+       if (prov_url.length() && (long)(current_millis - prov_due_ms) >= 0) provisionFetch();
+       // Adaptive cadence: recheck_interval_ms while a fresh problem is being
+       // confirmed, poll_interval_ms otherwise.
+       unsigned long effective_interval = lh::pollInterval(coreConfig(), alarm_confirm);
        if (current_millis - last_poll_time >= effective_interval) {
-         last_poll_time = current_millis;
-         checkIcinga();
+         if (checkIcinga()) last_poll_time = current_millis;   // skipped: next pass
        }
     } else {
        last_connection_status = eth_present ? "ETH no link" : "No WiFi";
@@ -314,10 +547,17 @@ void loop() {
   }
 
   updateRelayLogic();
+  otaWatch();
+  publishStatus();
+#if LH_MQTT
+  mqttNote();
+#endif
+  powerIdle();
 }
 
 // --- DICTIONARY LOGIC ---
 void setLanguage() {
+#if LH_LANG_PL
   if (system_lang == "pl") {
     txt.title = "icinga-lighthouse";
     txt.st_ok = "SYSTEM OK";
@@ -341,7 +581,9 @@ void setLanguage() {
     txt.eth_off = "Wyłączony (wymuś WiFi)";
     txt.btn_save = "ZAPISZ I RESTARTUJ";
     txt.msg_saved = "Zapisano! Restart urzadzenia...";
-  } else {
+  } else
+#endif
+  {
     txt.title = "icinga-lighthouse";
     txt.st_ok = "SYSTEM OK";
     txt.st_err = "CRITICAL ALARM";
@@ -369,7 +611,7 @@ void setLanguage() {
 
 void updateStatusLED() {
   unsigned long now = millis();
-  unsigned long interval = icinga_reachable ? 1000 : 200;
+  unsigned long interval = status_board.read().reachable ? 1000 : 200;
   if (now - last_blink_time > interval) {
     last_blink_time = now;
     led_state = !led_state;
@@ -377,213 +619,955 @@ void updateStatusLED() {
   }
 }
 
-void checkIcinga() {
-  bool service_alarm = queryIcingaEndpoint(icinga_url_svc, "Service");
+// False if a query was skipped (POLL_SKIPPED): the poll then leaves the
+// confirmation, the problem list and the reachable state as they were.
+bool checkIcinga() {
+  PmLock cpu(pm_cpu_lock);
+  SIM_EVENT("poll_start", {{"confirm", alarm_confirm.count}});
+  problem_scratch.clear(problem_list_max);
+  PollAnswer service = queryIcingaEndpoint(icinga_url_svc, "Service");
+  if (service == POLL_SKIPPED) { SIM_EVENT("poll_skipped"); return false; }
+  bool service_alarm = service == POLL_PROBLEM;
 
   bool host_alarm = false;
-  if (!service_alarm && icinga_url_host.length() > 5) {
-      host_alarm = queryIcingaEndpoint(icinga_url_host, "Host");
+  // Hosts are read when no service is down; an SQL Services URL needs no
+  // second read, since its one query counts hosts as well. Hosts are also
+  // read for the problem list while a service is down, except on the fast
+  // rechecks: a second request on each such poll. The panel's object, status
+  // and reachability stay the service query's, but an answer still counts
+  // as fresh data (watchdog) and in the link stats. When that read fails,
+  // the list goes out without host rows and says so.
+  bool for_list = service_alarm && problem_list_max > 0 && !alarm_confirm.confirming(confirm_threshold);
+  bool list_partial = false;
+  if ((!service_alarm || for_list) && icinga_url_host.length() > 5 && !icinga_url_svc.startsWith("mysql://")) {
+      String name = last_icinga_object_name, next = last_next_check, status = last_connection_status;
+      bool reachable = icinga_reachable;
+      PollAnswer host = queryIcingaEndpoint(icinga_url_host, "Host");
+      if (for_list) {
+        list_partial = host != POLL_SKIPPED && !last_connection_status.startsWith("OK");
+        last_icinga_object_name = name; last_next_check = next; last_connection_status = status;
+        icinga_reachable = reachable;
+      }
+      if (host == POLL_SKIPPED) { SIM_EVENT("poll_skipped"); return false; }
+      host_alarm = host == POLL_PROBLEM;
   }
 
   bool problem = service_alarm || host_alarm;
 
-  if (problem) {
-    if (alarm_confirm_count < confirm_threshold) alarm_confirm_count++;
-  } else {
-    alarm_confirm_count = 0;
+  // /problems changes with answered polls only; a failed one keeps the last list.
+  if (icinga_reachable) {
+    problem_list = problem_scratch;
+    problem_list_partial = list_partial;
+    problem_list_gen++;
+    problem_list_ms = millis();
+    problem_list_epoch = wall_clock.epoch;
+  }
+
+  if (!problem) {
     last_icinga_object_name = "None";
     last_next_check = "";
   }
 
   // The siren only arms once the problem has been confirmed N polls in a row.
-  is_alarm_active = (alarm_confirm_count >= confirm_threshold);
+  is_alarm_active = alarm_confirm.update(problem, confirm_threshold);
+  otaConfirm();
+  SIM_EVENT("poll_end", {{"problem", problem}, {"confirm", alarm_confirm.count},
+                         {"threshold", confirm_threshold}, {"alarm", is_alarm_active},
+                         {"reachable", icinga_reachable}});
 
   Serial.println("[checkIcinga] problem=" + String(problem ? 1 : 0) +
-                 " confirm=" + String(alarm_confirm_count) + "/" + String(confirm_threshold) +
+                 " confirm=" + String(alarm_confirm.count) + "/" + String(confirm_threshold) +
                  " alarm=" + String(is_alarm_active ? 1 : 0));
+  return true;
 }
 
 // --- Time & business hours (time is taken from the HTTP "Date" header) -----
 
-// Parse an IMF-fixdate value, e.g. "Sat, 13 Jun 2026 07:30:00 GMT".
-void captureHttpDate(String d) {
-  d.trim();
-  if (d.startsWith("Date:")) { d = d.substring(5); d.trim(); }
-  if (d.length() < 25) return;
-  const char* days[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
-  String wd = d.substring(0, 3);
-  int w = -1; for (int i = 0; i < 7; i++) if (wd == days[i]) w = i;
-  if (w < 0) return;
-  int hh = d.substring(17, 19).toInt();
-  int mm = d.substring(20, 22).toInt();
-  if (hh < 0 || hh > 23 || mm < 0 || mm > 59) return;
-  cur_wday = w; cur_utc_hour = hh; cur_utc_min = mm; time_valid = true;
-}
-
-// True if the siren may sound now. Fails open until the time is known, so a
-// fresh boot never silently swallows alerts.
-bool alertsAllowedNow() {
-  if (!bh_enabled) return true;
-  if (!time_valid) return true;
-  int h = cur_utc_hour + tz_offset;
-  int w = cur_wday;
-  while (h >= 24) { h -= 24; w = (w + 1) % 7; }
-  while (h < 0)   { h += 24; w = (w + 6) % 7; }
-  int dayBit = 1 << ((w + 6) % 7);   // convert 0=Sun..6=Sat to bit0=Mon..bit6=Sun
+// The parsing and the schedule itself are in lighthouse_core.h; these adapt
+// them to the firmware's globals.
+
+lh::Config coreConfig() {
+  lh::Config c;
+  c.poll_ms = poll_interval_ms;
+  c.recheck_ms = recheck_interval_ms;
+  c.confirm_threshold = confirm_threshold;
+  c.init_alarm_ms = init_alarm_duration_ms;
+  c.reminder_interval_ms = reminder_interval_ms;
+  c.reminder_ms = reminder_duration_ms;
+  c.schedule.enabled = bh_enabled;
+  c.schedule.tz_offset = tz_offset;
   for (int i = 0; i < BH_BLOCKS; i++) {
-    if (!(bh_days[i] & dayBit)) continue;          // block off or wrong day
-    int s = bh_s[i], e = bh_e[i];
-    bool inWin = (s <= e) ? (h >= s && h < e) : (h >= s || h < e);  // e<s spans midnight
-    if (inWin) return true;
+    c.schedule.days[i] = bh_days[i];
+    c.schedule.start[i] = bh_s[i];
+    c.schedule.end[i] = bh_e[i];
   }
-  return false;
+  return c;
+}
+
+// Takes the clock from a "Date" header (with or without the name).
+void captureHttpDate(String d) {
+  lh::parseHttpDate(d.c_str(), wall_clock);
+}
+
+// True if the siren may sound now (fails open until the time is known).
+bool alertsAllowedNow() {
+  return lh::alertsAllowed(coreConfig().schedule, wall_clock);
 }
 
 // Local time as "Www HH:MM" for the UI ("--" if unknown).
 String localTimeStr() {
-  if (!time_valid) return "--";
-  int h = cur_utc_hour + tz_offset;
-  int w = cur_wday;
-  while (h >= 24) { h -= 24; w = (w + 1) % 7; }
-  while (h < 0)   { h += 24; w = (w + 6) % 7; }
-  const char* days[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
   char buf[12];
-  snprintf(buf, sizeof(buf), "%s %02d:%02d", days[w], h, cur_utc_min);
-  return String(buf);
+  return String(lh::formatLocalTime(wall_clock, tz_offset, buf, sizeof(buf)));
 }
 
-// --- Icinga DB Web query (shared parser + WiFi/HTTPClient & Ethernet paths) ---
+// --- Transports: one byte pipe per link, one HTTP/JSON pipeline on top ---
+//
+// Every link the device can poll over is an Arduino Client behind the same
+// small interface: connect, write, read-into-buffer, close, what it can do
+// (caps) and per-link counters for the panel. The set is fixed at compile time
+// (statically allocated, no registry): WiFi, WiFi+TLS and the W5500, each
+// only if its subsystem is in the build profile. The simulator builds the
+// same classes on its mock clients (MockESP.h), so the HTTP code below is
+// what runs on the device.
+struct TransportStats {
+  unsigned long requests = 0;    // GETs started
+  unsigned long failures = 0;    // connect, read or HTTP errors
+  unsigned long bytes_out = 0;
+  unsigned long bytes_in = 0;
+  unsigned long ms_total = 0;    // connect -> close, summed
+  unsigned long ms_max = 0;
+  unsigned long cut = 0;         // bodies left unread once the decision was made
+  unsigned long bytes_skipped = 0;   // ... their unread bytes (when the length was sent)
+  unsigned long not_modified = 0;    // 304s: the last answer still holds
+  unsigned long same_body = 0;       // 200s whose body matched the last one
+};
+
+// A Stream, so the JSON parser reads straight off the link. Bytes come out of
+// a small buffer refilled in bulk (one SPI burst per refill on the W5500, not
+// one frame per byte).
+class Transport : public Stream {
+public:
+  enum { CAP_TLS = 0x01 };                       // can fetch https:// URLs
+  static const unsigned long TIMEOUT_MS = 4000;  // connect / read gap limit
+
+  TransportStats stats;
+
+  // read() already waits for the link; keep Stream's timed reads from
+  // waiting a second time at the end of a body.
+  Transport() { setTimeout(0); }
+  virtual ~Transport() {}
+
+  virtual const char* name() = 0;
+  virtual uint8_t caps() = 0;
+  virtual bool connect(const char* host, uint16_t port) = 0;
+  virtual size_t write(const uint8_t* data, size_t len) = 0;
+  // Up to len bytes, waiting at most timeout_ms for the first. Returns the
+  // count, 0 on a timeout, -1 once the server has closed.
+  virtual int readInto(uint8_t* buf, size_t len, unsigned long timeout_ms) = 0;
+  virtual void close() = 0;
+
+  void reset() { rx_pos_ = rx_len_ = 0; }
+  // Bytes handed out by read() so far (since the link was first used).
+  unsigned long consumed() { return stats.bytes_in - (rx_len_ - rx_pos_); }
+  int available() override { return rx_len_ - rx_pos_; }
+  int read() override { return (rx_pos_ < rx_len_ || refill()) ? rx_[rx_pos_++] : -1; }
+  int peek() override { return (rx_pos_ < rx_len_ || refill()) ? rx_[rx_pos_] : -1; }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+
+private:
+  bool refill() {
+    int n = readInto(rx_, sizeof(rx_), TIMEOUT_MS);
+    if (n <= 0) return false;
+    rx_pos_ = 0; rx_len_ = n; stats.bytes_in += n;
+    return true;
+  }
+  uint8_t rx_[256];
+  int rx_len_ = 0, rx_pos_ = 0;
+};
+
+// Shared body for any Arduino Client (WiFiClient, WiFiClientSecure, EthernetClient).
+template <class C> class ClientTransport : public Transport {
+public:
+  size_t write(const uint8_t* data, size_t len) override { return client.write(data, len); }
+  int readInto(uint8_t* buf, size_t len, unsigned long timeout_ms) override {
+    unsigned long t0 = millis();
+    while (client.available() <= 0) {
+      if (!client.connected()) return -1;
+      if (millis() - t0 >= timeout_ms) return 0;
+      delay(1);
+    }
+    int n = client.read(buf, len);
+    return n < 0 ? 0 : n;
+  }
+  void close() override { client.stop(); }
+protected:
+  C client;
+};
+
+#if LH_WIFI
+class WiFiTransport : public ClientTransport<WiFiClient> {
+public:
+  const char* name() override { return "wifi"; }
+  uint8_t caps() override { return 0; }
+  bool connect(const char* host, uint16_t port) override {
+    client.setTimeout(TIMEOUT_MS / 1000);          // core 2.x: seconds
+    return client.connect(host, port);
+  }
+};
+WiFiTransport wifi_transport;
+#endif
+
+#if LH_TLS
+class TlsTransport : public ClientTransport<WiFiClientSecure> {
+public:
+  const char* name() override { return "tls"; }
+  uint8_t caps() override { return CAP_TLS; }
+  bool connect(const char* host, uint16_t port) override {
+    client.setInsecure();
+    client.setTimeout(TIMEOUT_MS / 1000);          // core 2.x: seconds
+    return client.connect(host, port);
+  }
+};
+TlsTransport tls_transport;
+#endif
+
+#if LH_ETH
+// The WIZnet library has its own TCP stack (no TLS): http:// only, which is
+// what icingadb-web serves on the LAN.
+class EthTransport : public ClientTransport<EthernetClient> {
+public:
+  const char* name() override { return "eth"; }
+  uint8_t caps() override { return 0; }
+  bool connect(const char* host, uint16_t port) override {
+    client.setTimeout(TIMEOUT_MS);                 // Stream: milliseconds
+    return client.connect(host, port);
+  }
+};
+EthTransport eth_transport;
+#endif
+
+// The SQL backend's own connection on each link, kept open between polls
+// (the HTTP path closes its transport after every GET).
+template <class T> class SqlTransport : public T {
+public:
+  explicit SqlTransport(const char* name) : name_(name) {}
+  const char* name() override { return name_; }
+private:
+  const char* name_;
+};
+#if LH_WIFI
+SqlTransport<WiFiTransport> sql_wifi_transport{"sql-wifi"};
+#endif
+#if LH_ETH
+SqlTransport<EthTransport> sql_eth_transport{"sql-eth"};
+#endif
+
+// The W5500 while it has a lease, else WiFi (TLS for https://).
+Transport& transportFor(const String& url) {
+#if LH_ETH
+  if (eth_active) return eth_transport;
+#endif
+#if LH_TLS
+  if (url.startsWith("https://")) return tls_transport;
+#endif
+#if LH_WIFI
+  return wifi_transport;
+#else
+  return eth_transport;              // Ethernet-only build: the one link there is
+#endif
+}
+
+// The SQL backend's link: the W5500 while it has a lease, else WiFi.
+Transport& sqlTransport() {
+#if LH_ETH
+  if (eth_active) return sql_eth_transport;
+#endif
+#if LH_WIFI
+  return sql_wifi_transport;
+#else
+  return sql_eth_transport;
+#endif
+}
+
+// The links in this build, for the summaries. Returns the count (at most
+// TRANSPORT_MAX).
+const int TRANSPORT_MAX = 5;
+int allTransports(Transport** out) {
+  int n = 0;
+#if LH_WIFI
+  out[n++] = &wifi_transport;
+  out[n++] = &sql_wifi_transport;
+#endif
+#if LH_TLS
+  out[n++] = &tls_transport;
+#endif
+#if LH_ETH
+  out[n++] = &eth_transport;
+  out[n++] = &sql_eth_transport;
+#endif
+  return n;
+}
+
+// "wifi 12 req / 0 fail, 6 KB in, avg 35 ms, max 120 ms" per link used so far.
+String transportSummary() {
+  Transport* all[TRANSPORT_MAX];
+  int n = allTransports(all);
+  String s;
+  for (int i = 0; i < n; i++) {
+    Transport* t = all[i];
+    const TransportStats& st = t->stats;
+    if (st.requests == 0) continue;
+    if (s.length()) s += " &middot; ";
+    s += String(t->name()) + " " + String(st.requests) + " req / " + String(st.failures) +
+         " fail, " + String(st.bytes_in / 1024) + " KB in, avg " +
+         String(st.ms_total / st.requests) + " ms, max " + String(st.ms_max) + " ms";
+    if (st.cut) s += ", " + String(st.cut) + " cut short (" + String(st.bytes_skipped / 1024) + " KB unread)";
+    if (st.not_modified || st.same_body)
+      s += ", " + String(st.not_modified) + " not modified / " + String(st.same_body) + " same body";
+  }
+  return s.length() ? s : String("no requests yet");
+}
+
+// --- Icinga DB Web query (one HTTP/JSON pipeline over any transport) ---
 //
 // The URL already carries the state + "not handled" filters, so any element of
 // the returned array is a real, unmuted problem. Response is a TOP-LEVEL ARRAY:
 //   [ { "name":.., "display_name":.., "host":{"display_name":..},
 //       "state":{"soft_state":2,"next_check":"2026-..+00:00",..} }, .. ]
 
-// Parses the problem array from a body stream. Fills last_icinga_object_name /
-// last_next_check; returns true if at least one problem is present. Keeps only
-// the few fields we need (objects are huge), so memory stays small.
-bool applyProblemJson(Stream& stream, String typeName) {
-  StaticJsonDocument<256> filter;
-  filter[0]["name"] = true;
-  filter[0]["display_name"] = true;
-  filter[0]["host"]["display_name"] = true;
-  filter[0]["state"]["next_check"] = true;
-
-  // Filter keeps only a handful of short fields per element, so even if the URL
-  // limit were removed and many problems came back, this stays bounded; with the
-  // default limit=1 it is tiny. A NoMemory error is treated as "no problem".
-  DynamicJsonDocument doc(4096);
-  DeserializationError error =
-      deserializeJson(doc, stream, DeserializationOption::Filter(filter));
-  if (error) { last_connection_status = "JSON err (" + typeName + ")"; return false; }
-
-  JsonArray arr = doc.as<JsonArray>();
-  if (arr.isNull() || arr.size() == 0) return false;
-
-  JsonObject o = arr[0];
-  const char* dn = o["display_name"] | o["name"] | "Unknown";
-  const char* hn = o["host"]["display_name"] | "";
-  String label = String(dn);
-  if (typeName == "Service" && hn[0] != '\0') label = String(hn) + "!" + String(dn);
-  last_icinga_object_name = typeName + ": " + label;
-  last_next_check = String((const char*)(o["state"]["next_check"] | ""));
+// Compiles a source's selectors: a preset's own, or for "custom" the given
+// ones. False (with sel.error()) if they don't compile.
+bool compileSource(lh::Selector& sel, const String& source, const String& problem,
+                   const String& label, const String& hint) {
+  const lh::SourcePreset* preset = lh::findSource(source.c_str());
+  if (preset) return sel.compile(*preset);
+  return sel.compile(problem.c_str(), label.c_str(), hint.c_str());
+}
+
+// Runs the source's selector over a body stream as it arrives (constant
+// memory, whatever the reply's size), stopping once the answer is known
+// (*early: the rest of the body was left unread). Fills
+// last_icinga_object_name / last_next_check, and the list's rows if one is
+// given; returns true if the reply is a problem. A JSON error is treated as
+// "no problem".
+bool applyProblemJson(Stream& stream, String typeName, bool* early = NULL, lh::ProblemList* list = NULL) {
+  const lh::SourcePreset* preset = lh::findSource(alert_source.c_str());
+  String kind = !preset ? String("Problem") : preset->kind[0] ? String(preset->kind) : typeName;
+  if (list) list->begin(typeName == "Host" ? 1 : 0, kind.c_str());
+  lh::Problem p;
+  lh::ParseResult r = problem_selector.run(stream, p, early, list);
+  if (r == lh::PARSE_ERROR) {
+    last_connection_status = problem_selector.ok() ? "JSON err (" + typeName + ")" : String("Selector err");
+    return false;
+  }
+  if (r != lh::PARSE_PROBLEM) return false;
+  last_icinga_object_name = kind + ": " + String(p.label);
+  last_next_check = String(p.next_check);
+  // A plain number (the Icinga 2 API's next_check) is seconds since the epoch.
+  char* end;
+  double secs = strtod(p.next_check, &end);
+  if (p.next_check[0] && *end == '\0' && secs >= 1e9) {
+    char when[48];
+    last_next_check = lh::formatEpochUtc((unsigned long)secs, when, sizeof(when));
+  }
   return true;
 }
 
-#ifndef LINUX_SIM
-// HTTP GET over the W5500 (the WIZnet EthernetClient has its own TCP stack and
-// can't go through HTTPClient). http:// only — icingadb-web is plain HTTP.
-bool queryViaEthernet(String url, String typeName) {
-  if (!url.startsWith("http://")) { last_connection_status = "ETH needs http"; return false; }
-  String rest = url.substring(7);
+// The body a source's request carries, "" for a plain GET. The Icinga 2 API
+// filters on the server and returns only the attributes the selectors read;
+// the filters match the Icinga DB Web example URLs.
+String requestBody(const String& typeName) {
+  if (alert_source != "icinga2") return "";
+  if (typeName == "Host")
+    return "{\"filter\":\"host.state==1 && host.acknowledgement==0 && host.downtime_depth==0 && !host.flapping\","
+           "\"attrs\":[\"display_name\",\"last_state_change\",\"next_check\",\"state\"]}";
+  return "{\"filter\":\"service.state==2 && service.acknowledgement==0 && service.downtime_depth==0 && !service.flapping\","
+         "\"attrs\":[\"display_name\",\"last_state_change\",\"next_check\",\"state\"],\"joins\":[\"host.display_name\"]}";
+}
+
+// Reads one header line, without CR/LF, into buf (truncated to fit). False
+// once the stream has ended.
+bool readHttpLine(Stream& in, char* buf, size_t size) {
+  size_t n = 0;
+  int c;
+  while ((c = in.read()) >= 0 && c != '\n') {
+    if (c != '\r' && n + 1 < size) buf[n++] = (char)c;
+  }
+  buf[n] = '\0';
+  return c >= 0 || n > 0;
+}
+
+// What the last full answer from an endpoint was, to reuse while it holds:
+// the server's validators (sent back as If-None-Match / If-Modified-Since,
+// a 304 skips the body) and a hash of the body up to where the decision was
+// made (the same bytes make the same decision). Its problem list rows are
+// the ones in problem_list while that is the list of list_gen; otherwise the
+// validators aren't sent, so the body comes again.
+struct PollCache {
+  String url;                    // the endpoint it is for; another URL starts over
+                                 // (applyConfig() resets it, see pollSettings())
+  bool valid = false;
+  char etag[64] = "";
+  char modified[40] = "";        // Last-Modified, sent back verbatim
+  uint32_t body_hash = 0;
+  bool problem = false;
+  String object_name;            // last_icinga_object_name / last_next_check
+  String next_check;
+  unsigned list_gen = 0;         // problem_list_gen its rows were published as
+};
+PollCache poll_cache[2];         // services, hosts
+
+// What a cached answer was decided under besides its URL: the selectors and
+// the login (a 304 must not bring back what other settings decided).
+String pollSettings() {
+  return alert_source + "\n" + sel_problem + "\n" + sel_label + "\n" + sel_hint + "\n" + icinga_user + "\n" +
+         icinga_pass + "\n" + String(problem_list_max);
+}
+
+// Passes a body through to the parser, hashing what it reads (FNV-1a).
+class HashingStream : public Stream {
+public:
+  explicit HashingStream(Stream& in) : in_(in) {}
+  uint32_t hash() const { return h_; }
+  int available() override { return in_.available(); }
+  int read() override {
+    int c = in_.read();
+    if (c >= 0) h_ = (h_ ^ (uint8_t)c) * 16777619u;
+    return c;
+  }
+  int peek() override { return in_.peek(); }
+  size_t write(uint8_t) override { return 0; }
+private:
+  Stream& in_;
+  uint32_t h_ = 2166136261u;
+};
+
+// Copies a header's value (after "Name:" and blanks) into buf, or leaves it
+// empty when it doesn't fit: a cut validator would never match.
+void headerValue(const char* line, size_t name_len, char* buf, size_t size) {
+  const char* v = line + name_len;
+  while (*v == ' ' || *v == '\t') v++;
+  if (strlen(v) < size) strcpy(buf, v);
+  else buf[0] = '\0';
+}
+
+// Up to this much of a body left behind by an early decision is read off
+// instead of closing on it: about one segment, most likely in flight already.
+const long BODY_DRAIN_MAX = 1460;
+
+// The selector decided before the end of the body. Nothing reuses the
+// connection (Connection: close), so the cheap way out of a long remainder is
+// to close on it (the server sees a reset, the link stops carrying it); a
+// short known remainder is read off so the server sees a clean close.
+void finishBody(Transport& t, long content_length, unsigned long body_start) {
+  long rest = content_length >= 0 ? content_length - (long)(t.consumed() - body_start) : -1;
+  if (rest >= 0 && rest <= BODY_DRAIN_MAX) {
+    while (rest > 0 && t.read() >= 0) rest--;
+    return;
+  }
+  t.stats.cut++;
+  if (rest > 0) t.stats.bytes_skipped += rest;
+}
+
+// One GET over whichever transport is up. HTTP/1.0 with Connection: close, so
+// the body simply runs to EOF on every link (no chunked encoding). Status line
+// and headers are read here; the body goes straight into the JSON parser,
+// which stops as soon as the decision is known (finishBody()). A 304 reuses
+// the last answer (PollCache). A 200 whose body hashes like the last one is
+// only counted (same_body): the selector reads the body as a stream, so it
+// is parsed again all the same.
+PollAnswer queryIcingaEndpoint(String url, String typeName) {
+  if (url == "") return POLL_CLEAR;
+  if (url.startsWith("mysql://")) return querySqlEndpoint(url, typeName);
+  PollCache& cache = poll_cache[typeName == "Host" ? 1 : 0];
+  if (cache.url != url) { cache = PollCache(); cache.url = url; }
+
+  bool https = url.startsWith("https://");
+  if (!https && !url.startsWith("http://")) { last_connection_status = "Bad URL (" + typeName + ")"; return POLL_CLEAR; }
+  Transport& t = transportFor(url);
+  if (https && !(t.caps() & Transport::CAP_TLS)) {
+    last_connection_status = String(t.name()) + " needs http"; icinga_reachable = false; return POLL_CLEAR;
+  }
+#if LH_ETH
+  // The whole exchange holds the W5500 (shared with the MQTT task). loop()
+  // never waits for it: busy, the poll is skipped and tried on the next pass.
+  BusLock bus(&t == &eth_transport ? spi_lock : NULL, 0);
+  if (!bus.held()) return POLL_SKIPPED;
+#endif
+  String rest = url.substring(https ? 8 : 7);
   int slash = rest.indexOf('/');
   String hostport = (slash < 0) ? rest : rest.substring(0, slash);
   String path     = (slash < 0) ? "/"  : rest.substring(slash);
   int colon = hostport.indexOf(':');
   String host = (colon < 0) ? hostport : hostport.substring(0, colon);
-  int port    = (colon < 0) ? 80       : hostport.substring(colon + 1).toInt();
-
-  EthernetClient client;
-  client.setTimeout(4000);
-  if (!client.connect(host.c_str(), port)) {
-    last_connection_status = "ETH conn fail"; icinga_reachable = false; return false;
+  int port    = (colon < 0) ? (https ? 443 : 80) : hostport.substring(colon + 1).toInt();
+
+  // Revalidating needs the answer's list rows at hand (to copy on a 304).
+  bool revalidate = cache.valid && (problem_list_max == 0 || cache.list_gen == problem_list_gen);
+  unsigned long t0 = millis();
+  t.stats.requests++;
+  t.reset();
+  int code = 0;
+  bool result = false;
+  if (!t.connect(host.c_str(), port)) {
+    last_connection_status = "Conn Fail (" + typeName + "/" + t.name() + ")";
+  } else {
+    // One write, so the request leaves in one segment (one SPI burst on the W5500).
+    // A body goes as a POST the server reads as a GET (the Icinga 2 API's way).
+    String body = requestBody(typeName);
+    String req = String(body.length() ? "POST " : "GET ") + path + " HTTP/1.0\r\nHost: " + host +
+                 "\r\nAuthorization: Basic " + base64Encode(icinga_user + ":" + icinga_pass) +
+                 "\r\nAccept: application/json\r\nConnection: close\r\n";
+    if (body.length())
+      req += "X-HTTP-Method-Override: GET\r\nContent-Type: application/json\r\nContent-Length: " +
+             String(body.length()) + "\r\n";
+    if (revalidate && cache.etag[0]) req += "If-None-Match: " + String(cache.etag) + "\r\n";
+    if (revalidate && cache.modified[0]) req += "If-Modified-Since: " + String(cache.modified) + "\r\n";
+    req += "\r\n" + body;
+    t.stats.bytes_out += t.write((const uint8_t*)req.c_str(), req.length());
+
+    char line[128];
+    if (readHttpLine(t, line, sizeof(line))) {        // "HTTP/1.1 200 OK"
+      const char* sp = strchr(line, ' ');
+      if (sp) code = atoi(sp + 1);
+    }
+    long content_length = -1;
+    char etag[sizeof(cache.etag)] = "", modified[sizeof(cache.modified)] = "";
+    while (readHttpLine(t, line, sizeof(line)) && line[0] != '\0') {
+      if (strncasecmp(line, "Date:", 5) == 0) captureHttpDate(String(line));   // keep device clock fresh
+      else if (strncasecmp(line, "Content-Length:", 15) == 0) content_length = atol(line + 15);
+      else if (strncasecmp(line, "ETag:", 5) == 0) headerValue(line, 5, etag, sizeof(etag));
+      else if (strncasecmp(line, "Last-Modified:", 14) == 0) headerValue(line, 14, modified, sizeof(modified));
+    }
+    if (code == 304 && !revalidate) code = 0;      // nothing asked for it: not an answer
+    if (code == 200 || code == 304) {
+      icinga_reachable = true;
+      last_successful_data_time = millis();
+      is_network_error = false;
+      last_connection_status = "OK (" + String(code) + "/" + t.name() + ")";
+    }
+    if (code == 304) {
+      t.stats.not_modified++;
+      result = cache.problem;
+      if (result) { last_icinga_object_name = cache.object_name; last_next_check = cache.next_check; }
+      problem_scratch.copy(problem_list, typeName == "Host" ? 1 : 0);
+      cache.list_gen = problem_list_gen + 1;
+    } else if (code == 200) {
+      unsigned long body_start = t.consumed();
+      bool early = false;
+      HashingStream body(t);
+      result = applyProblemJson(body, typeName, &early, problem_list_max > 0 ? &problem_scratch : NULL);
+      cache.list_gen = problem_list_gen + 1;
+      if (early) finishBody(t, content_length, body_start);
+      if (cache.valid && body.hash() == cache.body_hash) t.stats.same_body++;
+      cache.valid = last_connection_status.startsWith("OK");   // not a reply the selector failed on
+      strcpy(cache.etag, etag);
+      strcpy(cache.modified, modified);
+      cache.body_hash = body.hash();
+      cache.problem = result;
+      cache.object_name = result ? last_icinga_object_name : String();
+      cache.next_check = result ? last_next_check : String();
+    } else {
+      last_connection_status = "HTTP " + String(code) + " (" + t.name() + ")";
+    }
   }
+  t.close();
+
+  unsigned long ms = millis() - t0;
+  if (code != 200 && code != 304) { t.stats.failures++; icinga_reachable = false; }
+  t.stats.ms_total += ms;
+  if (ms > t.stats.ms_max) t.stats.ms_max = ms;
+  SIM_EVENT("http", {{"code", code}, {"ms", (long)ms}, {"eth", strcmp(t.name(), "eth") == 0}, {"tls", https}});
+  return result ? POLL_PROBLEM : POLL_CLEAR;
+}
 
-  client.print(String("GET ") + path + " HTTP/1.0\r\n");
-  client.print("Host: " + host + "\r\n");
-  client.print("Authorization: Basic " + base64Encode(icinga_user + ":" + icinga_pass) + "\r\n");
-  client.print("Accept: application/json\r\n");
-  client.print("Connection: close\r\n\r\n");
+// --- Icinga DB over SQL (mysql:// Services URL) ---
+//
+// Skips Icinga Web's PHP stack (session, auth, ORM on every poll): the device
+// logs into the Icinga DB database itself, with Web User / Pass as a
+// read-only SQL login, over the MySQL/MariaDB client protocol. One prepared
+// statement returns the unhandled critical service and down host counts (the
+// filters of the example URLs) and the first such objects, one row each
+// (the first for the panel, all of them for the problem list). The connection and
+// the statement are kept between polls; a poll that fails drops both and the
+// next one starts over. Plain TCP only, and the mysql_native_password login
+// (MariaDB's default; on MySQL 8 create the user WITH mysql_native_password).
+
+struct SqlAnswer {
+  unsigned long services = 0;    // unhandled problems of each kind
+  unsigned long hosts = 0;
+  String kind;                   // of the first one: "Service" / "Host"
+  String name;                   // "host!service" / "host"
+  String next_check;             // "2026-..+00:00", as icingadb-web has it
+  String date;                   // the server's clock, as a Date header has it
+};
 
-  String status = client.readStringUntil('\n');     // "HTTP/1.0 200 OK"
-  int code = 0; { int sp = status.indexOf(' '); if (sp > 0) code = status.substring(sp + 1).toInt(); }
+// One logged-in connection with the problems statement prepared on it.
+class SqlLink {
+public:
+  String error;                  // why the last poll failed
+
+  // Runs the statement, logging in and preparing first if the link isn't
+  // open yet (or was opened elsewhere). A kept connection the server has
+  // dropped meanwhile (wait_timeout, restart) gets one fresh try.
+  bool poll(Transport& t, const String& host, uint16_t port, const String& db,
+            const String& user, const String& pass, SqlAnswer& out, lh::ProblemList* list) {
+    String key = user + "@" + host + ":" + String(port) + "/" + db;
+    if (open_ && (open_ != &t || key != key_)) close();
+    bool kept = open_ != NULL;
+    if (!kept && !login(t, host, port, db, user, pass)) return fail();
+    key_ = key;
+    lh::ProblemList::Mark m;
+    if (list) m = list->mark();
+    if (execute(out, list)) return true;
+    if (list) list->rollback(m);
+    if (!kept || !lost_) return fail();
+    close();
+    if (!login(t, host, port, db, user, pass) || !execute(out, list)) {
+      if (list) list->rollback(m);
+      return fail();
+    }
+    return true;
+  }
 
-  while (client.connected()) {                        // skip headers to blank line
-    String line = client.readStringUntil('\n');
-    if (line.length() == 0 || line == "\r") break;
-    if (line.startsWith("Date:")) captureHttpDate(line);
+  void close() {
+    if (!open_) return;
+    uint8_t quit[5] = {1, 0, 0, 0, 0x01};          // COM_QUIT
+    open_->write(quit, sizeof(quit));
+    open_->close();
+    open_ = NULL;
   }
 
-  if (code != 200) {
-    last_connection_status = "ETH HTTP " + String(code);
-    icinga_reachable = false; client.stop(); return false;
+private:
+  enum {
+    CLIENT_LONG_PASSWORD = 0x1, CLIENT_CONNECT_WITH_DB = 0x8, CLIENT_PROTOCOL_41 = 0x200,
+    CLIENT_TRANSACTIONS = 0x2000, CLIENT_SECURE_CONNECTION = 0x8000, CLIENT_PLUGIN_AUTH = 0x80000,
+    COM_STMT_PREPARE = 0x16, COM_STMT_EXECUTE = 0x17,
+    COLUMNS = 9,
+  };
+
+  Transport* open_ = NULL;
+  String key_;
+  uint32_t stmt_ = 0;
+  bool lost_ = false;            // the last failure was the link, not the server
+  uint8_t seq_ = 0;              // next packet sequence number
+  uint8_t buf_[320];             // the current packet (cut to fit)
+  long len_ = 0;                 // its length as sent
+  uint8_t types_[COLUMNS];
+
+  bool fail() {
+    if (open_) { open_->close(); open_ = NULL; }
+    return false;
   }
-  icinga_reachable = true; last_successful_data_time = millis();
-  is_network_error = false; last_connection_status = "OK (200/eth)";
-  bool res = applyProblemJson(client, typeName);
-  client.stop();
-  return res;
-}
-#endif
 
-bool queryIcingaEndpoint(String url, String typeName) {
-  if (url == "") return false;
+  bool lost(const char* what) { error = what; lost_ = true; return false; }
 
-#ifndef LINUX_SIM
-  if (eth_active) return queryViaEthernet(url, typeName);
-#endif
+  // Reads the next packet; false if the link fails.
+  bool readPacket() {
+    uint8_t h[4];
+    for (int i = 0; i < 4; i++) {
+      int c = open_->read();
+      if (c < 0) return lost("no reply");
+      h[i] = (uint8_t)c;
+    }
+    len_ = h[0] | (long)h[1] << 8 | (long)h[2] << 16;
+    seq_ = h[3] + 1;
+    for (long i = 0; i < len_; i++) {
+      int c = open_->read();
+      if (c < 0) return lost("reply cut");
+      if (i < (long)sizeof(buf_)) buf_[i] = (uint8_t)c;
+    }
+    return true;
+  }
 
-  // WiFi / sim path via HTTPClient. WiFiClientSecure derives from WiFiClient,
-  // so a base pointer drives either transport (TLS picked via the vtable).
-  bool https = url.startsWith("https");
-  WiFiClientSecure secureClient;
-  WiFiClient plainClient;
-  WiFiClient* client;
-  if (https) { secureClient.setInsecure(); secureClient.setTimeout(5); client = &secureClient; }
-  else       { client = &plainClient; }
-
-  HTTPClient http;
-  http.useHTTP10(true);
-  http.setTimeout(4000);
-
-  if (!http.begin(*client, url)) {
-    last_connection_status = "Conn Fail (" + typeName + ")";
-    icinga_reachable = false;
+  long have() const { return len_ < (long)sizeof(buf_) ? len_ : (long)sizeof(buf_); }
+  bool isErr() const { return len_ > 0 && buf_[0] == 0xFF; }
+  bool isEof() const { return len_ > 0 && len_ < 9 && buf_[0] == 0xFE; }
+
+  // An ERR packet: "1045 Access denied for user ..".
+  bool serverError() {
+    lost_ = false;
+    error = "?";
+    if (have() < 3) return false;
+    error = String((int)(buf_[1] | buf_[2] << 8));
+    long p = 3;
+    if (have() > 9 && buf_[3] == '#') p = 9;     // SQLSTATE
+    error += " ";
+    for (; p < have(); p++) error += (char)buf_[p];
     return false;
   }
-  http.setAuthorization(icinga_user.c_str(), icinga_pass.c_str());
-  http.addHeader("Accept", "application/json");
-  const char* dateHdr[] = { "Date" };
-  http.collectHeaders(dateHdr, 1);
 
-  int httpCode = http.GET();
-  bool result = false;
-  if (httpCode == HTTP_CODE_OK) {
-    icinga_reachable = true;
-    last_successful_data_time = millis();
-    is_network_error = false;
-    last_connection_status = "OK (200)";
-    captureHttpDate(http.header("Date"));   // keep device clock fresh
-    Stream& stream = http.getStream();
-    result = applyProblemJson(stream, typeName);
-  } else {
-    last_connection_status = "HTTP " + String(httpCode);
+  // A packet of its own: one write, so it leaves as one segment.
+  bool send(const uint8_t* payload, size_t n, const char* tail = NULL, size_t tail_len = 0) {
+    size_t len = n + tail_len;
+    uint8_t h[4] = {(uint8_t)len, (uint8_t)(len >> 8), (uint8_t)(len >> 16), seq_++};
+    if (open_->write(h, 4) != 4 || open_->write(payload, n) != n) return lost("send failed");
+    if (tail && open_->write((const uint8_t*)tail, tail_len) != tail_len) return lost("send failed");
+    open_->stats.bytes_out += 4 + len;
+    return true;
+  }
+
+  // Length-encoded integer at p of the current packet (p advanced past it);
+  // false if the packet, as far as it fit in buf_, ends first.
+  bool lenenc(long& p, unsigned long& v) const {
+    const long n = have();
+    if (p >= n) return false;
+    uint8_t c = buf_[p++];
+    if (c < 0xFB) { v = c; return true; }
+    int w = c == 0xFC ? 2 : c == 0xFD ? 3 : 8;
+    if (p + w > n) return false;
+    uint64_t x = 0;
+    for (int i = 0; i < w; i++) x |= (uint64_t)buf_[p + i] << (8 * i);
+    p += w;
+    v = x > 0xFFFFFFFFu ? 0xFFFFFFFFu : (unsigned long)x;
+    return true;
+  }
+
+  // mysql_native_password: SHA1(pass) XOR SHA1(scramble + SHA1(SHA1(pass))).
+  static void scramble(const String& pass, const uint8_t* salt, uint8_t out[20]) {
+    uint8_t h1[20], h2[20];
+    mbedtls_sha1_context c;
+    mbedtls_sha1_init(&c);
+    mbedtls_sha1_starts(&c);
+    mbedtls_sha1_update(&c, (const unsigned char*)pass.c_str(), pass.length());
+    mbedtls_sha1_finish(&c, h1);
+    mbedtls_sha1_starts(&c);
+    mbedtls_sha1_update(&c, h1, 20);
+    mbedtls_sha1_finish(&c, h2);
+    mbedtls_sha1_starts(&c);
+    mbedtls_sha1_update(&c, salt, 20);
+    mbedtls_sha1_update(&c, h2, 20);
+    mbedtls_sha1_finish(&c, out);
+    mbedtls_sha1_free(&c);
+    for (int i = 0; i < 20; i++) out[i] ^= h1[i];
+  }
+
+  bool login(Transport& t, const String& host, uint16_t port, const String& db,
+             const String& user, const String& pass) {
+    t.reset();
+    if (!t.connect(host.c_str(), port)) { error = "no connection"; lost_ = false; return false; }
+    open_ = &t;
+    // Greeting (protocol 10): version, thread id, salt[8], .., salt[12], plugin.
+    if (!readPacket()) return false;
+    if (isErr()) return serverError();
+    long n = have(), p = 1;
+    if (n < 1 || buf_[0] != 10) { error = "not MySQL"; return false; }
+    while (p < n && buf_[p]) p++;
+    p += 1 + 4;
+    uint8_t salt[20];
+    if (p + 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10 + 12 > n) { error = "old server"; return false; }
+    memcpy(salt, buf_ + p, 8);
+    p += 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10;
+    memcpy(salt + 8, buf_ + p, 12);
+
+    uint8_t r[200];
+    uint32_t caps = CLIENT_LONG_PASSWORD | CLIENT_CONNECT_WITH_DB | CLIENT_PROTOCOL_41 |
+                    CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION | CLIENT_PLUGIN_AUTH;
+    static const char plugin[] = "mysql_native_password";
+    if (user.length() + db.length() + sizeof(plugin) + 60 > sizeof(r)) { error = "login too long"; return false; }
+    long q = 0;
+    for (int i = 0; i < 4; i++) r[q++] = (uint8_t)(caps >> (8 * i));
+    r[q++] = 0; r[q++] = 0; r[q++] = 0; r[q++] = 1;   // max packet 16 MB
+    r[q++] = 45;                                      // utf8mb4_general_ci
+    memset(r + q, 0, 23); q += 23;
+    memcpy(r + q, user.c_str(), user.length() + 1); q += user.length() + 1;
+    if (pass.length()) { r[q++] = 20; scramble(pass, salt, r + q); q += 20; }
+    else r[q++] = 0;
+    memcpy(r + q, db.c_str(), db.length() + 1); q += db.length() + 1;
+    memcpy(r + q, plugin, sizeof(plugin)); q += sizeof(plugin);
+    if (!send(r, q) || !readPacket()) return false;
+    if (len_ > 0 && buf_[0] == 0xFE) {
+      // Auth switch: the account uses another plugin, or wants a new salt.
+      long a = 1;
+      while (a < have() && buf_[a]) a++;
+      buf_[a < have() ? a : have() - 1] = 0;
+      if (strcmp((const char*)buf_ + 1, plugin) != 0 || have() < a + 21) {
+        error = "login plugin " + String((const char*)buf_ + 1) + " unsupported";
+        return false;
+      }
+      scramble(pass, buf_ + a + 1, r);
+      if (!send(r, pass.length() ? 20 : 0) || !readPacket()) return false;
+    }
+    if (isErr()) return serverError();
+    if (len_ < 1 || buf_[0] != 0x00) { error = "login failed"; return false; }
+    return prepare();
+  }
+
+  bool skipUntilEof() {
+    do { if (!readPacket()) return false; } while (!isEof() && !isErr());
+    return !isErr() || serverError();
+  }
+
+  bool prepare() {
+    // Icinga DB schema; next_check and last_state_change are in ms since the
+    // epoch (UTC). Up to lh::LIST_MAX problems, services first; every row
+    // carries the counts and the server's clock (there is no Date header to
+    // take it from); with no problem, one row with the problem columns NULL.
+    static const char sql[] =
+      "SELECT"
+      " (SELECT COUNT(*) FROM service_state WHERE soft_state = 2 AND is_acknowledged = 'n'"
+      " AND in_downtime = 'n' AND is_flapping = 'n'),"
+      " (SELECT COUNT(*) FROM host_state WHERE soft_state = 1 AND is_acknowledged = 'n'"
+      " AND in_downtime = 'n' AND is_flapping = 'n'),"
+      " t.kind, t.host, t.name, t.state, t.since DIV 1000,"
+      " DATE_FORMAT(DATE_ADD('1970-01-01', INTERVAL t.next_check DIV 1000 SECOND), '%Y-%m-%dT%H:%i:%s+00:00'),"
+      " DATE_FORMAT(UTC_TIMESTAMP(), '%a, %d %b %Y %H:%i:%s GMT')"
+      " FROM (SELECT 1) one LEFT JOIN ("
+      "(SELECT 'Service' kind, h.display_name host, s.display_name name, ss.soft_state state,"
+      " ss.last_state_change since, ss.next_check"
+      " FROM service_state ss JOIN service s ON s.id = ss.service_id JOIN host h ON h.id = s.host_id"
+      " WHERE ss.soft_state = 2 AND ss.is_acknowledged = 'n' AND ss.in_downtime = 'n'"
+      " AND ss.is_flapping = 'n' LIMIT 32)"
+      " UNION ALL "
+      "(SELECT 'Host', '', h.display_name, hs.soft_state, hs.last_state_change, hs.next_check"
+      " FROM host_state hs JOIN host h ON h.id = hs.host_id"
+      " WHERE hs.soft_state = 1 AND hs.is_acknowledged = 'n' AND hs.in_downtime = 'n'"
+      " AND hs.is_flapping = 'n' LIMIT 32)"
+      " LIMIT 32) t ON 1";
+    seq_ = 0;
+    uint8_t cmd = COM_STMT_PREPARE;
+    if (!send(&cmd, 1, sql, sizeof(sql) - 1) || !readPacket()) return false;
+    if (isErr()) return serverError();
+    if (have() < 12 || buf_[0] != 0x00) { error = "prepare failed"; return false; }
+    stmt_ = buf_[1] | (uint32_t)buf_[2] << 8 | (uint32_t)buf_[3] << 16 | (uint32_t)buf_[4] << 24;
+    unsigned columns = buf_[5] | buf_[6] << 8, params = buf_[7] | buf_[8] << 8;
+    if (params && !skipUntilEof()) return false;
+    if (columns && !skipUntilEof()) return false;
+    return true;
+  }
+
+  bool execute(SqlAnswer& out, lh::ProblemList* list) {
+    lost_ = false;
+    seq_ = 0;
+    uint8_t cmd[10] = {COM_STMT_EXECUTE, (uint8_t)stmt_, (uint8_t)(stmt_ >> 8), (uint8_t)(stmt_ >> 16),
+                       (uint8_t)(stmt_ >> 24), 0, 1, 0, 0, 0};
+    if (!send(cmd, sizeof(cmd)) || !readPacket()) return false;
+    if (isErr()) return serverError();
+    long p = 0;
+    unsigned long columns = 0;
+    if (!lenenc(p, columns) || columns != COLUMNS) { error = "unexpected columns"; return false; }
+    for (int i = 0; i < COLUMNS; i++) {
+      if (!readPacket()) return false;
+      // Column definition: six length-encoded strings, then 0x0C, charset,
+      // length, type, ..
+      long c = 0;
+      for (int k = 0; k < 6; k++) {
+        unsigned long len = 0;
+        if (!lenenc(c, len) || len > (unsigned long)(have() - c)) { error = "bad column"; return false; }
+        c += len;
+      }
+      if (c + 8 > have()) { error = "bad column"; return false; }
+      types_[i] = buf_[c + 1 + 2 + 4];
+    }
+    if (!readPacket() || !isEof()) return lost("bad reply");
+    bool row = false;
+    for (;;) {
+      if (!readPacket()) return false;
+      if (isErr()) return serverError();
+      if (isEof()) break;
+      decodeRow(out, list, !row);
+      row = true;
+    }
+    if (!row) { error = "no row"; return false; }
+    return true;
+  }
+
+  // A binary-protocol row: 0x00, the NULL bitmap (offset 2), the values.
+  // The first one fills out; each problem one is a list row. A row cut short
+  // (end of the packet, or of buf_) keeps the values that fit whole, and a
+  // string cut at the end what there is of it.
+  void decodeRow(SqlAnswer& out, lh::ProblemList* list, bool first) {
+    const long n = have();
+    long p = 1 + (COLUMNS + 7 + 2) / 8;
+    if (p > n) return;                                             // not even the NULL bitmap
+    unsigned long num[COLUMNS] = {};
+    String text[COLUMNS];
+    bool problem = false;
+    for (int i = 0; i < COLUMNS; i++) {
+      if (buf_[1 + (i + 2) / 8] & (1 << ((i + 2) % 8))) continue;   // NULL
+      int width = 0;
+      switch (types_[i]) {
+        case 0x01: width = 1; break;                               // TINY
+        case 0x02: width = 2; break;                               // SHORT
+        case 0x03: case 0x09: width = 4; break;                    // LONG, INT24
+        case 0x08: width = 8; break;                               // LONGLONG
+      }
+      if (width) {
+        if (p + width > n) break;
+        uint64_t v = 0;
+        for (int k = 0; k < width; k++) v |= (uint64_t)buf_[p + k] << (8 * k);
+        num[i] = (unsigned long)v;
+        p += width;
+      } else {                                                     // strings, DECIMAL
+        unsigned long k = 0;
+        if (!lenenc(p, k)) break;
+        for (unsigned long j = 0; j < k && p < n; j++) text[i] += (char)buf_[p++];
+        num[i] = strtoul(text[i].c_str(), NULL, 10);
+      }
+      if (i == 2) problem = true;
+    }
+    if (first) {
+      out = SqlAnswer();
+      out.services = num[0];
+      out.hosts = num[1];
+      out.kind = text[2];
+      out.name = text[3].length() ? text[3] + "!" + text[4] : text[4];
+      out.next_check = text[7];
+      out.date = text[8];
+    }
+    if (list && problem) {
+      list->begin(0, text[2].c_str());
+      list->add(text[3].c_str(), text[4].c_str(), String((int)num[5]).c_str(), num[6]);
+    }
+  }
+};
+SqlLink sql_link;
+
+// queryIcingaEndpoint() for a mysql://host[:port]/database URL: services and
+// hosts in one statement, so the Hosts URL can stay empty.
+PollAnswer querySqlEndpoint(const String& url, const String& typeName) {
+  String rest = url.substring(8);
+  int slash = rest.indexOf('/');
+  String hostport = slash < 0 ? rest : rest.substring(0, slash);
+  String db = slash < 0 ? String("icingadb") : rest.substring(slash + 1);
+  int colon = hostport.indexOf(':');
+  String host = colon < 0 ? hostport : hostport.substring(0, colon);
+  uint16_t port = colon < 0 ? 3306 : hostport.substring(colon + 1).toInt();
+  if (host == "" || db == "") { last_connection_status = "Bad URL (" + typeName + ")"; return POLL_CLEAR; }
+
+  Transport& t = sqlTransport();
+#if LH_ETH
+  BusLock bus(&t == &sql_eth_transport ? spi_lock : NULL, 0);   // busy: skipped, as above
+  if (!bus.held()) return POLL_SKIPPED;
+#endif
+  unsigned long t0 = millis();
+  t.stats.requests++;
+  SqlAnswer a;
+  bool ok = sql_link.poll(t, host, port, db, icinga_user, icinga_pass, a,
+                          problem_list_max > 0 ? &problem_scratch : NULL);
+  unsigned long ms = millis() - t0;
+  t.stats.ms_total += ms;
+  if (ms > t.stats.ms_max) t.stats.ms_max = ms;
+  SIM_EVENT("sql", {{"ok", ok}, {"ms", (long)ms}, {"eth", strcmp(t.name(), "sql-eth") == 0}});
+  if (!ok) {
+    t.stats.failures++;
     icinga_reachable = false;
+    last_connection_status = "SQL " + sql_link.error.substring(0, 24) + " (" + t.name() + ")";
+    Serial.println("[SQL] " + sql_link.error);
+    return POLL_CLEAR;
   }
-  http.end();
-  return result;
+  icinga_reachable = true;
+  last_successful_data_time = millis();
+  is_network_error = false;
+  if (a.date.length()) captureHttpDate(a.date);
+  last_connection_status = String("OK (") + t.name() + ")";
+  if (a.services + a.hosts == 0) return POLL_CLEAR;
+  last_icinga_object_name = (a.kind.length() ? a.kind : String("Problem")) + ": " + a.name;
+  last_next_check = a.next_check;
+  return POLL_PROBLEM;
 }
 
+#if LH_WIFI
 void setupWiFi() {
   if (wifi_ssid == "") {
     WiFi.softAP("icinga-lighthouse-cfg", "admin123");
@@ -595,7 +1579,7 @@ void setupWiFi() {
   WiFi.disconnect(true);
   delay(100);
   WiFi.mode(WIFI_STA);
-  WiFi.setSleep(false);
+  WiFi.setSleep(power_mode != PWR_PERFORMANCE);   // modem sleep: radio wakes for beacons
   WiFi.setTxPower(WIFI_POWER_11dBm); 
   
   WiFi.begin(wifi_ssid.c_str(), wifi_pass.c_str());
@@ -616,18 +1600,18 @@ void setupWiFi() {
     last_connection_status = "WiFi Fail";
   }
 }
+#endif
 
 // --- NETWORK: prefer W5500 Ethernet when present, else fall back to WiFi ---
 
-#ifndef LINUX_SIM
-// Minimal base64 (for the HTTP Basic auth header on the Ethernet path).
+// Minimal base64 (for the HTTP Basic auth header).
 String base64Encode(String in) {
   static const char* t =
       "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-  String out; int val = 0, bits = -6;
+  String out; unsigned val = 0; int bits = -6;
   for (int i = 0; i < (int)in.length(); i++) {
     val = (val << 8) + (unsigned char)in[i]; bits += 8;
-    while (bits >= 0) { out += t[(val >> bits) & 0x3F]; bits -= 8; }
+    while (bits >= 0) { out += t[(val >> bits) & 0x3F]; bits -= 6; }
   }
   if (bits > -6) out += t[((val << 8) >> (bits + 8)) & 0x3F];
   while (out.length() % 4) out += '=';
@@ -637,6 +1621,7 @@ String base64Encode(String in) {
 // Brings up the W5500 shield over SPI using the WIZnet Ethernet library
 // (Arduino core 2.x has no SPI PHY support in its built-in ETH). Sets
 // eth_present (chip detected) and eth_active (got a DHCP lease + link).
+#if LH_ETH
 bool setupEthernet() {
   if (eth_disabled) { last_connection_status = "ETH disabled"; return false; }
   SPI.begin(ETH_W5500_SCLK, ETH_W5500_MISO, ETH_W5500_MOSI, ETH_W5500_CS);
@@ -652,6 +1637,7 @@ bool setupEthernet() {
   if (!eth_present) { last_connection_status = "No W5500"; return false; }
 
   eth_active = (ok == 1) && (Ethernet.linkStatus() != LinkOFF);
+  eth_ip_str = Ethernet.localIP().toString();
   last_connection_status = eth_active ? "ETH up"
                          : (Ethernet.linkStatus() == LinkOFF ? "ETH no link" : "ETH no DHCP");
   return eth_active;
@@ -659,31 +1645,68 @@ bool setupEthernet() {
 #endif
 
 void setupNetwork() {
-#ifndef LINUX_SIM
+#if LH_ETH
   setupEthernet();                 // sets eth_present / eth_active
 #endif
+#if LH_WIFI
   // Bring up WiFi when Ethernet isn't ready (primary path / AP config), OR as a
   // hot standby alongside Ethernet when credentials exist — so pulling the cable
   // later doesn't leave the device unreachable. Skip only when Ethernet is up and
   // no WiFi is configured (then Ethernet alone provides access; no stray AP).
   if (!eth_active || wifi_ssid != "") setupWiFi();
+#else
+  // Ethernet-only build: no station, just the config AP while there's no link.
+  if (!eth_active) {
+    WiFi.softAP("icinga-lighthouse-cfg", "admin123");
+    config_ap_active = true;
+  }
+#endif
 }
 
 bool networkUp() {
-#ifdef LINUX_SIM
-  return WiFi.status() == WL_CONNECTED;
-#else
+#if LH_WIFI
   return eth_active || (WiFi.status() == WL_CONNECTED);
+#else
+  return eth_active;
 #endif
 }
 
 String localIPStr() {
-#ifndef LINUX_SIM
-  if (eth_active) return Ethernet.localIP().toString();
+#if LH_ETH
+  if (eth_active) {
+    BusLock bus(spi_lock, 0);          // MQTT task on the chip: the last address read
+    if (bus.held()) eth_ip_str = Ethernet.localIP().toString();
+    return eth_ip_str;
+  }
 #endif
   return WiFi.localIP().toString();
 }
 
+// Subsystems compiled into this image (the build profile), for the panel.
+String buildFeatures() {
+  String f = "";
+#if LH_WIFI
+  f += " wifi";
+#endif
+#if LH_ETH
+  f += " eth";
+#endif
+#if LH_TLS
+  f += " tls";
+#endif
+#if LH_LANG_PL
+  f += " pl";
+#endif
+#if LH_MQTT
+  f += " mqtt";
+#endif
+  f.trim();
+  return f;
+}
+
+// Relays 2-4 are unused and held off; relay 1 (siren) follows the core's state
+// machine. Every transition is reported here, so the simulator's event/waveform
+// trace sees it.
 void updateRelayLogic() {
   if (manual_override_active) return; 
 
@@ -691,58 +1714,11 @@ void updateRelayLogic() {
   digitalWrite(RELAY_3_PIN, RELAY_OFF);
   digitalWrite(RELAY_4_PIN, RELAY_OFF);
 
-  if (is_network_error) {
-    if (digitalRead(RELAY_1_PIN) == RELAY_ON) digitalWrite(RELAY_1_PIN, RELAY_OFF);
-    return;
-  }
-
-  if (!alertsAllowedNow()) {              // outside business hours: keep siren muted
-    if (digitalRead(RELAY_1_PIN) == RELAY_ON) digitalWrite(RELAY_1_PIN, RELAY_OFF);
-    current_state = STATE_IDLE;
-    return;
-  }
-
-  unsigned long now = millis();
-  unsigned long elapsed = now - state_start_time;
-
-  switch (current_state) {
-    case STATE_IDLE:
-      if (is_alarm_active) {
-        digitalWrite(RELAY_1_PIN, RELAY_ON);
-        current_state = STATE_INITIAL_ALARM;
-        state_start_time = now;
-      }
-      break;
-    case STATE_INITIAL_ALARM:
-      if (!is_alarm_active) {
-        digitalWrite(RELAY_1_PIN, RELAY_OFF);
-        current_state = STATE_IDLE;
-      } else if (elapsed >= init_alarm_duration_ms) {
-        digitalWrite(RELAY_1_PIN, RELAY_OFF);
-        current_state = STATE_COOLDOWN;
-        state_start_time = now;
-      }
-      break;
-    case STATE_COOLDOWN:
-      if (!is_alarm_active) {
-        current_state = STATE_IDLE;
-      } else if (elapsed >= reminder_interval_ms) {
-        digitalWrite(RELAY_1_PIN, RELAY_ON);
-        current_state = STATE_REMINDER_ALARM;
-        state_start_time = now;
-      }
-      break;
-    case STATE_REMINDER_ALARM:
-      if (!is_alarm_active) {
-        digitalWrite(RELAY_1_PIN, RELAY_OFF);
-        current_state = STATE_IDLE;
-      } else if (elapsed >= reminder_duration_ms) {
-        digitalWrite(RELAY_1_PIN, RELAY_OFF);
-        current_state = STATE_COOLDOWN;
-        state_start_time = now;
-      }
-      break;
-  }
+  lh::RelayCommand cmd = alarm_machine.step(coreConfig(), millis(), is_alarm_active,
+                                            is_network_error, alertsAllowedNow());
+  if (cmd.changed()) SIM_EVENT("state", {{"from", cmd.from}, {"to", cmd.to}});
+  if (cmd.siren == lh::SIREN_ON) digitalWrite(RELAY_1_PIN, RELAY_ON);
+  else if (cmd.siren == lh::SIREN_OFF) digitalWrite(RELAY_1_PIN, RELAY_OFF);
 }
 
 // Authenticates a request with brute-force protection. Returns true only when
@@ -760,6 +1736,7 @@ bool requireAuth() {
 
   if (server.authenticate(web_user.c_str(), web_pass.c_str())) {
     auth_fail_count = 0;
+    power_web_ms = now;
     return true;
   }
 
@@ -776,69 +1753,220 @@ bool requireAuth() {
   return false;
 }
 
-// IMPROVED: Saves Web Credentials and TLS Fingerprint
-void handleSave() {
-  if (!requireAuth()) return;
+// --- Settings (the panel's form, provisioning) ------------------------------
+
+// Settings given as the panel's form fields, one "key=value" per line: what
+// handleSave() and provisioning hand to applyConfig(), with the web server's
+// hasArg() / arg(). A key the text lacks is looked up in `fallback` (if
+// given), so a document only needs what it changes.
+class ConfigArgs {
+public:
+  explicit ConfigArgs(const String& text, const String* fallback = NULL) : text_(text), fallback_(fallback) {}
+  bool hasArg(const String& key) const { String v; return find(key, v); }
+  String arg(const String& key) const { String v; find(key, v); return v; }
+
+private:
+  bool find(const String& key, String& v) const {
+    return lookup(text_, key, v) || (fallback_ && lookup(*fallback_, key, v));
+  }
+  static bool lookup(const String& text, const String& key, String& v) {
+    const char* p = text.c_str();
+    size_t n = key.length();
+    while (*p) {
+      const char* e = strchr(p, '\n');
+      if (!e) e = p + strlen(p);
+      if ((size_t)(e - p) > n && p[n] == '=' && strncmp(p, key.c_str(), n) == 0) {
+        const char* end = (e > p + n + 1 && e[-1] == '\r') ? e - 1 : e;
+        v = "";
+        for (const char* c = p + n + 1; c < end; c++) v += *c;
+        return true;
+      }
+      p = *e ? e + 1 : e;
+    }
+    return false;
+  }
+  String text_;
+  const String* fallback_;
+};
+
+enum ConfigResult { CONFIG_REFUSED, CONFIG_LIVE, CONFIG_RESTART };
+
+// Checks and stores settings (the form's fields) and puts them into effect:
+// most at once, the ones only setup() reads (network, MQTT, power mode) at
+// the next boot, which CONFIG_RESTART asks for when one of them changed. A
+// source whose selectors don't compile refuses the lot (error says why).
+ConfigResult applyConfig(const ConfigArgs& a, String& error) {
+  // A source that doesn't compile is refused before anything is stored.
+  if (a.hasArg("src")) {
+    lh::Selector check;
+    if (!compileSource(check, a.arg("src"), a.arg("selp"), a.arg("sell"), a.arg("selh"))) {
+      error = "Selector: " + String(check.error());
+      return CONFIG_REFUSED;
+    }
+  }
+  bool restart = false;
+  String decided = pollSettings();
 
-  String new_ssid = server.arg("ssid");
-  String new_pass = server.arg("wpass");
+  String new_ssid = a.arg("ssid");
+  String new_pass = a.arg("wpass");
   new_ssid.trim(); new_pass.trim();
 
-  preferences.putString("ssid", new_ssid);
+  // Fields a slimmer build profile leaves out of the form keep their stored
+  // values, so reflashing a full image later finds them intact.
+  if (a.hasArg("ssid")) {
+    restart = restart || new_ssid != wifi_ssid;
+    preferences.putString("ssid", new_ssid);
+  }
   // Passwords: only overwrite when a new value is given, so a blank field
   // (we never pre-fill passwords into the HTML) keeps the stored one.
-  if (new_pass.length() > 0) preferences.putString("wpass", new_pass);
-  preferences.putString("iurl_s", server.arg("iurl_s"));
-  preferences.putString("iurl_h", server.arg("iurl_h"));
-  preferences.putString("iuser", server.arg("iuser"));
-  String n_ipass = server.arg("ipass"); n_ipass.trim();
-  if (n_ipass.length() > 0) preferences.putString("ipass", n_ipass);
-  preferences.putString("lang", server.arg("lang"));
+  if (new_pass.length() > 0) {
+    restart = restart || new_pass != wifi_pass;
+    preferences.putString("wpass", new_pass);
+  }
+  icinga_url_svc = a.arg("iurl_s");
+  icinga_url_host = a.arg("iurl_h");
+  preferences.putString("iurl_s", icinga_url_svc);
+  preferences.putString("iurl_h", icinga_url_host);
+  if (a.hasArg("src")) {
+    alert_source = a.arg("src");
+    sel_problem = a.arg("selp");
+    sel_label = a.arg("sell");
+    sel_hint = a.arg("selh");
+    preferences.putString("src", alert_source);
+    preferences.putString("selp", sel_problem);
+    preferences.putString("sell", sel_label);
+    preferences.putString("selh", sel_hint);
+    compileSource(problem_selector, alert_source, sel_problem, sel_label, sel_hint);
+  }
+  if (a.hasArg("plist")) {
+    problem_list_max = constrain((int)a.arg("plist").toInt(), 0, lh::LIST_MAX);
+    preferences.putInt("plist", problem_list_max);
+  }
+  icinga_user = a.arg("iuser");
+  preferences.putString("iuser", icinga_user);
+  String n_ipass = a.arg("ipass"); n_ipass.trim();
+  if (n_ipass.length() > 0) { icinga_pass = n_ipass; preferences.putString("ipass", n_ipass); }
   
   // FIX: Save Web User/Pass if changed
-  String n_wu = server.arg("wu"); n_wu.trim();
-  String n_wp = server.arg("wp"); n_wp.trim();
+  String n_wu = a.arg("wu"); n_wu.trim();
+  String n_wp = a.arg("wp"); n_wp.trim();
   if (n_wu.length() > 0 && n_wp.length() > 0) {
+     web_user = n_wu;
+     web_pass = n_wp;
      preferences.putString("wu", n_wu);
      preferences.putString("wp", n_wp);
   }
 
   // NEW: Save Fingerprint
-  String n_fing = server.arg("fing");
+  String n_fing = a.arg("fing");
   n_fing.trim();
-  preferences.putString("fing", n_fing);
+  if (a.hasArg("fing")) { tls_fingerprint = n_fing; preferences.putString("fing", n_fing); }
+
+  if (a.hasArg("mq_host")) {
+    String n_mqh = a.arg("mq_host"); n_mqh.trim();
+    int port = a.arg("mq_port").toInt(); if (port < 1 || port > 65535) port = 1883;
+    String n_mqu = a.arg("mq_user");
+    String n_mqp = a.arg("mq_pass"); n_mqp.trim();
+    String n_mqb = a.arg("mq_base"); n_mqb.trim();
+    unsigned long hb_sec = a.arg("mq_hb").toInt(); if (hb_sec < 5) hb_sec = 5;
+    // The MQTT task reads these: they change at the next boot.
+    restart = restart || n_mqh != mqtt_host || port != mqtt_port || n_mqu != mqtt_user ||
+              (n_mqp.length() > 0 && n_mqp != mqtt_pass) || n_mqb != mqtt_base || hb_sec * 1000 != mqtt_heartbeat_ms;
+    preferences.putString("mq_host", n_mqh);
+    preferences.putInt("mq_port", port);
+    preferences.putString("mq_user", n_mqu);
+    if (n_mqp.length() > 0) preferences.putString("mq_pass", n_mqp);
+    preferences.putString("mq_base", n_mqb);
+    preferences.putULong("mq_hb", hb_sec * 1000);
+  }
   
-  unsigned long p_sec = server.arg("poll").toInt();
+  unsigned long p_sec = a.arg("poll").toInt();
   if(p_sec < 1) p_sec = 1;
-  preferences.putULong("poll", p_sec * 1000);
-  unsigned long rchk_sec = server.arg("rchk").toInt(); if (rchk_sec < 1) rchk_sec = 1;
-  preferences.putULong("rchk", rchk_sec * 1000);
-  int thr = server.arg("thr").toInt(); if (thr < 1) thr = 1;
+  poll_interval_ms = p_sec * 1000;
+  preferences.putULong("poll", poll_interval_ms);
+  unsigned long rchk_sec = a.arg("rchk").toInt(); if (rchk_sec < 1) rchk_sec = 1;
+  recheck_interval_ms = rchk_sec * 1000;
+  preferences.putULong("rchk", recheck_interval_ms);
+  int thr = a.arg("thr").toInt(); if (thr < 1) thr = 1;
+  confirm_threshold = thr;
   preferences.putInt("thr", thr);
-  eth_disabled = (server.arg("ethdis").toInt() == 1);
-  preferences.putInt("ethdis", eth_disabled ? 1 : 0);
-  bh_enabled = (server.arg("bh_en").toInt() == 1);
+  if (a.hasArg("ethdis")) {
+    bool dis = (a.arg("ethdis").toInt() == 1);
+    restart = restart || dis != eth_disabled;
+    eth_disabled = dis;
+    preferences.putInt("ethdis", eth_disabled ? 1 : 0);
+  }
+  bh_enabled = (a.arg("bh_en").toInt() == 1);
   preferences.putInt("bh_en", bh_enabled ? 1 : 0);
-  tz_offset = constrain((int)server.arg("tz").toInt(), -12, 14);
+  tz_offset = constrain((int)a.arg("tz").toInt(), -12, 14);
   preferences.putInt("tz", tz_offset);
   for (int i = 0; i < BH_BLOCKS; i++) {
     int days = 0;
     for (int d = 0; d < 7; d++)
-      if (server.arg(("b" + String(i) + "d" + String(d)).c_str()) == "1") days |= (1 << d);
+      if (a.arg("b" + String(i) + "d" + String(d)) == "1") days |= (1 << d);
     bh_days[i] = days;
-    bh_s[i] = constrain((int)server.arg(("bs" + String(i)).c_str()).toInt(), 0, 23);
-    bh_e[i] = constrain((int)server.arg(("be" + String(i)).c_str()).toInt(), 0, 23);
+    bh_s[i] = constrain((int)a.arg("bs" + String(i)).toInt(), 0, 23);
+    bh_e[i] = constrain((int)a.arg("be" + String(i)).toInt(), 0, 23);
     preferences.putInt((String("bd") + i).c_str(), bh_days[i]);
     preferences.putInt((String("bs") + i).c_str(), bh_s[i]);
     preferences.putInt((String("be") + i).c_str(), bh_e[i]);
   }
-  unsigned long init_sec = server.arg("init").toInt(); if (init_sec < 1) init_sec = 1; preferences.putULong("init", init_sec * 1000);
-  unsigned long rint_min = server.arg("rint").toInt(); if (rint_min < 1) rint_min = 1; preferences.putULong("rint", rint_min * 60 * 1000);
-  unsigned long rdur_sec = server.arg("rdur").toInt(); if (rdur_sec < 1) rdur_sec = 1; preferences.putULong("rdur", rdur_sec * 1000);
+  unsigned long init_sec = a.arg("init").toInt(); if (init_sec < 1) init_sec = 1;
+  init_alarm_duration_ms = init_sec * 1000; preferences.putULong("init", init_alarm_duration_ms);
+  unsigned long rint_min = a.arg("rint").toInt(); if (rint_min < 1) rint_min = 1;
+  reminder_interval_ms = rint_min * 60 * 1000; preferences.putULong("rint", reminder_interval_ms);
+  unsigned long rdur_sec = a.arg("rdur").toInt(); if (rdur_sec < 1) rdur_sec = 1;
+  reminder_duration_ms = rdur_sec * 1000; preferences.putULong("rdur", reminder_duration_ms);
+  int pwr = constrain((int)a.arg("pwr").toInt(), PWR_PERFORMANCE, PWR_LOW);
+  restart = restart || pwr != power_mode;
+  preferences.putInt("pwr", pwr);
+  if (a.hasArg("prov")) {
+    String n_prov = a.arg("prov"); n_prov.trim();
+    if (n_prov != prov_url) {
+      // Another server: its validators and hash start over, and it is asked now.
+      prov_url = n_prov;
+      prov_due_ms = millis();
+      preferences.putString("prov_etag", "");
+      preferences.putString("prov_lm", "");
+      preferences.putULong("prov_hash", 0);
+    }
+    preferences.putString("prov", prov_url);
+    unsigned long provi_min = a.arg("provi").toInt(); if (provi_min < 1) provi_min = 1;
+    prov_interval_ms = provi_min * 60 * 1000;
+    preferences.putULong("provi", prov_interval_ms);
+  }
 
-  system_lang = server.arg("lang");
+  system_lang = a.arg("lang");
+  preferences.putString("lang", system_lang);
   setLanguage();
 
+  // Same URL, another selector or login: a 304 would bring back an answer
+  // the old settings decided, so the next poll reads the body again.
+  if (pollSettings() != decided) {
+    for (int i = 0; i < 2; i++) poll_cache[i] = PollCache();
+  }
+  return restart ? CONFIG_RESTART : CONFIG_LIVE;
+}
+
+// The form's fields as applyConfig() text (a line break in a value ends it).
+String formConfig() {
+  String t;
+  for (int i = 0; i < server.args(); i++) {
+    String v = server.arg(i);
+    int nl = v.indexOf('\n');
+    t += server.argName(i) + "=" + (nl < 0 ? v : v.substring(0, nl)) + "\n";
+  }
+  return t;
+}
+
+// IMPROVED: Saves Web Credentials and TLS Fingerprint
+void handleSave() {
+  if (!requireAuth()) return;
+  String error;
+  if (applyConfig(ConfigArgs(formConfig()), error) == CONFIG_REFUSED) {
+    server.send(400, "text/plain", error);
+    return;
+  }
   server.send(200, "text/html", "<h1>" + txt.msg_saved + "</h1>");
   delay(1000);
   ESP.restart();
@@ -916,56 +2044,75 @@ void handleRoot() {
   SEND_HTML("<h2>" + txt.title + "</h2>");
   SEND_HTML("<a href='https://github.com/dzaczek/icinga-lighthouse' class='head-link' target='_blank'>GitHub: dzaczek/icinga-lighthouse</a><br><br>");
 
-  if (manual_override_active) SEND_HTML("<div class='status warn'>" + txt.st_man + "</div>");
-  else if (!icinga_reachable) SEND_HTML("<div class='status warn'>" + txt.st_warn + "</div>");
-  else if (is_alarm_active && !alertsAllowedNow()) SEND_HTML("<div class='status warn'>" + txt.st_err + " (quiet hours, siren muted): " + esc(last_icinga_object_name) + "</div>");
-  else if (is_alarm_active) SEND_HTML("<div class='status err'>" + txt.st_err + ": " + esc(last_icinga_object_name) + "</div>");
-  else if (alarm_confirm_count > 0) SEND_HTML("<div class='status warn'>CONFIRMING " + String(alarm_confirm_count) + "/" + String(confirm_threshold) + ": " + esc(last_icinga_object_name) + "</div>");
+  // One snapshot for the whole page: banner, link and info agree.
+  lh::Status st = status_board.read();
+  String problem = esc(st.problem);
+  if (st.manual) SEND_HTML("<div class='status warn'>" + txt.st_man + "</div>");
+  else if (!st.reachable) SEND_HTML("<div class='status warn'>" + txt.st_warn + "</div>");
+  else if (st.quiet) SEND_HTML("<div class='status warn'>" + txt.st_err + " (quiet hours, siren muted): " + problem + "</div>");
+  else if (st.alarm) SEND_HTML("<div class='status err'>" + txt.st_err + ": " + problem + "</div>");
+  else if (st.confirm > 0) SEND_HTML("<div class='status warn'>CONFIRMING " + String(st.confirm) + "/" + String(st.threshold) + ": " + problem + "</div>");
   else SEND_HTML("<div class='status ok'>" + txt.st_ok + "</div>");
 
-  String link_kind;
-#ifdef LINUX_SIM
-  link_kind = "WiFi (sim)";
-#else
-  link_kind = eth_active ? "Ethernet (W5500)" : (wifi_connected_mode ? "WiFi" : "AP config");
-#endif
+  String link_kind = strcmp(st.link, "eth") == 0 ? "Ethernet (W5500)" : (strcmp(st.link, "wifi") == 0 ? "WiFi" : "AP config");
   SEND_HTML("<p>Link: " + link_kind + " &middot; IP: " + localIPStr() + "</p>");
-  SEND_HTML("<p>Info: " + last_connection_status + "</p>");
-  if (last_next_check.length() > 0) SEND_HTML("<p>Icinga next check: " + esc(last_next_check) + "</p>");
+  SEND_HTML("<p>Info: " + esc(st.status) + "</p>");
+  if (problem_list_max > 0) SEND_HTML("<p>Problems: <a href='/problems'>" + String(problem_list.size()) + " listed</a></p>");
+  SEND_HTML("<p>Links: " + transportSummary() + "</p>");
+#if LH_MQTT
+  SEND_HTML("<p>MQTT: " + esc(mqttSummary()) + "</p>");
+#endif
+  SEND_HTML("<p>Build: " + buildFeatures() + " &middot; slot " + otaSummary() + "</p>");
+  SEND_HTML("<p>Power: " + powerSummary() + "</p>");
+  if (st.next_check[0]) SEND_HTML("<p>Icinga next check: " + esc(st.next_check) + "</p>");
   String bh_info = bh_enabled ? " &middot; siren: scheduled" : " &middot; siren: 24/7";
   SEND_HTML("<p>Device time: " + localTimeStr() + bh_info + "</p>");
 
   SEND_HTML("<div class='group'><h3>" + txt.t_test + "</h3>");
   SEND_HTML("<button onclick=\"location.href='/toggle?r=1'\">" + txt.btn_siren + "</button>");
-  if (manual_override_active) SEND_HTML("<button style='background:#dc3545' onclick=\"location.href='/toggle?r=0'\">" + txt.btn_end + "</button>");
+  if (st.manual) SEND_HTML("<button style='background:#dc3545' onclick=\"location.href='/toggle?r=0'\">" + txt.btn_end + "</button>");
   SEND_HTML("</div>");
 
   SEND_HTML("<form action='/save' method='POST'>");
   
+#if LH_WIFI
   s = "<div class='group'><h3>" + txt.sec_net + "</h3>";
   s += "<label>SSID:</label><input type='text' name='ssid' value='" + esc(wifi_ssid) + "'>";
   s += "<label>Pass:</label><input type='password' name='wpass' placeholder='(leave blank = unchanged)'>";
   s += "</div>";
   SEND_HTML(s);
+#endif
 
+#if LH_ETH
   s = "<div class='group'><h3>Ethernet (W5500)</h3>";
-#ifdef LINUX_SIM
-  s += "<small style='color:gray'>n/a in simulator</small>";
-#else
   s += "<small style='color:gray'>Shield: " + String(eth_present ? "detected" : "not detected") +
        " &middot; Link: " + String(eth_active ? "up" : "down") + "</small>";
-#endif
   s += "<label>" + txt.lbl_eth + ":</label><select name='ethdis'>";
   s += "<option value='0' " + String(!eth_disabled ? "selected" : "") + ">" + txt.eth_auto + "</option>";
   s += "<option value='1' " + String(eth_disabled ? "selected" : "") + ">" + txt.eth_off + "</option>";
   s += "</select></div>";
   SEND_HTML(s);
+#endif
 
   s = "<div class='group'><h3>Security / Admin</h3>";
   s += "<label>Web User:</label><input type='text' name='wu' value='" + esc(web_user) + "'>";
   s += "<label>Web Pass:</label><input type='password' name='wp' placeholder='(leave blank = unchanged)'>";
+#if LH_TLS
   s += "<label>TLS Fingerprint (SHA1):</label><input type='text' name='fing' placeholder='AA:BB:CC...' value='" + esc(tls_fingerprint) + "'>";
   s += "<small style='color:gray'>Leave empty for Insecure Mode (no validation)</small>";
+#endif
+  s += "</div>";
+  SEND_HTML(s);
+
+  s = "<div class='group'><h3>Provisioning</h3>";
+  s += "<small style='color:gray'>Settings fetched from a central server at boot and periodically, {id} = " + deviceId() +
+       ". Empty = off. <a href='/config'>This device's settings</a> as a document.</small>";
+  s += "<label>Config URL:</label><input type='text' name='prov' placeholder='http://server/lighthouse/{id}.conf' value='" + esc(prov_url) + "'>";
+  s += "<label>Check every (min):</label><input type='number' name='provi' min='1' value='" + String(prov_interval_ms / 60000) + "'>";
+  if (prov_status.length()) {
+    char ago[16];
+    s += "<small style='color:gray'>Last: " + esc(prov_status) + ", " + lh::formatDuration((millis() - prov_status_ms) / 1000, ago, sizeof(ago)) + " ago</small>";
+  }
   s += "</div>";
   SEND_HTML(s);
 
@@ -973,11 +2120,36 @@ void handleRoot() {
   s += "<small style='color:gray'>Icinga DB Web JSON API. Filters (is_acknowledged=n &amp; in_downtime=n &amp; is_flapping=n) keep muted problems out.</small>";
   s += "<label>URL Services (Critical):</label><input type='text' name='iurl_s' value='" + esc(icinga_url_svc) + "'>";
   s += "<label>URL Hosts (Down):</label><input type='text' name='iurl_h' value='" + esc(icinga_url_host) + "'>";
+  s += "<label>Source:</label><select name='src'>";
+  for (int i = 0; i < lh::SOURCE_PRESET_COUNT; i++) {
+    const lh::SourcePreset& p = lh::SOURCE_PRESETS[i];
+    s += "<option value='" + String(p.name) + "' " + String(alert_source == p.name ? "selected" : "") + ">" + p.title + "</option>";
+  }
+  s += "<option value='custom' " + String(lh::findSource(alert_source.c_str()) ? "" : "selected") + ">Custom (selectors below)</option></select>";
+  s += "<small style='color:gray'>Custom: JSON paths over the services URL's reply, e.g. problem <code>count($.data) &gt; 0</code>, label <code>$.data[0].name</code>.</small>";
+  s += "<label>Problem selector:</label><input type='text' name='selp' value='" + esc(sel_problem) + "'>";
+  s += "<label>Label selector:</label><input type='text' name='sell' value='" + esc(sel_label) + "'>";
+  s += "<label>Hint selector:</label><input type='text' name='selh' value='" + esc(sel_hint) + "'>";
+  if (!problem_selector.ok()) s += "<small style='color:red'>" + esc(problem_selector.error()) + "</small>";
+  s += "<label>Problem list (rows, 0 = off):</label><input type='number' name='plist' min='0' max='" + String(lh::LIST_MAX) + "' value='" + String(problem_list_max) + "'>";
   s += "<label>Web User:</label><input type='text' name='iuser' value='" + esc(icinga_user) + "'>";
   s += "<label>Web Pass:</label><input type='password' name='ipass' placeholder='(leave blank = unchanged)'>";
   s += "</div>";
   SEND_HTML(s);
 
+#if LH_MQTT
+  s = "<div class='group'><h3>MQTT</h3>";
+  s += "<small style='color:gray'>Retained state topics under the prefix (alarm, state, confirm, problem, link, relays, status), sent on change. Empty broker = off.</small>";
+  s += "<label>Broker host:</label><input type='text' name='mq_host' value='" + esc(mqtt_host) + "'>";
+  s += "<label>Port:</label><input type='number' name='mq_port' value='" + String(mqtt_port) + "'>";
+  s += "<label>User:</label><input type='text' name='mq_user' value='" + esc(mqtt_user) + "'>";
+  s += "<label>Pass:</label><input type='password' name='mq_pass' placeholder='(leave blank = unchanged)'>";
+  s += "<label>Topic prefix:</label><input type='text' name='mq_base' placeholder='lighthouse/" + deviceId() + "' value='" + esc(mqtt_base) + "'>";
+  s += "<label>Heartbeat (s):</label><input type='number' name='mq_hb' min='5' value='" + String(mqtt_heartbeat_ms / 1000) + "'>";
+  s += "</div>";
+  SEND_HTML(s);
+#endif
+
   s = "<div class='group'><h3>" + txt.sec_time + "</h3>";
   s += "<label>" + txt.lbl_poll + ":</label><input type='number' name='poll' value='" + String(poll_interval_ms / 1000) + "'>";
   s += "<label>" + txt.lbl_rchk + ":</label><input type='number' name='rchk' value='" + String(recheck_interval_ms / 1000) + "'>";
@@ -985,7 +2157,11 @@ void handleRoot() {
   s += "<label>" + txt.lbl_init + ":</label><input type='number' name='init' value='" + String(init_alarm_duration_ms / 1000) + "'>";
   s += "<label>" + txt.lbl_rint + ":</label><input type='number' name='rint' value='" + String(reminder_interval_ms / 60000) + "'>";
   s += "<label>" + txt.lbl_rdur + ":</label><input type='number' name='rdur' value='" + String(reminder_duration_ms / 1000) + "'>";
-  s += "</div>";
+  s += "<label>Power mode:</label><select name='pwr'>";
+  s += "<option value='0' " + String(power_mode == PWR_PERFORMANCE ? "selected" : "") + ">Performance (always on)</option>";
+  s += "<option value='1' " + String(power_mode == PWR_BALANCED ? "selected" : "") + ">Balanced (idle between timers)</option>";
+  s += "<option value='2' " + String(power_mode == PWR_LOW ? "selected" : "") + ">Low power (sleep between timers)</option>";
+  s += "</select></div>";
   SEND_HTML(s);
 
   SEND_HTML("<div class='group'><h3>Business Hours (siren schedule)</h3>");
@@ -1018,15 +2194,90 @@ void handleRoot() {
   s = "<div class='group'><h3>Language / Język</h3>";
   s += "<select name='lang'>";
   s += "<option value='en' " + String(system_lang == "en" ? "selected" : "") + ">English</option>";
+#if LH_LANG_PL
   s += "<option value='pl' " + String(system_lang == "pl" ? "selected" : "") + ">Polski</option>";
+#endif
   s += "</select></div>";
   SEND_HTML(s);
 
-  SEND_HTML("<button type='submit'>" + txt.btn_save + "</button></form></body></html>");
+  SEND_HTML("<button type='submit'>" + txt.btn_save + "</button></form>");
+
+  // Separate form: the file goes up as multipart, the hash in the query string.
+  s = "<form method='POST' enctype='multipart/form-data' onsubmit=\"this.action='/update?sha256='+this.h.value.trim()\">";
+  s += "<div class='group'><h3>Firmware update</h3>";
+  s += "<small style='color:gray'>firmware.bin with its SHA-256 (sha256sum), or a delta from ota-delta.py (hash optional). Running v" FW_VERSION " from " + otaSummary() + ".</small>";
+  s += "<label>Image:</label><input type='file' name='image'>";
+  s += "<label>SHA-256:</label><input type='text' name='h' placeholder='64 hex digits'>";
+  s += "<button type='submit'>UPLOAD AND RESTART</button></div></form></body></html>";
+  SEND_HTML(s);
   
   server.sendContent(""); 
 }
 
+// --- Problem list page ------------------------------------------------------
+
+// A row's state by Icinga's names for its numbers (Icinga DB, the API);
+// anything else as the source wrote it ("critical").
+String problemStateText(const lh::ProblemList& l, const lh::ProblemRow& r) {
+  const char* st = l.str(r.state);
+  char* end;
+  int v = (int)strtod(st, &end);
+  if (!st[0] || *end) return String(st);
+  if (strcmp(l.str(r.kind), "Host") == 0) return v == 0 ? "UP" : v == 1 ? "DOWN" : v == 2 ? "UNREACHABLE" : st;
+  if (strcmp(l.str(r.kind), "Service") == 0)
+    return v == 0 ? "OK" : v == 1 ? "WARNING" : v == 2 ? "CRITICAL" : v == 3 ? "UNKNOWN" : st;
+  return String(st);
+}
+
+// /problems: what the last answered poll found (problem_list), with how long
+// each has been in its state. Served from that copy only, so opening or
+// reloading it never sends Icinga a request; it reloads at the poll cadence.
+void handleProblems() {
+  if (!requireAuth()) return;
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/html", "");
+
+  unsigned long age_s = (millis() - problem_list_ms) / 1000;
+  unsigned long now = problem_list_epoch ? problem_list_epoch + age_s : 0;
+  char buf[48];
+  String s = "<!DOCTYPE html><html><head>";
+  s += "<meta charset='UTF-8'><meta name='viewport' content='width=device-width, initial-scale=1'>";
+  s += "<meta http-equiv='refresh' content='" + String((int)(poll_interval_ms < 1000 ? 1 : poll_interval_ms / 1000)) + "'>";
+  s += "<title>" + txt.title + " - problems</title>";
+  s += "<style>body{font-family:Segoe UI,sans-serif;padding:10px;background:#f4f4f9;color:#333;}";
+  s += "table{border-collapse:collapse;width:100%;background:white;} th,td{padding:6px 8px;border-bottom:1px solid #eee;text-align:left;}";
+  s += ".head-link{font-size:12px;color:#666;text-decoration:none;}</style></head><body>";
+  s += "<h2>" + txt.title + " &middot; problems</h2><a href='/' class='head-link'>&larr; panel</a>";
+  SEND_HTML(s);
+
+  if (problem_list_max == 0) {
+    SEND_HTML("<p>The problem list is off (Problem list rows = 0 in the panel).</p>");
+  } else if (!problem_list_ms) {
+    SEND_HTML("<p>No answer from Icinga yet.</p>");
+  } else {
+    s = "<p>" + String(problem_list.size()) + " problem(s) as of " + String(lh::formatDuration(age_s, buf, sizeof(buf))) + " ago";
+    if (problem_list.full()) s += ", the first " + String(problem_list.capacity()) + " only";
+    if (problem_list.dropped()) s += ", " + String((int)problem_list.dropped()) + " left out (names too long)";
+    if (problem_list_partial) s += ", services only (the hosts query failed)";
+    s += ".</p>";
+    if (problem_list.size()) s += "<table><tr><th>Kind</th><th>Host</th><th>Service</th><th>State</th><th>For</th></tr>";
+    SEND_HTML(s);
+    for (int i = 0; i < problem_list.size(); i++) {
+      const lh::ProblemRow& r = problem_list.row(i);
+      bool host = strcmp(problem_list.str(r.kind), "Host") == 0;
+      s = "<tr><td>" + esc(problem_list.str(r.kind)) + "</td><td>" + esc(problem_list.str(host ? r.name : r.host)) +
+          "</td><td>" + esc(host ? "" : problem_list.str(r.name)) + "</td><td>" + esc(problemStateText(problem_list, r)) +
+          "</td><td>" + (r.since && now >= r.since ? String(lh::formatDuration(now - r.since, buf, sizeof(buf))) : String("?")) +
+          "</td></tr>";
+      SEND_HTML(s);
+    }
+    if (problem_list.size()) SEND_HTML("</table>");
+  }
+  SEND_HTML("</body></html>");
+  server.sendContent("");
+}
+
 // IMPROVED: Loads saved credentials and fingerprint
 void loadSettings() {
   preferences.begin("trelay_cfg", false);
@@ -1034,6 +2285,12 @@ void loadSettings() {
   wifi_pass = preferences.getString("wpass", "");
   icinga_url_svc = preferences.getString("iurl_s", icinga_url_svc);
   icinga_url_host = preferences.getString("iurl_h", icinga_url_host);
+  alert_source = preferences.getString("src", alert_source);
+  sel_problem = preferences.getString("selp", sel_problem);
+  sel_label = preferences.getString("sell", sel_label);
+  sel_hint = preferences.getString("selh", sel_hint);
+  compileSource(problem_selector, alert_source, sel_problem, sel_label, sel_hint);
+  problem_list_max = constrain(preferences.getInt("plist", problem_list_max), 0, lh::LIST_MAX);
   icinga_user = preferences.getString("iuser", icinga_user);
   icinga_pass = preferences.getString("ipass", icinga_pass);
   
@@ -1044,6 +2301,13 @@ void loadSettings() {
   // NEW: Load fingerprint
   tls_fingerprint = preferences.getString("fing", "");
 
+  mqtt_host = preferences.getString("mq_host", mqtt_host);
+  mqtt_port = preferences.getInt("mq_port", mqtt_port);
+  mqtt_user = preferences.getString("mq_user", mqtt_user);
+  mqtt_pass = preferences.getString("mq_pass", mqtt_pass);
+  mqtt_base = preferences.getString("mq_base", mqtt_base);
+  mqtt_heartbeat_ms = preferences.getULong("mq_hb", mqtt_heartbeat_ms);
+
   system_lang = preferences.getString("lang", "en"); 
   
   poll_interval_ms = preferences.getULong("poll", poll_interval_ms);
@@ -1060,10 +2324,822 @@ void loadSettings() {
   init_alarm_duration_ms = preferences.getULong("init", init_alarm_duration_ms);
   reminder_interval_ms = preferences.getULong("rint", reminder_interval_ms);
   reminder_duration_ms = preferences.getULong("rdur", reminder_duration_ms);
+  power_mode = constrain(preferences.getInt("pwr", power_mode), PWR_PERFORMANCE, PWR_LOW);
+  prov_url = preferences.getString("prov", prov_url);
+  prov_interval_ms = preferences.getULong("provi", prov_interval_ms);
+  prov_rev = preferences.getString("prov_rev", "");
 
   setLanguage();
 }
 
+// --- Machine-readable status (fleet tools, Prometheus) ---------------------
+
+// Factory MAC as 12 hex digits: a stable device id across IP changes.
+String deviceId() {
+  char id[13];
+  snprintf(id, sizeof(id), "%012llx", (unsigned long long)(ESP.getEfuseMac() & 0xFFFFFFFFFFFFULL));
+  return String(id);
+}
+
+// The link the device is on: eth, wifi, or ap (config access point only).
+const char* linkName() {
+  return eth_active ? "eth" : (wifi_connected_mode ? "wifi" : "ap");
+}
+
+String jsonStr(const String& v) {
+  String o = "\"";
+  for (int i = 0; i < (int)v.length(); i++) {
+    char c = v[i];
+    if (c == '"' || c == '\\') { o += '\\'; o += c; }
+    else if ((unsigned char)c < 0x20) o += ' ';
+    else o += c;
+  }
+  return o + "\"";
+}
+
+// End of every loop() pass (and setup()): the state as readers should see it.
+void publishStatus() {
+  lh::Status st;
+  st.at_ms = millis();
+  st.state = alarm_machine.state();
+  st.alarm = is_alarm_active;
+  st.quiet = is_alarm_active && !alertsAllowedNow();
+  st.reachable = icinga_reachable;
+  st.network_error = is_network_error;
+  st.manual = manual_override_active;
+  st.confirm = alarm_confirm.count;
+  st.threshold = confirm_threshold;
+  st.poll_ms = lh::pollInterval(coreConfig(), alarm_confirm);
+  st.last_poll_ms = last_poll_time;
+  st.last_data_ms = last_successful_data_time;
+  lh::copyField(st.link, sizeof(st.link), linkName());
+  lh::copyField(st.status, sizeof(st.status), last_connection_status.c_str());
+  lh::copyField(st.problem, sizeof(st.problem), last_icinga_object_name.c_str());
+  lh::copyField(st.next_check, sizeof(st.next_check), last_next_check.c_str());
+  status_board.publish(st);
+}
+
+// GET /api/status: one flat JSON object, the panel's status in numbers (see
+// linux/lighthouse-collector). Ages are ms since the event, -1 if never.
+void handleStatusJson() {
+  if (!requireAuth()) return;
+  unsigned long now = millis();
+  Transport* all[TRANSPORT_MAX];
+  int n = allTransports(all);
+  unsigned long requests = 0, failures = 0;
+  for (int i = 0; i < n; i++) { requests += all[i]->stats.requests; failures += all[i]->stats.failures; }
+
+  lh::Status st = status_board.read();
+  String j = "{\"id\":\"" + deviceId() + "\",\"version\":\"" FW_VERSION "\"";
+  j += ",\"uptime_s\":" + String(now / 1000);
+  j += ",\"state\":\"" + String(lh::stateName(st.state)) + "\"";
+  j += ",\"alarm\":" + String(st.alarm ? "true" : "false");
+  j += ",\"siren\":" + String(digitalRead(RELAY_1_PIN) == RELAY_ON ? "true" : "false");
+  j += ",\"network_error\":" + String(st.network_error ? "true" : "false");
+  j += ",\"reachable\":" + String(st.reachable ? "true" : "false");
+  j += ",\"manual\":" + String(st.manual ? "true" : "false");
+  j += ",\"confirm\":" + String(st.confirm) + ",\"threshold\":" + String(st.threshold);
+  j += ",\"poll_ms\":" + String(st.poll_ms);
+  j += ",\"last_poll_ms\":" + String(st.last_poll_ms ? (long)(now - st.last_poll_ms) : -1L);
+  j += ",\"last_data_ms\":" + String((long)(now - st.last_data_ms));
+  j += ",\"requests\":" + String(requests) + ",\"failures\":" + String(failures);
+  j += ",\"link\":\"" + String(st.link) + "\"";
+  j += ",\"source\":" + jsonStr(alert_source);
+  j += ",\"config_rev\":" + jsonStr(prov_rev);
+  j += ",\"ota_pending\":" + String(ota_pending ? "true" : "false");
+  j += ",\"power_mode\":" + String(power_mode) + ",\"cpu_mhz\":" + String((unsigned long)getCpuFrequencyMhz());
+  j += ",\"loop_passes\":" + String(pwr_passes) + ",\"idle_ms\":" + String(pwr_idle_ms);
+  j += ",\"status\":" + jsonStr(st.status);
+  j += ",\"problem\":" + jsonStr(st.problem) + "}";
+  server.send(200, "application/json", j);
+}
+
+// GET /metrics: the same in the Prometheus text format, for scraping the
+// device directly.
+void handleMetrics() {
+  if (!requireAuth()) return;
+  unsigned long now = millis();
+  lh::Status st = status_board.read();
+  String m = "# TYPE lighthouse_info gauge\nlighthouse_info{id=\"" + deviceId() +
+             "\",version=\"" FW_VERSION "\",features=\"" + buildFeatures() + "\"} 1\n";
+  m += "# TYPE lighthouse_uptime_seconds gauge\nlighthouse_uptime_seconds " + String(now / 1000) + "\n";
+  m += "# TYPE lighthouse_alarm gauge\nlighthouse_alarm " + String(st.alarm ? 1 : 0) + "\n";
+  m += "# TYPE lighthouse_siren gauge\nlighthouse_siren " + String(digitalRead(RELAY_1_PIN) == RELAY_ON ? 1 : 0) + "\n";
+  m += "# TYPE lighthouse_network_error gauge\nlighthouse_network_error " + String(st.network_error ? 1 : 0) + "\n";
+  m += "# TYPE lighthouse_state gauge\n";
+  for (int s = 0; s < lh::STATE_COUNT; s++)
+    m += "lighthouse_state{state=\"" + String(lh::stateName((lh::AlarmState)s)) + "\"} " +
+         String(st.state == s ? 1 : 0) + "\n";
+  m += "# TYPE lighthouse_confirm_count gauge\nlighthouse_confirm_count " + String(st.confirm) + "\n";
+  m += "# TYPE lighthouse_last_data_age_seconds gauge\nlighthouse_last_data_age_seconds " +
+       String((now - st.last_data_ms) / 1000) + "\n";
+  m += "# TYPE lighthouse_http_requests_total counter\n# TYPE lighthouse_http_failures_total counter\n";
+  Transport* all[TRANSPORT_MAX];
+  int n = allTransports(all);
+  for (int i = 0; i < n; i++) {
+    String link = String("{link=\"") + all[i]->name() + "\"} ";
+    m += "lighthouse_http_requests_total" + link + String(all[i]->stats.requests) + "\n";
+    m += "lighthouse_http_failures_total" + link + String(all[i]->stats.failures) + "\n";
+  }
+  server.send(200, "text/plain; version=0.0.4", m);
+}
+
+// --- Provisioning -----------------------------------------------------------
+//
+// A fleet is configured from one place: with a provisioning URL set (in the
+// panel, or baked into the image with -D LH_PROV_URL='"http://.."'), the
+// device fetches its settings at boot and every prov_interval_ms. {id} in
+// the URL stands for deviceId() (the factory MAC), so a server can keep a
+// file per device; user:pass@ in it is sent as Basic auth. The document is
+// the panel's form as text, only the keys that change:
+//
+//   lighthouse-config 1
+//   rev=2026-10-18.1
+//   thr=2
+//   iurl_s=http://icinga.lan:8080/icingadb/services?...&limit=20
+//
+// GET /config prints every key (passwords left out). A document goes
+// through applyConfig() like a form save, but the device only reboots when
+// a network, MQTT or power setting changed. Nothing authenticates the
+// document (plain http, or TLS without a checked certificate), so the keys
+// that would hand the device to whoever is on the path, or silence it, are
+// left out of it (provUnlocked()) and stay as set in the panel: logins, the
+// Icinga URLs, the alert source and its selectors, the fingerprint, the
+// WiFi / MQTT / provisioning endpoints and the Ethernet switch. URL changes
+// are therefore rolled out per device, in the panel. The applied document's
+// ETag / Last-Modified go back as If-None-Match / If-Modified-Since, so an
+// unchanged one costs a 304; from a server without them, a body that hashes
+// like the applied one isn't applied again. Validators, hash and rev live
+// in NVS, so a reboot doesn't fetch it all again either.
+
+const long PROV_MAX = 4096;   // bytes of a document, at most
+
+// The document without the keys it may not set; their names go to `locked`.
+String provUnlocked(const String& doc, String& locked) {
+  static const char* const LOCKED[] = { "ssid", "wpass", "iurl_s", "iurl_h", "iuser", "ipass", "wu", "wp",
+                                        "src", "selp", "sell", "selh", "fing", "mq_host", "mq_user",
+                                        "mq_pass", "ethdis", "prov" };
+  String out;
+  const char* p = doc.c_str();
+  while (*p) {
+    const char* e = strchr(p, '\n');
+    if (!e) e = p + strlen(p);
+    const char* eq = (const char*)memchr(p, '=', e - p);
+    bool keep = true;
+    for (size_t i = 0; eq && keep && i < sizeof(LOCKED) / sizeof(LOCKED[0]); i++) {
+      if (strlen(LOCKED[i]) != (size_t)(eq - p) || strncmp(p, LOCKED[i], eq - p) != 0) continue;
+      locked += String(locked.length() ? ", " : "") + LOCKED[i];
+      keep = false;
+    }
+    if (keep) for (const char* c = p; c < e; c++) out += *c;
+    if (keep) out += '\n';
+    p = *e ? e + 1 : e;
+  }
+  return out;
+}
+
+// Fetches the document and applies it if it changed; schedules the next
+// fetch (sooner after a failure or a refused document).
+void provisionFetch() {
+  PmLock cpu(pm_cpu_lock);
+  prov_due_ms = millis() + PROV_RETRY_MS;
+  String url = prov_url;
+  const char* id = strstr(url.c_str(), "{id}");
+  if (id) {
+    int at = id - url.c_str();
+    url = url.substring(0, at) + deviceId() + url.substring(at + 4);
+  }
+  bool https = url.startsWith("https://");
+  if (!https && !url.startsWith("http://")) { prov_status = "bad URL"; prov_status_ms = millis(); return; }
+  Transport& t = transportFor(url);
+  if (https && !(t.caps() & Transport::CAP_TLS)) {
+    prov_status = String(t.name()) + " needs http"; prov_status_ms = millis(); return;
+  }
+#if LH_ETH
+  BusLock bus(&t == &eth_transport ? spi_lock : NULL, 0);
+  if (!bus.held()) { prov_due_ms = millis(); return; }     // MQTT task on the chip: next pass
+#endif
+  prov_status_ms = millis();
+  String rest = url.substring(https ? 8 : 7);
+  int slash = rest.indexOf('/');
+  String hostport = (slash < 0) ? rest : rest.substring(0, slash);
+  String path     = (slash < 0) ? "/"  : rest.substring(slash);
+  String auth;
+  int at = hostport.indexOf('@');
+  if (at >= 0) { auth = hostport.substring(0, at); hostport = hostport.substring(at + 1); }
+  int colon = hostport.indexOf(':');
+  String host = (colon < 0) ? hostport : hostport.substring(0, colon);
+  int port    = (colon < 0) ? (https ? 443 : 80) : hostport.substring(colon + 1).toInt();
+
+  unsigned long t0 = millis();
+  t.stats.requests++;
+  t.reset();
+  int code = 0;
+  bool too_long = false;
+  String body;
+  char etag[64] = "", modified[40] = "";
+  if (t.connect(host.c_str(), port)) {
+    String req = "GET " + path + " HTTP/1.0\r\nHost: " + host + "\r\nConnection: close\r\n";
+    if (auth.length()) req += "Authorization: Basic " + base64Encode(auth) + "\r\n";
+    String v = preferences.getString("prov_etag", "");
+    if (v.length()) req += "If-None-Match: " + v + "\r\n";
+    v = preferences.getString("prov_lm", "");
+    if (v.length()) req += "If-Modified-Since: " + v + "\r\n";
+    req += "\r\n";
+    t.stats.bytes_out += t.write((const uint8_t*)req.c_str(), req.length());
+
+    char line[128];
+    if (readHttpLine(t, line, sizeof(line))) {
+      const char* sp = strchr(line, ' ');
+      if (sp) code = atoi(sp + 1);
+    }
+    while (readHttpLine(t, line, sizeof(line)) && line[0] != '\0') {
+      if (strncasecmp(line, "ETag:", 5) == 0) headerValue(line, 5, etag, sizeof(etag));
+      else if (strncasecmp(line, "Last-Modified:", 14) == 0) headerValue(line, 14, modified, sizeof(modified));
+    }
+    int c;
+    while (code == 200 && (c = t.read()) >= 0) {
+      if ((long)body.length() >= PROV_MAX) { too_long = true; break; }
+      body += (char)c;
+    }
+  }
+  t.close();
+  unsigned long ms = millis() - t0;
+  if (code != 200 && code != 304) t.stats.failures++;
+  t.stats.ms_total += ms;
+  if (ms > t.stats.ms_max) t.stats.ms_max = ms;
+  SIM_EVENT("provision", {{"code", code}, {"ms", (long)ms}});
+
+  if (code == 304) {
+    t.stats.not_modified++;
+    prov_status = "rev " + (prov_rev.length() ? prov_rev : String("-")) + ", not modified";
+    prov_due_ms = millis() + prov_interval_ms;
+    return;
+  }
+  if (code != 200) { prov_status = code ? String("HTTP ") + String(code) : String("no answer"); return; }
+  if (too_long) { prov_status = "document over " + String((int)PROV_MAX) + " bytes"; return; }
+
+  uint32_t h = 2166136261u;
+  for (unsigned i = 0; i < body.length(); i++) h = (h ^ (uint8_t)body[i]) * 16777619u;
+  String before = prov_url;
+  ConfigResult r = CONFIG_LIVE;
+  if (h != preferences.getULong("prov_hash", 0)) {
+    if (strncmp(body.c_str(), "lighthouse-config 1", 19) != 0 || (body[19] != '\n' && body[19] != '\r')) {
+      prov_status = "not a lighthouse-config 1 document";
+      return;
+    }
+    String current = configDocument();
+    String error, locked;
+    r = applyConfig(ConfigArgs(provUnlocked(body, locked), &current), error);
+    if (r == CONFIG_REFUSED) { prov_status = "refused: " + error; return; }
+    prov_rev = ConfigArgs(body).arg("rev");
+    preferences.putString("prov_rev", prov_rev);
+    preferences.putULong("prov_hash", h);
+    prov_status = "rev " + (prov_rev.length() ? prov_rev : String("-")) + ", applied";
+    if (locked.length()) {
+      prov_status += " without " + locked + " (panel only)";
+      Serial.println("[PROV] not taken from a document: " + locked);
+    }
+    Serial.println("[PROV] applied rev " + prov_rev);
+  } else {
+    t.stats.same_body++;
+    prov_status = "rev " + (prov_rev.length() ? prov_rev : String("-")) + ", unchanged";
+  }
+  // A document that moved provisioning elsewhere: the new server is asked
+  // now, without this one's validators.
+  if (prov_url == before) {
+    preferences.putString("prov_etag", etag);
+    preferences.putString("prov_lm", modified);
+    prov_due_ms = millis() + prov_interval_ms;
+  }
+  if (r == CONFIG_RESTART) {
+    Serial.println("[PROV] network / MQTT / power settings changed, restarting");
+    delay(500);
+    ESP.restart();
+  }
+}
+
+// The settings as a provisioning document, every key applyConfig() reads
+// except the passwords (a document without them keeps the device's own).
+String configDocument() {
+  String d = "lighthouse-config 1\n";
+  if (prov_rev.length()) d += "rev=" + prov_rev + "\n";
+  d += "ssid=" + wifi_ssid + "\n";
+  d += "iurl_s=" + icinga_url_svc + "\niurl_h=" + icinga_url_host + "\n";
+  d += "src=" + alert_source + "\nselp=" + sel_problem + "\nsell=" + sel_label + "\nselh=" + sel_hint + "\n";
+  d += "plist=" + String(problem_list_max) + "\n";
+  d += "iuser=" + icinga_user + "\nwu=" + web_user + "\nfing=" + tls_fingerprint + "\n";
+  d += "mq_host=" + mqtt_host + "\nmq_port=" + String(mqtt_port) + "\nmq_user=" + mqtt_user +
+       "\nmq_base=" + mqtt_base + "\nmq_hb=" + String(mqtt_heartbeat_ms / 1000) + "\n";
+  d += "poll=" + String(poll_interval_ms / 1000) + "\nrchk=" + String(recheck_interval_ms / 1000) +
+       "\nthr=" + String(confirm_threshold) + "\n";
+  d += "init=" + String(init_alarm_duration_ms / 1000) + "\nrint=" + String(reminder_interval_ms / 60000) +
+       "\nrdur=" + String(reminder_duration_ms / 1000) + "\n";
+  d += "ethdis=" + String(eth_disabled ? 1 : 0) + "\npwr=" + String(power_mode) + "\n";
+  d += "bh_en=" + String(bh_enabled ? 1 : 0) + "\ntz=" + String(tz_offset) + "\n";
+  for (int i = 0; i < BH_BLOCKS; i++) {
+    for (int day = 0; day < 7; day++) d += "b" + String(i) + "d" + String(day) + "=" + String((bh_days[i] >> day) & 1) + "\n";
+    d += "bs" + String(i) + "=" + String(bh_s[i]) + "\nbe" + String(i) + "=" + String(bh_e[i]) + "\n";
+  }
+  d += "lang=" + system_lang + "\nprov=" + prov_url + "\nprovi=" + String(prov_interval_ms / 60000) + "\n";
+  return d;
+}
+
+// GET /config: this device's settings as a document, to start a fleet's from.
+void handleConfig() {
+  if (!requireAuth()) return;
+  server.send(200, "text/plain", configDocument());
+}
+
+// --- MQTT state publishing --------------------------------------------------
+//
+// Optional (LH_MQTT, and only while a broker host is set). Every field is a
+// retained topic under the prefix, published when its value changes, so a
+// dashboard that subscribes later still gets the current state at once:
+//   <prefix>/alarm    1 / 0             <prefix>/state    IDLE, INITIAL_ALARM, ..
+//   <prefix>/confirm  2/3               <prefix>/problem  "Service: web1!http" / None
+//   <prefix>/link     eth / wifi / ap   <prefix>/relays   1000 (relays 1..4)
+//   <prefix>/status   online, or the last will "offline" once the session dies
+//   <prefix>/heartbeat  uptime in s every mqtt_heartbeat_ms (not retained)
+//
+// loop() only compares and enqueues (mqttNote(), never waits). A background
+// task owns the client: it drains the queue, (re)connects with backoff and
+// publishes. A change that doesn't fit into a full queue is simply noted again
+// on the next pass, and after every reconnect the task republishes the latest
+// value of each topic.
+#if LH_MQTT
+#define MQTT_QUEUE_LEN 8
+#define MQTT_VALUE_MAX 80                      // longer values (problem names) are cut
+
+enum MqttField { MQ_ALARM, MQ_STATE, MQ_CONFIRM, MQ_PROBLEM, MQ_LINK, MQ_RELAYS, MQ_FIELDS };
+
+struct MqttMsg {
+  uint8_t field;
+  char value[MQTT_VALUE_MAX];
+};
+
+PubSubClient mqtt_client;
+#if LH_WIFI
+WiFiClient mqtt_wifi_client;
+#endif
+#if LH_ETH
+// The session's W5500 socket. spi_lock is held for one library call at a
+// time (a connect, a write, a read), never across a session setup or a
+// CONNACK wait, so loop() finds the chip free between calls.
+class BusClient : public Client {
+public:
+  BusClient(EthernetClient& c, SemaphoreHandle_t& lock) : c_(c), lock_(lock) {}
+  int connect(IPAddress ip, uint16_t port) override { BusLock b(lock_, portMAX_DELAY); return c_.connect(ip, port); }
+  int connect(const char* host, uint16_t port) override { BusLock b(lock_, portMAX_DELAY); return c_.connect(host, port); }
+  size_t write(uint8_t v) override { BusLock b(lock_, portMAX_DELAY); return c_.write(v); }
+  size_t write(const uint8_t* buf, size_t n) override { BusLock b(lock_, portMAX_DELAY); return c_.write(buf, n); }
+  int available() override { BusLock b(lock_, portMAX_DELAY); return c_.available(); }
+  int read() override { BusLock b(lock_, portMAX_DELAY); return c_.read(); }
+  int read(uint8_t* buf, size_t n) override { BusLock b(lock_, portMAX_DELAY); return c_.read(buf, n); }
+  int peek() override { BusLock b(lock_, portMAX_DELAY); return c_.peek(); }
+  void flush() override { BusLock b(lock_, portMAX_DELAY); c_.flush(); }
+  void stop() override { BusLock b(lock_, portMAX_DELAY); c_.stop(); }
+  uint8_t connected() override { BusLock b(lock_, portMAX_DELAY); return c_.connected(); }
+  operator bool() override { return connected(); }
+private:
+  EthernetClient& c_;
+  SemaphoreHandle_t& lock_;          // spi_lock (created in mqttBegin())
+};
+
+EthernetClient mqtt_eth_client;
+BusClient mqtt_eth_bus{mqtt_eth_client, spi_lock};
+#endif
+QueueHandle_t mqtt_queue = NULL;
+String mqtt_prefix;
+char mqtt_noted[MQ_FIELDS][MQTT_VALUE_MAX] = {};   // loop(): last value enqueued
+char mqtt_value[MQ_FIELDS][MQTT_VALUE_MAX] = {};   // task: latest value per topic
+volatile bool mqtt_up = false;
+volatile int mqtt_rc = 0;                          // client state after the last failure
+volatile unsigned long mqtt_published = 0, mqtt_deferred = 0, mqtt_sessions = 0;
+
+const char* mqttFieldName(int f) {
+  static const char* const names[MQ_FIELDS] = { "alarm", "state", "confirm", "problem", "link", "relays" };
+  return names[f];
+}
+
+void mqttFieldValue(int f, const lh::Status& st, char* out) {
+  const size_t n = MQTT_VALUE_MAX;
+  switch (f) {
+    case MQ_ALARM:   snprintf(out, n, "%d", st.alarm ? 1 : 0); break;
+    case MQ_STATE:   snprintf(out, n, "%s", lh::stateName(st.state)); break;
+    case MQ_CONFIRM: snprintf(out, n, "%d/%d", st.confirm, st.threshold); break;
+    case MQ_PROBLEM: lh::copyField(out, n, st.problem); break;   // cut to fit
+    case MQ_LINK:    snprintf(out, n, "%s", st.link); break;
+    case MQ_RELAYS:
+      snprintf(out, n, "%d%d%d%d", digitalRead(RELAY_1_PIN) == RELAY_ON, digitalRead(RELAY_2_PIN) == RELAY_ON,
+               digitalRead(RELAY_3_PIN) == RELAY_ON, digitalRead(RELAY_4_PIN) == RELAY_ON);
+      break;
+  }
+}
+
+// Opens a session over the given link, with the last will on <prefix>/status.
+bool mqttConnect(bool eth) {
+#if LH_ETH
+  if (eth) mqtt_client.setClient(mqtt_eth_bus);
+#endif
+#if LH_WIFI
+  if (!eth) mqtt_client.setClient(mqtt_wifi_client);
+#endif
+  String status = mqtt_prefix + "/status";
+  String id = "lighthouse-" + deviceId();
+  if (!mqtt_client.connect(id.c_str(), mqtt_user.length() ? mqtt_user.c_str() : NULL,
+                           mqtt_pass.length() ? mqtt_pass.c_str() : NULL,
+                           status.c_str(), 0, true, "offline")) {
+    mqtt_rc = mqtt_client.state();
+    return false;
+  }
+  mqtt_sessions++;
+  return mqtt_client.publish(status.c_str(), "online", true);
+}
+
+void mqttTask() {
+  unsigned long retry_at = 0, backoff_ms = 1000, last_beat = 0;
+  bool on_eth = false;                 // link of the current session
+  unsigned known = 0, dirty = 0;       // fields with a value / not sent since it changed
+  char topic[128];
+  for (;;) {
+    MqttMsg m;
+    if (xQueueReceive(mqtt_queue, &m, pdMS_TO_TICKS(100)) == pdTRUE) {
+      do {
+        memcpy(mqtt_value[m.field], m.value, MQTT_VALUE_MAX);
+        known |= 1u << m.field;
+        dirty |= 1u << m.field;
+      } while (xQueueReceive(mqtt_queue, &m, 0) == pdTRUE);
+    }
+
+    unsigned long now = millis();
+    if (!mqtt_up) {
+      if ((long)(now - retry_at) < 0 || !networkUp()) continue;
+      on_eth = eth_active;
+    }
+    if (!mqtt_up) {
+      if (!mqttConnect(on_eth)) {
+        retry_at = now + backoff_ms;
+        backoff_ms = backoff_ms < 30000 ? backoff_ms * 2 : 60000;
+        continue;
+      }
+      mqtt_up = true;
+      backoff_ms = 1000;
+      dirty = known;                   // new session: republish everything
+      last_beat = now - mqtt_heartbeat_ms;
+    }
+
+    for (int f = 0; f < MQ_FIELDS; f++) {
+      if (!(dirty & (1u << f))) continue;
+      snprintf(topic, sizeof(topic), "%s/%s", mqtt_prefix.c_str(), mqttFieldName(f));
+      if (!mqtt_client.publish(topic, mqtt_value[f], true)) break;
+      dirty &= ~(1u << f);
+      mqtt_published++;
+    }
+    if (now - last_beat >= mqtt_heartbeat_ms) {
+      char up[16];
+      snprintf(topic, sizeof(topic), "%s/heartbeat", mqtt_prefix.c_str());
+      snprintf(up, sizeof(up), "%lu", now / 1000);
+      mqtt_client.publish(topic, up, false);
+      last_beat = now;
+    }
+    if (!mqtt_client.loop()) {         // session lost: reconnect at once, then back off
+      mqtt_up = false;
+      mqtt_rc = mqtt_client.state();
+      retry_at = now;
+    }
+  }
+}
+
+// Called from setup(): starts the task if a broker is configured.
+void mqttBegin() {
+  if (mqtt_host.length() == 0) return;
+  mqtt_prefix = mqtt_base.length() ? mqtt_base : String("lighthouse/") + deviceId();
+  mqtt_queue = xQueueCreate(MQTT_QUEUE_LEN, sizeof(MqttMsg));
+#if LH_ETH
+  spi_lock = xSemaphoreCreateMutex();
+#endif
+  mqtt_client.setServer(mqtt_host.c_str(), mqtt_port);
+  mqtt_client.setBufferSize(MQTT_VALUE_MAX + 128);   // + topic and header
+  mqtt_client.setSocketTimeout(2);                   // CONNACK / reply wait (the W5500 is held per call)
+  // Core 0, beside the network stack; loop() runs on core 1.
+#ifdef SIM_INSTANCE
+  xTaskCreatePinnedToCore([this](void*) { mqttTask(); }, "mqtt", 4096, NULL, 1, NULL, 0);
+#else
+  xTaskCreatePinnedToCore([](void*) { mqttTask(); }, "mqtt", 4096, NULL, 1, NULL, 0);
+#endif
+}
+
+// Called from loop(): enqueues the fields that changed, without waiting.
+void mqttNote() {
+  if (!mqtt_queue) return;
+  lh::Status st = status_board.read();
+  MqttMsg m;
+  for (int f = 0; f < MQ_FIELDS; f++) {
+    mqttFieldValue(f, st, m.value);
+    if (strcmp(m.value, mqtt_noted[f]) == 0) continue;
+    m.field = f;
+    if (xQueueSend(mqtt_queue, &m, 0) != pdTRUE) { mqtt_deferred++; return; }   // full: next pass
+    memcpy(mqtt_noted[f], m.value, MQTT_VALUE_MAX);
+  }
+}
+
+// "connected to broker:1883, 42 published" for the panel.
+String mqttSummary() {
+  if (!mqtt_queue) return "off (no broker set)";
+  String s = String(mqtt_up ? "connected to " : "down (rc " + String(mqtt_rc) + "), retrying ") +
+             mqtt_host + ":" + String(mqtt_port) + ", " + String(mqtt_published) + " published";
+  if (mqtt_deferred) s += ", " + String(mqtt_deferred) + " deferred (queue full)";
+  return s;
+}
+#endif
+
+// --- OTA updates ------------------------------------------------------------
+//
+// POST /update?sha256=<hex> with the image as a multipart file upload (panel
+// login). The WebServer hands the upload over in HTTP_UPLOAD_BUFLEN pieces and
+// each goes straight to Update, which keeps one flash sector and writes the
+// inactive app slot; nothing else of the image is held in RAM. SHA-256 runs
+// over what is written, and only a match lets Update.end() make the slot
+// bootable. An ota-delta.py delta is recognised by its magic and rebuilt from
+// the running slot on the way (lh::DeltaDecoder); it carries its own target
+// hash, so ?sha256= is optional there.
+//
+// The new image boots on probation (PENDING_VERIFY: verifyRollbackLater()
+// below keeps the core from confirming it at boot) and the first poll Icinga
+// answers marks it valid. A reset before that boots the previous image again,
+// and otaWatch() forces one if no poll succeeds within OTA_VERIFY_MS (or three
+// poll intervals, if longer). Needs the default two-slot partition table.
+#define OTA_VERIFY_MS 600000UL
+
+#if !defined(LINUX_SIM)
+extern "C" bool verifyRollbackLater() { return true; }
+#endif
+
+unsigned long ota_since = 0;      // boot of the unconfirmed image
+bool ota_authed = false;          // this upload's login checked out
+bool ota_delta = false;
+bool ota_ok = false;              // the last upload is installed
+bool ota_have_want = false;
+uint8_t ota_want[32];             // expected SHA-256 of the written image
+size_t ota_in = 0;                // upload bytes received
+String ota_error = "";            // why the upload failed, "" = fine so far
+mbedtls_sha256_context ota_sha;
+lh::DeltaDecoder ota_decoder;
+
+// Flash side of the delta decoder: reads the running slot, hashes and writes
+// the output into Update. Uses globals only, so it also nests in the
+// simulator's class-body build.
+struct OtaFlashIo : lh::DeltaDecoder::Io {
+  const esp_partition_t* base;
+  mbedtls_sha256_context* sha;
+  const uint8_t* want;            // NULL = no ?sha256= given
+  const char* error;
+
+  bool header(const lh::DeltaHeader& h) {
+    if (h.base_size > base->size) { error = "delta base larger than the slot"; return false; }
+    if (want && memcmp(want, h.target_sha256, 32) != 0) { error = "sha256 is not the delta's target"; return false; }
+    uint8_t got[32], chunk[256];
+    mbedtls_sha256_context c;
+    mbedtls_sha256_init(&c);
+    mbedtls_sha256_starts(&c, 0);
+    bool read_ok = true;
+    for (uint32_t off = 0; off < h.base_size && read_ok; off += sizeof(chunk)) {
+      size_t k = h.base_size - off < sizeof(chunk) ? h.base_size - off : sizeof(chunk);
+      read_ok = esp_partition_read(base, off, chunk, k) == ESP_OK;
+      mbedtls_sha256_update(&c, chunk, k);
+    }
+    mbedtls_sha256_finish(&c, got);
+    mbedtls_sha256_free(&c);
+    if (!read_ok || memcmp(got, h.base_sha256, 32) != 0) { error = "delta is for another image"; return false; }
+    if (!Update.begin(h.target_size)) { error = Update.errorString(); return false; }
+    return true;
+  }
+  bool readBase(uint32_t offset, uint8_t* buf, size_t n) {
+    return esp_partition_read(base, offset, buf, n) == ESP_OK;
+  }
+  bool write(const uint8_t* buf, size_t n) {
+    mbedtls_sha256_update(sha, buf, n);
+    if (Update.write(const_cast<uint8_t*>(buf), n) == n) return true;
+    error = Update.errorString();
+    return false;
+  }
+};
+OtaFlashIo ota_io;
+
+// Called from setup(): is this the first boot of a freshly installed image?
+void otaBegin() {
+  esp_ota_img_states_t st;
+  ota_pending = esp_ota_get_state_partition(esp_ota_get_running_partition(), &st) == ESP_OK &&
+                st == ESP_OTA_IMG_PENDING_VERIFY;
+  ota_since = millis();
+  if (ota_pending) Serial.println("[OTA] new image, confirmed by the first successful poll");
+}
+
+// Called after every poll; the first one Icinga answered keeps the image.
+void otaConfirm() {
+  if (!ota_pending || !icinga_reachable) return;
+  esp_ota_mark_app_valid_cancel_rollback();
+  ota_pending = false;
+  Serial.println("[OTA] image confirmed");
+}
+
+// Called from loop(): an image that never gets a poll through goes back.
+void otaWatch() {
+  if (!ota_pending) return;
+  unsigned long limit = poll_interval_ms * 3 > OTA_VERIFY_MS ? poll_interval_ms * 3 : OTA_VERIFY_MS;
+  if (millis() - ota_since < limit) return;
+  Serial.println("[OTA] no successful poll, rolling back");
+  ota_pending = false;
+  esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+void otaFail(const String& why) {
+  if (ota_error.length() == 0) ota_error = why;
+  if (Update.isRunning()) Update.abort();
+}
+
+// Parses 64 hex digits into ota_want.
+bool otaParseSha(const String& hex) {
+  if (hex.length() != 64) return false;
+  for (int i = 0; i < 32; i++) {
+    char b[3] = { hex[2 * i], hex[2 * i + 1], 0 };
+    char* end;
+    ota_want[i] = (uint8_t)strtoul(b, &end, 16);
+    if (*end) return false;
+  }
+  return true;
+}
+
+// Upload handler: sees the file piece by piece (server.upload()).
+void handleUpload() {
+  HTTPUpload& up = server.upload();
+  if (up.status == UPLOAD_FILE_START) {
+    ota_error = "";
+    ota_ok = false;
+    ota_in = 0;
+    ota_delta = false;
+    // The answer (401 / 429) is handleUpdate()'s; here the data is just ignored.
+    ota_authed = !(auth_lock_until && (long)(millis() - auth_lock_until) < 0) &&
+                 server.authenticate(web_user.c_str(), web_pass.c_str());
+    if (!ota_authed) return;
+    ota_have_want = server.hasArg("sha256");
+    if (ota_have_want && !otaParseSha(server.arg("sha256"))) otaFail("sha256 must be 64 hex digits");
+    mbedtls_sha256_init(&ota_sha);
+    mbedtls_sha256_starts(&ota_sha, 0);
+    Serial.println("[OTA] receiving " + up.filename);
+    return;
+  }
+  if (!ota_authed) return;
+  if (up.status == UPLOAD_FILE_WRITE) {
+    if (ota_error.length()) return;
+    if (ota_in == 0) {                              // first piece: full image or delta?
+      ota_delta = lh::isDelta(up.buf, up.currentSize);
+      if (ota_delta) {
+        ota_decoder.reset();
+        ota_io.base = esp_ota_get_running_partition();
+        ota_io.sha = &ota_sha;
+        ota_io.want = ota_have_want ? ota_want : NULL;
+        ota_io.error = "";
+      } else if (!ota_have_want) {
+        otaFail("sha256 missing");
+        return;
+      } else if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
+        otaFail(Update.errorString());
+        return;
+      }
+    }
+    ota_in += up.currentSize;
+    if (ota_delta) {
+      if (ota_decoder.feed(up.buf, up.currentSize, ota_io) == lh::DeltaDecoder::BAD)
+        otaFail(String(ota_decoder.error()) + (ota_io.error[0] ? String(": ") + ota_io.error : String("")));
+    } else {
+      mbedtls_sha256_update(&ota_sha, up.buf, up.currentSize);
+      if (Update.write(up.buf, up.currentSize) != up.currentSize) otaFail(Update.errorString());
+    }
+  } else if (up.status == UPLOAD_FILE_END) {
+    if (ota_in == 0) otaFail("empty file");
+    if (ota_delta && ota_decoder.produced() != ota_decoder.header().target_size) otaFail("delta incomplete");
+    uint8_t got[32];
+    mbedtls_sha256_finish(&ota_sha, got);
+    mbedtls_sha256_free(&ota_sha);
+    if (ota_error.length()) return;
+    if (memcmp(got, ota_delta ? ota_decoder.header().target_sha256 : ota_want, 32) != 0) {
+      otaFail("sha256 mismatch");
+      return;
+    }
+    if (!Update.end(true)) { otaFail(Update.errorString()); return; }
+    ota_ok = true;
+    Serial.println("[OTA] " + String((unsigned long)ota_in) + " bytes received, " +
+                   String(ota_delta ? "delta applied" : "image written") + ", installed");
+  } else if (up.status == UPLOAD_FILE_ABORTED) {
+    otaFail("upload aborted");
+    mbedtls_sha256_free(&ota_sha);
+  }
+}
+
+// POST /update, after the upload: report, and reboot into a good image.
+void handleUpdate() {
+  if (!requireAuth()) return;
+  if (!ota_ok) {
+    server.send(400, "text/plain", "Update failed: " + (ota_error.length() ? ota_error : String("no file")));
+    ota_error = "";
+    return;
+  }
+  server.send(200, "text/plain", "Update installed (" + String((unsigned long)ota_in) +
+              " bytes received), rebooting. It is kept after the first successful poll.");
+  delay(1000);
+  ESP.restart();
+}
+
+// "app1, unconfirmed" for the panel.
+String otaSummary() {
+  String s = String(esp_ota_get_running_partition()->label);
+  if (ota_pending) s += ", unconfirmed until a poll succeeds";
+  return s;
+}
+
+// --- Power management ---------------------------------------------------------
+//
+// loop() has work every few seconds at most. PWR_PERFORMANCE (the default)
+// still spins it at 240 MHz with the radio always on; the other modes idle
+// between timers instead:
+//  - WiFi uses modem sleep: the radio wakes for the AP's DTIM beacons, so
+//    incoming traffic waits for the next one (typically 100-300 ms);
+//  - at the end of each pass powerIdle() sleeps until the next timer loop()
+//    runs (poll, relay pulse, LED blink, Ethernet upkeep, manual test
+//    timeout, data watchdog), at most PWR_IDLE_*_MS, which is how late web
+//    requests and link changes (both polled from loop()) are noticed. Right
+//    after a panel login the limit is 1 ms for PWR_WEB_BURST_MS, so
+//    follow-up clicks aren't slowed;
+//  - with esp_pm (a core built with CONFIG_PM_ENABLE and tickless idle) the
+//    clock scales between the limits below and, in PWR_LOW, the idle task
+//    light-sleeps through those waits; pm_cpu_lock keeps the full clock for a
+//    poll. The stock Arduino core has no esp_pm (ESP_ERR_NOT_SUPPORTED), so
+//    there the clock is just fixed lower.
+// Currents and latencies per mode: README "Power modes".
+#define PWR_IDLE_BALANCED_MS 20
+#define PWR_IDLE_LOW_MS      100
+#define PWR_WEB_BURST_MS     2000
+
+bool pm_active = false;           // esp_pm scales the clock
+unsigned long pwr_since = 0;      // powerBegin(), for the rates in the summary
+
+// Called from setup(), before the network comes up.
+void powerBegin() {
+  pwr_since = millis();
+  if (power_mode == PWR_PERFORMANCE) return;
+  esp_pm_config_esp32_t pm;
+  pm.max_freq_mhz = power_mode == PWR_LOW ? 160 : 240;
+  pm.min_freq_mhz = power_mode == PWR_LOW ? 40 : 80;
+  pm.light_sleep_enable = power_mode == PWR_LOW;
+  pm_active = esp_pm_configure(&pm) == ESP_OK;
+  if (pm_active) esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "poll", &pm_cpu_lock);
+  else setCpuFrequencyMhz(power_mode == PWR_LOW ? 80 : 160);   // 80 MHz: the least WiFi runs on
+  Serial.println("[PWR] " + powerSummary());
+}
+
+// End of a loop() pass: wait for the earliest timer that is still ahead.
+// Anything already due was handled (or deliberately put off) by this pass.
+void powerIdle() {
+  pwr_passes++;
+  if (power_mode == PWR_PERFORMANCE) return;
+  unsigned long now = millis();
+  unsigned long wait = power_mode == PWR_LOW ? PWR_IDLE_LOW_MS : PWR_IDLE_BALANCED_MS;
+  if (now - power_web_ms < PWR_WEB_BURST_MS) wait = 1;
+
+  lh::Config c = coreConfig();
+  unsigned long due[6];
+  int n = 0;
+  due[n++] = last_poll_time + lh::pollInterval(c, alarm_confirm);
+  due[n++] = last_blink_time + (icinga_reachable ? 1000 : 200) + 1;
+  due[n++] = last_successful_data_time + watchdog_timeout_ms + 1;
+  if (alarm_machine.state() != lh::STATE_IDLE) due[n++] = alarm_machine.deadline(c);
+  if (manual_override_active) due[n++] = last_manual_action_time + 60000 + 1;
+#if LH_ETH
+  if (eth_present) due[n++] = last_eth_check + 3000 + 1;
+#endif
+  for (int i = 0; i < n; i++) {
+    long left = (long)(due[i] - now);
+    if (left > 0 && (unsigned long)left < wait) wait = left;
+  }
+  delay(wait);
+  pwr_idle_ms += wait;
+}
+
+// "low, 80 MHz fixed, 9.8 wake-ups/s, idle 97%" for the panel.
+String powerSummary() {
+  static const char* const names[3] = { "performance", "balanced", "low" };
+  String s = String(names[power_mode]) + ", " + String((unsigned long)getCpuFrequencyMhz()) + " MHz";
+  if (power_mode != PWR_PERFORMANCE)
+    s += pm_active ? (power_mode == PWR_LOW ? " scaling, light sleep" : " scaling") : " fixed";
+  unsigned long up = millis() - pwr_since;
+  if (up >= 1000)
+    s += ", " + String(pwr_passes * 1000.0 / up, 1) + " wake-ups/s, idle " +
+         String((unsigned long)(pwr_idle_ms * 100.0 / up)) + "%";
+  return s;
+}
+
 String getUptimeStr() {
   return String((unsigned long)(millis() / 1000 / 60)) + " min";
 }
\ No newline at end of file